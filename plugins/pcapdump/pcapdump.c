@@ -63,10 +63,19 @@ static logerr_t *logerr = 0;
 char *dump_base = 0;
 static int to_stdout = 0;
 static int dbg_lvl = 0;
-static char *dumpname = 0;
-static char *dumpnamepart = 0;
 static pcap_t *pcap_dead = 0;
-static pcap_dumper_t *dumper = 0;
+static enum { shard_client, shard_responder } shard_key = shard_client;
+static unsigned shard_count = 1;
+static shard_t *shard = 0;
+static unsigned dns_port = 53;
+
+/* one dump per shard, there is only one unless -n is used */
+struct dump {
+    char *dumpname;
+    char *dumpnamepart;
+    pcap_dumper_t *dumper;
+};
+static struct dump *dumps = 0;
 static char *kick_cmd = 0;
 static int flush = 0;
 static int dir_wanted = DIR_INITIATE|DIR_RESPONSE;
@@ -79,6 +88,8 @@ pcapdump_usage()
 	"\t-d         increase debugging\n"
 	"\t-f         flush output on every packet\n"
 	"\t-k <cmd>   kick off <cmd> when each dump closes\n"
+	"\t-n <num>   split into <num> shards dumped to <base>.<shard>.<timesec>.<timeusec>\n"
+	"\t-S <key>   shard by key: client (default) or responder\n"
 	"\t-s [ir]    select sides: initiations, responses\n"
 	"\t-w <base>  dump to <base>.<timesec>.<timeusec>\n"
 	);
@@ -90,7 +101,8 @@ pcapdump_getopt(int *argc, char **argv[])
     int c;
     int u;
     const char *p;
-    while ((c = getopt(*argc, *argv, "dfk:s:w:")) != EOF) {
+    char *e;
+    while ((c = getopt(*argc, *argv, "dfk:n:S:s:w:")) != EOF) {
 	switch (c) {
 	case 'd':
 	    dbg_lvl++;
@@ -103,6 +115,25 @@ pcapdump_getopt(int *argc, char **argv[])
 	        free(kick_cmd);
 	    kick_cmd = strdup(optarg);
 	    break;
+	case 'n':
+	    shard_count = strtoul(optarg, &e, 0);
+	    if (*e || !shard_count) {
+		fprintf(stderr, "-n takes a positive number\n");
+		pcapdump_usage();
+		exit(1);
+	    }
+	    break;
+	case 'S':
+	    if (!strcmp(optarg, "client"))
+		shard_key = shard_client;
+	    else if (!strcmp(optarg, "responder"))
+		shard_key = shard_responder;
+	    else {
+		fprintf(stderr, "-S takes client or responder\n");
+		pcapdump_usage();
+		exit(1);
+	    }
+	    break;
 	case 's':
 	    u = 0;
 	    for (p = optarg; *p; p++)
@@ -137,12 +168,30 @@ pcapdump_getopt(int *argc, char **argv[])
 	pcapdump_usage();
 	exit(1);
     }
+    if (to_stdout && shard_count > 1) {
+	fprintf(stderr, "Can't use -n when dumping to stdout\n");
+	pcapdump_usage();
+	exit(1);
+    }
+    dumps = calloc(shard_count, sizeof(*dumps));
+    assert(dumps);
+}
+
+void
+pcapdump_set_shard(shard_t * a_shard, unsigned a_dns_port)
+{
+    shard = a_shard;
+    dns_port = a_dns_port;
 }
 
 int
 pcapdump_start(logerr_t * a_logerr)
 {
     logerr = a_logerr;
+    if (shard_count > 1 && !shard) {
+	logerr("pcapdump.so: -n needs a dnscap that exports sharding");
+	return 1;
+    }
     pcap_dead = pcap_open_dead(DLT_RAW, SNAPLEN);
     return 0;
 }
@@ -158,26 +207,36 @@ int
 pcapdump_open(my_bpftimeval ts)
 {
     const char *t = NULL;
-    if (to_stdout) {
-	t = "-";
-    } else {
-	char sbuf[64];
-	while (ts.tv_usec >= MILLION) {
-	    ts.tv_sec++;
-	    ts.tv_usec -= MILLION;
+    unsigned n;
+    char sbuf[64];
+    while (ts.tv_usec >= MILLION) {
+	ts.tv_sec++;
+	ts.tv_usec -= MILLION;
+    }
+    strftime(sbuf, 64, "%Y%m%d.%H%M%S", gmtime((time_t *) & ts.tv_sec));
+    for (n = 0; n < shard_count; n++) {
+	struct dump *d = &dumps[n];
+	if (to_stdout) {
+	    t = "-";
+	} else {
+	    int r;
+	    if (shard_count > 1)
+		r = asprintf(&d->dumpname, "%s.%u.%s.%06lu",
+		    dump_base, n, sbuf, (u_long) ts.tv_usec);
+	    else
+		r = asprintf(&d->dumpname, "%s.%s.%06lu",
+		    dump_base, sbuf, (u_long) ts.tv_usec);
+	    if (r < 0 || asprintf(&d->dumpnamepart, "%s.part", d->dumpname) < 0) {
+		logerr("asprintf: %s", strerror(errno));
+		return 1;
+	    }
+	    t = d->dumpnamepart;
 	}
-	strftime(sbuf, 64, "%Y%m%d.%H%M%S", gmtime((time_t *) & ts.tv_sec));
-	if (asprintf(&dumpname, "%s.%s.%06lu",
-		dump_base, sbuf, (u_long) ts.tv_usec) < 0 || asprintf(&dumpnamepart, "%s.part", dumpname) < 0) {
-	    logerr("asprintf: %s", strerror(errno));
+	d->dumper = pcap_dump_open(pcap_dead, t);
+	if (d->dumper == NULL) {
+	    logerr("pcap dump open: %s", pcap_geterr(pcap_dead));
 	    return 1;
 	}
-	t = dumpnamepart;
-    }
-    dumper = pcap_dump_open(pcap_dead, t);
-    if (dumper == NULL) {
-	logerr("pcap dump open: %s", pcap_geterr(pcap_dead));
-	return 1;
     }
     return 0;
 }
@@ -186,44 +245,49 @@ int
 pcapdump_close(my_bpftimeval ts)
 {
     int ret = 0;
+    unsigned n;
 #if 0
     if (print_pcap_stats)
 	do_pcap_stats();
 #endif
-    pcap_dump_close(dumper);
-    dumper = 0;
-    if (to_stdout) {
-	assert(dumpname == 0);
-	assert(dumpnamepart == 0);
-	if (dbg_lvl >= 1)
-	    logerr("breaking");
-	ret = 0;
-    } else {
-	char *cmd = NULL;
-	if (dbg_lvl >= 1)
-	    logerr("closing %s", dumpname);
-	if (rename(dumpnamepart, dumpname)) {
-	    logerr("rename: %s", strerror(errno));
-	    return 1;
-	}
-	if (kick_cmd != NULL)
-	    if (asprintf(&cmd, "%s %s &", kick_cmd, dumpname) < 0) {
-		logerr("asprintf: %s", strerror(errno));
-		cmd = NULL;
+    for (n = 0; n < shard_count; n++) {
+	struct dump *d = &dumps[n];
+	if (d->dumper == NULL)
+	    continue;
+	pcap_dump_close(d->dumper);
+	d->dumper = 0;
+	if (to_stdout) {
+	    assert(d->dumpname == 0);
+	    assert(d->dumpnamepart == 0);
+	    if (dbg_lvl >= 1)
+		logerr("breaking");
+	    ret = 0;
+	} else {
+	    char *cmd = NULL;
+	    if (dbg_lvl >= 1)
+		logerr("closing %s", d->dumpname);
+	    if (rename(d->dumpnamepart, d->dumpname)) {
+		logerr("rename: %s", strerror(errno));
+		ret = 1;
+		continue;
 	    }
-	free(dumpnamepart);
-	dumpnamepart = NULL;
-	free(dumpname);
-	dumpname = NULL;
-	if (cmd != NULL) {
-	    int x = system(cmd);
-	    if (x) {
-	        logerr("system %s returned %d", cmd, x);
+	    if (kick_cmd != NULL)
+		if (asprintf(&cmd, "%s %s &", kick_cmd, d->dumpname) < 0) {
+		    logerr("asprintf: %s", strerror(errno));
+		    cmd = NULL;
+		}
+	    free(d->dumpnamepart);
+	    d->dumpnamepart = NULL;
+	    free(d->dumpname);
+	    d->dumpname = NULL;
+	    if (cmd != NULL) {
+		int x = system(cmd);
+		if (x) {
+		    logerr("system %s returned %d", cmd, x);
+		}
+		free(cmd);
 	    }
-	    free(cmd);
 	}
-	if (kick_cmd == NULL)
-	    ret = 0;
     }
     return ret;
 }
@@ -234,6 +298,7 @@ pcapdump_output(const char *descr, iaddr from, iaddr to, uint8_t proto, unsigned
     const u_char * pkt_copy, const unsigned olen, const u_char * payload, const unsigned payloadlen)
 {
     struct pcap_pkthdr h;
+    pcap_dumper_t *dumper;
     if (flags & DNSCAP_OUTPUT_ISDNS) {
         HEADER *dns = (HEADER *) payload;
         if (0 == dns->qr && 0 == (dir_wanted&DIR_INITIATE))
@@ -241,6 +306,10 @@ pcapdump_output(const char *descr, iaddr from, iaddr to, uint8_t proto, unsigned
         if (1 == dns->qr && 0 == (dir_wanted&DIR_RESPONSE))
 	    return;
     }
+    if (shard_count > 1)
+	dumper = dumps[shard(from, to, flags, dport, dns_port, payload, shard_key == shard_client, shard_count)].dumper;
+    else
+	dumper = dumps[0].dumper;
     memset(&h, 0, sizeof h);
     h.ts = ts;
     h.len = h.caplen = olen;
@@ -43,6 +43,9 @@
 #include "dnscap_common.h"
 
 static logerr_t *logerr;
+static trigger_t *trigger;
+static shard_t *shard;
+static unsigned dns_port;
 static int opt_f = 0;
 static const char *opt_x = 0;
 
@@ -95,6 +98,31 @@ template_start(logerr_t *a_logerr)
 	return 0;
 }
 
+void
+template_set_trigger(trigger_t *a_trigger)
+{
+	/*
+	 * The optional "set_trigger" function is called once when the
+	 * plugin is loaded.  Calling a_trigger with a reason from
+	 * "output" dumps the flight recorder ring when dnscap runs
+	 * with -o ring_size=<bytes>, otherwise it does nothing.
+	 */
+	trigger = a_trigger;
+}
+
+void
+template_set_shard(shard_t *a_shard, unsigned a_dns_port)
+{
+	/*
+	 * The optional "set_shard" function is called once before "start".
+	 * a_shard picks the shard of a message the same way dnscap does
+	 * for -o shard_key=client or responder, a_dns_port is the port
+	 * given with -u.
+	 */
+	shard = a_shard;
+	dns_port = a_dns_port;
+}
+
 void
 template_stop()
 {
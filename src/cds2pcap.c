@@ -0,0 +1,678 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pcap.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "cds_decode.h"
+
+/*
+ * Rebuild pcap from CBOR DNS Stream files.  Each DNS message is written as
+ * an IPv4 or IPv6 packet with a UDP header, or as a TCP SYN followed by a
+ * segment holding the length prefixed message so that readers tracking
+ * TCP state pick it up.  Messages without a DNS part carry no payload in
+ * CDS and are skipped.
+ *
+ * With -t the input is cut at stream headers into segments which are
+ * decoded by a pool of workers and written in order.
+ */
+
+#define SNAPLEN         (65535 + 128)
+#define IP4_HDR_SIZE    20
+#define IP6_HDR_SIZE    40
+#define UDP_HDR_SIZE    8
+#define TCP_HDR_SIZE    20
+#define TCP_SYN         0x02
+#define TCP_PSH_ACK     0x18
+
+#define SEGMENT_SIZE    (1024 * 1024)
+#define READ_SIZE       (64 * 1024)
+
+static const char* progname = "cds2pcap";
+static int stats = 0;
+static size_t workers = 0;
+static cds_dict_t* dict = 0;
+static pcap_t* pcap_dead = 0;
+static pcap_dumper_t* dumper = 0;
+
+struct out {
+    uint8_t* buf;
+    size_t len;
+    size_t size;
+    size_t messages;
+    size_t packets;
+    size_t skipped;
+};
+
+static void usage(const char* msg) {
+    fprintf(stderr, "%s: usage error: %s\n\n", progname, msg);
+    fprintf(stderr, "usage: %s [-s] [-d dictionary] [-t workers] [-w file] [file ...]\n", progname);
+    fprintf(stderr, "\t-d   use this dictionary for streams that refer to one\n");
+    fprintf(stderr, "\t-s   print statistics to stderr\n");
+    fprintf(stderr, "\t-t   decode segments of the input with this many workers\n");
+    fprintf(stderr, "\t-w   write pcap to this file instead of stdout\n");
+    exit(1);
+}
+
+static cds_dict_t* load_dict(const char* file) {
+    FILE* fp;
+    cds_dict_t* d;
+    int ret;
+
+    if (!(fp = fopen(file, "r"))) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+        exit(1);
+    }
+    if ((ret = cds_dict_load(fp, &d)) != CDS_DECODE_OK) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, cds_decoder_strerror(ret));
+        exit(1);
+    }
+    fclose(fp);
+
+    return d;
+}
+
+static int out_need(struct out* o, size_t len) {
+    if (o->len + len > o->size) {
+        size_t size = o->size ? o->size : 64 * 1024;
+        uint8_t* p;
+
+        while (size < o->len + len) {
+            size *= 2;
+        }
+        if (!(p = realloc(o->buf, size))) {
+            return CDS_DECODE_ENOMEM;
+        }
+        o->buf = p;
+        o->size = size;
+    }
+    return CDS_DECODE_OK;
+}
+
+static uint32_t csum_add(uint32_t sum, const uint8_t* p, size_t len) {
+    while (len > 1) {
+        sum += (p[0] << 8) | p[1];
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        sum += p[0] << 8;
+    }
+    return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum & 0xffff;
+}
+
+static void put16(uint8_t* p, unsigned v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+
+/*
+ * Append one packet, the pcap header followed by the IP and transport
+ * headers and the data, TCP data gets the length prefix of DNS over TCP.
+ */
+static int out_packet(struct out* o, const cds_message_t* m, int proto, int tcp_flags, const uint8_t* data, size_t len) {
+    struct pcap_pkthdr h;
+    size_t ip_len = m->is_v6 ? IP6_HDR_SIZE : IP4_HDR_SIZE;
+    size_t tp_len = proto == IPPROTO_TCP ? TCP_HDR_SIZE : UDP_HDR_SIZE;
+    size_t prefix = proto == IPPROTO_TCP && len ? 2 : 0;
+    size_t total = ip_len + tp_len + prefix + len, alen = m->is_v6 ? 16 : 4;
+    uint8_t *ip, *tp;
+    uint32_t sum;
+    int ret;
+
+    if ((ret = out_need(o, sizeof(h) + total)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    memset(&h, 0, sizeof(h));
+    h.ts.tv_sec = m->sec;
+    h.ts.tv_usec = m->usec;
+    h.caplen = h.len = total;
+    memcpy(&(o->buf[o->len]), &h, sizeof(h));
+    ip = &(o->buf[o->len + sizeof(h)]);
+    tp = ip + ip_len;
+    memset(ip, 0, ip_len + tp_len);
+
+    if (m->is_v6) {
+        ip[0] = 0x60;
+        put16(&ip[4], total - ip_len);
+        ip[6] = proto;
+        ip[7] = 64;
+        memcpy(&ip[8], m->src_addr, 16);
+        memcpy(&ip[24], m->dest_addr, 16);
+    }
+    else {
+        ip[0] = 0x45;
+        put16(&ip[2], total);
+        ip[8] = 64;
+        ip[9] = proto;
+        memcpy(&ip[12], m->src_addr, 4);
+        memcpy(&ip[16], m->dest_addr, 4);
+        put16(&ip[10], csum_fold(csum_add(0, ip, IP4_HDR_SIZE)));
+    }
+
+    put16(&tp[0], m->src_port);
+    put16(&tp[2], m->dest_port);
+    if (proto == IPPROTO_TCP) {
+        /* the SYN takes sequence 0 so the data starts at 1 */
+        if (tcp_flags != TCP_SYN) {
+            tp[7] = 1;
+            tp[11] = 1;
+        }
+        tp[12] = (TCP_HDR_SIZE / 4) << 4;
+        tp[13] = tcp_flags;
+        put16(&tp[14], 65535);
+    }
+    else {
+        put16(&tp[4], tp_len + len);
+    }
+    if (prefix) {
+        put16(tp + tp_len, len);
+    }
+    if (len) {
+        memcpy(tp + tp_len + prefix, data, len);
+    }
+
+    sum = csum_add(0, m->is_v6 ? &ip[8] : &ip[12], alen * 2);
+    sum += proto + total - ip_len;
+    sum = csum_fold(csum_add(sum, tp, total - ip_len));
+    put16(&tp[proto == IPPROTO_TCP ? 16 : 6], proto == IPPROTO_UDP && !sum ? 0xffff : sum);
+
+    o->len += sizeof(h) + total;
+    o->packets++;
+
+    return CDS_DECODE_OK;
+}
+
+static int out_message(const cds_message_t* m, void* ctx) {
+    struct out* o = (struct out*)ctx;
+    size_t max = 65535 - TCP_HDR_SIZE - 2 - (m->is_v6 ? 0 : IP4_HDR_SIZE);
+    int ret;
+
+    o->messages++;
+    if (!(m->bits & CDS_MESSAGE_ISDNS) || !m->payload_len || m->payload_len > max) {
+        o->skipped++;
+        return 0;
+    }
+    if (!(m->bits & CDS_MESSAGE_TCP)) {
+        return out_packet(o, m, IPPROTO_UDP, 0, m->payload, m->payload_len);
+    }
+    if ((ret = out_packet(o, m, IPPROTO_TCP, TCP_SYN, 0, 0)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    return out_packet(o, m, IPPROTO_TCP, TCP_PSH_ACK, m->payload, m->payload_len);
+}
+
+/* Write the packets collected and empty the buffer. */
+static void out_write(struct out* o) {
+    struct pcap_pkthdr h;
+    size_t n = 0;
+
+    while (n < o->len) {
+        memcpy(&h, &(o->buf[n]), sizeof(h));
+        pcap_dump((u_char*)dumper, &h, &(o->buf[n + sizeof(h)]));
+        n += sizeof(h) + h.caplen;
+    }
+    o->len = 0;
+}
+
+static void out_count(struct out* total, const struct out* o) {
+    total->messages += o->messages;
+    total->packets += o->packets;
+    total->skipped += o->skipped;
+}
+
+static int convert_file(const char* file, FILE* fp, struct out* total) {
+    cds_decoder_t* decoder;
+    cds_message_t message;
+    struct out o;
+    int ret;
+
+    if (!(decoder = cds_decoder_new(fp))) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, cds_decoder_strerror(CDS_DECODE_ENOMEM));
+        return 1;
+    }
+    cds_decoder_set_dict(decoder, dict);
+    memset(&o, 0, sizeof(o));
+    while ((ret = cds_decoder_next(decoder, &message)) == CDS_DECODE_OK) {
+        if ((ret = out_message(&message, &o)) != CDS_DECODE_OK) {
+            break;
+        }
+        if (o.len >= SEGMENT_SIZE) {
+            out_write(&o);
+        }
+    }
+    out_write(&o);
+    if (ret != CDS_DECODE_END) {
+        fprintf(stderr, "%s: %s: %s after %lu messages\n", progname, file,
+            cds_decoder_strerror(ret), (unsigned long)o.messages);
+    }
+    out_count(total, &o);
+    free(o.buf);
+    cds_decoder_free(decoder);
+
+    return ret != CDS_DECODE_END;
+}
+
+#if HAVE_PTHREAD
+/*
+ * Segments of whole streams, decoded by the workers and written by the
+ * main thread in the order they were read.
+ */
+struct segment;
+struct segment {
+    struct segment* next;
+    const char* file;
+    uint8_t* in;
+    size_t in_len;
+    size_t in_size;
+    struct out out;
+    int done;
+    int ret;
+};
+
+static size_t pool_started = 0;
+static pthread_t* pool_threads = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static struct segment* pool_head = 0;
+static struct segment* pool_tail = 0;
+static struct segment* pool_next = 0;
+static struct segment* pool_free = 0;
+static size_t pool_pending = 0;
+
+static void pool_decode(struct segment* segment) {
+    cds_decoder_t* decoder;
+    cds_message_t message;
+    int ret;
+
+    segment->out.len = 0;
+    segment->out.messages = segment->out.packets = segment->out.skipped = 0;
+    if (!(decoder = cds_decoder_new_buffer(segment->in, segment->in_len))) {
+        segment->ret = CDS_DECODE_ENOMEM;
+        return;
+    }
+    cds_decoder_set_dict(decoder, dict);
+    while ((ret = cds_decoder_next(decoder, &message)) == CDS_DECODE_OK) {
+        if ((ret = out_message(&message, &(segment->out))) != CDS_DECODE_OK) {
+            break;
+        }
+    }
+    segment->ret = ret == CDS_DECODE_END ? CDS_DECODE_OK : ret;
+    cds_decoder_free(decoder);
+}
+
+static void* pool_worker(void* arg) {
+    struct segment* segment;
+
+    (void)arg;
+    pthread_mutex_lock(&pool_lock);
+    while (1) {
+        while (!pool_next) {
+            pthread_cond_wait(&pool_cond, &pool_lock);
+        }
+        segment = pool_next;
+        pool_next = segment->next;
+        pthread_mutex_unlock(&pool_lock);
+
+        pool_decode(segment);
+
+        pthread_mutex_lock(&pool_lock);
+        segment->done = 1;
+        pool_pending--;
+        pthread_cond_broadcast(&pool_cond);
+    }
+
+    return 0;
+}
+
+/* Write the decoded segments at the head, all of them if wait is set. */
+static int pool_write(struct out* total, int wait) {
+    struct segment* segment;
+    int ret = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    while ((segment = pool_head)) {
+        if (!segment->done) {
+            if (!wait) {
+                break;
+            }
+            pthread_cond_wait(&pool_cond, &pool_lock);
+            continue;
+        }
+        if (!(pool_head = segment->next)) {
+            pool_tail = 0;
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        out_write(&(segment->out));
+        out_count(total, &(segment->out));
+        if (segment->ret != CDS_DECODE_OK) {
+            fprintf(stderr, "%s: %s: %s\n", progname, segment->file, cds_decoder_strerror(segment->ret));
+            ret = 1;
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        segment->next = pool_free;
+        pool_free = segment;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    return ret;
+}
+
+static int pool_submit(struct segment* segment, struct out* total) {
+    int err, ret;
+
+    pthread_mutex_lock(&pool_lock);
+    if (!pool_threads && !(pool_threads = calloc(workers, sizeof(*pool_threads)))) {
+        pthread_mutex_unlock(&pool_lock);
+        fprintf(stderr, "%s: %s\n", progname, cds_decoder_strerror(CDS_DECODE_ENOMEM));
+        return -1;
+    }
+    while (pool_started < workers) {
+        if ((err = pthread_create(&pool_threads[pool_started], 0, pool_worker, 0))) {
+            pthread_mutex_unlock(&pool_lock);
+            fprintf(stderr, "%s: pthread_create: %s\n", progname, strerror(err));
+            return -1;
+        }
+        pool_started++;
+    }
+    segment->next = 0;
+    segment->done = 0;
+    if (pool_tail) {
+        pool_tail->next = segment;
+    }
+    else {
+        pool_head = segment;
+    }
+    pool_tail = segment;
+    if (!pool_next) {
+        pool_next = segment;
+    }
+    pool_pending++;
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+
+    ret = pool_write(total, 0);
+
+    /* keep at most two segments per worker in memory */
+    pthread_mutex_lock(&pool_lock);
+    while (pool_pending >= workers * 2) {
+        pthread_cond_wait(&pool_cond, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    return ret;
+}
+
+static struct segment* pool_get(const char* file) {
+    struct segment* segment;
+
+    pthread_mutex_lock(&pool_lock);
+    if ((segment = pool_free)) {
+        pool_free = segment->next;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (!segment && !(segment = calloc(1, sizeof(*segment)))) {
+        fprintf(stderr, "%s: %s\n", progname, cds_decoder_strerror(CDS_DECODE_ENOMEM));
+        return 0;
+    }
+    segment->file = file;
+    segment->in_len = 0;
+
+    return segment;
+}
+
+/*
+ * Read the file and cut it into segments of whole streams, a segment is
+ * handed to the workers at the first stream header after it has grown
+ * past SEGMENT_SIZE.  The segments still being decoded are written by
+ * later calls, the last one waits for all of them.
+ */
+static int pool_file(const char* file, FILE* fp, struct out* total) {
+    struct segment* segment;
+    uint8_t *buf = 0, *p;
+    size_t size = 0, len = 0, pos = 0, n, element;
+    int ret = 0, submitted, is_stream_init, err = CDS_DECODE_OK, eof = 0;
+
+    if (!(segment = pool_get(file))) {
+        return 1;
+    }
+    while (1) {
+        if (pos < len) {
+            err = cds_decode_element(&buf[pos], len - pos, &element, &is_stream_init);
+        }
+        else {
+            err = CDS_DECODE_END;
+        }
+        if (err == CDS_DECODE_OK) {
+            if (is_stream_init && segment->in_len >= SEGMENT_SIZE) {
+                if ((submitted = pool_submit(segment, total)) < 0) {
+                    segment = 0;
+                    ret = 1;
+                    break;
+                }
+                ret |= submitted;
+                if (!(segment = pool_get(file))) {
+                    ret = 1;
+                    break;
+                }
+            }
+            if (segment->in_len + element > segment->in_size) {
+                n = segment->in_size ? segment->in_size : SEGMENT_SIZE;
+                while (n < segment->in_len + element) {
+                    n *= 2;
+                }
+                if (!(p = realloc(segment->in, n))) {
+                    err = CDS_DECODE_ENOMEM;
+                    break;
+                }
+                segment->in = p;
+                segment->in_size = n;
+            }
+            memcpy(&(segment->in[segment->in_len]), &buf[pos], element);
+            segment->in_len += element;
+            pos += element;
+            continue;
+        }
+        if (err != CDS_DECODE_END || eof) {
+            if (err == CDS_DECODE_END && pos < len) {
+                err = CDS_DECODE_EFORMAT;
+            }
+            break;
+        }
+
+        if (pos) {
+            memmove(buf, &buf[pos], len - pos);
+            len -= pos;
+            pos = 0;
+        }
+        if (len + READ_SIZE > size) {
+            n = size ? size * 2 : READ_SIZE * 2;
+            if (!(p = realloc(buf, n))) {
+                err = CDS_DECODE_ENOMEM;
+                break;
+            }
+            buf = p;
+            size = n;
+        }
+        n = fread(&buf[len], 1, size - len, fp);
+        len += n;
+        if (!n) {
+            if (ferror(fp)) {
+                err = CDS_DECODE_EREAD;
+                break;
+            }
+            eof = 1;
+        }
+    }
+    free(buf);
+
+    if (segment) {
+        if (segment->in_len && pool_submit(segment, total)) {
+            ret = 1;
+        }
+        else if (!segment->in_len) {
+            pthread_mutex_lock(&pool_lock);
+            segment->next = pool_free;
+            pool_free = segment;
+            pthread_mutex_unlock(&pool_lock);
+        }
+    }
+    ret |= pool_write(total, 0);
+    if (err != CDS_DECODE_END && err != CDS_DECODE_OK) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, cds_decoder_strerror(err));
+        ret = 1;
+    }
+
+    return ret;
+}
+#endif
+
+static int convert(const char* file, struct out* total) {
+    FILE* fp;
+    int ret;
+
+    if (!strcmp(file, "-")) {
+        fp = stdin;
+    }
+    else if (!(fp = fopen(file, "r"))) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+        return 1;
+    }
+#if HAVE_PTHREAD
+    if (workers) {
+        ret = pool_file(file, fp, total);
+    }
+    else
+#endif
+        ret = convert_file(file, fp, total);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    return ret;
+}
+
+int main(int argc, char* argv[]) {
+    struct out total;
+    struct timeval start, end;
+    const char* outfile = "-";
+    double seconds;
+    char* p;
+    int ch, ret = 0;
+
+    while ((ch = getopt(argc, argv, "d:st:w:")) != EOF) {
+        switch (ch) {
+        case 'd':
+            dict = load_dict(optarg);
+            break;
+        case 's':
+            stats = 1;
+            break;
+        case 't':
+            workers = strtoul(optarg, &p, 10);
+            if (!*optarg || *p || !workers || workers > 256) {
+                usage("-t takes a number of workers from 1 to 256");
+            }
+#if !HAVE_PTHREAD
+            usage("-t requires pthread support");
+#endif
+            break;
+        case 'w':
+            outfile = optarg;
+            break;
+        default:
+            usage("unrecognized command line option");
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (!(pcap_dead = pcap_open_dead(DLT_RAW, SNAPLEN))
+        || !(dumper = pcap_dump_open(pcap_dead, outfile)))
+    {
+        fprintf(stderr, "%s: %s: %s\n", progname, outfile,
+            pcap_dead ? pcap_geterr(pcap_dead) : "pcap_open_dead failed");
+        return 1;
+    }
+
+    memset(&total, 0, sizeof(total));
+    gettimeofday(&start, 0);
+    if (!argc) {
+        ret = convert("-", &total);
+    }
+    for (; argc; argc--, argv++) {
+        ret |= convert(*argv, &total);
+    }
+#if HAVE_PTHREAD
+    if (workers) {
+        ret |= pool_write(&total, 1);
+    }
+#endif
+    pcap_dump_close(dumper);
+    pcap_close(pcap_dead);
+    gettimeofday(&end, 0);
+
+    if (stats) {
+        seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+        fprintf(stderr, "messages %lu packets %lu skipped %lu\n",
+            (unsigned long)total.messages, (unsigned long)total.packets,
+            (unsigned long)total.skipped);
+        fprintf(stderr, "seconds %.3f messages/sec %.0f\n",
+            seconds, seconds > 0 ? total.messages / seconds : 0);
+    }
+
+    return ret;
+}
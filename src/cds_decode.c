@@ -0,0 +1,2149 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "cds_decode.h"
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Decoder for the CBOR DNS Stream written by dump_cds.c, see
+ * CBOR_DNS_STREAM.md.  The reverse label and rdata indexes are rebuilt in
+ * the same order as the encoder builds them and each DNS message is put
+ * back together in wire format, so a stream decodes to the messages that
+ * were encoded.
+ */
+
+#define CDS_OPTION_RLABELS                  0
+#define CDS_OPTION_RLABEL_MIN_SIZE          1
+#define CDS_OPTION_RDATA_RINDEX_SIZE        2
+#define CDS_OPTION_RDATA_RINDEX_MIN_SIZE    3
+#define CDS_OPTION_USE_RDATA_INDEX          4
+#define CDS_OPTION_RDATA_INDEX_MIN_SIZE     5
+#define CDS_OPTION_RDATA_INDEX_SIZE         6
+#define CDS_OPTION_DICTIONARY               7
+
+#define CDS_CONTROL_RDATA_INDEX_EVICT       0
+#define CDS_CONTROL_INDEX                   1
+#define CDS_CONTROL_INDEX_FOOTER            2
+
+#define CDS_INDEX_FOOTER_SIZE               11
+
+#define CDS_DEFAULT_MAX_RLABELS             255
+#define CDS_DEFAULT_MIN_RLABEL_SIZE         3
+#define CDS_DEFAULT_RDATA_INDEX_MIN_SIZE    5
+#define CDS_DEFAULT_RDATA_RINDEX_SIZE       255
+#define CDS_DEFAULT_RDATA_RINDEX_MIN_SIZE   5
+
+#define CDS_READ_SIZE   (64 * 1024)
+
+/*
+ * CBOR
+ */
+
+#define CBOR_UINT   0
+#define CBOR_NINT   1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_TAG    6
+#define CBOR_SIMPLE 7
+
+#define CBOR_FALSE  20
+#define CBOR_NULL   22
+
+#define CBOR_MAX_ITEMS  (1 << 24)
+
+struct cbor {
+    const uint8_t* p;
+    const uint8_t* end;
+};
+
+/*
+ * Read the head of the next item, for byte and text strings the string
+ * follows.  Returns 1 if the input ends and -1 for items the stream does
+ * not use (floats and indefinite lengths).
+ */
+static int cbor_head(struct cbor* c, int* major, uint64_t* val) {
+    uint8_t ai;
+    size_t n;
+
+    if (c->p >= c->end) {
+        return 1;
+    }
+    *major = *c->p >> 5;
+    ai = *c->p & 0x1f;
+    if (ai < 24) {
+        *val = ai;
+        c->p++;
+        return 0;
+    }
+    if (ai > 27 || (*major == CBOR_SIMPLE && ai > 24)) {
+        return -1;
+    }
+    n = (size_t)1 << (ai - 24);
+    if ((size_t)(c->end - c->p) < n + 1) {
+        return 1;
+    }
+    c->p++;
+    *val = 0;
+    while (n--) {
+        *val = (*val << 8) | *c->p++;
+    }
+    return 0;
+}
+
+static int cbor_peek(const struct cbor* c, int* major, uint64_t* val) {
+    struct cbor peek = *c;
+
+    return cbor_head(&peek, major, val);
+}
+
+/*
+ * Get the size of the next complete item, returns 1 if more input is
+ * needed.
+ */
+static int cbor_size(const uint8_t* p, const uint8_t* end, size_t* size) {
+    struct cbor c;
+    uint64_t items = 1, val;
+    int major, ret;
+
+    c.p = p;
+    c.end = end;
+    while (items) {
+        if ((ret = cbor_head(&c, &major, &val))) {
+            return ret;
+        }
+        items--;
+        switch (major) {
+        case CBOR_BYTES:
+        case CBOR_TEXT:
+            if ((uint64_t)(c.end - c.p) < val) {
+                return 1;
+            }
+            c.p += val;
+            break;
+        case CBOR_ARRAY:
+        case CBOR_MAP:
+            if (val > CBOR_MAX_ITEMS || items > CBOR_MAX_ITEMS) {
+                return -1;
+            }
+            items += major == CBOR_MAP ? val * 2 : val;
+            break;
+        case CBOR_TAG:
+            items++;
+            break;
+        }
+    }
+    *size = c.p - p;
+
+    return 0;
+}
+
+/*
+ * Decoder state
+ */
+
+struct cds_entry {
+    size_t stamp;
+    size_t len;
+    uint8_t data[1];
+};
+
+#define CDS_ENTRY_SIZE(len) (offsetof(struct cds_entry, data) + (len))
+
+/*
+ * Most recently used index as kept by the encoder, entries are looked up
+ * by their position from the front through a Fenwick tree counting the
+ * entries by the stamp they were last used at.
+ */
+struct cds_mru {
+    struct cds_entry** slot;
+    uint32_t* rank;
+    size_t rank_size;
+    size_t rank_step;
+    size_t stamp;
+    size_t entries;
+    size_t max;
+};
+
+struct cds_last_ip {
+    uint8_t     src_addr[16];
+    uint8_t     dest_addr[16];
+    uint16_t    src_port;
+    uint16_t    dest_port;
+};
+
+struct cds_fixup {
+    size_t pos;
+    size_t label;
+};
+
+struct cds_decoder {
+    FILE* fp;
+    int borrowed;
+    uint8_t* buf;
+    size_t buf_size;
+    size_t buf_len;
+    size_t buf_pos;
+    int eof;
+    int limited;
+    uint64_t remaining;
+    cds_decode_stats_t stats;
+
+    int have_range;
+    uint64_t from;
+    uint64_t to;
+
+    int have_stream;
+    size_t max_rlabels;
+    size_t min_rlabel_size;
+    int use_rdata_index;
+    int use_rdata_rindex;
+    size_t rdata_index_min_size;
+    size_t rdata_rindex_size;
+    size_t rdata_rindex_min_size;
+    const cds_dict_t* dict;
+
+    struct {
+        uint64_t            sec;
+        uint32_t            usec;
+        struct cds_last_ip  ip4;
+        struct cds_last_ip  ip6;
+        uint16_t            dns_type;
+        uint16_t            dns_class;
+        uint32_t            dns_ttl;
+    } last;
+
+    struct cds_mru rlabels;
+    struct cds_mru rdatas;
+
+    struct cds_entry** rdata_idx;
+    size_t rdata_idx_size;
+    size_t rdata_next;
+    size_t* reuse;
+    size_t reuse_size;
+    size_t reuse_head;
+    size_t reuse_ready;
+    size_t reuse_tail;
+
+    uint8_t* wire;
+    size_t wire_size;
+    size_t wire_len;
+    size_t* labels;
+    size_t labels_size;
+    size_t labels_num;
+    struct cds_fixup* fixups;
+    size_t fixups_size;
+    size_t fixups_num;
+};
+
+static int grow(void** p, size_t* size, size_t need, size_t elem) {
+    size_t n = *size ? *size : 64;
+    void* tmp;
+
+    while (n < need) {
+        n *= 2;
+    }
+    if (!(tmp = realloc(*p, n * elem))) {
+        return CDS_DECODE_ENOMEM;
+    }
+    *p = tmp;
+    *size = n;
+
+    return CDS_DECODE_OK;
+}
+
+#define need_size(p, size, need) \
+    ((need) <= (size) ? CDS_DECODE_OK : grow((void**)&(p), &(size), (need), sizeof(*(p))))
+
+/*
+ * MRU
+ */
+
+static void mru_rank_add(struct cds_mru* mru, size_t stamp, int v) {
+    for (; stamp <= mru->rank_size; stamp += stamp & -stamp) {
+        mru->rank[stamp] += v;
+    }
+}
+
+/*
+ * Find the stamp of the n:th entry counting from the least recently
+ * used, n starts at 1.
+ */
+static size_t mru_rank_find(struct cds_mru* mru, size_t n) {
+    size_t pos = 0, step;
+
+    for (step = mru->rank_step; step; step >>= 1) {
+        if (pos + step <= mru->rank_size && mru->rank[pos + step] < n) {
+            pos += step;
+            n -= mru->rank[pos];
+        }
+    }
+    return pos + 1;
+}
+
+static void mru_renumber(struct cds_mru* mru) {
+    size_t n, parent, stamp = 0;
+    struct cds_entry* entry;
+
+    for (n = 1; n <= mru->stamp; n++) {
+        if ((entry = mru->slot[n])) {
+            mru->slot[n] = 0;
+            mru->slot[++stamp] = entry;
+            entry->stamp = stamp;
+        }
+    }
+    mru->stamp = stamp;
+
+    memset(mru->rank, 0, (mru->rank_size + 1) * sizeof(*(mru->rank)));
+    for (n = 1; n <= stamp; n++) {
+        mru->rank[n] = 1;
+    }
+    for (n = 1; n <= mru->rank_size; n++) {
+        parent = n + (n & -n);
+        if (parent <= mru->rank_size) {
+            mru->rank[parent] += mru->rank[n];
+        }
+    }
+}
+
+static int mru_init(struct cds_mru* mru, size_t max) {
+    memset(mru, 0, sizeof(*mru));
+    mru->max = max;
+    mru->rank_size = max * 2 + 4;
+    if (!(mru->slot = calloc(mru->rank_size + 1, sizeof(*(mru->slot))))
+        || !(mru->rank = calloc(mru->rank_size + 1, sizeof(*(mru->rank)))))
+    {
+        free(mru->slot);
+        mru->slot = 0;
+        return CDS_DECODE_ENOMEM;
+    }
+    for (mru->rank_step = 1; mru->rank_step * 2 <= mru->rank_size; mru->rank_step *= 2);
+
+    return CDS_DECODE_OK;
+}
+
+static void mru_free(struct cds_mru* mru) {
+    size_t n;
+
+    if (mru->slot) {
+        for (n = 1; n <= mru->stamp; n++) {
+            free(mru->slot[n]);
+        }
+    }
+    free(mru->slot);
+    free(mru->rank);
+    memset(mru, 0, sizeof(*mru));
+}
+
+static void mru_push(struct cds_mru* mru, struct cds_entry* entry) {
+    if (mru->stamp == mru->rank_size) {
+        mru_renumber(mru);
+    }
+    entry->stamp = ++mru->stamp;
+    mru->slot[entry->stamp] = entry;
+    mru_rank_add(mru, entry->stamp, 1);
+    mru->entries++;
+}
+
+static void mru_unlink(struct cds_mru* mru, struct cds_entry* entry) {
+    mru_rank_add(mru, entry->stamp, -1);
+    mru->slot[entry->stamp] = 0;
+    mru->entries--;
+}
+
+/*
+ * Get the entry at idx counting from the most recently used, it then
+ * becomes the most recently used.
+ */
+static struct cds_entry* mru_get(struct cds_mru* mru, uint64_t idx) {
+    struct cds_entry* entry;
+
+    if (idx >= mru->entries) {
+        return 0;
+    }
+    entry = mru->slot[mru_rank_find(mru, mru->entries - idx)];
+    if (idx) {
+        mru_unlink(mru, entry);
+        mru_push(mru, entry);
+    }
+
+    return entry;
+}
+
+/*
+ * Add a copy of data as the most recently used, dropping the least
+ * recently used entry the same way the encoder does.
+ */
+static int mru_add(struct cds_mru* mru, const uint8_t* data, size_t len) {
+    struct cds_entry* entry;
+
+    if (!(entry = malloc(CDS_ENTRY_SIZE(len)))) {
+        return CDS_DECODE_ENOMEM;
+    }
+    entry->len = len;
+    memcpy(entry->data, data, len);
+
+    mru_push(mru, entry);
+    if (mru->entries > 1 && mru->entries >= mru->max) {
+        entry = mru->slot[mru_rank_find(mru, 1)];
+        mru_unlink(mru, entry);
+        free(entry);
+    }
+
+    return CDS_DECODE_OK;
+}
+
+/*
+ * Resource data index
+ */
+
+static void rdata_reset(cds_decoder_t* d) {
+    size_t n;
+
+    for (n = 0; n < d->rdata_next; n++) {
+        free(d->rdata_idx[n]);
+        d->rdata_idx[n] = 0;
+    }
+    d->rdata_next = 0;
+    d->reuse_head = d->reuse_ready = d->reuse_tail = 0;
+}
+
+static int rdata_add(cds_decoder_t* d, const uint8_t* data, size_t len) {
+    struct cds_entry* entry;
+    size_t idx;
+    int ret;
+
+    if (len < d->rdata_index_min_size) {
+        return CDS_DECODE_OK;
+    }
+    if (d->reuse_head < d->reuse_ready) {
+        idx = d->reuse[d->reuse_head++];
+    }
+    else {
+        if ((ret = need_size(d->rdata_idx, d->rdata_idx_size, d->rdata_next + 1)) != CDS_DECODE_OK) {
+            return ret;
+        }
+        idx = d->rdata_next++;
+        d->rdata_idx[idx] = 0;
+    }
+
+    if (!(entry = malloc(CDS_ENTRY_SIZE(len)))) {
+        return CDS_DECODE_ENOMEM;
+    }
+    entry->len = len;
+    memcpy(entry->data, data, len);
+    free(d->rdata_idx[idx]);
+    d->rdata_idx[idx] = entry;
+
+    return CDS_DECODE_OK;
+}
+
+/*
+ * Evicted indexes are handed out again only after the message following
+ * the control, the encoder evicts while parsing that message.
+ */
+static int rdata_evict(cds_decoder_t* d, uint64_t idx) {
+    int ret;
+
+    if (idx >= d->rdata_next || !d->rdata_idx[idx]) {
+        return CDS_DECODE_EFORMAT;
+    }
+    if (d->reuse_head == d->reuse_tail) {
+        d->reuse_head = d->reuse_ready = d->reuse_tail = 0;
+    }
+    if ((ret = need_size(d->reuse, d->reuse_size, d->reuse_tail + 1)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    free(d->rdata_idx[idx]);
+    d->rdata_idx[idx] = 0;
+    d->reuse[d->reuse_tail++] = idx;
+
+    return CDS_DECODE_OK;
+}
+
+/*
+ * Wire format
+ */
+
+static int wire_put(cds_decoder_t* d, const uint8_t* data, size_t len) {
+    int ret;
+
+    if ((ret = need_size(d->wire, d->wire_size, d->wire_len + len)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    memcpy(&(d->wire[d->wire_len]), data, len);
+    d->wire_len += len;
+
+    return CDS_DECODE_OK;
+}
+
+static int wire_u8(cds_decoder_t* d, unsigned v) {
+    uint8_t b = v;
+
+    return wire_put(d, &b, 1);
+}
+
+static int wire_u16(cds_decoder_t* d, unsigned v) {
+    uint8_t b[2];
+
+    b[0] = v >> 8;
+    b[1] = v;
+    return wire_put(d, b, 2);
+}
+
+static int wire_u32(cds_decoder_t* d, uint32_t v) {
+    uint8_t b[4];
+
+    b[0] = v >> 24;
+    b[1] = v >> 16;
+    b[2] = v >> 8;
+    b[3] = v;
+    return wire_put(d, b, 4);
+}
+
+static void wire_set16(cds_decoder_t* d, size_t pos, unsigned v) {
+    d->wire[pos] = v >> 8;
+    d->wire[pos + 1] = v;
+}
+
+/*
+ * Labels are numbered in the order they are in the message, a label that
+ * a compression pointer refers to before it is seen is patched in when
+ * it is.
+ */
+static int label_add(cds_decoder_t* d) {
+    size_t n;
+    int ret;
+
+    if ((ret = need_size(d->labels, d->labels_size, d->labels_num + 1)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    d->labels[d->labels_num] = d->wire_len;
+
+    for (n = 0; n < d->fixups_num; ) {
+        if (d->fixups[n].label == d->labels_num) {
+            if (d->wire_len > 0x3fff) {
+                return CDS_DECODE_EFORMAT;
+            }
+            wire_set16(d, d->fixups[n].pos, 0xc000 | d->wire_len);
+            d->fixups[n] = d->fixups[--d->fixups_num];
+            continue;
+        }
+        n++;
+    }
+    d->labels_num++;
+
+    return CDS_DECODE_OK;
+}
+
+static int label_pointer(cds_decoder_t* d, uint64_t label) {
+    int ret;
+
+    if (label < d->labels_num) {
+        if (d->labels[label] > 0x3fff) {
+            return CDS_DECODE_EFORMAT;
+        }
+        return wire_u16(d, 0xc000 | d->labels[label]);
+    }
+    if ((ret = need_size(d->fixups, d->fixups_size, d->fixups_num + 1)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    d->fixups[d->fixups_num].pos = d->wire_len;
+    d->fixups[d->fixups_num].label = label;
+    d->fixups_num++;
+
+    return wire_u16(d, 0xc000);
+}
+
+/*
+ * Rebuild a name from the label array in data, sets eligible if the
+ * encoder would have added the name to the reverse label index.  A name
+ * ending with a label has had its root label dropped.
+ */
+static int decode_labels(cds_decoder_t* d, const uint8_t* data, size_t len, int* eligible) {
+    struct cbor c;
+    uint64_t labels, val, n;
+    size_t size = 0;
+    int major, ret, rooted = 1;
+
+    c.p = data;
+    c.end = data + len;
+    if (cbor_head(&c, &major, &labels) || major != CBOR_ARRAY) {
+        return CDS_DECODE_EFORMAT;
+    }
+
+    *eligible = 1;
+    for (n = 0; n < labels; n++) {
+        if (cbor_head(&c, &major, &val)) {
+            return CDS_DECODE_EFORMAT;
+        }
+        rooted = 0;
+        switch (major) {
+        case CBOR_TEXT:
+            if (val > 63 || (uint64_t)(c.end - c.p) < val) {
+                return CDS_DECODE_EFORMAT;
+            }
+            if ((ret = label_add(d)) != CDS_DECODE_OK
+                || (ret = wire_u8(d, val)) != CDS_DECODE_OK
+                || (ret = wire_put(d, c.p, val)) != CDS_DECODE_OK)
+            {
+                return ret;
+            }
+            c.p += val;
+            size += val;
+            rooted = 1;
+            break;
+
+        case CBOR_UINT:
+            if ((ret = label_add(d)) != CDS_DECODE_OK
+                || (ret = label_pointer(d, val)) != CDS_DECODE_OK)
+            {
+                return ret;
+            }
+            break;
+
+        case CBOR_NINT:
+            if (val > 0x3fff) {
+                return CDS_DECODE_EFORMAT;
+            }
+            if ((ret = label_add(d)) != CDS_DECODE_OK
+                || (ret = wire_u16(d, 0xc000 | val)) != CDS_DECODE_OK)
+            {
+                return ret;
+            }
+            *eligible = 0;
+            break;
+
+        case CBOR_SIMPLE:
+            if (val == CBOR_NULL) {
+                /* label cut short, nothing of it is left */
+            }
+            else if (val && val < 3) {
+                if ((ret = wire_u8(d, val << 6)) != CDS_DECODE_OK) {
+                    return ret;
+                }
+            }
+            else {
+                return CDS_DECODE_EFORMAT;
+            }
+            *eligible = 0;
+            break;
+
+        default:
+            return CDS_DECODE_EFORMAT;
+        }
+    }
+    if (rooted && (ret = wire_u8(d, 0)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    if (labels + rooted > 255 || size < d->min_rlabel_size) {
+        *eligible = 0;
+    }
+
+    return CDS_DECODE_OK;
+}
+
+/*
+ * Decode a name given either as a reverse label index or as a label
+ * array, the latter is added to the reverse label index if eligible.
+ */
+static int decode_name(cds_decoder_t* d, struct cbor* c) {
+    struct cds_entry* entry;
+    uint64_t val;
+    size_t size;
+    int major, ret, eligible;
+
+    if (cbor_peek(c, &major, &val)) {
+        return CDS_DECODE_EFORMAT;
+    }
+    if (major == CBOR_NINT) {
+        cbor_head(c, &major, &val);
+        if (!(entry = mru_get(&(d->rlabels), val))) {
+            return CDS_DECODE_EFORMAT;
+        }
+        return decode_labels(d, entry->data, entry->len, &eligible);
+    }
+    if (major != CBOR_ARRAY || cbor_size(c->p, c->end, &size)) {
+        return CDS_DECODE_EFORMAT;
+    }
+    if ((ret = decode_labels(d, c->p, size, &eligible)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    if (eligible && (ret = mru_add(&(d->rlabels), c->p, size)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    c->p += size;
+
+    return CDS_DECODE_OK;
+}
+
+static int decode_uint(struct cbor* c, int want, uint64_t* val) {
+    int major;
+
+    if (cbor_head(c, &major, val) || major != want) {
+        return CDS_DECODE_EFORMAT;
+    }
+    return CDS_DECODE_OK;
+}
+
+/*
+ * Begin an item of a message, returns the number of items in it after the
+ * false that marks an incomplete item.
+ */
+static int decode_item(struct cbor* c, uint64_t* items, int* complete) {
+    uint64_t val;
+    int major;
+
+    if (decode_uint(c, CBOR_ARRAY, items) != CDS_DECODE_OK || !*items) {
+        return CDS_DECODE_EFORMAT;
+    }
+    *complete = 1;
+    if (!cbor_peek(c, &major, &val) && major == CBOR_SIMPLE && val == CBOR_FALSE) {
+        cbor_head(c, &major, &val);
+        *complete = 0;
+        if (!--*items) {
+            return CDS_DECODE_EFORMAT;
+        }
+    }
+    return CDS_DECODE_OK;
+}
+
+static int decode_questions(cds_decoder_t* d, struct cbor* c, size_t* count) {
+    uint64_t questions, items, val, type = 0, class = 0;
+    int major, ret, complete, have_type, have_class;
+
+    if (decode_uint(c, CBOR_ARRAY, &questions) != CDS_DECODE_OK) {
+        return CDS_DECODE_EFORMAT;
+    }
+    for (*count = 0; *count < questions; (*count)++) {
+        if ((ret = decode_item(c, &items, &complete)) != CDS_DECODE_OK
+            || (ret = decode_name(d, c)) != CDS_DECODE_OK)
+        {
+            return ret;
+        }
+        items--;
+
+        have_type = have_class = 0;
+        if (items && !cbor_peek(c, &major, &val) && major == CBOR_UINT) {
+            cbor_head(c, &major, &type);
+            have_type = 1;
+            items--;
+        }
+        if (items && !cbor_peek(c, &major, &val) && major == CBOR_NINT) {
+            cbor_head(c, &major, &class);
+            have_class = 1;
+            items--;
+        }
+        if (items || type > 0xffff || class > 0xffff) {
+            return CDS_DECODE_EFORMAT;
+        }
+
+        /* fields left out are the same as the last, unless cut short */
+        if (!have_type && (complete || have_class)) {
+            type = d->last.dns_type;
+            have_type = 1;
+        }
+        if (!have_class && complete) {
+            class = d->last.dns_class;
+            have_class = 1;
+        }
+        if ((have_type && (ret = wire_u16(d, type)) != CDS_DECODE_OK)
+            || (have_class && (ret = wire_u16(d, class)) != CDS_DECODE_OK))
+        {
+            return ret;
+        }
+        if (have_type) {
+            d->last.dns_type = type;
+        }
+        if (have_class) {
+            d->last.dns_class = class;
+        }
+    }
+
+    return CDS_DECODE_OK;
+}
+
+static int decode_rdata(cds_decoder_t* d, struct cbor* c) {
+    struct cds_entry* entry;
+    uint64_t val, parts;
+    size_t start = d->wire_len;
+    int major, ret;
+
+    if (cbor_head(c, &major, &val)) {
+        return CDS_DECODE_EFORMAT;
+    }
+    switch (major) {
+    case CBOR_UINT:
+        if (!d->use_rdata_index || val >= d->rdata_next || !(entry = d->rdata_idx[val])) {
+            return CDS_DECODE_EFORMAT;
+        }
+        return wire_put(d, entry->data, entry->len);
+
+    case CBOR_NINT:
+        if (!d->use_rdata_rindex || !(entry = mru_get(&(d->rdatas), val))) {
+            return CDS_DECODE_EFORMAT;
+        }
+        return wire_put(d, entry->data, entry->len);
+
+    case CBOR_BYTES:
+        if ((uint64_t)(c->end - c->p) < val) {
+            return CDS_DECODE_EFORMAT;
+        }
+        if ((ret = wire_put(d, c->p, val)) != CDS_DECODE_OK) {
+            return ret;
+        }
+        c->p += val;
+        break;
+
+    case CBOR_ARRAY:
+        for (parts = val; parts; parts--) {
+            if (cbor_peek(c, &major, &val)) {
+                return CDS_DECODE_EFORMAT;
+            }
+            if (major == CBOR_BYTES) {
+                cbor_head(c, &major, &val);
+                if ((uint64_t)(c->end - c->p) < val) {
+                    return CDS_DECODE_EFORMAT;
+                }
+                if ((ret = wire_put(d, c->p, val)) != CDS_DECODE_OK) {
+                    return ret;
+                }
+                c->p += val;
+            }
+            else if ((ret = decode_name(d, c)) != CDS_DECODE_OK) {
+                return ret;
+            }
+        }
+        break;
+
+    default:
+        return CDS_DECODE_EFORMAT;
+    }
+
+    if (d->use_rdata_index) {
+        return rdata_add(d, &(d->wire[start]), d->wire_len - start);
+    }
+    if (d->use_rdata_rindex && d->wire_len - start >= d->rdata_rindex_min_size) {
+        return mru_add(&(d->rdatas), &(d->wire[start]), d->wire_len - start);
+    }
+    return CDS_DECODE_OK;
+}
+
+static int decode_rrs(cds_decoder_t* d, struct cbor* c, size_t* count) {
+    uint64_t rrs, items, val, bits, field[4];
+    size_t rdlength_pos;
+    int major, ret, complete, n, have, last_field, opt;
+
+    if (decode_uint(c, CBOR_ARRAY, &rrs) != CDS_DECODE_OK) {
+        return CDS_DECODE_EFORMAT;
+    }
+    for (*count = 0; *count < rrs; (*count)++) {
+        if ((ret = decode_item(c, &items, &complete)) != CDS_DECODE_OK
+            || (ret = decode_name(d, c)) != CDS_DECODE_OK)
+        {
+            return ret;
+        }
+        items--;
+
+        /* type, class, ttl and rdlength given by bits or all or none */
+        if (items && !cbor_peek(c, &major, &val) && major == CBOR_SIMPLE && val < 0xf) {
+            cbor_head(c, &major, &bits);
+            items--;
+        }
+        else {
+            bits = items >= 4 ? 0xf : 0;
+        }
+        for (n = 0; n < 4; n++) {
+            if (bits & (1 << n)) {
+                if (!items-- || decode_uint(c, CBOR_UINT, &(field[n])) != CDS_DECODE_OK) {
+                    return CDS_DECODE_EFORMAT;
+                }
+            }
+        }
+        if (items > 1
+            || (bits & 1 && field[0] > 0xffff)
+            || (bits & 2 && field[1] > 0xffff)
+            || (bits & 4 && field[2] > 0xffffffff)
+            || (bits & 8 && field[3] > 0xffff))
+        {
+            return CDS_DECODE_EFORMAT;
+        }
+
+        /*
+         * Fields left out are the same as the last, OPT records are not
+         * deduplicated.  For records cut short only the fields before the
+         * last one given were left out.
+         */
+        opt = bits & 1 && field[0] == 41;
+        last_field = items ? 4 : -1;
+        if (complete) {
+            last_field = 4;
+        }
+        else if (last_field < 0) {
+            for (n = 3; n >= 0 && !(bits & (1 << n)); n--);
+            last_field = n;
+        }
+        if (!opt) {
+            if (!(bits & 1) && last_field > 0) {
+                field[0] = d->last.dns_type;
+                bits |= 1;
+            }
+            if (!(bits & 2) && last_field > 1) {
+                field[1] = d->last.dns_class;
+                bits |= 2;
+            }
+            if (!(bits & 4) && last_field > 2) {
+                field[2] = d->last.dns_ttl;
+                bits |= 4;
+            }
+        }
+
+        for (n = 0; n < 3; n++) {
+            if (bits & (1 << n)) {
+                ret = n == 2 ? wire_u32(d, field[n]) : wire_u16(d, field[n]);
+                if (ret != CDS_DECODE_OK) {
+                    return ret;
+                }
+            }
+        }
+        if (!opt) {
+            if (bits & 1) {
+                d->last.dns_type = field[0];
+            }
+            if (bits & 2) {
+                d->last.dns_class = field[1];
+            }
+            if (bits & 4) {
+                d->last.dns_ttl = field[2];
+            }
+        }
+
+        have = items;
+        if (have) {
+            rdlength_pos = d->wire_len;
+            if ((ret = wire_u16(d, 0)) != CDS_DECODE_OK
+                || (ret = decode_rdata(d, c)) != CDS_DECODE_OK)
+            {
+                return ret;
+            }
+            if (d->wire_len - rdlength_pos - 2 > 0xffff) {
+                return CDS_DECODE_EFORMAT;
+            }
+            wire_set16(d, rdlength_pos, d->wire_len - rdlength_pos - 2);
+        }
+        else if (bits & 8 && (ret = wire_u16(d, field[3])) != CDS_DECODE_OK) {
+            return ret;
+        }
+    }
+
+    return CDS_DECODE_OK;
+}
+
+/*
+ * Decode a DNS message into d->wire, for a slimmed response the header
+ * gets the counts of the records kept and slim_counts those of the
+ * original.
+ */
+static int decode_dns(cds_decoder_t* d, struct cbor* c, uint64_t items, uint16_t* slim_counts) {
+    uint64_t val, cnt_bits = 0, rr_bits, count[4] = { 0, 0, 0, 0 }, head[2];
+    size_t rrs[4] = { 0, 0, 0, 0 }, count_pos;
+    int major, ret, complete = 1, n, have_head = 0, have_cnt_bits = 0, top;
+
+    d->wire_len = 0;
+    d->labels_num = 0;
+    d->fixups_num = 0;
+
+    if (items && !cbor_peek(c, &major, &val) && major == CBOR_SIMPLE && val == CBOR_FALSE) {
+        cbor_head(c, &major, &val);
+        complete = 0;
+        items--;
+    }
+
+    /* id and raw, then counts that differ from the number of records */
+    while (have_head < 2 && items && !cbor_peek(c, &major, &val) && major == CBOR_UINT) {
+        cbor_head(c, &major, &(head[have_head++]));
+        items--;
+    }
+    if (complete && have_head != 2) {
+        return CDS_DECODE_EFORMAT;
+    }
+    if (items && !cbor_peek(c, &major, &val) && major == CBOR_NINT) {
+        cbor_head(c, &major, &cnt_bits);
+        have_cnt_bits = 1;
+        items--;
+    }
+    for (n = 0; n < 4; n++) {
+        if (have_cnt_bits ? cnt_bits & (1 << n) : items && !cbor_peek(c, &major, &val) && major == CBOR_UINT) {
+            if (!items-- || decode_uint(c, CBOR_UINT, &(count[n])) != CDS_DECODE_OK) {
+                return CDS_DECODE_EFORMAT;
+            }
+            cnt_bits |= 1 << n;
+        }
+    }
+    for (n = 0; n < have_head; n++) {
+        if (head[n] > 0xffff || (ret = wire_u16(d, head[n])) != CDS_DECODE_OK) {
+            return head[n] > 0xffff ? CDS_DECODE_EFORMAT : ret;
+        }
+    }
+
+    count_pos = d->wire_len;
+    if (complete) {
+        top = 4;
+        for (n = 0; n < 4; n++) {
+            if ((ret = wire_u16(d, 0)) != CDS_DECODE_OK) {
+                return ret;
+            }
+        }
+    }
+    else {
+        /* the counts read before the header was cut short */
+        for (top = 4; top > 0 && !(cnt_bits & (1 << (top - 1))); top--);
+        for (n = 0; n < top; n++) {
+            if (count[n] > 0xffff || (ret = wire_u16(d, count[n])) != CDS_DECODE_OK) {
+                return count[n] > 0xffff ? CDS_DECODE_EFORMAT : ret;
+            }
+        }
+    }
+
+    /* sections given by bits or all or none */
+    if (items && !cbor_peek(c, &major, &val) && major == CBOR_SIMPLE && val < 0xf) {
+        cbor_head(c, &major, &rr_bits);
+        items--;
+    }
+    else {
+        rr_bits = (items && !cbor_peek(c, &major, &val) && major == CBOR_ARRAY) ? 0xf : 0;
+    }
+    for (n = 0; n < 4; n++) {
+        if (rr_bits & (1 << n)) {
+            if (!items--) {
+                return CDS_DECODE_EFORMAT;
+            }
+            ret = n ? decode_rrs(d, c, &(rrs[n])) : decode_questions(d, c, &(rrs[n]));
+            if (ret != CDS_DECODE_OK) {
+                return ret;
+            }
+        }
+    }
+
+    /* what could not be parsed */
+    if (items) {
+        if (items > 1 || cbor_head(c, &major, &val) || major != CBOR_BYTES
+            || (uint64_t)(c->end - c->p) < val)
+        {
+            return CDS_DECODE_EFORMAT;
+        }
+        if ((ret = wire_put(d, c->p, val)) != CDS_DECODE_OK) {
+            return ret;
+        }
+        c->p += val;
+    }
+
+    if (complete) {
+        for (n = 0; n < 4; n++) {
+            if (!(cnt_bits & (1 << n))) {
+                count[n] = rrs[n];
+            }
+            if (count[n] > 0xffff) {
+                return CDS_DECODE_EFORMAT;
+            }
+            if (slim_counts && n) {
+                slim_counts[n - 1] = count[n];
+                count[n] = rrs[n];
+            }
+            wire_set16(d, count_pos + n * 2, count[n]);
+        }
+    }
+
+    return CDS_DECODE_OK;
+}
+
+static int decode_message(cds_decoder_t* d, struct cbor* c, uint64_t items, cds_message_t* message) {
+    struct cds_last_ip* last;
+    uint64_t val, bits;
+    int major, reverse = 0, ret;
+    size_t alen;
+
+    memset(message, 0, sizeof(*message));
+
+    /* timestamp, relative to the last if the seconds are negative */
+    if (decode_uint(c, CBOR_ARRAY, &val) != CDS_DECODE_OK || val != 2
+        || cbor_head(c, &major, &val) || (major != CBOR_UINT && major != CBOR_NINT))
+    {
+        return CDS_DECODE_EFORMAT;
+    }
+    if (major == CBOR_NINT) {
+        message->sec = d->last.sec + val;
+        if (cbor_head(c, &major, &val) || (major != CBOR_UINT && major != CBOR_NINT)) {
+            return CDS_DECODE_EFORMAT;
+        }
+        message->usec = major == CBOR_UINT ? d->last.usec + val : d->last.usec - 1 - val;
+    }
+    else {
+        message->sec = val;
+        if (decode_uint(c, CBOR_UINT, &val) != CDS_DECODE_OK) {
+            return CDS_DECODE_EFORMAT;
+        }
+        message->usec = val;
+    }
+    d->last.sec = message->sec;
+    d->last.usec = message->usec;
+
+    if (decode_uint(c, CBOR_UINT, &val) != CDS_DECODE_OK) {
+        return CDS_DECODE_EFORMAT;
+    }
+    message->bits = val;
+
+    /* ip header, missing parts are the same as the last or its reverse */
+    if (cbor_head(c, &major, &bits) || (major != CBOR_UINT && major != CBOR_NINT)) {
+        return CDS_DECODE_EFORMAT;
+    }
+    reverse = major == CBOR_NINT;
+    message->is_v6 = bits & 1;
+    alen = message->is_v6 ? 16 : 4;
+    last = message->is_v6 ? &(d->last.ip6) : &(d->last.ip4);
+    if (reverse) {
+        memcpy(message->src_addr, last->dest_addr, alen);
+        memcpy(message->dest_addr, last->src_addr, alen);
+        message->src_port = last->dest_port;
+        message->dest_port = last->src_port;
+    }
+    else {
+        memcpy(message->src_addr, last->src_addr, alen);
+        memcpy(message->dest_addr, last->dest_addr, alen);
+        message->src_port = last->src_port;
+        message->dest_port = last->dest_port;
+    }
+    if (items < (uint64_t)(3 + !!(bits & 2) + !!(bits & 4) + !!(bits & 8))) {
+        return CDS_DECODE_EFORMAT;
+    }
+    items -= 3;
+    if (bits & 2) {
+        if (cbor_head(c, &major, &val) || major != CBOR_BYTES || val != alen || (size_t)(c->end - c->p) < alen) {
+            return CDS_DECODE_EFORMAT;
+        }
+        memcpy(message->src_addr, c->p, alen);
+        c->p += alen;
+        items--;
+    }
+    if (bits & 4) {
+        if (cbor_head(c, &major, &val) || major != CBOR_BYTES || val != alen || (size_t)(c->end - c->p) < alen) {
+            return CDS_DECODE_EFORMAT;
+        }
+        memcpy(message->dest_addr, c->p, alen);
+        c->p += alen;
+        items--;
+    }
+    if (bits & 8) {
+        if (cbor_head(c, &major, &val) || val > 0xffffffff) {
+            return CDS_DECODE_EFORMAT;
+        }
+        if (major == CBOR_NINT) {
+            message->dest_port = val;
+        }
+        else if (major != CBOR_UINT) {
+            return CDS_DECODE_EFORMAT;
+        }
+        else if (val > 0xffff) {
+            message->dest_port = val >> 16;
+            message->src_port = val & 0xffff;
+        }
+        else {
+            message->src_port = val;
+        }
+        items--;
+    }
+    memcpy(last->src_addr, message->src_addr, alen);
+    memcpy(last->dest_addr, message->dest_addr, alen);
+    last->src_port = message->src_port;
+    last->dest_port = message->dest_port;
+
+    if (message->bits & CDS_MESSAGE_ISDNS) {
+        /* a slimmed response ends with the length of the original */
+        if ((message->bits & CDS_MESSAGE_SLIM) && !items--) {
+            return CDS_DECODE_EFORMAT;
+        }
+        if ((ret = decode_dns(d, c, items, message->bits & CDS_MESSAGE_SLIM ? message->slim_counts : 0)) != CDS_DECODE_OK) {
+            return ret;
+        }
+        if ((message->bits & CDS_MESSAGE_SLIM) && decode_uint(c, CBOR_UINT, &val) != CDS_DECODE_OK) {
+            return CDS_DECODE_EFORMAT;
+        }
+        message->payload = d->wire;
+        message->payload_len = d->wire_len;
+        message->slim_len = message->bits & CDS_MESSAGE_SLIM ? val : 0;
+    }
+    else if (items) {
+        return CDS_DECODE_EFORMAT;
+    }
+
+    return CDS_DECODE_OK;
+}
+
+/*
+ * A new stream header resets all state and sets the options of the
+ * stream.
+ */
+/*
+ * Dictionaries
+ */
+
+#define CDS_DICT_MAGIC      "CDSDICTv1"
+#define CDS_DICT_MAGIC_LEN  9
+
+struct cds_dict_item {
+    size_t wire;
+    size_t wire_len;
+    size_t cbor;
+    size_t cbor_len;
+    size_t labels;
+    size_t label_bytes;
+};
+
+struct cds_dict {
+    uint8_t* data;
+    size_t data_size;
+    size_t data_len;
+    struct cds_dict_item* name;
+    size_t name_size;
+    size_t names;
+    struct cds_dict_item* rdata;
+    size_t rdata_size;
+    size_t rdatas;
+    uint64_t hash;
+};
+
+/* FNV-1a, the stream initiator refers to the dictionary by this hash. */
+static uint64_t dict_hash(const uint8_t* p, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    while (len--) {
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int put_head(uint8_t** buf, size_t* size, size_t* len, int major, uint64_t val) {
+    uint8_t head[9];
+    size_t n = 0, i;
+    int ret;
+
+    if (val < 24) {
+        head[n++] = (major << 5) | val;
+    }
+    else {
+        i = val <= 0xff ? 1 : val <= 0xffff ? 2 : val <= 0xffffffffULL ? 4 : 8;
+        head[n++] = (major << 5) | (i == 1 ? 24 : i == 2 ? 25 : i == 4 ? 26 : 27);
+        while (i--) {
+            head[n++] = (uint8_t)(val >> (i * 8));
+        }
+    }
+    if ((ret = need_size(*buf, *size, *len + n)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    memcpy(*buf + *len, head, n);
+    *len += n;
+
+    return CDS_DECODE_OK;
+}
+
+static int put_bytes(uint8_t** buf, size_t* size, size_t* len, const uint8_t* data, size_t data_len) {
+    int ret;
+
+    if ((ret = need_size(*buf, *size, *len + data_len)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    memcpy(*buf + *len, data, data_len);
+    *len += data_len;
+
+    return CDS_DECODE_OK;
+}
+
+cds_dict_t* cds_dict_new(void) {
+    return calloc(1, sizeof(cds_dict_t));
+}
+
+void cds_dict_free(cds_dict_t* dict) {
+    if (!dict) {
+        return;
+    }
+    free(dict->data);
+    free(dict->name);
+    free(dict->rdata);
+    free(dict);
+}
+
+/*
+ * Add an uncompressed name in wire format, it is also kept as the label
+ * array the stream would have for it.
+ */
+int cds_dict_add_name(cds_dict_t* dict, const uint8_t* name, size_t len) {
+    struct cds_dict_item* item;
+    size_t n, labels = 0, label_bytes = 0;
+    int ret;
+
+    if (!dict || !name || !len || len > 255) {
+        return CDS_DECODE_EINVAL;
+    }
+    for (n = 0; name[n]; n += 1 + name[n]) {
+        if (name[n] > 63 || n + 1 + name[n] >= len) {
+            return CDS_DECODE_EINVAL;
+        }
+        labels++;
+        label_bytes += name[n];
+    }
+    if (n + 1 != len) {
+        return CDS_DECODE_EINVAL;
+    }
+    if ((ret = need_size(dict->name, dict->name_size, dict->names + 1)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    item = &(dict->name[dict->names]);
+    item->wire = dict->data_len;
+    item->wire_len = len;
+    item->labels = labels;
+    item->label_bytes = label_bytes;
+    if ((ret = put_bytes(&(dict->data), &(dict->data_size), &(dict->data_len), name, len)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    item->cbor = dict->data_len;
+    if ((ret = put_head(&(dict->data), &(dict->data_size), &(dict->data_len), CBOR_ARRAY, labels)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    for (n = 0; name[n]; n += 1 + name[n]) {
+        if ((ret = put_head(&(dict->data), &(dict->data_size), &(dict->data_len), CBOR_TEXT, name[n])) != CDS_DECODE_OK
+            || (ret = put_bytes(&(dict->data), &(dict->data_size), &(dict->data_len), &name[n + 1], name[n])) != CDS_DECODE_OK)
+        {
+            return ret;
+        }
+    }
+    item->cbor_len = dict->data_len - item->cbor;
+    dict->names++;
+
+    return CDS_DECODE_OK;
+}
+
+int cds_dict_add_rdata(cds_dict_t* dict, const uint8_t* rdata, size_t len) {
+    struct cds_dict_item* item;
+    int ret;
+
+    if (!dict || (!rdata && len) || len > 0xffff) {
+        return CDS_DECODE_EINVAL;
+    }
+    if ((ret = need_size(dict->rdata, dict->rdata_size, dict->rdatas + 1)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    item = &(dict->rdata[dict->rdatas]);
+    memset(item, 0, sizeof(*item));
+    item->wire = dict->data_len;
+    item->wire_len = len;
+    if ((ret = put_bytes(&(dict->data), &(dict->data_size), &(dict->data_len), rdata, len)) != CDS_DECODE_OK) {
+        return ret;
+    }
+    dict->rdatas++;
+
+    return CDS_DECODE_OK;
+}
+
+static int dict_parse(cds_dict_t* dict, const uint8_t* buf, size_t len) {
+    struct cbor c;
+    uint8_t name[256];
+    uint64_t items, n, labels, val;
+    size_t name_len;
+    int major;
+
+    c.p = buf;
+    c.end = buf + len;
+    if (decode_uint(&c, CBOR_ARRAY, &items) != CDS_DECODE_OK || items != 3
+        || decode_uint(&c, CBOR_TEXT, &val) != CDS_DECODE_OK || val != CDS_DICT_MAGIC_LEN
+        || (size_t)(c.end - c.p) < CDS_DICT_MAGIC_LEN || memcmp(c.p, CDS_DICT_MAGIC, CDS_DICT_MAGIC_LEN))
+    {
+        return CDS_DECODE_EFORMAT;
+    }
+    c.p += CDS_DICT_MAGIC_LEN;
+
+    if (decode_uint(&c, CBOR_ARRAY, &items) != CDS_DECODE_OK || items > len) {
+        return CDS_DECODE_EFORMAT;
+    }
+    for (n = 0; n < items; n++) {
+        if (decode_uint(&c, CBOR_ARRAY, &labels) != CDS_DECODE_OK || labels > 127) {
+            return CDS_DECODE_EFORMAT;
+        }
+        for (name_len = 0; labels--;) {
+            if (decode_uint(&c, CBOR_TEXT, &val) != CDS_DECODE_OK || !val || val > 63
+                || (uint64_t)(c.end - c.p) < val || name_len + 1 + val >= sizeof(name))
+            {
+                return CDS_DECODE_EFORMAT;
+            }
+            name[name_len++] = (uint8_t)val;
+            memcpy(&name[name_len], c.p, val);
+            name_len += val;
+            c.p += val;
+        }
+        name[name_len++] = 0;
+        if (cds_dict_add_name(dict, name, name_len) != CDS_DECODE_OK) {
+            return CDS_DECODE_EFORMAT;
+        }
+    }
+
+    if (decode_uint(&c, CBOR_ARRAY, &items) != CDS_DECODE_OK || items > len) {
+        return CDS_DECODE_EFORMAT;
+    }
+    for (n = 0; n < items; n++) {
+        if (cbor_head(&c, &major, &val) || major != CBOR_BYTES || (uint64_t)(c.end - c.p) < val
+            || cds_dict_add_rdata(dict, c.p, val) != CDS_DECODE_OK)
+        {
+            return CDS_DECODE_EFORMAT;
+        }
+        c.p += val;
+    }
+
+    return c.p == c.end ? CDS_DECODE_OK : CDS_DECODE_EFORMAT;
+}
+
+int cds_dict_load(FILE* fp, cds_dict_t** dict) {
+    uint8_t* buf = 0;
+    size_t size = 0, len = 0, n;
+    int ret = CDS_DECODE_OK;
+
+    if (!fp || !dict) {
+        return CDS_DECODE_EINVAL;
+    }
+    if (!(*dict = cds_dict_new())) {
+        return CDS_DECODE_ENOMEM;
+    }
+    do {
+        if ((ret = need_size(buf, size, len + CDS_READ_SIZE)) != CDS_DECODE_OK) {
+            break;
+        }
+        n = fread(&buf[len], 1, size - len, fp);
+        len += n;
+    } while (n);
+    if (ret == CDS_DECODE_OK && ferror(fp)) {
+        ret = CDS_DECODE_EREAD;
+    }
+    if (ret == CDS_DECODE_OK && (ret = dict_parse(*dict, buf, len)) == CDS_DECODE_OK) {
+        (*dict)->hash = dict_hash(buf, len);
+    }
+    free(buf);
+    if (ret != CDS_DECODE_OK) {
+        cds_dict_free(*dict);
+        *dict = 0;
+    }
+
+    return ret;
+}
+
+/*
+ * Write the dictionary, entries are put in the indexes in the order they
+ * were added so the most used should be added last.
+ */
+int cds_dict_write(cds_dict_t* dict, FILE* fp) {
+    uint8_t* buf = 0;
+    size_t size = 0, len = 0, n;
+    int ret;
+
+    if (!dict || !fp) {
+        return CDS_DECODE_EINVAL;
+    }
+    ret = put_head(&buf, &size, &len, CBOR_ARRAY, 3);
+    if (ret == CDS_DECODE_OK) ret = put_head(&buf, &size, &len, CBOR_TEXT, CDS_DICT_MAGIC_LEN);
+    if (ret == CDS_DECODE_OK) ret = put_bytes(&buf, &size, &len, (const uint8_t*)CDS_DICT_MAGIC, CDS_DICT_MAGIC_LEN);
+    if (ret == CDS_DECODE_OK) ret = put_head(&buf, &size, &len, CBOR_ARRAY, dict->names);
+    for (n = 0; ret == CDS_DECODE_OK && n < dict->names; n++) {
+        ret = put_bytes(&buf, &size, &len, &(dict->data[dict->name[n].cbor]), dict->name[n].cbor_len);
+    }
+    if (ret == CDS_DECODE_OK) ret = put_head(&buf, &size, &len, CBOR_ARRAY, dict->rdatas);
+    for (n = 0; ret == CDS_DECODE_OK && n < dict->rdatas; n++) {
+        ret = put_head(&buf, &size, &len, CBOR_BYTES, dict->rdata[n].wire_len);
+        if (ret == CDS_DECODE_OK) ret = put_bytes(&buf, &size, &len, &(dict->data[dict->rdata[n].wire]), dict->rdata[n].wire_len);
+    }
+    if (ret == CDS_DECODE_OK) {
+        dict->hash = dict_hash(buf, len);
+        if (len && fwrite(buf, len, 1, fp) != 1) {
+            ret = CDS_DECODE_EWRITE;
+        }
+    }
+    free(buf);
+
+    return ret;
+}
+
+size_t cds_dict_names(const cds_dict_t* dict) {
+    return dict ? dict->names : 0;
+}
+
+const uint8_t* cds_dict_name(const cds_dict_t* dict, size_t n, size_t* len) {
+    if (!dict || n >= dict->names || !len) {
+        return 0;
+    }
+    *len = dict->name[n].wire_len;
+    return &(dict->data[dict->name[n].wire]);
+}
+
+size_t cds_dict_rdatas(const cds_dict_t* dict) {
+    return dict ? dict->rdatas : 0;
+}
+
+const uint8_t* cds_dict_rdata(const cds_dict_t* dict, size_t n, size_t* len) {
+    if (!dict || n >= dict->rdatas || !len) {
+        return 0;
+    }
+    *len = dict->rdata[n].wire_len;
+    return &(dict->data[dict->rdata[n].wire]);
+}
+
+uint64_t cds_dict_hash(const cds_dict_t* dict) {
+    return dict ? dict->hash : 0;
+}
+
+/*
+ * Put the dictionary in the indexes the same way the encoder does, names
+ * that could not be in the reverse label index are left out.
+ */
+static int dict_seed(cds_decoder_t* d) {
+    const struct cds_dict_item* item;
+    size_t n;
+    int ret;
+
+    for (n = 0; n < d->dict->names; n++) {
+        item = &(d->dict->name[n]);
+        if (item->labels + 1 > 255 || item->label_bytes < d->min_rlabel_size) {
+            continue;
+        }
+        if ((ret = mru_add(&(d->rlabels), &(d->dict->data[item->cbor]), item->cbor_len)) != CDS_DECODE_OK) {
+            return ret;
+        }
+    }
+    for (n = 0; n < d->dict->rdatas; n++) {
+        item = &(d->dict->rdata[n]);
+        if (d->use_rdata_index) {
+            ret = rdata_add(d, &(d->dict->data[item->wire]), item->wire_len);
+        }
+        else if (!d->use_rdata_rindex) {
+            break;
+        }
+        else if (item->wire_len >= d->rdata_rindex_min_size) {
+            ret = mru_add(&(d->rdatas), &(d->dict->data[item->wire]), item->wire_len);
+        }
+        else {
+            continue;
+        }
+        if (ret != CDS_DECODE_OK) {
+            return ret;
+        }
+    }
+
+    return CDS_DECODE_OK;
+}
+
+static int decode_stream_init(cds_decoder_t* d, struct cbor* c, uint64_t items) {
+    uint64_t option, val, hash = 0;
+    int major, ret, use_dict = 0;
+
+    if (cbor_head(c, &major, &val) || major != CBOR_TEXT || val != 5
+        || (size_t)(c->end - c->p) < 5 || memcmp(c->p, "CDSv1", 5))
+    {
+        return CDS_DECODE_EFORMAT;
+    }
+    c->p += 5;
+    items--;
+
+    mru_free(&(d->rlabels));
+    mru_free(&(d->rdatas));
+    rdata_reset(d);
+    memset(&(d->last), 0, sizeof(d->last));
+
+    d->max_rlabels = CDS_DEFAULT_MAX_RLABELS;
+    d->min_rlabel_size = CDS_DEFAULT_MIN_RLABEL_SIZE;
+    d->use_rdata_index = 0;
+    d->use_rdata_rindex = 0;
+    d->rdata_index_min_size = CDS_DEFAULT_RDATA_INDEX_MIN_SIZE;
+    d->rdata_rindex_size = CDS_DEFAULT_RDATA_RINDEX_SIZE;
+    d->rdata_rindex_min_size = CDS_DEFAULT_RDATA_RINDEX_MIN_SIZE;
+
+    while (items--) {
+        if (decode_uint(c, CBOR_UINT, &option) != CDS_DECODE_OK) {
+            return CDS_DECODE_EFORMAT;
+        }
+        if (option == CDS_OPTION_USE_RDATA_INDEX) {
+            d->use_rdata_index = 1;
+            continue;
+        }
+        if (!items-- || decode_uint(c, CBOR_UINT, &val) != CDS_DECODE_OK) {
+            return CDS_DECODE_EFORMAT;
+        }
+        switch (option) {
+        case CDS_OPTION_RLABELS:
+            d->max_rlabels = val;
+            break;
+        case CDS_OPTION_RLABEL_MIN_SIZE:
+            d->min_rlabel_size = val;
+            break;
+        case CDS_OPTION_RDATA_RINDEX_SIZE:
+            d->use_rdata_rindex = 1;
+            d->rdata_rindex_size = val;
+            break;
+        case CDS_OPTION_RDATA_RINDEX_MIN_SIZE:
+            d->rdata_rindex_min_size = val;
+            break;
+        case CDS_OPTION_RDATA_INDEX_MIN_SIZE:
+            d->rdata_index_min_size = val;
+            break;
+        case CDS_OPTION_RDATA_INDEX_SIZE:
+            /* the encoder announces what it evicts */
+            break;
+        case CDS_OPTION_DICTIONARY:
+            use_dict = 1;
+            hash = val;
+            break;
+        default:
+            return CDS_DECODE_EFORMAT;
+        }
+    }
+    if (d->max_rlabels > CBOR_MAX_ITEMS || d->rdata_rindex_size > CBOR_MAX_ITEMS) {
+        return CDS_DECODE_EFORMAT;
+    }
+
+    if ((ret = mru_init(&(d->rlabels), d->max_rlabels)) != CDS_DECODE_OK
+        || (ret = mru_init(&(d->rdatas), d->rdata_rindex_size)) != CDS_DECODE_OK)
+    {
+        return ret;
+    }
+    if (use_dict) {
+        if (!d->dict || d->dict->hash != hash) {
+            return CDS_DECODE_EDICT;
+        }
+        if ((ret = dict_seed(d)) != CDS_DECODE_OK) {
+            return ret;
+        }
+    }
+    d->have_stream = 1;
+    d->stats.streams++;
+
+    return CDS_DECODE_OK;
+}
+
+static int decode_stream_control(cds_decoder_t* d, struct cbor* c, uint64_t items) {
+    uint64_t control, evicted, idx;
+    int ret;
+
+    if (items != 2 || decode_uint(c, CBOR_UINT, &control) != CDS_DECODE_OK) {
+        return CDS_DECODE_EFORMAT;
+    }
+    switch (control) {
+    case CDS_CONTROL_RDATA_INDEX_EVICT:
+        if (!d->have_stream || decode_uint(c, CBOR_ARRAY, &evicted) != CDS_DECODE_OK) {
+            return CDS_DECODE_EFORMAT;
+        }
+        while (evicted--) {
+            if (decode_uint(c, CBOR_UINT, &idx) != CDS_DECODE_OK) {
+                return CDS_DECODE_EFORMAT;
+            }
+            if ((ret = rdata_evict(d, idx)) != CDS_DECODE_OK) {
+                return ret;
+            }
+        }
+        break;
+    case CDS_CONTROL_INDEX:
+    case CDS_CONTROL_INDEX_FOOTER:
+        /* only used to seek, see cds_decoder_seek() */
+        c->p = c->end;
+        break;
+    default:
+        return CDS_DECODE_EFORMAT;
+    }
+    d->stats.controls++;
+
+    return CDS_DECODE_OK;
+}
+
+/*
+ * Get the next complete element of the stream into the buffer.
+ */
+static int read_element(cds_decoder_t* d, struct cbor* c) {
+    size_t size;
+    int ret;
+
+    while (1) {
+        ret = 1;
+        if (d->buf_pos < d->buf_len) {
+            ret = cbor_size(&(d->buf[d->buf_pos]), &(d->buf[d->buf_len]), &size);
+        }
+        if (!ret) {
+            c->p = &(d->buf[d->buf_pos]);
+            c->end = c->p + size;
+            d->buf_pos += size;
+            d->stats.bytes += size;
+            return CDS_DECODE_OK;
+        }
+        if (ret < 0) {
+            return CDS_DECODE_EFORMAT;
+        }
+        if (d->eof) {
+            return d->buf_pos < d->buf_len ? CDS_DECODE_EFORMAT : CDS_DECODE_END;
+        }
+
+        if (d->buf_pos) {
+            memmove(d->buf, &(d->buf[d->buf_pos]), d->buf_len - d->buf_pos);
+            d->buf_len -= d->buf_pos;
+            d->buf_pos = 0;
+        }
+        if ((ret = need_size(d->buf, d->buf_size, d->buf_len + CDS_READ_SIZE)) != CDS_DECODE_OK) {
+            return ret;
+        }
+        size = d->buf_size - d->buf_len;
+        if (d->limited && d->remaining < size) {
+            size = d->remaining;
+        }
+        size = fread(&(d->buf[d->buf_len]), 1, size, d->fp);
+        d->buf_len += size;
+        d->remaining -= size;
+        if (!size) {
+            if (ferror(d->fp)) {
+                return CDS_DECODE_EREAD;
+            }
+            d->eof = 1;
+        }
+    }
+}
+
+/*
+ * File index
+ */
+
+struct cds_index_point {
+    uint64_t offset;
+    uint64_t earliest;
+    uint64_t latest;
+};
+
+static int index_read(cds_decoder_t* d, uint64_t offset, uint8_t* buf, size_t len) {
+    if (d->borrowed) {
+        memcpy(buf, &(d->buf[offset]), len);
+        return CDS_DECODE_OK;
+    }
+    if (fseeko(d->fp, (off_t)offset, SEEK_SET) || fread(buf, 1, len, d->fp) != len) {
+        return CDS_DECODE_EREAD;
+    }
+    return CDS_DECODE_OK;
+}
+
+/*
+ * Load the index the footer points at, returns CDS_DECODE_END if there is
+ * no footer or the input can not seek.
+ */
+static int index_load(cds_decoder_t* d, struct cds_index_point** points, size_t* num, uint64_t* index_offset) {
+    uint8_t footer[CDS_INDEX_FOOTER_SIZE];
+    uint8_t* buf;
+    struct cbor c;
+    uint64_t size, offset, items, val[6];
+    off_t end;
+    size_t len;
+    int i, ret;
+
+    if (d->borrowed) {
+        size = d->buf_len;
+    }
+    else if (fseeko(d->fp, 0, SEEK_END) || (end = ftello(d->fp)) < 0) {
+        clearerr(d->fp);
+        return CDS_DECODE_END;
+    }
+    else {
+        size = (uint64_t)end;
+    }
+    if (size < CDS_INDEX_FOOTER_SIZE) {
+        return CDS_DECODE_END;
+    }
+    if ((ret = index_read(d, size - CDS_INDEX_FOOTER_SIZE, footer, sizeof(footer))) != CDS_DECODE_OK) {
+        return ret;
+    }
+    if (footer[0] != 0x82 || footer[1] != CDS_CONTROL_INDEX_FOOTER || footer[2] != 0x1b) {
+        return CDS_DECODE_END;
+    }
+    for (offset = 0, i = 3; i < CDS_INDEX_FOOTER_SIZE; i++) {
+        offset = (offset << 8) | footer[i];
+    }
+    if (offset >= size - CDS_INDEX_FOOTER_SIZE) {
+        return CDS_DECODE_EFORMAT;
+    }
+
+    len = size - CDS_INDEX_FOOTER_SIZE - offset;
+    if (!(buf = malloc(len))) {
+        return CDS_DECODE_ENOMEM;
+    }
+    if ((ret = index_read(d, offset, buf, len)) != CDS_DECODE_OK) {
+        free(buf);
+        return ret;
+    }
+    c.p = buf;
+    c.end = buf + len;
+    *points = 0;
+    *num = 0;
+    ret = CDS_DECODE_EFORMAT;
+    if (decode_uint(&c, CBOR_ARRAY, &items) != CDS_DECODE_OK || items != 2
+        || decode_uint(&c, CBOR_UINT, &val[0]) != CDS_DECODE_OK || val[0] != CDS_CONTROL_INDEX
+        || decode_uint(&c, CBOR_ARRAY, &items) != CDS_DECODE_OK || items > len)
+    {
+        goto done;
+    }
+    if (!(*points = malloc((items ? items : 1) * sizeof(**points)))) {
+        ret = CDS_DECODE_ENOMEM;
+        goto done;
+    }
+    for (; *num < items; (*num)++) {
+        if (decode_uint(&c, CBOR_ARRAY, &val[0]) != CDS_DECODE_OK || val[0] != 6) {
+            goto done;
+        }
+        for (i = 0; i < 6; i++) {
+            if (decode_uint(&c, CBOR_UINT, &val[i]) != CDS_DECODE_OK) {
+                goto done;
+            }
+        }
+        if (val[0] >= offset || (*num && val[0] < (*points)[*num - 1].offset)) {
+            goto done;
+        }
+        (*points)[*num].offset = val[0];
+        (*points)[*num].earliest = val[1];
+        (*points)[*num].latest = val[3];
+    }
+    *index_offset = offset;
+    ret = CDS_DECODE_OK;
+
+done:
+    free(buf);
+    if (ret != CDS_DECODE_OK) {
+        free(*points);
+        *points = 0;
+    }
+    return ret;
+}
+
+/*
+ * Position the decoder at the first index point that can have messages
+ * from the start of the range and end the input at the first point after
+ * that only has messages from its end.  Capture times can go back so the
+ * latest time is carried forward and the earliest backward, making both
+ * ordered for the binary searches.
+ */
+static int index_seek(cds_decoder_t* d) {
+    struct cds_index_point* points;
+    size_t num, n, lo, hi, first, last;
+    uint64_t index_offset, start, end;
+    int ret;
+
+    if ((ret = index_load(d, &points, &num, &index_offset)) != CDS_DECODE_OK) {
+        if (ret == CDS_DECODE_END && !d->borrowed && fseeko(d->fp, 0, SEEK_SET)) {
+            clearerr(d->fp);
+        }
+        return ret == CDS_DECODE_END ? CDS_DECODE_OK : ret;
+    }
+    for (n = 1; n < num; n++) {
+        if (points[n].latest < points[n - 1].latest) {
+            points[n].latest = points[n - 1].latest;
+        }
+    }
+    for (n = num; n-- > 1;) {
+        if (points[n - 1].earliest > points[n].earliest) {
+            points[n - 1].earliest = points[n].earliest;
+        }
+    }
+
+    for (lo = 0, hi = num; lo < hi;) {
+        n = lo + (hi - lo) / 2;
+        if (points[n].latest < d->from) {
+            lo = n + 1;
+        }
+        else {
+            hi = n;
+        }
+    }
+    first = lo;
+    last = num;
+    if (d->to) {
+        for (lo = first, hi = num; lo < hi;) {
+            n = lo + (hi - lo) / 2;
+            if (points[n].earliest < d->to) {
+                lo = n + 1;
+            }
+            else {
+                hi = n;
+            }
+        }
+        last = lo;
+    }
+    start = first < num ? points[first].offset : index_offset;
+    end = last < num ? points[last].offset : index_offset;
+    free(points);
+
+    if (d->borrowed) {
+        d->buf_pos = start;
+        d->buf_len = end;
+        return CDS_DECODE_OK;
+    }
+    if (fseeko(d->fp, (off_t)start, SEEK_SET)) {
+        return CDS_DECODE_EREAD;
+    }
+    d->buf_len = 0;
+    d->buf_pos = 0;
+    d->eof = 0;
+    d->limited = 1;
+    d->remaining = end - start;
+
+    return CDS_DECODE_OK;
+}
+
+/*
+ * API
+ */
+
+cds_decoder_t* cds_decoder_new(FILE* fp) {
+    cds_decoder_t* d;
+
+    if (!fp) {
+        return 0;
+    }
+    if (!(d = calloc(1, sizeof(*d)))) {
+        return 0;
+    }
+    d->fp = fp;
+
+    return d;
+}
+
+/*
+ * Decode from memory, the buffer must stay valid and unchanged until the
+ * decoder is freed.
+ */
+cds_decoder_t* cds_decoder_new_buffer(const uint8_t* buf, size_t len) {
+    cds_decoder_t* d;
+
+    if (!buf && len) {
+        return 0;
+    }
+    if (!(d = calloc(1, sizeof(*d)))) {
+        return 0;
+    }
+    d->borrowed = 1;
+    d->buf = (uint8_t*)buf;
+    d->buf_size = d->buf_len = len;
+    d->eof = 1;
+
+    return d;
+}
+
+void cds_decoder_free(cds_decoder_t* decoder) {
+    if (!decoder) {
+        return;
+    }
+    mru_free(&(decoder->rlabels));
+    mru_free(&(decoder->rdatas));
+    rdata_reset(decoder);
+    free(decoder->rdata_idx);
+    free(decoder->reuse);
+    if (!decoder->borrowed) {
+        free(decoder->buf);
+    }
+    free(decoder->wire);
+    free(decoder->labels);
+    free(decoder->fixups);
+    free(decoder);
+}
+
+/*
+ * Decode the next message, stream headers and controls are handled on
+ * the way.  Returns CDS_DECODE_END at the end of the input.
+ */
+int cds_decoder_next(cds_decoder_t* decoder, cds_message_t* message) {
+    struct cbor c;
+    uint64_t items, val;
+    int major, ret;
+
+    if (!decoder || !message) {
+        return CDS_DECODE_EINVAL;
+    }
+
+    while ((ret = read_element(decoder, &c)) == CDS_DECODE_OK) {
+        if (decode_uint(&c, CBOR_ARRAY, &items) != CDS_DECODE_OK || !items
+            || cbor_peek(&c, &major, &val))
+        {
+            return CDS_DECODE_EFORMAT;
+        }
+        if (major == CBOR_TEXT) {
+            ret = decode_stream_init(decoder, &c, items);
+        }
+        else if (major == CBOR_UINT) {
+            ret = decode_stream_control(decoder, &c, items);
+        }
+        else if (!decoder->have_stream) {
+            ret = CDS_DECODE_EFORMAT;
+        }
+        else if (major == CBOR_ARRAY) {
+            if ((ret = decode_message(decoder, &c, items, message)) == CDS_DECODE_OK) {
+                decoder->reuse_ready = decoder->reuse_tail;
+                decoder->stats.messages++;
+                if (!decoder->have_range
+                    || (message->sec >= decoder->from && (!decoder->to || message->sec < decoder->to)))
+                {
+                    return CDS_DECODE_OK;
+                }
+                continue;
+            }
+        }
+        else {
+            ret = CDS_DECODE_EFORMAT;
+        }
+        if (ret != CDS_DECODE_OK) {
+            return ret;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Decode all messages calling callback for each, stops if the callback
+ * returns non-zero and returns what it returned.
+ */
+int cds_decoder_run(cds_decoder_t* decoder, cds_message_cb callback, void* ctx) {
+    cds_message_t message;
+    int ret;
+
+    if (!decoder || !callback) {
+        return CDS_DECODE_EINVAL;
+    }
+
+    while ((ret = cds_decoder_next(decoder, &message)) == CDS_DECODE_OK) {
+        if ((ret = callback(&message, ctx))) {
+            return ret;
+        }
+    }
+
+    return ret == CDS_DECODE_END ? CDS_DECODE_OK : ret;
+}
+
+/*
+ * Only return messages captured from the second from up to, but not
+ * including, the second to (0 for no end).  Files with an index are
+ * seeked to the index points covering the range, otherwise messages are
+ * filtered as they are decoded.  Must be called before decoding.
+ */
+int cds_decoder_seek(cds_decoder_t* decoder, uint64_t from, uint64_t to) {
+    if (!decoder || decoder->stats.bytes || decoder->buf_pos) {
+        return CDS_DECODE_EINVAL;
+    }
+    decoder->have_range = 1;
+    decoder->from = from;
+    decoder->to = to;
+
+    return index_seek(decoder);
+}
+
+/*
+ * Get the size of the next stream element in the buffer and whether it
+ * starts a new stream, a stream can be decoded on its own from there.
+ * Returns CDS_DECODE_END if the element does not end within the buffer.
+ */
+int cds_decode_element(const uint8_t* buf, size_t len, size_t* size, int* is_stream_init) {
+    struct cbor c;
+    uint64_t val;
+    int major, ret;
+
+    if (!buf || !size || !is_stream_init) {
+        return CDS_DECODE_EINVAL;
+    }
+    if ((ret = cbor_size(buf, buf + len, size))) {
+        return ret < 0 ? CDS_DECODE_EFORMAT : CDS_DECODE_END;
+    }
+    c.p = buf;
+    c.end = buf + *size;
+    if (cbor_head(&c, &major, &val) || major != CBOR_ARRAY || !val
+        || cbor_peek(&c, &major, &val))
+    {
+        return CDS_DECODE_EFORMAT;
+    }
+    *is_stream_init = major == CBOR_TEXT;
+
+    return CDS_DECODE_OK;
+}
+
+/*
+ * Use the dictionary for streams that refer to it, it must stay valid
+ * until the decoder is freed.
+ */
+int cds_decoder_set_dict(cds_decoder_t* decoder, const cds_dict_t* dict) {
+    if (!decoder) {
+        return CDS_DECODE_EINVAL;
+    }
+    decoder->dict = dict;
+
+    return CDS_DECODE_OK;
+}
+
+int cds_decoder_stats(cds_decoder_t* decoder, cds_decode_stats_t* stats) {
+    if (!decoder || !stats) {
+        return CDS_DECODE_EINVAL;
+    }
+    *stats = decoder->stats;
+
+    return CDS_DECODE_OK;
+}
+
+const char* cds_decoder_strerror(int err) {
+    switch (err) {
+    case CDS_DECODE_OK:
+        return "ok";
+    case CDS_DECODE_END:
+        return "end of stream";
+    case CDS_DECODE_EINVAL:
+        return "invalid argument";
+    case CDS_DECODE_ENOMEM:
+        return "out of memory";
+    case CDS_DECODE_EREAD:
+        return "read error";
+    case CDS_DECODE_EFORMAT:
+        return "invalid CDS";
+    case CDS_DECODE_EDICT:
+        return "dictionary missing or not the one used";
+    case CDS_DECODE_EWRITE:
+        return "write error";
+    }
+    return "unknown error";
+}
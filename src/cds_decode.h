@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef __dnscap_cds_decode_h
+#define __dnscap_cds_decode_h
+
+#define CDS_DECODE_OK       0
+#define CDS_DECODE_END      1
+#define CDS_DECODE_EINVAL   2
+#define CDS_DECODE_ENOMEM   3
+#define CDS_DECODE_EREAD    4
+#define CDS_DECODE_EFORMAT  5
+#define CDS_DECODE_EDICT    6
+#define CDS_DECODE_EWRITE   7
+
+#define CDS_MESSAGE_ISDNS       (1 << 0)
+#define CDS_MESSAGE_TCP         (1 << 1)
+#define CDS_MESSAGE_FRAG        (1 << 2)
+#define CDS_MESSAGE_MALFORMED   (1 << 3)
+#define CDS_MESSAGE_SLIM        (1 << 4)
+
+/*
+ * A decoded message, the DNS message is rebuilt in wire format and is
+ * only valid until the next message is decoded.  For a response slimmed
+ * by slim= the header counts the records that were kept, slim_len and
+ * slim_counts are the length and the answer, authority and additional
+ * counts of the original.
+ */
+typedef struct cds_message cds_message_t;
+struct cds_message {
+    uint64_t        sec;
+    uint32_t        usec;
+    unsigned        bits;
+    int             is_v6;
+    uint8_t         src_addr[16];
+    uint8_t         dest_addr[16];
+    uint16_t        src_port;
+    uint16_t        dest_port;
+    const uint8_t*  payload;
+    size_t          payload_len;
+    size_t          slim_len;
+    uint16_t        slim_counts[3];
+};
+
+typedef struct cds_decode_stats cds_decode_stats_t;
+struct cds_decode_stats {
+    size_t  streams;
+    size_t  messages;
+    size_t  controls;
+    size_t  bytes;
+};
+
+typedef struct cds_decoder cds_decoder_t;
+typedef int (*cds_message_cb)(const cds_message_t* message, void* ctx);
+
+/*
+ * A dictionary of names and rdata that the encoder and decoder put in the
+ * indexes at the start of every stream, names are in uncompressed wire
+ * format.
+ */
+typedef struct cds_dict cds_dict_t;
+
+cds_decoder_t* cds_decoder_new(FILE* fp);
+cds_decoder_t* cds_decoder_new_buffer(const uint8_t* buf, size_t len);
+void cds_decoder_free(cds_decoder_t* decoder);
+int cds_decoder_next(cds_decoder_t* decoder, cds_message_t* message);
+int cds_decoder_run(cds_decoder_t* decoder, cds_message_cb callback, void* ctx);
+int cds_decoder_seek(cds_decoder_t* decoder, uint64_t from, uint64_t to);
+int cds_decoder_stats(cds_decoder_t* decoder, cds_decode_stats_t* stats);
+int cds_decode_element(const uint8_t* buf, size_t len, size_t* size, int* is_stream_init);
+int cds_decoder_set_dict(cds_decoder_t* decoder, const cds_dict_t* dict);
+const char* cds_decoder_strerror(int err);
+
+cds_dict_t* cds_dict_new(void);
+void cds_dict_free(cds_dict_t* dict);
+int cds_dict_load(FILE* fp, cds_dict_t** dict);
+int cds_dict_write(cds_dict_t* dict, FILE* fp);
+int cds_dict_add_name(cds_dict_t* dict, const uint8_t* name, size_t len);
+int cds_dict_add_rdata(cds_dict_t* dict, const uint8_t* rdata, size_t len);
+size_t cds_dict_names(const cds_dict_t* dict);
+const uint8_t* cds_dict_name(const cds_dict_t* dict, size_t n, size_t* len);
+size_t cds_dict_rdatas(const cds_dict_t* dict);
+const uint8_t* cds_dict_rdata(const cds_dict_t* dict, size_t n, size_t* len);
+uint64_t cds_dict_hash(const cds_dict_t* dict);
+
+#endif /* __dnscap_cds_decode_h */
@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cds_decode.h"
+
+/*
+ * Build a dictionary for the CDS output of dnscap from the names and rdata
+ * seen most often in CDS files, or check a dictionary and the files that
+ * were written with it.
+ */
+
+static const char* progname = "cdsdict";
+static size_t max_names = 255;
+static size_t max_rdatas = 255;
+static size_t min_count = 2;
+
+/*
+ * Counted names or rdata, open addressing on an FNV-1a hash with the
+ * bytes kept in one buffer.
+ */
+
+struct count_item {
+    uint64_t    hash;
+    size_t      offset;
+    size_t      len;
+    size_t      count;
+};
+
+struct counter {
+    struct count_item*  item;
+    size_t              items;
+    size_t              size;
+    uint8_t*            data;
+    size_t              data_len;
+    size_t              data_size;
+};
+
+static struct counter names, rdatas;
+
+static void usage(const char* msg) {
+    fprintf(stderr, "%s: usage error: %s\n\n", progname, msg);
+    fprintf(stderr, "usage: %s [-c count] [-n names] [-r rdatas] -w dictionary [file ...]\n", progname);
+    fprintf(stderr, "       %s -v dictionary [file ...]\n", progname);
+    fprintf(stderr, "\t-c   only use names and rdata seen this many times (default 2)\n");
+    fprintf(stderr, "\t-n   put at most this many names in the dictionary (default 255)\n");
+    fprintf(stderr, "\t-r   put at most this many rdata in the dictionary (default 255)\n");
+    fprintf(stderr, "\t-w   write the dictionary built from the files to this file\n");
+    fprintf(stderr, "\t-v   print the dictionary and decode the files with it\n");
+    exit(1);
+}
+
+static void nomem(void) {
+    fprintf(stderr, "%s: %s\n", progname, cds_decoder_strerror(CDS_DECODE_ENOMEM));
+    exit(1);
+}
+
+static uint64_t hash(const uint8_t* p, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (len--) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void counter_grow(struct counter* c) {
+    struct count_item* old = c->item;
+    size_t n, i, size = c->size;
+
+    c->size = size ? size * 2 : 1024;
+    if (!(c->item = calloc(c->size, sizeof(*(c->item))))) {
+        nomem();
+    }
+    for (n = 0; n < size; n++) {
+        if (!old[n].count) {
+            continue;
+        }
+        for (i = old[n].hash & (c->size - 1); c->item[i].count; i = (i + 1) & (c->size - 1))
+            ;
+        c->item[i] = old[n];
+    }
+    free(old);
+}
+
+static void counter_add(struct counter* c, const uint8_t* p, size_t len) {
+    uint64_t h = hash(p, len);
+    size_t i;
+
+    if (c->items * 2 >= c->size) {
+        counter_grow(c);
+    }
+    for (i = h & (c->size - 1); c->item[i].count; i = (i + 1) & (c->size - 1)) {
+        if (c->item[i].hash == h && c->item[i].len == len
+            && !memcmp(c->data + c->item[i].offset, p, len))
+        {
+            c->item[i].count++;
+            return;
+        }
+    }
+
+    while (c->data_len + len > c->data_size) {
+        c->data_size = c->data_size ? c->data_size * 2 : 64 * 1024;
+        if (!(c->data = realloc(c->data, c->data_size))) {
+            nomem();
+        }
+    }
+    memcpy(c->data + c->data_len, p, len);
+    c->item[i].hash = h;
+    c->item[i].offset = c->data_len;
+    c->item[i].len = len;
+    c->item[i].count = 1;
+    c->data_len += len;
+    c->items++;
+}
+
+static int count_cmp(const void* a, const void* b) {
+    const struct count_item* x = a;
+    const struct count_item* y = b;
+
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    if (x->len != y->len) {
+        return x->len < y->len ? -1 : 1;
+    }
+    return x->offset < y->offset ? -1 : 1;
+}
+
+/*
+ * Sort the items seen often enough by count and add the top ones, the
+ * most used last so they get the lowest index in the stream.
+ */
+static void counter_top(struct counter* c, size_t max, cds_dict_t* dict,
+    int (*add)(cds_dict_t*, const uint8_t*, size_t))
+{
+    size_t n, top = 0;
+    int ret;
+
+    for (n = 0; n < c->size; n++) {
+        if (c->item[n].count >= min_count) {
+            c->item[top++] = c->item[n];
+        }
+    }
+    qsort(c->item, top, sizeof(*(c->item)), count_cmp);
+    if (top > max) {
+        top = max;
+    }
+    while (top--) {
+        if ((ret = add(dict, c->data + c->item[top].offset, c->item[top].len)) != CDS_DECODE_OK) {
+            fprintf(stderr, "%s: %s\n", progname, cds_decoder_strerror(ret));
+            exit(1);
+        }
+    }
+}
+
+/*
+ * Skip the name at offset, returns the offset after it or 0 if malformed.
+ * Only names without compression pointers are counted since only those
+ * are put in the label index as a whole by the encoder.
+ */
+static size_t name_count(const uint8_t* p, size_t len, size_t offset) {
+    size_t start = offset;
+
+    while (offset < len) {
+        if ((p[offset] & 0xc0) == 0xc0) {
+            return offset + 2 <= len ? offset + 2 : 0;
+        }
+        if (p[offset] & 0xc0) {
+            return 0;
+        }
+        if (!p[offset]) {
+            if (offset + 1 - start <= 255) {
+                counter_add(&names, p + start, offset + 1 - start);
+            }
+            return offset + 1;
+        }
+        offset += 1 + p[offset];
+    }
+    return 0;
+}
+
+static int count_message(const cds_message_t* message, void* ctx) {
+    const uint8_t* p = message->payload;
+    size_t len = message->payload_len, offset = 12, rr, rrs, rdlength;
+    unsigned type;
+
+    (void)ctx;
+    if (!(message->bits & CDS_MESSAGE_ISDNS) || len < 12) {
+        return 0;
+    }
+    for (rr = 0, rrs = p[4] << 8 | p[5]; rr < rrs; rr++) {
+        if (!(offset = name_count(p, len, offset)) || offset + 4 > len) {
+            return 0;
+        }
+        offset += 4;
+    }
+    rrs = (p[6] << 8 | p[7]) + (p[8] << 8 | p[9]) + (p[10] << 8 | p[11]);
+    for (rr = 0; rr < rrs; rr++) {
+        if (!(offset = name_count(p, len, offset)) || offset + 10 > len) {
+            return 0;
+        }
+        type = p[offset] << 8 | p[offset + 1];
+        rdlength = p[offset + 8] << 8 | p[offset + 9];
+        offset += 10;
+        if (offset + rdlength > len) {
+            return 0;
+        }
+        /* OPT is not put in the rdata indexes */
+        if (type != 41 && rdlength) {
+            counter_add(&rdatas, p + offset, rdlength);
+        }
+        offset += rdlength;
+    }
+    return 0;
+}
+
+static int count_written(const cds_message_t* message, void* ctx) {
+    (void)message;
+    (*(size_t*)ctx)++;
+    return 0;
+}
+
+static int decode_file(const char* file, const cds_dict_t* dict, cds_message_cb callback, void* ctx) {
+    FILE* fp;
+    cds_decoder_t* decoder;
+    int ret;
+
+    if (!strcmp(file, "-")) {
+        fp = stdin;
+    }
+    else if (!(fp = fopen(file, "r"))) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+        return 1;
+    }
+    if (!(decoder = cds_decoder_new(fp))) {
+        nomem();
+    }
+    cds_decoder_set_dict(decoder, dict);
+    if ((ret = cds_decoder_run(decoder, callback, ctx)) != CDS_DECODE_OK) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, cds_decoder_strerror(ret));
+    }
+    cds_decoder_free(decoder);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    return ret != CDS_DECODE_OK;
+}
+
+static void print_name(const uint8_t* name, size_t len) {
+    size_t n;
+
+    if (len == 1) {
+        putchar('.');
+    }
+    while (len > 1 && *name) {
+        for (n = 1; n <= *name; n++) {
+            if (name[n] == '.' || name[n] == '\\') {
+                printf("\\%c", name[n]);
+            }
+            else if (name[n] < 0x21 || name[n] > 0x7e) {
+                printf("\\%03u", name[n]);
+            }
+            else {
+                putchar(name[n]);
+            }
+        }
+        putchar('.');
+        len -= 1 + *name;
+        name += 1 + *name;
+    }
+}
+
+static int verify(const char* file, int argc, char* argv[]) {
+    FILE* fp;
+    cds_dict_t* dict;
+    const uint8_t* p;
+    size_t n, i, len, messages;
+    int ret = 0;
+
+    if (!(fp = fopen(file, "r"))) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+        return 1;
+    }
+    if ((ret = cds_dict_load(fp, &dict)) != CDS_DECODE_OK) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, cds_decoder_strerror(ret));
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+
+    printf("hash %016llx\n", (unsigned long long)cds_dict_hash(dict));
+    printf("names %lu\n", (unsigned long)cds_dict_names(dict));
+    for (n = 0; n < cds_dict_names(dict); n++) {
+        p = cds_dict_name(dict, n, &len);
+        putchar('\t');
+        print_name(p, len);
+        putchar('\n');
+    }
+    printf("rdatas %lu\n", (unsigned long)cds_dict_rdatas(dict));
+    for (n = 0; n < cds_dict_rdatas(dict); n++) {
+        p = cds_dict_rdata(dict, n, &len);
+        putchar('\t');
+        for (i = 0; i < len; i++) {
+            printf("%02x", p[i]);
+        }
+        putchar('\n');
+    }
+
+    for (n = 0; n < (size_t)argc; n++) {
+        messages = 0;
+        if (decode_file(argv[n], dict, count_written, &messages)) {
+            ret = 1;
+        }
+        else {
+            printf("%s: %lu messages\n", argv[n], (unsigned long)messages);
+        }
+    }
+    cds_dict_free(dict);
+
+    return ret;
+}
+
+static size_t parse_size(const char* arg, const char* msg) {
+    char* end;
+    unsigned long val;
+
+    errno = 0;
+    val = strtoul(arg, &end, 10);
+    if (errno || !*arg || *end) {
+        usage(msg);
+    }
+    return val;
+}
+
+int main(int argc, char* argv[]) {
+    const char* write_file = 0;
+    const char* verify_file = 0;
+    cds_dict_t* dict;
+    FILE* fp;
+    int ch, n, ret = 0;
+
+    while ((ch = getopt(argc, argv, "c:n:r:w:v:")) != EOF) {
+        switch (ch) {
+        case 'c':
+            min_count = parse_size(optarg, "-c arg must be a number");
+            break;
+        case 'n':
+            max_names = parse_size(optarg, "-n arg must be a number");
+            break;
+        case 'r':
+            max_rdatas = parse_size(optarg, "-r arg must be a number");
+            break;
+        case 'w':
+            write_file = optarg;
+            break;
+        case 'v':
+            verify_file = optarg;
+            break;
+        default:
+            usage("unrecognized command line option");
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (!write_file == !verify_file) {
+        usage("give one of -w or -v");
+    }
+    if (verify_file) {
+        return verify(verify_file, argc, argv);
+    }
+
+    if (argc) {
+        for (n = 0; n < argc; n++) {
+            ret |= decode_file(argv[n], 0, count_message, 0);
+        }
+    }
+    else {
+        ret = decode_file("-", 0, count_message, 0);
+    }
+    if (ret) {
+        return 1;
+    }
+
+    if (!(dict = cds_dict_new())) {
+        nomem();
+    }
+    counter_top(&names, max_names, dict, cds_dict_add_name);
+    counter_top(&rdatas, max_rdatas, dict, cds_dict_add_rdata);
+
+    if (!(fp = fopen(write_file, "w"))) {
+        fprintf(stderr, "%s: %s: %s\n", progname, write_file, strerror(errno));
+        return 1;
+    }
+    if ((ret = cds_dict_write(dict, fp)) != CDS_DECODE_OK || fclose(fp)) {
+        fprintf(stderr, "%s: %s: %s\n", progname, write_file,
+            cds_decoder_strerror(ret != CDS_DECODE_OK ? ret : CDS_DECODE_EWRITE));
+        return 1;
+    }
+    cds_dict_free(dict);
+
+    return 0;
+}
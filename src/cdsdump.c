@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "dnscap_common.h"
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dump_dns.h"
+#include "cds_decode.h"
+
+#ifdef __linux__
+extern char *strptime(const char *, const char *, struct tm *);
+#endif
+
+/*
+ * Print the messages of CBOR DNS Stream files in the same form as
+ * `dnscap -g` or as JSON, one object per line.
+ */
+
+static const char* progname = "cdsdump";
+static int json = 0;
+static int quiet = 0;
+static int stats = 0;
+static int have_range = 0;
+static uint64_t start_time = 0;
+static uint64_t stop_time = 0;
+static cds_dict_t* dict = 0;
+static size_t msgcount = 0;
+
+static void usage(const char* msg) {
+    fprintf(stderr, "%s: usage error: %s\n\n", progname, msg);
+    fprintf(stderr, "usage: %s [-jqs] [-B datetime] [-E datetime] [-d dictionary] [file ...]\n", progname);
+    fprintf(stderr, "\t-j   print messages as JSON, one object per line\n");
+    fprintf(stderr, "\t-q   decode only, print nothing\n");
+    fprintf(stderr, "\t-s   print decode statistics to stderr\n");
+    fprintf(stderr, "\t-B   begin with messages from this time (YYYY-MM-DD HH:MM:SS)\n");
+    fprintf(stderr, "\t-E   end before messages from this time (YYYY-MM-DD HH:MM:SS)\n");
+    fprintf(stderr, "\t-d   use this dictionary for streams that refer to one\n");
+    exit(1);
+}
+
+static cds_dict_t* load_dict(const char* file) {
+    FILE* fp;
+    cds_dict_t* d;
+    int ret;
+
+    if (!(fp = fopen(file, "r"))) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+        exit(1);
+    }
+    if ((ret = cds_dict_load(fp, &d)) != CDS_DECODE_OK) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, cds_decoder_strerror(ret));
+        exit(1);
+    }
+    fclose(fp);
+
+    return d;
+}
+
+static uint64_t parse_time(const char* arg, const char* msg) {
+    struct tm tm;
+
+    memset(&tm, 0, sizeof(tm));
+    if (!strptime(arg, "%F %T", &tm)) {
+        usage(msg);
+    }
+    return (uint64_t)timegm(&tm);
+}
+
+static const char* addr_str(const cds_message_t* message, const uint8_t* addr, char* buf, size_t size) {
+    if (!inet_ntop(message->is_v6 ? AF_INET6 : AF_INET, addr, buf, size)) {
+        snprintf(buf, size, "?");
+    }
+    return buf;
+}
+
+static void print_text(const cds_message_t* message, const char* file) {
+    char when[64], src[INET6_ADDRSTRLEN], dest[INET6_ADDRSTRLEN];
+    time_t t = (time_t)message->sec;
+
+    strftime(when, sizeof when, "%Y-%m-%d %T", gmtime(&t));
+    printf("[%lu] %s.%06lu [#%lu %s] \\\n",
+        (unsigned long)message->payload_len, when, (unsigned long)message->usec,
+        (unsigned long)msgcount, file);
+
+    addr_str(message, message->src_addr, src, sizeof src);
+    addr_str(message, message->dest_addr, dest, sizeof dest);
+    if (message->bits & CDS_MESSAGE_FRAG) {
+        printf(";: [%s] -> [%s] (frag)", src, dest);
+    }
+    else {
+        printf("\t[%s].%u [%s].%u ", src, message->src_port, dest, message->dest_port);
+        if (message->payload_len) {
+            dump_dns(message->payload, message->payload_len, stdout, "\\\n\t");
+        }
+    }
+    putchar('\n');
+}
+
+/*
+ * Print a name from the message as a JSON string, following compression
+ * pointers backwards only.
+ */
+static size_t json_name(const uint8_t* payload, size_t len, size_t offset) {
+    size_t end = 0, n, limit = offset, labels = 0;
+    uint8_t label;
+
+    putchar('"');
+    while (offset < len) {
+        label = payload[offset];
+        if ((label & 0xc0) == 0xc0) {
+            if (offset + 1 >= len) {
+                break;
+            }
+            if (!end) {
+                end = offset + 2;
+            }
+            n = ((label & 0x3f) << 8) | payload[offset + 1];
+            if (n >= limit) {
+                break;
+            }
+            offset = limit = n;
+            continue;
+        }
+        if (label & 0xc0 || offset + 1 + label > len) {
+            break;
+        }
+        if (!label) {
+            if (!end) {
+                end = offset + 1;
+            }
+            /* every label is already followed by a dot, only the root has none */
+            if (!labels) {
+                putchar('.');
+            }
+            break;
+        }
+        for (n = offset + 1; n < offset + 1 + label; n++) {
+            if (payload[n] == '"' || payload[n] == '\\' || payload[n] == '.') {
+                printf("\\\\%c", payload[n]);
+            }
+            else if (payload[n] < 0x21 || payload[n] > 0x7e) {
+                printf("\\\\%03u", payload[n]);
+            }
+            else {
+                putchar(payload[n]);
+            }
+        }
+        putchar('.');
+        labels++;
+        offset += 1 + label;
+    }
+    putchar('"');
+
+    return end;
+}
+
+static void print_json(const cds_message_t* message) {
+    char src[INET6_ADDRSTRLEN], dest[INET6_ADDRSTRLEN];
+    const uint8_t* p = message->payload;
+    size_t len = message->payload_len, end;
+
+    printf("{\"time\":%lu.%06lu,\"ip\":%d",
+        (unsigned long)message->sec, (unsigned long)message->usec,
+        message->is_v6 ? 6 : 4);
+    printf(",\"src\":\"%s\",\"dst\":\"%s\"",
+        addr_str(message, message->src_addr, src, sizeof src),
+        addr_str(message, message->dest_addr, dest, sizeof dest));
+    if (message->bits & CDS_MESSAGE_FRAG) {
+        printf(",\"frag\":true");
+    }
+    else {
+        printf(",\"sport\":%u,\"dport\":%u", message->src_port, message->dest_port);
+    }
+    if (message->bits & CDS_MESSAGE_ISDNS) {
+        printf(",\"proto\":\"%s\"", message->bits & CDS_MESSAGE_TCP ? "tcp" : "udp");
+    }
+    if (message->bits & CDS_MESSAGE_MALFORMED) {
+        printf(",\"malformed\":true");
+    }
+    if (message->bits & CDS_MESSAGE_ISDNS) {
+        printf(",\"length\":%lu", (unsigned long)len);
+    }
+    if (message->bits & CDS_MESSAGE_SLIM) {
+        printf(",\"slim\":{\"length\":%lu,\"ancount\":%u,\"nscount\":%u,\"arcount\":%u}",
+            (unsigned long)message->slim_len, message->slim_counts[0], message->slim_counts[1], message->slim_counts[2]);
+    }
+    if (len >= 12) {
+        printf(",\"dns\":{\"id\":%u,\"qr\":%u,\"opcode\":%u,\"aa\":%u,\"tc\":%u,\"rd\":%u,\"ra\":%u,\"ad\":%u,\"cd\":%u,\"rcode\":%u",
+            p[0] << 8 | p[1], p[2] >> 7, (p[2] >> 3) & 0xf, (p[2] >> 2) & 1, (p[2] >> 1) & 1, p[2] & 1,
+            p[3] >> 7, (p[3] >> 5) & 1, (p[3] >> 4) & 1, p[3] & 0xf);
+        printf(",\"qdcount\":%u,\"ancount\":%u,\"nscount\":%u,\"arcount\":%u",
+            p[4] << 8 | p[5], p[6] << 8 | p[7], p[8] << 8 | p[9], p[10] << 8 | p[11]);
+        if (p[4] << 8 | p[5] && len > 12) {
+            printf(",\"qname\":");
+            end = json_name(p, len, 12);
+            if (end && end + 4 <= len) {
+                printf(",\"qtype\":%u,\"qclass\":%u",
+                    p[end] << 8 | p[end + 1], p[end + 2] << 8 | p[end + 3]);
+            }
+        }
+        putchar('}');
+    }
+    printf("}\n");
+}
+
+static int print_message(const cds_message_t* message, void* ctx) {
+    if (json && !quiet) {
+        print_json(message);
+    }
+    else if (!quiet) {
+        print_text(message, (const char*)ctx);
+    }
+    msgcount++;
+    return 0;
+}
+
+static int dump_file(const char* file, cds_decode_stats_t* total) {
+    FILE* fp;
+    cds_decoder_t* decoder;
+    cds_decode_stats_t st;
+    int ret;
+
+    if (!strcmp(file, "-")) {
+        fp = stdin;
+    }
+    else if (!(fp = fopen(file, "r"))) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+        return 1;
+    }
+    if (!(decoder = cds_decoder_new(fp))) {
+        fprintf(stderr, "%s: %s: %s\n", progname, file, cds_decoder_strerror(CDS_DECODE_ENOMEM));
+        if (fp != stdin) {
+            fclose(fp);
+        }
+        return 1;
+    }
+
+    cds_decoder_set_dict(decoder, dict);
+    if (have_range) {
+        ret = cds_decoder_seek(decoder, start_time, stop_time);
+    }
+    else {
+        ret = CDS_DECODE_OK;
+    }
+    if (ret == CDS_DECODE_OK) {
+        ret = cds_decoder_run(decoder, print_message, (void*)file);
+    }
+    if (ret != CDS_DECODE_OK) {
+        fprintf(stderr, "%s: %s: %s after %lu messages\n", progname, file,
+            cds_decoder_strerror(ret), (unsigned long)msgcount);
+    }
+
+    cds_decoder_stats(decoder, &st);
+    total->streams += st.streams;
+    total->messages += st.messages;
+    total->controls += st.controls;
+    total->bytes += st.bytes;
+
+    cds_decoder_free(decoder);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    return ret != CDS_DECODE_OK;
+}
+
+int main(int argc, char* argv[]) {
+    cds_decode_stats_t total;
+    struct timeval start, end;
+    double seconds;
+    int ch, ret = 0;
+
+    while ((ch = getopt(argc, argv, "jqsB:E:d:")) != EOF) {
+        switch (ch) {
+        case 'j':
+            json = 1;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 's':
+            stats = 1;
+            break;
+        case 'B':
+            start_time = parse_time(optarg, "-B arg must have format YYYY-MM-DD HH:MM:SS");
+            have_range = 1;
+            break;
+        case 'E':
+            stop_time = parse_time(optarg, "-E arg must have format YYYY-MM-DD HH:MM:SS");
+            have_range = 1;
+            break;
+        case 'd':
+            dict = load_dict(optarg);
+            break;
+        default:
+            usage("unrecognized command line option");
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (stop_time && start_time >= stop_time) {
+        usage("start time must be before stop time");
+    }
+
+    memset(&total, 0, sizeof(total));
+    gettimeofday(&start, 0);
+    if (!argc) {
+        ret = dump_file("-", &total);
+    }
+    for (; argc; argc--, argv++) {
+        ret |= dump_file(*argv, &total);
+    }
+    gettimeofday(&end, 0);
+
+    if (stats) {
+        seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+        fprintf(stderr, "streams %lu controls %lu messages %lu bytes %lu\n",
+            (unsigned long)total.streams, (unsigned long)total.controls,
+            (unsigned long)total.messages, (unsigned long)total.bytes);
+        fprintf(stderr, "seconds %.3f messages/sec %.0f\n",
+            seconds, seconds > 0 ? total.messages / seconds : 0);
+    }
+
+    return ret;
+}
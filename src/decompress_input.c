@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "config.h"
+
+#if HAVE_FOPENCOOKIE
+# define _GNU_SOURCE
+#endif
+
+#include "decompress_input.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <pcap.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/*
+ * Compressed files are decoded by the same programs that compress=
+ * writes with, run with the file as standard input and their output on a
+ * pipe. The stream given to libpcap is a stdio cookie over that pipe, so
+ * pcap and pcapng files are both read as usual.
+ *
+ * Once started a thread reads the pipe into a ring as fast as the program
+ * decodes, the reader takes from the ring and only waits for the program
+ * when it has caught up with it, so decoding and parsing overlap.
+ * The ring is filled from tail and emptied from head, each side only
+ * touches its own part of it outside of the lock.
+ */
+
+static const struct {
+    u_char      magic[6];
+    size_t      length;
+    const char  *program;
+    const char  *threads;
+} decompress_formats[] = {
+    { { 0x1f, 0x8b }, 2, "gzip", 0 },
+    { { 'B', 'Z', 'h' }, 3, "bzip2", 0 },
+    { { 0xfd, '7', 'z', 'X', 'Z', 0 }, 6, "xz", "-T0" },
+    { { 0x28, 0xb5, 0x2f, 0xfd }, 4, "zstd", 0 },
+};
+
+struct decompress_input {
+    char            *name;
+    const char      *program;
+    FILE            *fp;
+    int             fd;
+    pid_t           pid;
+#if HAVE_PTHREAD
+    int             started, eof, closed, error;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  data, space;
+    u_char          *ring;
+    size_t          head, tail;
+#endif
+};
+
+const char *decompress_input_program(const char * file) {
+    u_char magic[6];
+    size_t length, i;
+    FILE *fp;
+
+    if (!file || !strcmp(file, "-") || !(fp = fopen(file, "r"))) {
+        return 0;
+    }
+    length = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+
+    for (i = 0; i < sizeof(decompress_formats) / sizeof(decompress_formats[0]); i++) {
+        if (length >= decompress_formats[i].length
+            && !memcmp(magic, decompress_formats[i].magic, decompress_formats[i].length))
+        {
+            return decompress_formats[i].program;
+        }
+    }
+    return 0;
+}
+
+#if HAVE_FOPENCOOKIE || HAVE_FUNOPEN
+static ssize_t decompress_input_pipe(decompress_input_t *input, void *buf, size_t size) {
+    ssize_t n;
+
+    while ((n = read(input->fd, buf, size)) < 0 && errno == EINTR)
+        ;
+    return n;
+}
+
+#if HAVE_PTHREAD
+static void *decompress_input_thread(void *arg) {
+    decompress_input_t *input = (decompress_input_t *)arg;
+    size_t at, size;
+    ssize_t n;
+
+    for (;;) {
+        pthread_mutex_lock(&input->lock);
+        while (!input->closed && input->tail - input->head == DECOMPRESS_INPUT_RING) {
+            pthread_cond_wait(&input->space, &input->lock);
+        }
+        if (input->closed) {
+            pthread_mutex_unlock(&input->lock);
+            break;
+        }
+        at = input->tail % DECOMPRESS_INPUT_RING;
+        size = DECOMPRESS_INPUT_RING - (input->tail - input->head);
+        if (size > DECOMPRESS_INPUT_RING - at) {
+            size = DECOMPRESS_INPUT_RING - at;
+        }
+        pthread_mutex_unlock(&input->lock);
+
+        n = decompress_input_pipe(input, input->ring + at, size);
+
+        pthread_mutex_lock(&input->lock);
+        if (n > 0) {
+            input->tail += n;
+        }
+        else {
+            input->eof = 1;
+            input->error = n < 0 ? errno : 0;
+        }
+        pthread_cond_signal(&input->data);
+        pthread_mutex_unlock(&input->lock);
+        if (n <= 0) {
+            break;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+static ssize_t decompress_input_read(void *cookie, char *buf, size_t size) {
+    decompress_input_t *input = (decompress_input_t *)cookie;
+#if HAVE_PTHREAD
+    size_t at, n;
+
+    if (input->started) {
+        pthread_mutex_lock(&input->lock);
+        while (input->head == input->tail && !input->eof) {
+            pthread_cond_wait(&input->data, &input->lock);
+        }
+        if (input->head == input->tail) {
+            pthread_mutex_unlock(&input->lock);
+            if (input->error) {
+                errno = input->error;
+                return -1;
+            }
+            return 0;
+        }
+        at = input->head % DECOMPRESS_INPUT_RING;
+        n = input->tail - input->head;
+        pthread_mutex_unlock(&input->lock);
+
+        if (n > DECOMPRESS_INPUT_RING - at) {
+            n = DECOMPRESS_INPUT_RING - at;
+        }
+        if (n > size) {
+            n = size;
+        }
+        memcpy(buf, input->ring + at, n);
+
+        pthread_mutex_lock(&input->lock);
+        input->head += n;
+        pthread_cond_signal(&input->space);
+        pthread_mutex_unlock(&input->lock);
+
+        return n;
+    }
+#endif
+
+    return decompress_input_pipe(input, buf, size);
+}
+
+static int decompress_input_close(void *cookie) {
+    decompress_input_t *input = (decompress_input_t *)cookie;
+    int status;
+
+#if HAVE_PTHREAD
+    if (input->started) {
+        pthread_mutex_lock(&input->lock);
+        input->closed = 1;
+        pthread_cond_signal(&input->space);
+        pthread_mutex_unlock(&input->lock);
+    }
+#endif
+
+    /*
+     * A program stopped before it was done is not an error, it goes away
+     * with the write end of the pipe so the thread is done reading it.
+     */
+    if (input->pid > 0) {
+        kill(input->pid, SIGTERM);
+    }
+#if HAVE_PTHREAD
+    if (input->started) {
+        pthread_join(input->thread, 0);
+    }
+    pthread_cond_destroy(&input->space);
+    pthread_cond_destroy(&input->data);
+    pthread_mutex_destroy(&input->lock);
+    free(input->ring);
+#endif
+    if (input->fd >= 0) {
+        close(input->fd);
+    }
+    if (input->pid > 0 && waitpid(input->pid, &status, 0) == input->pid && WIFEXITED(status)) {
+        if (WEXITSTATUS(status) == 127) {
+            fprintf(stderr, "%s: can not run %s\n", input->name, input->program);
+        }
+        else if (WEXITSTATUS(status)) {
+            fprintf(stderr, "%s: %s exited with status %d\n", input->name, input->program, WEXITSTATUS(status));
+        }
+    }
+    free(input->name);
+    free(input);
+
+    return 0;
+}
+
+#if HAVE_FOPENCOOKIE
+static FILE *decompress_input_fopen(decompress_input_t *input) {
+    cookie_io_functions_t io = { decompress_input_read, 0, 0, decompress_input_close };
+
+    return fopencookie(input, "r", io);
+}
+#elif HAVE_FUNOPEN
+static int decompress_input_funread(void *cookie, char *buf, int size) {
+    return decompress_input_read(cookie, buf, size);
+}
+
+static FILE *decompress_input_fopen(decompress_input_t *input) {
+    return funopen(input, decompress_input_funread, 0, 0, decompress_input_close);
+}
+#endif
+#endif
+
+int decompress_input_open(decompress_input_t ** input, const char * file, const char * program, char * errbuf) {
+#if HAVE_FOPENCOOKIE || HAVE_FUNOPEN
+    decompress_input_t *in;
+    const char *threads = 0;
+    int fd, fds[2];
+    size_t i;
+
+    if (!input || !file || !program) {
+        strcpy(errbuf, "invalid argument");
+        return DECOMPRESS_INPUT_EINVAL;
+    }
+    for (i = 0; i < sizeof(decompress_formats) / sizeof(decompress_formats[0]); i++) {
+        if (!strcmp(program, decompress_formats[i].program)) {
+            threads = decompress_formats[i].threads;
+        }
+    }
+
+    if (!(in = calloc(1, sizeof(*in))) || !(in->name = strdup(file))) {
+        free(in);
+        strcpy(errbuf, "out of memory");
+        return DECOMPRESS_INPUT_ENOMEM;
+    }
+    in->program = program;
+#if HAVE_PTHREAD
+    if (!(in->ring = malloc(DECOMPRESS_INPUT_RING))) {
+        free(in->name);
+        free(in);
+        strcpy(errbuf, "out of memory");
+        return DECOMPRESS_INPUT_ENOMEM;
+    }
+    pthread_mutex_init(&in->lock, 0);
+    pthread_cond_init(&in->data, 0);
+    pthread_cond_init(&in->space, 0);
+#endif
+
+    if ((fd = open(file, O_RDONLY)) < 0) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", strerror(errno));
+        in->pid = -1;
+        in->fd = -1;
+        decompress_input_close(in);
+        return DECOMPRESS_INPUT_EINVAL;
+    }
+    if (pipe(fds) < 0) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", strerror(errno));
+        close(fd);
+        in->pid = -1;
+        in->fd = -1;
+        decompress_input_close(in);
+        return DECOMPRESS_INPUT_EFORK;
+    }
+    /* don't leak the read end into later decompressors */
+    (void) fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    if ((in->pid = fork()) < 0) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        close(fd);
+        in->fd = -1;
+        decompress_input_close(in);
+        return DECOMPRESS_INPUT_EFORK;
+    }
+    if (in->pid == 0) {
+        sigset_t set;
+
+        sigemptyset(&set);
+        sigprocmask(SIG_SETMASK, &set, NULL);
+        if (dup2(fd, STDIN_FILENO) < 0 || dup2(fds[1], STDOUT_FILENO) < 0)
+            _exit(127);
+        close(fds[0]);
+        close(fds[1]);
+        close(fd);
+        execlp(program, program, "-dc", threads, (char *) NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    close(fd);
+    in->fd = fds[0];
+
+    if (!(in->fp = decompress_input_fopen(in))) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", strerror(errno));
+        decompress_input_close(in);
+        return DECOMPRESS_INPUT_ENOMEM;
+    }
+    *input = in;
+
+    return DECOMPRESS_INPUT_OK;
+#else
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "compressed input needs fopencookie() or funopen()");
+    return DECOMPRESS_INPUT_EINVAL;
+#endif
+}
+
+FILE *decompress_input_file(const decompress_input_t * input) {
+    return input ? input->fp : 0;
+}
+
+void decompress_input_start(decompress_input_t * input) {
+#if HAVE_PTHREAD && (HAVE_FOPENCOOKIE || HAVE_FUNOPEN)
+    if (!input || input->started || input->eof) {
+        return;
+    }
+    if (!pthread_create(&input->thread, 0, decompress_input_thread, input)) {
+        input->started = 1;
+    }
+#endif
+}
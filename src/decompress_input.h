@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "dnscap_common.h"
+
+#ifndef __dnscap_decompress_input_h
+#define __dnscap_decompress_input_h
+
+#include <stdio.h>
+
+#define DECOMPRESS_INPUT_OK     0
+#define DECOMPRESS_INPUT_EINVAL 1
+#define DECOMPRESS_INPUT_ENOMEM 2
+#define DECOMPRESS_INPUT_EFORK  3
+
+/* decoded data the background thread may read ahead of the reader */
+#define DECOMPRESS_INPUT_RING   (1024 * 1024)
+
+typedef struct decompress_input decompress_input_t;
+
+/*
+ * The program that decodes the file if it starts with the magic of a
+ * gzip, bzip2, xz or zstd stream, NULL if it does not or can not be read.
+ */
+const char *decompress_input_program(const char * file);
+
+/*
+ * Run "program -dc" on the file and give its output as a stream that
+ * libpcap can read, until decompress_input_start() the stream reads the
+ * pipe from the program directly. Closing the stream stops the program
+ * and frees the input. On error errbuf, of PCAP_ERRBUF_SIZE, says why.
+ */
+int decompress_input_open(decompress_input_t ** input, const char * file, const char * program, char * errbuf);
+FILE *decompress_input_file(const decompress_input_t * input);
+
+/*
+ * Start the background thread that drains the pipe into a ring of
+ * DECOMPRESS_INPUT_RING bytes, done when reading starts and not at open
+ * so the thread is started after dnscap went into the background.
+ */
+void decompress_input_start(decompress_input_t * input);
+
+#endif /* __dnscap_decompress_input_h */
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "dns_wire.h"
+
+#include <string.h>
+
+/*
+ * The parser used by the encoders that work on the message in wire format,
+ * nothing is allocated and the messages are checked as they are walked.
+ */
+
+#define DNS_WIRE_MAX_POINTERS 128
+
+/* rdata with the compressed names in it expanded */
+static uint8_t dns_wire_rdata[65535 + 2 * 255];
+
+/*
+ * Copy the name at *offset in uncompressed wire format to out and move
+ * *offset past it, returns the length of the name or 0 if it is malformed.
+ */
+size_t dns_wire_name(const u_char *payload, size_t len, size_t *offset, uint8_t *out) {
+    size_t p = *offset, out_len = 0, pointers = 0;
+    int jumped = 0;
+    uint8_t label;
+
+    while (p < len) {
+        label = payload[p];
+        if ((label & 0xc0) == 0xc0) {
+            if (p + 1 >= len || ++pointers > DNS_WIRE_MAX_POINTERS) {
+                return 0;
+            }
+            if (!jumped) {
+                *offset = p + 2;
+                jumped = 1;
+            }
+            p = (label & 0x3f) << 8 | payload[p + 1];
+            continue;
+        }
+        if (label & 0xc0 || p + 1 + label > len || out_len + 1 + label > 255) {
+            return 0;
+        }
+        memcpy(out + out_len, payload + p, 1 + label);
+        out_len += 1 + label;
+        p += 1 + label;
+        if (!label) {
+            if (!jumped) {
+                *offset = p;
+            }
+            return out_len;
+        }
+    }
+
+    return 0;
+}
+
+/* Print the name as ldns does, returns the length of the text. */
+size_t dns_wire_name_text(const uint8_t *name, char *text) {
+    char *p = text;
+    uint8_t c;
+    size_t n;
+
+    if (!*name) {
+        *p++ = '.';
+    }
+    while (*name) {
+        for (n = 1; n <= *name; n++) {
+            c = name[n];
+            if (c == '.' || c == ';' || c == '(' || c == ')' || c == '\\') {
+                *p++ = '\\';
+                *p++ = c;
+            }
+            else if (c < 0x21 || c > 0x7e) {
+                *p++ = '\\';
+                *p++ = '0' + c / 100;
+                *p++ = '0' + c / 10 % 10;
+                *p++ = '0' + c % 10;
+            }
+            else {
+                *p++ = c;
+            }
+        }
+        *p++ = '.';
+        name += 1 + *name;
+    }
+
+    return p - text;
+}
+
+/*
+ * The types that can have compressed names in their rdata, the names are
+ * expanded so the RDATA stands on its own without the message.
+ */
+static size_t wire_rdata_names(unsigned type, const u_char *rdata, size_t rdlength, size_t *offset) {
+    size_t n;
+
+    *offset = 0;
+    switch (type) {
+    case 2: /* NS */
+    case 3: /* MD */
+    case 4: /* MF */
+    case 5: /* CNAME */
+    case 7: /* MB */
+    case 8: /* MG */
+    case 9: /* MR */
+    case 12: /* PTR */
+    case 30: /* NXT */
+        return 1;
+    case 6: /* SOA */
+    case 14: /* MINFO */
+    case 17: /* RP */
+        return 2;
+    case 15: /* MX */
+    case 18: /* AFSDB */
+    case 21: /* RT */
+    case 36: /* KX */
+        *offset = 2;
+        return 1;
+    case 26: /* PX */
+        *offset = 2;
+        return 2;
+    case 24: /* SIG */
+        *offset = 18;
+        return 1;
+    case 33: /* SRV */
+        *offset = 6;
+        return 1;
+    case 35: /* NAPTR */
+        /* order, preference, flags, services and regexp */
+        *offset = 4;
+        for (n = 0; n < 3 && *offset < rdlength; n++) {
+            *offset += 1 + rdata[*offset];
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+static void wire_rdata(const u_char *payload, size_t len, size_t start, dns_wire_rr_t *rr) {
+    size_t names, offset, p, end = start + rr->rdlength, out_len, name_len;
+
+    rr->rdata = payload + start;
+    if (!rr->rdlength
+        || !(names = wire_rdata_names(rr->type, payload + start, rr->rdlength, &offset))
+        || offset >= rr->rdlength)
+    {
+        return;
+    }
+
+    /* rdata that does not parse is given as it is */
+    memcpy(dns_wire_rdata, payload + start, offset);
+    out_len = offset;
+    p = start + offset;
+    while (names--) {
+        if (p >= end || !(name_len = dns_wire_name(payload, len, &p, dns_wire_rdata + out_len)) || p > end) {
+            return;
+        }
+        out_len += name_len;
+    }
+    memcpy(dns_wire_rdata + out_len, payload + p, end - p);
+    rr->rdata = dns_wire_rdata;
+    rr->rdlength = out_len + end - p;
+}
+
+/* Parse the resource record at *offset, returns non-zero if it is malformed. */
+int dns_wire_rr(const u_char *payload, size_t len, size_t *offset, int is_question, dns_wire_rr_t *rr) {
+    const u_char *p;
+
+    if (!(rr->name_len = dns_wire_name(payload, len, offset, rr->name))
+        || *offset + 4 > len)
+    {
+        return 1;
+    }
+    p = payload + *offset;
+    rr->type = p[0] << 8 | p[1];
+    rr->class = p[2] << 8 | p[3];
+    *offset += 4;
+    if (is_question) {
+        return 0;
+    }
+
+    if (*offset + 6 > len) {
+        return 1;
+    }
+    p = payload + *offset;
+    rr->ttl = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    rr->rdlength = p[4] << 8 | p[5];
+    *offset += 6;
+    if (*offset + rr->rdlength > len) {
+        return 1;
+    }
+    wire_rdata(payload, len, *offset, rr);
+    *offset += p[4] << 8 | p[5];
+
+    return 0;
+}
+
+/*
+ * Move *offset past the resource record without copying its name or
+ * expanding its rdata, only type, class, ttl, rdata and rdlength of rr are
+ * set. Returns non-zero if it is malformed.
+ */
+int dns_wire_skip(const u_char *payload, size_t len, size_t *offset, int is_question, dns_wire_rr_t *rr) {
+    size_t p = *offset;
+    uint8_t label;
+
+    for (;;) {
+        if (p >= len) {
+            return 1;
+        }
+        label = payload[p];
+        if ((label & 0xc0) == 0xc0) {
+            p += 2;
+            break;
+        }
+        if (label & 0xc0) {
+            return 1;
+        }
+        p += 1 + label;
+        if (!label) {
+            break;
+        }
+    }
+    if (p + (is_question ? 4 : 10) > len) {
+        return 1;
+    }
+    rr->name_len = 0;
+    rr->type = payload[p] << 8 | payload[p + 1];
+    rr->class = payload[p + 2] << 8 | payload[p + 3];
+    if (is_question) {
+        *offset = p + 4;
+        return 0;
+    }
+    rr->ttl = (uint32_t)payload[p + 4] << 24 | payload[p + 5] << 16 | payload[p + 6] << 8 | payload[p + 7];
+    rr->rdlength = payload[p + 8] << 8 | payload[p + 9];
+    p += 10;
+    if (p + rr->rdlength > len) {
+        return 1;
+    }
+    rr->rdata = payload + p;
+    *offset = p + rr->rdlength;
+
+    return 0;
+}
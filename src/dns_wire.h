@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dnscap_common.h"
+
+#ifndef __dnscap_dns_wire_h
+#define __dnscap_dns_wire_h
+
+/*
+ * A resource record or question parsed from a message in wire format, the
+ * owner name is uncompressed and compressed names in the rdata of the
+ * types that can have them are expanded so the rdata stands on its own.
+ */
+typedef struct dns_wire_rr dns_wire_rr_t;
+struct dns_wire_rr {
+    uint8_t         name[255];
+    size_t          name_len;
+    unsigned        type;
+    unsigned        class;
+    uint32_t        ttl;
+    const uint8_t   *rdata;
+    size_t          rdlength;
+};
+
+size_t dns_wire_name(const u_char *payload, size_t len, size_t *offset, uint8_t *out);
+size_t dns_wire_name_text(const uint8_t *name, char *text);
+int dns_wire_rr(const u_char *payload, size_t len, size_t *offset, int is_question, dns_wire_rr_t *rr);
+int dns_wire_skip(const u_char *payload, size_t len, size_t *offset, int is_question, dns_wire_rr_t *rr);
+
+#endif /* __dnscap_dns_wire_h */
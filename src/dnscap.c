@@ -50,6 +50,7 @@
 #include <dlfcn.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
+#include <sys/wait.h>
 #if HAVE_PTHREAD
 #include <pthread.h>
 #endif
@@ -147,6 +148,14 @@
 #include "dump_dns.h"
 #include "dump_cbor.h"
 #include "dump_cds.h"
+#include "dump_cdns.h"
+#include "dump_arrow.h"
+#include "dump_dnstap.h"
+#include "dump_pcapng.h"
+#include "dnstap_input.h"
+#include "mmap_input.h"
+#include "merge_input.h"
+#include "decompress_input.h"
 #include "options.h"
 #include "pcap-thread/pcap_thread.h"
 
@@ -242,6 +251,8 @@ struct mypcap {
 	const char *		name;
 	struct pcap_stat	ps0, ps1;
 	uint64_t            drops;
+	unsigned		shard;
+	unsigned		ifindex;	/* pcapng interface */
 };
 typedef struct mypcap *mypcap_ptr;
 typedef LIST(struct mypcap) mypcap_list;
@@ -296,9 +307,73 @@ struct plugin {
 	output_t		(*output);
 	void			(*getopt)(int *, char **[]);
 	void			(*usage)();
+	void			(*set_trigger)(trigger_t *);
+	void			(*set_shard)(shard_t *, unsigned);
 };
 LIST(struct plugin) plugins;
 
+struct sink {
+	LINK(struct sink)	link;
+	const output_sink_t *	spec;
+	int			opened;
+	char			*name, *namepart;
+	pcap_dumper_t		*dumper;
+	FILE			*fp;
+	pid_t			compress_pid;
+	time_t			next_interval;
+	unsigned		msgcount;
+	size_t			bytes;
+};
+typedef struct sink *sink_ptr;
+typedef LIST(struct sink) sink_list;
+
+struct shard {
+	pcap_dumper_t		*dumper;
+	char			*name, *namepart;
+#if HAVE_PTHREAD
+	/*
+	 * With writer threads packets are collected in one buffer while
+	 * the thread writes out the other.
+	 */
+	int			started;
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	u_char			*buf[2];
+	int			active;
+	size_t			fill;
+	int			pending;
+	size_t			pending_len;
+	int			stop;
+#endif
+};
+#define SHARD_BUFSIZE	(16 * SNAPLEN)
+
+/*
+ * The flight recorder keeps the most recent messages in a ring of records,
+ * each followed by the packet, and dumps it when a trigger fires.
+ */
+struct ring_rec {
+	my_bpftimeval		ts;
+	iaddr			from, to;
+	uint8_t			proto;
+	unsigned		flags, sport, dport;
+	unsigned		olen, wirelen;
+	unsigned		payload_off, payloadlen;
+	unsigned		ifindex;
+	int			is_slim;
+	slim_t			slim;
+	size_t			size;
+};
+enum ring_source { ring_signal, ring_plugin, ring_regex, ring_rcode, ring_sources };
+struct ring_dump {
+	int			active;
+	time_t			until;
+	char			*name, *namepart;
+	pcap_dumper_t		*dumper;
+	FILE			*fp;
+};
+
 /* Forward. */
 
 static void setsig(int, int);
@@ -312,22 +387,47 @@ static void prepare_bpft(void);
 static int ep_present(const endpoint_list *, iaddr);
 static size_t text_add(text_list *, const char *, ...);
 static void text_free(text_list *);
+static void open_offline_merge(void);
 static void open_pcaps(void);
 static void poll_pcaps(void);
 static void breakloop_pcaps(void);
 static void close_pcaps(void);
 static void dl_pkt(u_char *, const struct pcap_pkthdr *, const u_char *, const char*, const int);
+static void dnstap_pkt(const dnstap_input_message_t *);
 static void network_pkt(const char *, my_bpftimeval, unsigned,
 			const u_char *, size_t);
 static output_t output;
 static int dumper_open(my_bpftimeval);
 static int dumper_close(my_bpftimeval);
+static int sink_open(sink_ptr, my_bpftimeval);
+static void sink_close(sink_ptr);
+static void sink_output(sink_ptr, iaddr, iaddr, uint8_t, unsigned, unsigned,
+			unsigned, my_bpftimeval, const u_char *, size_t,
+			const u_char *, size_t, size_t, const slim_t *);
+static shard_t shard_hash;
+static unsigned shard_select(iaddr, iaddr, unsigned, unsigned, unsigned,
+			const u_char *);
+static void shard_dump(struct shard *, const struct pcap_pkthdr *,
+			const u_char *);
+static int shards_open(my_bpftimeval);
+static void shards_close(void);
+static void shards_free(void);
+static void ring_output(iaddr, iaddr, uint8_t, unsigned, unsigned, unsigned,
+			my_bpftimeval, const u_char *, size_t, const u_char *,
+			size_t, size_t, const slim_t *);
+static unsigned slim_response(const u_char *, unsigned, const u_char *,
+			unsigned, u_char *, unsigned *);
+static void ring_trigger(const char *);
+static void ring_check(my_bpftimeval);
+static void ring_free(void);
+static void sigtrigger(int);
 static void sigclose(int);
 static void sigbreak(int);
 #if HAVE_PTHREAD
 static void *sigthread(void * arg);
 #endif
 static uint16_t in_checksum(const u_char *, size_t);
+static void fix_checksums(u_char *, u_char *, size_t, uint8_t, int);
 static void daemonize(void);
 static void drop_privileges(void);
 static logerr_t logerr;
@@ -355,10 +455,12 @@ static endpoint_list drop_responders;		/* drops only responses from these hosts
 static myregex_list myregexes;
 static mypcap_list mypcaps;
 static mypcap_ptr pcap_offline = NULL;
+static merge_input_t *offline_merge = NULL;
+static mypcap_ptr dnstap_in = NULL;
 static const char *dump_base = NULL;
 static char *dump_suffix = NULL;
 static char *extra_bpf = NULL;
-static enum {nowhere, to_stdout, to_file} dump_type = nowhere;
+static enum {nowhere, to_stdout, to_file, to_socket} dump_type = nowhere;
 static enum {dumper_opened, dumper_closed} dump_state = dumper_closed;
 static const char *kick_cmd = NULL;
 static unsigned limit_seconds = 0U;
@@ -369,10 +471,27 @@ static fd_set mypcap_fdset;
 static int pcap_maxfd;
 static pcap_t *pcap_dead;
 static pcap_dumper_t *dumper;
+static FILE *dumpfp = NULL;
 static time_t dumpstart;
 static unsigned msgcount;
 static size_t capturedbytes = 0;
 static char *dumpname, *dumpnamepart;
+static sink_list sinks;
+static struct shard *shards = NULL;
+static unsigned output_vlan = MAX_VLAN;
+static mypcap_ptr output_mypcap = NULL;
+static u_char *ring_buf = NULL;
+static size_t ring_head, ring_tail, ring_wrap;
+static unsigned ring_count;
+static unsigned ring_pending;
+static volatile sig_atomic_t ring_signalled = FALSE;
+static time_t ring_rcode_start;
+static unsigned ring_rcode_seen;
+static struct ring_dump ring_dumps[ring_sources];
+static const char *ring_source_names[ring_sources] = { "signal", "plugin", "regex", "rcode" };
+static u_char slim_pkt[SNAPLEN];
+static uint64_t slim_responses = 0;
+static uint64_t slim_saved = 0;
 static char *bpft;
 static unsigned dns_port = DNS_PORT;
 static int promisc = TRUE;
@@ -427,6 +546,8 @@ main(int argc, char *argv[]) {
 	open_pcaps();
 	if (dump_type == to_stdout)
 		dumper_open(now);
+	else if (dump_type == to_socket && dumper_open(now))
+		exit(1);
 	INIT_LIST(tcpstates);
 
     if (!dont_drop_privileges && !only_offline_pcaps) {
@@ -434,6 +555,8 @@ main(int argc, char *argv[]) {
     }
 
 	for (p = HEAD(plugins); p != NULL; p = NEXT(p, link)) {
+		if (p->set_shard)
+			(*p->set_shard)(shard_hash, dns_port);
 		if (p->start)
 			if (0 != (*p->start)(logerr)) {
 				logerr("%s_start returned non-zero", p->name);
@@ -468,6 +591,8 @@ main(int argc, char *argv[]) {
         sigaddset(&set, SIGALRM);
         sigaddset(&set, SIGTERM);
         sigaddset(&set, SIGQUIT);
+        if (ring_buf != NULL)
+            sigaddset(&set, SIGUSR1);
 
         if ((err = pthread_create(&thread, 0, &sigthread, (void*)&set))) {
             logerr("pthread_create: %s", strerror(err));
@@ -484,6 +609,8 @@ main(int argc, char *argv[]) {
         sigdelset(&set, SIGALRM);
         sigdelset(&set, SIGTERM);
         sigdelset(&set, SIGQUIT);
+        if (ring_buf != NULL)
+            sigdelset(&set, SIGUSR1);
 
         if (sigprocmask(SIG_BLOCK, &set, 0)) {
             logerr("sigprocmask: %s", strerror(errno));
@@ -496,13 +623,52 @@ main(int argc, char *argv[]) {
 	setsig(SIGALRM, FALSE);
 	setsig(SIGTERM, TRUE);
 	setsig(SIGQUIT, TRUE);
+	if (ring_buf != NULL) {
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof sa);
+		sa.sa_handler = sigtrigger;
+		sa.sa_flags = SA_RESTART;
+		if (sigaction(SIGUSR1, &sa, NULL) < 0) {
+			logerr("sigaction: %s", strerror(errno));
+			exit(1);
+		}
+	}
 #endif
 
-	while (!main_exit)
+	while (!main_exit) {
 		poll_pcaps();
+		if (ring_buf != NULL)
+			ring_check(last_ts);
+	}
+	if (ring_buf != NULL)
+		ring_check(last_ts);
 	/* close PCAPs after dumper_close() to have statistics still available during dumper_close() */
 	if (dumper_opened == dump_state)
 		(void) dumper_close(last_ts);
+	shards_free();
+	ring_free();
+	if (options.cds_use_rdata_index) {
+		cds_rdata_index_stats_t stats;
+
+		if (cds_get_rdata_index_stats(&stats) == DUMP_CDS_OK && stats.lookups)
+			logerr("cds rdata index: %lu entries, %lu bytes, %lu/%lu hits (%.1f%%), %lu evictions",
+				(unsigned long) stats.entries, (unsigned long) stats.memory,
+				(unsigned long) stats.hits, (unsigned long) stats.lookups,
+				100.0 * stats.hits / stats.lookups,
+				(unsigned long) stats.evictions);
+	}
+	if (options.slim)
+		logerr("slim: %llu responses, %llu bytes saved",
+			(unsigned long long) slim_responses,
+			(unsigned long long) slim_saved);
+	{
+		sink_ptr sink;
+
+		for (sink = HEAD(sinks); sink != NULL; sink = NEXT(sink, link))
+			sink_close(sink);
+	}
+	cds_free();
 	close_pcaps();
 	for (p = HEAD(plugins); p != NULL; p = NEXT(p, link)) {
 		if (p->stop)
@@ -796,7 +962,7 @@ help_2(void) {
 		"             in the TCP stream; DNS payload filters will not be applied.)\n"
 		"  -I         include ICMP and ICMPv6 packets\n"
 		"  -i <if>    select this live interface(s)\n"
-		"  -r <file>  read this pcap file\n"
+		"  -r <file>  read this pcap file(s)\n"
 		"  -l <vlan>  select only these vlan(s) (4095 for all)\n"
 		"  -L <vlan>  select these vlan(s) and non-VLAN frames (4095 for all)\n"
 		"  -u <port>  dns port (default: 53)\n"
@@ -820,7 +986,8 @@ help_2(void) {
 		"  -w <base>  dump to <base>.<timesec>.<timeusec>\n"
 		"  -W <suffix> add suffix to dump file name, e.g. '.pcap'\n"
 		"  -k <cmd>   kick off <cmd> when each dump closes\n"
-		"  -F <format> dump format: pcap (default), cbor, cds\n"
+		"  -F <format> dump format: pcap (default), cbor, cds, cdns,\n"
+		"             arrow, dnstap, pcapng\n"
 		"  -t <lim>   close dump or exit every/after <lim> secs\n"
 		"  -c <lim>   close dump or exit every/after <lim> pkts\n"
 		"  -C <lim>   close dump or exit every/after <lim> bytes captured\n"
@@ -847,6 +1014,9 @@ parse_args(int argc, char *argv[]) {
 	unsigned u;
 	int ch;
 	char *p;
+	const output_sink_t *spec;
+	int cbor_outputs = 0, cds_outputs = 0, cdns_outputs = 0, arrow_outputs = 0;
+	int dnstap_outputs = 0, pcapng_outputs = 0;
 
 	if ((p = strrchr(argv[0], '/')) == NULL)
 		ProgramName = argv[0];
@@ -862,6 +1032,7 @@ parse_args(int argc, char *argv[]) {
 	INIT_LIST(drop_responders);
 	INIT_LIST(myregexes);
 	INIT_LIST(plugins);
+	INIT_LIST(sinks);
 	while ((ch = getopt(argc, argv,
 			"a:bc:de:fgh:i:k:l:m:o:pr:s:t:u:w:x:yz:"
 			"A:B:C:DE:F:IL:MNP:STU:VW:X:Y:Z:16?")
@@ -921,14 +1092,16 @@ parse_args(int argc, char *argv[]) {
 			only_offline_pcaps = FALSE;
 			break;
 		case 'r':
-			if (!EMPTY(mypcaps))
+			if (!EMPTY(mypcaps) && pcap_offline == NULL)
 				usage("-r makes no sense after -i");
-			pcap_offline = calloc(1, sizeof *pcap_offline);
-			assert(pcap_offline != NULL);
-			INIT_LINK(pcap_offline, link);
-			pcap_offline->name = strdup(optarg);
-			assert(pcap_offline->name != NULL);
-			APPEND(mypcaps, pcap_offline, link);
+			mypcap = calloc(1, sizeof *mypcap);
+			assert(mypcap != NULL);
+			INIT_LINK(mypcap, link);
+			mypcap->name = strdup(optarg);
+			assert(mypcap->name != NULL);
+			APPEND(mypcaps, mypcap, link);
+			if (pcap_offline == NULL)
+				pcap_offline = mypcap;
 			break;
 		case 'l':
 			ul = strtoul(optarg, &p, 0);
@@ -1059,6 +1232,18 @@ parse_args(int argc, char *argv[]) {
 		    else if (!strcmp(optarg, "cds")) {
 		        options.dump_format = cds;
 		    }
+		    else if (!strcmp(optarg, "cdns")) {
+		        options.dump_format = cdns;
+		    }
+		    else if (!strcmp(optarg, "arrow")) {
+		        options.dump_format = arrow;
+		    }
+		    else if (!strcmp(optarg, "dnstap")) {
+		        options.dump_format = dnstap;
+		    }
+		    else if (!strcmp(optarg, "pcapng")) {
+		        options.dump_format = pcapng;
+		    }
 		    else {
 		        usage("invalid output format for -F");
 		    }
@@ -1165,6 +1350,12 @@ parse_args(int argc, char *argv[]) {
 				}
 				snprintf(sn, sizeof(sn), "%s_usage", p->name);
 				p->usage = dlsym(p->handle, sn);
+				snprintf(sn, sizeof(sn), "%s_set_trigger", p->name);
+				p->set_trigger = dlsym(p->handle, sn);
+				if (p->set_trigger)
+					(*p->set_trigger)(ring_trigger);
+				snprintf(sn, sizeof(sn), "%s_set_shard", p->name);
+				p->set_shard = dlsym(p->handle, sn);
 				snprintf(sn, sizeof(sn), "%s_getopt", p->name);
 				p->getopt = dlsym(p->handle, sn);
 				if (p->getopt)
@@ -1199,8 +1390,20 @@ parse_args(int argc, char *argv[]) {
 	}
 	assert(msg_wanted != 0U);
 	assert(err_wanted != 0U);
-	if (dump_type == nowhere && !preso && EMPTY(plugins))
-		usage("without -w, -g or -P, there would be no output");
+	for (spec = options.outputs; spec != NULL; spec = spec->next) {
+		sink_ptr sink = calloc(1, sizeof *sink);
+		assert(sink != NULL);
+		INIT_LINK(sink, link);
+		sink->spec = spec;
+		APPEND(sinks, sink, link);
+	}
+	if (options.dnstap_socket) {
+		if (options.dump_format != dnstap || dump_type != nowhere)
+			usage("dnstap_socket needs -F dnstap and can't be used with -w");
+		dump_type = to_socket;
+	}
+	if (dump_type == nowhere && !preso && EMPTY(plugins) && EMPTY(sinks))
+		usage("without -w, -g, -P or -o output, there would be no output");
 	if (end_hide != 0U && wantfrags)
 		usage("the -h and -f options are incompatible");
 	if (!EMPTY(vlans_incl) && !EMPTY(vlans_excl))
@@ -1292,6 +1495,36 @@ parse_args(int argc, char *argv[]) {
 			fprintf(stderr, "\n");
 		}
 	}
+	if (options.offline_threads > 1)
+		options.offline_mmap = 1;
+	if (options.offline_mmap) {
+		if (pcap_offline == NULL)
+			usage("offline_mmap and offline_threads need -r");
+#if !HAVE_PTHREAD
+		if (options.offline_threads > 1)
+			usage("offline_threads needs pthread support");
+#endif
+	}
+	if (options.dnstap_input || options.dnstap_listen) {
+		if (!EMPTY(mypcaps))
+			usage("dnstap_input and dnstap_listen can't be used with -i or -r");
+		if (options.dnstap_input && options.dnstap_listen)
+			usage("only one of dnstap_input and dnstap_listen can be used");
+		if (extra_bpf)
+			usage("-U can't be used with dnstap input");
+#if !HAVE_PTHREAD
+		if (options.dnstap_listen)
+			usage("dnstap_listen needs pthread support");
+#endif
+		dnstap_in = calloc(1, sizeof *dnstap_in);
+		assert(dnstap_in != NULL);
+		INIT_LINK(dnstap_in, link);
+		dnstap_in->name = strdup(options.dnstap_input ? options.dnstap_input : options.dnstap_listen);
+		assert(dnstap_in->name != NULL);
+		APPEND(mypcaps, dnstap_in, link);
+		if (options.dnstap_listen)
+			only_offline_pcaps = FALSE;
+	}
 	if (EMPTY(mypcaps)) {
 		const char *name;
 		name = pcap_lookupdev(errbuf);
@@ -1311,13 +1544,59 @@ parse_args(int argc, char *argv[]) {
 	if ((start_time || stop_time) && NULL == dump_base)
 		usage("--B and --E require -w");
 
-    if (options.dump_format == cbor) {
+    if (dump_type != nowhere) {
+        if (options.dump_format == cbor)
+            cbor_outputs++;
+        else if (options.dump_format == cds)
+            cds_outputs++;
+        else if (options.dump_format == cdns)
+            cdns_outputs++;
+        else if (options.dump_format == arrow)
+            arrow_outputs++;
+        else if (options.dump_format == dnstap)
+            dnstap_outputs++;
+        else if (options.dump_format == pcapng)
+            pcapng_outputs++;
+    }
+    for (spec = options.outputs; spec != NULL; spec = spec->next) {
+        if (spec->format == cbor)
+            cbor_outputs++;
+        else if (spec->format == cds)
+            cds_outputs++;
+        else if (spec->format == cdns)
+            cdns_outputs++;
+        else if (spec->format == arrow)
+            arrow_outputs++;
+        else if (spec->format == dnstap)
+            dnstap_outputs++;
+        else if (spec->format == pcapng)
+            pcapng_outputs++;
+    }
+    if (cbor_outputs > 1)
+        usage("only one cbor output can be used");
+    if (cds_outputs > 1)
+        usage("only one cds output can be used");
+    if (cdns_outputs > 1)
+        usage("only one cdns output can be used");
+    if (arrow_outputs > 1)
+        usage("only one arrow output can be used");
+    if (dnstap_outputs > 1)
+        usage("only one dnstap output can be used");
+
+    if (cbor_outputs) {
         if (!have_cbor_support()) {
             usage("no built in cbor support");
         }
         cbor_set_size(options.cbor_chunk_size);
+        if (cbor_set_compat(options.cbor_compat) != DUMP_CBOR_OK) {
+            usage("cbor_compat needs ldns support");
+        }
+        if (options.cbor_compat && options.cbor_version != 1) {
+            usage("cbor_compat can only be used with cbor_version=1");
+        }
+        cbor_set_version(options.cbor_version);
     }
-    else if (options.dump_format == cds) {
+    if (cds_outputs) {
         if (!have_cds_support()) {
             usage("no built in cds support");
         }
@@ -1331,9 +1610,105 @@ parse_args(int argc, char *argv[]) {
         cds_set_use_rdata_index(options.cds_use_rdata_index);
         cds_set_use_rdata_rindex(options.cds_use_rdata_rindex);
         cds_set_rdata_index_min_size(options.cds_rdata_index_min_size);
+        cds_set_rdata_index_size(options.cds_rdata_index_size);
         cds_set_rdata_rindex_min_size(options.cds_rdata_rindex_min_size);
         cds_set_rdata_rindex_size(options.cds_rdata_rindex_size);
+        cds_set_segment(options.cds_segment_messages, options.cds_segment_seconds);
+        if (options.cds_workers) {
+            if (!options.cds_segment_messages && !options.cds_segment_seconds) {
+                usage("cds_workers requires cds_segment_messages or cds_segment_seconds");
+            }
+            if (cds_set_workers(options.cds_workers) != DUMP_CDS_OK) {
+                usage("cds_workers requires pthread support");
+            }
+        }
+        if (options.cds_index) {
+            if (dump_type == to_stdout && options.dump_format == cds) {
+                usage("cds_index needs output to files");
+            }
+            cds_set_index(options.cds_index);
+        }
+        if (options.cds_dictionary && cds_set_dictionary(options.cds_dictionary) != DUMP_CDS_OK) {
+            usage("cds_dictionary could not be loaded");
+        }
+    }
+    if (cdns_outputs) {
+        cdns_set_block_size(options.cdns_block_size);
+    }
+    if (arrow_outputs) {
+        arrow_set_batch_size(options.arrow_batch_size);
+    }
+    if (dnstap_outputs) {
+        dnstap_set_type(options.dnstap_type);
+        if (options.dnstap_identity && dnstap_set_identity(options.dnstap_identity) != DUMP_DNSTAP_OK) {
+            usage("dnstap_identity can be at most 255 characters");
+        }
+        if (options.dnstap_socket && dnstap_set_socket(options.dnstap_socket) != DUMP_DNSTAP_OK) {
+            usage("dnstap_socket is not a valid socket path");
+        }
+    }
+
+    if (options.shard_key != shard_none || options.shard_count) {
+        unsigned n;
+
+        if (options.shard_key == shard_none || options.shard_count < 2)
+            usage("shard_key and shard_count (>1) must be used together");
+        if (dump_type != to_file || options.dump_format != pcap)
+            usage("sharding requires -w <base> and pcap output");
+        shards = calloc(options.shard_count, sizeof *shards);
+        assert(shards != NULL);
+#if HAVE_PTHREAD
+        for (n = 0; n < options.shard_count; n++) {
+            struct shard *shard = &shards[n];
+
+            if (!options.shard_threads)
+                continue;
+            pthread_mutex_init(&shard->lock, NULL);
+            pthread_cond_init(&shard->cond, NULL);
+            shard->buf[0] = malloc(SHARD_BUFSIZE);
+            shard->buf[1] = malloc(SHARD_BUFSIZE);
+            assert(shard->buf[0] != NULL && shard->buf[1] != NULL);
+            shard->pending = -1;
+        }
+#else
+        if (options.shard_threads)
+            usage("shard_threads requires pthread support");
+#endif
+        n = 0;
+        for (mypcap = HEAD(mypcaps); mypcap != NULL; mypcap = NEXT(mypcap, link))
+            mypcap->shard = n++;
+    }
+
+    if (options.ring_size) {
+        if (dump_type != to_file)
+            usage("the flight recorder requires -w <base>");
+        if (shards != NULL)
+            usage("the flight recorder can't be used with sharding");
+        if (options.ring_size < 2 * (sizeof(struct ring_rec) + SNAPLEN))
+            usage("ring_size must hold at least two full packets");
+        ring_buf = malloc(options.ring_size);
+        assert(ring_buf != NULL);
+        /* -w now only names the dumps made on triggers */
+        dump_type = nowhere;
+    }
+    else if (options.ring_seconds || options.ring_post_seconds
+        || options.ring_regex || options.ring_rcode >= 0)
+        usage("the ring options require ring_size");
+
+    /* one pcapng interface per input, in the order they were given */
+    if (pcapng_outputs) {
+        int ifindex;
+
+        for (mypcap = HEAD(mypcaps); mypcap != NULL; mypcap = NEXT(mypcap, link)) {
+            if ((ifindex = pcapng_add_interface(mypcap->name, PCAPNG_LINKTYPE_RAW, SNAPLEN)) < 0) {
+                fprintf(stderr, "%s: out of memory for pcapng interfaces\n", ProgramName);
+                exit(1);
+            }
+            mypcap->ifindex = ifindex;
+        }
     }
+    else if (options.pcapng_stats)
+        usage("pcapng_stats requires pcapng output");
 }
 
 static void
@@ -1621,11 +1996,82 @@ drop_pkt(u_char *user, const struct pcap_pkthdr *hdr, const u_char *pkt, const c
     }
 }
 
+/*
+ * More than one -r, -r with offline_mmap or a compressed -r, are read by
+ * the merge stage that hands out the packets of all files in time order.
+ */
+static void
+open_offline_merge(void) {
+	mypcap_ptr mypcap;
+	mmap_input_t *mmap;
+	char errbuf[PCAP_ERRBUF_SIZE];
+	int err;
+
+	if (merge_input_open(&offline_merge) != MERGE_INPUT_OK) {
+		fprintf(stderr, "%s: out of memory for offline inputs\n",
+			ProgramName);
+		exit(1);
+	}
+	for (mypcap = HEAD(mypcaps);
+	     mypcap != NULL;
+	     mypcap = NEXT(mypcap, link))
+	{
+		if (options.offline_mmap) {
+			err = mmap_input_open(&mmap, mypcap->name, options.offline_threads,
+				options.offline_order == offline_order_time ? MMAP_INPUT_ORDER_TIME : MMAP_INPUT_ORDER_FILE,
+				bpft, SNAPLEN);
+			if (err == MMAP_INPUT_OK &&
+			    merge_input_add_mmap(offline_merge, mmap, mypcap->name, (u_char *) mypcap) != MERGE_INPUT_OK)
+				err = MMAP_INPUT_ENOMEM;
+			if (err == MMAP_INPUT_ENOMEM) {
+				fprintf(stderr, "%s: out of memory for offline_mmap\n",
+					ProgramName);
+				exit(1);
+			}
+			if (err == MMAP_INPUT_OK)
+				continue;
+			if (dumptrace >= 1)
+				fprintf(stderr, "%s: %s can not be mapped, reading it with libpcap\n",
+					ProgramName, mypcap->name);
+		}
+		if (merge_input_add_pcap(offline_merge, mypcap->name, bpft, (u_char *) mypcap, errbuf) != MERGE_INPUT_OK) {
+			fprintf(stderr, "%s: %s: %s\n",
+				ProgramName, mypcap->name, errbuf);
+			exit(1);
+		}
+	}
+}
+
 static void
 open_pcaps(void) {
 	mypcap_ptr mypcap;
 	int err;
 
+	if (dnstap_in != NULL) {
+		if (options.dnstap_listen)
+			err = dnstap_input_listen(options.dnstap_listen);
+		else
+			err = dnstap_input_open(options.dnstap_input);
+		if (err == DNSTAP_INPUT_EINVAL)
+			fprintf(stderr, "%s: %s is not a valid dnstap input\n",
+				ProgramName, dnstap_in->name);
+		else if (err == DNSTAP_INPUT_ENOMEM)
+			fprintf(stderr, "%s: out of memory for dnstap input\n",
+				ProgramName);
+		if (err != DNSTAP_INPUT_OK)
+			exit(1);
+		pcap_dead = pcap_open_dead(DLT_RAW, SNAPLEN);
+		return;
+	}
+	if (pcap_offline != NULL &&
+	    (options.offline_mmap || NEXT(pcap_offline, link) != NULL ||
+	     decompress_input_program(pcap_offline->name) != NULL))
+	{
+		open_offline_merge();
+		pcap_dead = pcap_open_dead(DLT_RAW, SNAPLEN);
+		return;
+	}
+
     pcap_thread_set_snaplen(&pcap_thread, SNAPLEN);
     pcap_thread_set_promiscuous(&pcap_thread, promisc);
     pcap_thread_set_monitor(&pcap_thread, monitor_mode);
@@ -1667,18 +2113,39 @@ open_pcaps(void) {
 
 static void
 poll_pcaps(void) {
-    pcap_thread_run(&pcap_thread);
+    if (dnstap_in != NULL) {
+        dnstap_input_message_t message;
+
+        while (!main_exit && dnstap_input_next(&message) == DNSTAP_INPUT_OK)
+            dnstap_pkt(&message);
+    }
+    else if (offline_merge != NULL)
+        merge_input_run(offline_merge, dl_pkt);
+    else
+        pcap_thread_run(&pcap_thread);
     main_exit = TRUE;
 }
 
 static void
 breakloop_pcaps(void) {
-    pcap_thread_stop(&pcap_thread);
+    if (dnstap_in != NULL)
+        dnstap_input_stop();
+    else if (offline_merge != NULL)
+        merge_input_stop(offline_merge);
+    else
+        pcap_thread_stop(&pcap_thread);
 }
 
 static void
 close_pcaps(void) {
-    pcap_thread_close(&pcap_thread);
+    if (dnstap_in != NULL)
+        dnstap_input_close();
+    else if (offline_merge != NULL) {
+        merge_input_close(offline_merge);
+        offline_merge = NULL;
+    }
+    else
+        pcap_thread_close(&pcap_thread);
 }
 
 #define MAX_TCP_IDLE_TIME	600
@@ -1754,6 +2221,8 @@ dl_pkt(u_char *user, const struct pcap_pkthdr *hdr, const u_char *pkt, const cha
 	char descr[200];
 
 	last_ts = hdr->ts;
+	output_vlan = MAX_VLAN;
+	output_mypcap = NULL;
 	if (stop_time != 0 && hdr->ts.tv_sec >= stop_time) {
 		breakloop_pcaps();
 		main_exit = TRUE;
@@ -1915,7 +2384,11 @@ dl_pkt(u_char *user, const struct pcap_pkthdr *hdr, const u_char *pkt, const cha
 	if (dumper_closed == dump_state && dumper_open(hdr->ts))
 		goto breakloop;
 
+	output_vlan = vlan;
+	output_mypcap = mypcap;
 	network_pkt(descr, hdr->ts, pf, pkt, len);
+	output_vlan = MAX_VLAN;
+	output_mypcap = NULL;
 
 	if (limit_packets != 0U && msgcount == limit_packets) {
 		if (preso)
@@ -1941,6 +2414,82 @@ dl_pkt(u_char *user, const struct pcap_pkthdr *hdr, const u_char *pkt, const cha
 	main_exit = TRUE;
 }
 
+/*
+ * Make a raw IP packet of a DNS message read from dnstap and give it to
+ * dl_pkt() so it goes through the same filters and outputs as a captured
+ * one.  A message over TCP gets the 2 byte length in front of it and the
+ * stream state a SYN would have made so it is taken as the first message
+ * of its stream.
+ */
+static void
+dnstap_pkt(const dnstap_input_message_t *message) {
+	static u_char pkt[SNAPLEN];
+	struct pcap_pkthdr hdr;
+	u_char *l4;
+	size_t iplen, hlen, l4len;
+	int tcp = message->proto == IPPROTO_TCP;
+
+	iplen = message->from.af == AF_INET ? 20 : 40;
+	hlen = tcp ? 20 + 2 : 8;
+	l4len = hlen + message->payloadlen;
+	if (iplen + l4len > SNAPLEN || l4len > 0xffff)
+		return;
+
+	memset(pkt, 0, iplen + hlen);
+	l4 = pkt + iplen;
+	if (message->from.af == AF_INET) {
+		pkt[0] = 0x45;
+		pkt[2] = (iplen + l4len) >> 8;
+		pkt[3] = iplen + l4len;
+		pkt[8] = 64;
+		pkt[9] = message->proto;
+		memcpy(pkt + 12, &message->from.u.a4, 4);
+		memcpy(pkt + 16, &message->to.u.a4, 4);
+	} else {
+		pkt[0] = 0x60;
+		pkt[4] = l4len >> 8;
+		pkt[5] = l4len;
+		pkt[6] = message->proto;
+		pkt[7] = 64;
+		memcpy(pkt + 8, &message->from.u.a6, 16);
+		memcpy(pkt + 24, &message->to.u.a6, 16);
+	}
+
+	l4[0] = message->sport >> 8;
+	l4[1] = message->sport;
+	l4[2] = message->dport >> 8;
+	l4[3] = message->dport;
+	if (tcp) {
+		l4[12] = 5 << 4;
+		l4[13] = TH_PUSH|TH_ACK;
+		l4[14] = l4[15] = 0xff;
+		l4[20] = message->payloadlen >> 8;
+		l4[21] = message->payloadlen;
+	} else {
+		l4[4] = l4len >> 8;
+		l4[5] = l4len;
+	}
+	memcpy(l4 + hlen, message->payload, message->payloadlen);
+	fix_checksums(pkt, l4, l4len, message->proto, TRUE);
+
+	if (tcp && wanttcp) {
+		tcpstate_ptr tcpstate = tcpstate_find(message->from, message->to,
+			message->sport, message->dport, message->ts.tv_sec);
+
+		if (tcpstate == NULL)
+			tcpstate = tcpstate_new(message->from, message->to,
+				message->sport, message->dport);
+		tcpstate->last_use = message->ts.tv_sec;
+		tcpstate->start = 0;
+		tcpstate->maxdiff = 1;
+		tcpstate->dnslen = 0;
+	}
+
+	hdr.ts = message->ts;
+	hdr.caplen = hdr.len = iplen + l4len;
+	dl_pkt((u_char *) dnstap_in, &hdr, pkt, dnstap_in->name, DLT_RAW);
+}
+
 /* Discard this packet.  If it's part of TCP stream, all subsequent pkts on
  * the same tcp stream will also be discarded. */
 static void
@@ -2001,8 +2550,8 @@ network_pkt(const char *descr, my_bpftimeval ts, unsigned pf,
 		to.af = AF_INET;
 		memcpy(&to.u.a4, &ip->ip_dst, sizeof(struct in_addr));
 		offset = ip->ip_hl << 2;
-		if (len > ip->ip_len)	/* small IP packets have L2 padding */
-			len = ip->ip_len;
+		if (len > ntohs(ip->ip_len))	/* small IP packets have L2 padding */
+			len = ntohs(ip->ip_len);
 		if (len <= (size_t) offset)
 			return;
 		pkt += offset;
@@ -2426,7 +2975,11 @@ network_pkt(const char *descr, my_bpftimeval ts, unsigned pf,
 				}
 			}
 		}
-		if (!match) {
+		if (options.ring_size && options.ring_regex) {
+			/* record everything, a match dumps the ring */
+			if (match)
+				ring_pending |= 1 << ring_regex;
+		} else if (!match) {
 			discard(tcpstate, "failed regex match");
 			return;
 		}
@@ -2499,6 +3052,12 @@ output(const char *descr, iaddr from, iaddr to, uint8_t proto, unsigned flags,
     const u_char *payload, const unsigned payloadlen)
 {
 	struct plugin *p;
+	sink_ptr sink;
+	const u_char *out_pkt = pkt_copy, *out_payload = payload;
+	unsigned out_olen = olen, out_payloadlen = payloadlen;
+	unsigned slim_olen = 0, slim_payloadlen = 0;
+	slim_t slim;
+	const slim_t *out_slim = NULL;
 
 	msgcount++;
 	capturedbytes += olen;
@@ -2528,37 +3087,114 @@ output(const char *descr, iaddr from, iaddr to, uint8_t proto, unsigned flags,
 		}
 		putc('\n', stderr);
 	}
+
+	/* Slim responses, see slim_response(). */
+	if (options.slim && proto == IPPROTO_UDP && (flags & DNSCAP_OUTPUT_ISDNS)
+	    && payload && (payload[2] & 0x80))
+	{
+		slim_olen = slim_response(pkt_copy, olen, payload, payloadlen,
+			slim_pkt, &slim_payloadlen);
+		if (slim_olen) {
+			int i;
+
+			slim_responses++;
+			slim_saved += olen - slim_olen;
+			slim.payloadlen = payloadlen;
+			for (i = 0; i < 3; i++)
+				slim.counts[i] = ns_get16(payload + 6 + 2 * i);
+		}
+	}
+	if (slim_olen && (options.slim & OPTIONS_SLIM(options.dump_format))) {
+		out_pkt = slim_pkt;
+		out_olen = slim_olen;
+		out_payload = slim_pkt + (payload - pkt_copy);
+		out_payloadlen = slim_payloadlen;
+		out_slim = &slim;
+	}
+
+	if (ring_buf != NULL)
+		ring_output(from, to, proto, flags, sport, dport, ts, out_pkt, out_olen, out_payload, out_payloadlen, olen, out_slim);
 	if (dump_type != nowhere) {
 	    if (options.dump_format == pcap) {
 		    struct pcap_pkthdr h;
 
 		    memset(&h, 0, sizeof h);
 		    h.ts = ts;
-		    h.len = h.caplen = olen;
-		    pcap_dump((u_char *)dumper, &h, pkt_copy);
-		    if (flush)
-			    pcap_dump_flush(dumper);
+		    h.len = olen;
+		    h.caplen = out_olen;
+		    if (shards != NULL)
+			    shard_dump(&shards[shard_select(from, to, flags, sport, dport, payload)], &h, out_pkt);
+		    else {
+			    pcap_dump((u_char *)dumper, &h, out_pkt);
+			    if (flush)
+				    pcap_dump_flush(dumper);
+		    }
         }
         else if (options.dump_format == cbor && (flags & DNSCAP_OUTPUT_ISDNS) && payload) {
-            int ret = output_cbor(from, to, proto, flags, sport, dport, ts, payload, payloadlen);
+            int ret = output_cbor(from, to, proto, flags, sport, dport, ts, out_payload, out_payloadlen, out_slim);
 
-            if (ret == DUMP_CBOR_FLUSH) {
-                if (dumper_close(ts)) {
-                    fprintf(stderr, "%s: dumper_close() failed\n", ProgramName);
-                    exit(1);
-                }
-                if (dumper_open(ts)) {
-                    fprintf(stderr, "%s: dumper_open() failed\n", ProgramName);
-                    exit(1);
-                }
+            if (ret == DUMP_CBOR_FLUSH || (ret == DUMP_CBOR_OK && flush)) {
+                ret = dump_cbor(dumpfp);
+                if (ret == DUMP_CBOR_OK && flush)
+                    fflush(dumpfp);
             }
-            else if (ret != DUMP_CBOR_OK) {
+            if (ret != DUMP_CBOR_OK) {
                 fprintf(stderr, "%s: output to cbor failed [%u]\n", ProgramName, ret);
                 exit(1);
             }
         }
+        else if (options.dump_format == cdns && (flags & DNSCAP_OUTPUT_ISDNS) && payload) {
+            int ret = output_cdns(from, to, proto, flags, sport, dport, ts, out_payload, out_payloadlen, out_slim);
+
+            if (ret == DUMP_CDNS_FLUSH || (ret == DUMP_CDNS_OK && flush)) {
+                ret = dump_cdns(dumpfp);
+                if (ret == DUMP_CDNS_OK && flush)
+                    fflush(dumpfp);
+            }
+            if (ret != DUMP_CDNS_OK) {
+                fprintf(stderr, "%s: output to cdns failed [%u]\n", ProgramName, ret);
+                exit(1);
+            }
+        }
+        else if (options.dump_format == arrow && (flags & DNSCAP_OUTPUT_ISDNS) && payload) {
+            int ret = output_arrow(from, to, proto, flags, sport, dport, ts, out_payload, out_payloadlen, out_slim);
+
+            if (ret == DUMP_ARROW_FLUSH || (ret == DUMP_ARROW_OK && flush)) {
+                ret = dump_arrow(dumpfp);
+                if (ret == DUMP_ARROW_OK && flush)
+                    fflush(dumpfp);
+            }
+            if (ret != DUMP_ARROW_OK) {
+                fprintf(stderr, "%s: output to arrow failed [%u]\n", ProgramName, ret);
+                exit(1);
+            }
+        }
+        else if (options.dump_format == dnstap && (flags & DNSCAP_OUTPUT_ISDNS) && payload) {
+            int ret = output_dnstap(from, to, proto, flags, sport, dport, ts, out_payload, out_payloadlen, out_slim);
+
+            /* dumpfp is NULL when writing to dnstap_socket */
+            if (ret == DUMP_DNSTAP_FLUSH || (ret == DUMP_DNSTAP_OK && flush)) {
+                ret = dump_dnstap(dumpfp);
+                if (ret == DUMP_DNSTAP_OK && flush && dumpfp)
+                    fflush(dumpfp);
+            }
+            if (ret != DUMP_DNSTAP_OK) {
+                fprintf(stderr, "%s: output to dnstap failed [%u]\n", ProgramName, ret);
+                exit(1);
+            }
+        }
+        else if (options.dump_format == pcapng) {
+            int ret = dump_pcapng(dumpfp, output_mypcap ? output_mypcap->ifindex : 0, ts, out_pkt, out_olen, olen, out_slim);
+
+            if (ret == DUMP_PCAPNG_OK && flush)
+                fflush(dumpfp);
+            if (ret != DUMP_PCAPNG_OK) {
+                fprintf(stderr, "%s: output to pcapng failed [%u]\n", ProgramName, ret);
+                exit(1);
+            }
+        }
         else if (options.dump_format == cds) {
-            int ret = output_cds(from, to, proto, flags, sport, dport, ts, pkt_copy, olen, payload, payloadlen);
+            int ret = output_cds(from, to, proto, flags, sport, dport, ts, out_pkt, out_olen, out_payload, out_payloadlen, out_slim);
 
             if (ret == DUMP_CDS_FLUSH) {
                 if (dumper_close(ts)) {
@@ -2576,6 +3212,14 @@ output(const char *descr, iaddr from, iaddr to, uint8_t proto, unsigned flags,
             }
         }
 	}
+	for (sink = HEAD(sinks); sink != NULL; sink = NEXT(sink, link)) {
+		if (slim_olen && (options.slim & OPTIONS_SLIM(sink->spec->format)))
+			sink_output(sink, from, to, proto, flags, sport, dport, ts,
+				slim_pkt, slim_olen, slim_pkt + (payload - pkt_copy), slim_payloadlen, olen, &slim);
+		else
+			sink_output(sink, from, to, proto, flags, sport, dport, ts,
+				pkt_copy, olen, payload, payloadlen, olen, NULL);
+	}
 	for (p = HEAD(plugins); p != NULL; p = NEXT(p, link))
 		if (p->output)
 			(*p->output)(descr, from, to, proto, flags, sport, dport, ts, pkt_copy, olen, payload, payloadlen);
@@ -2600,6 +3244,9 @@ dumper_open(my_bpftimeval ts) {
 
 	if (dump_type == to_stdout) {
 		t = "-";
+	} else if (dump_type == to_file && shards != NULL) {
+		if (shards_open(ts))
+			return (TRUE);
 	} else if (dump_type == to_file) {
 		char sbuf[64];
 
@@ -2613,6 +3260,9 @@ dumper_open(my_bpftimeval ts) {
 			return (TRUE);
 		}
 		t = dumpnamepart;
+	} else if (dump_type == to_socket) {
+		if (dnstap_connect() != DUMP_DNSTAP_OK)
+			return (TRUE);
 	}
 	if (NULL != t) {
 	    if (options.dump_format == pcap) {
@@ -2623,6 +3273,23 @@ dumper_open(my_bpftimeval ts) {
 			    return (TRUE);
 		    }
 	    }
+	    else if (options.dump_format == cbor || options.dump_format == cdns
+		|| options.dump_format == arrow || options.dump_format == dnstap
+		|| options.dump_format == pcapng)
+	    {
+		    if (dump_type == to_stdout)
+			    dumpfp = stdout;
+		    else if (!(dumpfp = fopen(t, "w"))) {
+			    logerr("fopen(%s): %s", t, strerror(errno));
+			    return (TRUE);
+		    }
+		    if (options.dump_format == pcapng
+			&& dump_pcapng_open(dumpfp) != DUMP_PCAPNG_OK)
+		    {
+			    logerr("pcapng dump open: %s", strerror(errno));
+			    return (TRUE);
+		    }
+	    }
 	}
 	dumpstart = ts.tv_sec;
 	if (limit_seconds != 0U) {
@@ -2679,6 +3346,36 @@ void stat_callback(u_char* user, const struct pcap_stat* stats, const char* name
     }
 }
 
+static void
+pcapng_stat_callback(u_char* user, const struct pcap_stat* stats, const char* name, int dlt) {
+	mypcap_ptr mypcap;
+	struct timeval now;
+	int ret;
+
+	for (mypcap = HEAD(mypcaps);
+	     mypcap != NULL;
+	     mypcap = NEXT(mypcap, link)) {
+	     if (!strcmp(name, mypcap->name))
+	        break;
+	}
+	if (mypcap == NULL)
+		return;
+
+	gettimeofday(&now, NULL);
+	ret = dump_pcapng_stats((FILE *) user, mypcap->ifindex, now,
+		stats->ps_recv, stats->ps_ifdrop, stats->ps_drop);
+	if (ret != DUMP_PCAPNG_OK)
+		logerr("%s: output of pcapng statistics failed [%u]", mypcap->name, ret);
+}
+
+/* Write an Interface Statistics Block for every interface before closing */
+static void
+pcapng_stats(FILE *fp)
+{
+	if (options.pcapng_stats && dnstap_in == NULL)
+		pcap_thread_stats(&pcap_thread, pcapng_stat_callback, (u_char *) fp);
+}
+
 static void
 do_pcap_stats()
 {
@@ -2710,27 +3407,80 @@ dumper_close(my_bpftimeval ts) {
 	else if (options.dump_format == cbor) {
 	    int ret;
 
-    	if (dump_type == to_stdout) {
-    	    ret = dump_cbor(stdout);
-
+    	if (dumpfp) {
+    	    ret = dump_cbor_close(dumpfp);
     	    if (ret != DUMP_CBOR_OK) {
                 fprintf(stderr, "%s: output to cbor failed [%u]\n", ProgramName, ret);
                 exit(1);
     	    }
+    	    if (dumpfp == stdout)
+    	        fflush(dumpfp);
+    	    else
+    	        fclose(dumpfp);
+    	    dumpfp = NULL;
     	}
-    	else if (dump_type == to_file) {
-    	    FILE * fp;
+	}
+	else if (options.dump_format == cdns) {
+	    int ret;
 
-    	    if (!(fp = fopen(dumpnamepart, "w"))) {
-                fprintf(stderr, "%s: fopen(%s) failed: %s\n", ProgramName, dumpnamepart, strerror(errno));
+    	if (dumpfp) {
+    	    ret = dump_cdns_close(dumpfp);
+    	    if (ret != DUMP_CDNS_OK) {
+                fprintf(stderr, "%s: output to cdns failed [%u]\n", ProgramName, ret);
                 exit(1);
     	    }
-    	    ret = dump_cbor(fp);
-    	    if (ret != DUMP_CBOR_OK) {
-                fprintf(stderr, "%s: output to cbor failed [%u]\n", ProgramName, ret);
+    	    if (dumpfp == stdout)
+    	        fflush(dumpfp);
+    	    else
+    	        fclose(dumpfp);
+    	    dumpfp = NULL;
+    	}
+	}
+	else if (options.dump_format == arrow) {
+	    int ret;
+
+    	if (dumpfp) {
+    	    ret = dump_arrow_close(dumpfp);
+    	    if (ret != DUMP_ARROW_OK) {
+                fprintf(stderr, "%s: output to arrow failed [%u]\n", ProgramName, ret);
                 exit(1);
     	    }
-    	    fclose(fp);
+    	    if (dumpfp == stdout)
+    	        fflush(dumpfp);
+    	    else
+    	        fclose(dumpfp);
+    	    dumpfp = NULL;
+    	}
+	}
+	else if (options.dump_format == dnstap) {
+	    int ret;
+
+    	if (dumpfp || dump_type == to_socket) {
+    	    ret = dump_dnstap_close(dumpfp);
+    	    if (ret != DUMP_DNSTAP_OK) {
+                fprintf(stderr, "%s: output to dnstap failed [%u]\n", ProgramName, ret);
+                exit(1);
+    	    }
+    	    if (dumpfp == stdout)
+    	        fflush(dumpfp);
+    	    else if (dumpfp)
+    	        fclose(dumpfp);
+    	    dumpfp = NULL;
+    	}
+	}
+	else if (options.dump_format == pcapng) {
+	    int ret;
+
+    	if (dumpfp) {
+    	    pcapng_stats(dumpfp);
+    	    ret = dump_pcapng_close(dumpfp);
+    	    if (ret != DUMP_PCAPNG_OK) {
+                fprintf(stderr, "%s: output to pcapng failed [%u]\n", ProgramName, ret);
+                exit(1);
+    	    }
+    	    if (dumpfp != stdout)
+    	        fclose(dumpfp);
+    	    dumpfp = NULL;
     	}
 	}
 	else if (options.dump_format == cds) {
@@ -2751,7 +3501,7 @@ dumper_close(my_bpftimeval ts) {
                 fprintf(stderr, "%s: fopen(%s) failed: %s\n", ProgramName, dumpnamepart, strerror(errno));
                 exit(1);
     	    }
-    	    ret = dump_cds(fp);
+    	    ret = dump_cds_close(fp);
     	    if (ret != DUMP_CDS_OK) {
                 fprintf(stderr, "%s: output to cds failed [%u]\n", ProgramName, ret);
                 exit(1);
@@ -2760,12 +3510,16 @@ dumper_close(my_bpftimeval ts) {
     	}
 	}
 
-	if (dump_type == to_stdout) {
+	if (dump_type == to_stdout || dump_type == to_socket) {
 		assert(dumpname == NULL);
 		assert(dumpnamepart == NULL);
 		if (dumptrace >= 1)
 			fprintf(stderr, "%s: breaking\n", ProgramName);
 		ret = TRUE;
+	} else if (dump_type == to_file && shards != NULL) {
+		shards_close();
+		if (kick_cmd == NULL)
+			ret = TRUE;
 	} else if (dump_type == to_file) {
 		char *cmd = NULL;;
 
@@ -2789,7 +3543,7 @@ dumper_close(my_bpftimeval ts) {
 			    logerr("system: \"%s\" returned %d", cmd, x);
 			free(cmd);
 		}
-		if (kick_cmd == NULL && options.dump_format != cbor && options.dump_format != cds)
+		if (kick_cmd == NULL && options.dump_format != cds)
 			ret = TRUE;
 	}
 	for (p = HEAD(plugins); p != NULL; p = NEXT(p, link)) {
@@ -2804,47 +3558,1040 @@ dumper_close(my_bpftimeval ts) {
 	return (ret);
 }
 
-static void
-sigclose(int signum) {
-	if (0 == last_ts.tv_sec)
-		gettimeofday(&last_ts, NULL);
-	if (signum == SIGALRM)
-		alarm_set = FALSE;
-	if (dumper_close(last_ts))
-		breakloop_pcaps();
+static const char *
+compress_suffix(const char *prog) {
+	if (!strcmp(prog, "gzip"))
+		return (".gz");
+	if (!strcmp(prog, "bzip2"))
+		return (".bz2");
+	if (!strcmp(prog, "xz"))
+		return (".xz");
+	return ("");
 }
 
-static void
-sigbreak(int signum __attribute__((unused))) {
-	logerr("%s: signalled break", ProgramName);
-	main_exit = TRUE;
-	breakloop_pcaps();
+/*
+ * Open path for writing through an external compressor, the returned
+ * stream is the write end of a pipe to "prog -c" whose output goes to path.
+ */
+static FILE *
+compress_open(const char *prog, const char *path, pid_t *pid) {
+	int fd, fds[2];
+	FILE *fp;
+
+	if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0)
+		return (NULL);
+	if (pipe(fds) < 0) {
+		close(fd);
+		return (NULL);
+	}
+	/* don't leak the write end into later compressors */
+	(void) fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	if ((*pid = fork()) < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		close(fd);
+		return (NULL);
+	}
+	if (*pid == 0) {
+		sigset_t set;
+
+		sigemptyset(&set);
+		sigprocmask(SIG_SETMASK, &set, NULL);
+		if (dup2(fds[0], STDIN_FILENO) < 0 || dup2(fd, STDOUT_FILENO) < 0)
+			_exit(127);
+		close(fds[0]);
+		close(fds[1]);
+		close(fd);
+		execlp(prog, prog, "-c", (char *) NULL);
+		_exit(127);
+	}
+	close(fds[0]);
+	close(fd);
+	if (!(fp = fdopen(fds[1], "w"))) {
+		close(fds[1]);
+		(void) waitpid(*pid, NULL, 0);
+		*pid = 0;
+	}
+	return (fp);
 }
 
-#if HAVE_PTHREAD
-static void *
-sigthread(void * arg) {
-    sigset_t *set = (sigset_t*)arg;
-    int sig, err;
-
-    while (1) {
-        if ((err = sigwait(set, &sig))) {
-            logerr("sigwait: %s", strerror(err));
-            return 0;
-        }
+static int
+sink_open(sink_ptr sink, my_bpftimeval ts) {
+	const output_sink_t *spec = sink->spec;
+	char sbuf[64];
 
-        switch (sig) {
-            case SIGALRM:
-                sigclose(sig);
-                break;
+	assert(!sink->opened);
 
-            default:
-                sigbreak(sig);
-                break;
-        }
-    }
+	while (ts.tv_usec >= MILLION) {
+		ts.tv_sec++;
+		ts.tv_usec -= MILLION;
+	}
+	sink->next_interval = 0;
+	if (spec->limit_seconds != 0U)
+		sink->next_interval = ts.tv_sec
+			- (ts.tv_sec % spec->limit_seconds)
+			+ spec->limit_seconds;
+
+	strftime(sbuf, 64, "%Y%m%d.%H%M%S", gmtime((time_t *) &ts.tv_sec));
+	if (asprintf(&sink->name, "%s.%s.%06lu%s%s",
+		     spec->base, sbuf, (u_long) ts.tv_usec,
+		     spec->suffix ? spec->suffix : "",
+		     spec->compress ? compress_suffix(spec->compress) : "") < 0 ||
+	    asprintf(&sink->namepart, "%s.part", sink->name) < 0)
+	{
+		logerr("asprintf: %s", strerror(errno));
+		return (TRUE);
+	}
 
-    return 0;
+	if (spec->compress)
+		sink->fp = compress_open(spec->compress, sink->namepart, &sink->compress_pid);
+	else
+		sink->fp = fopen(sink->namepart, "w");
+	if (sink->fp == NULL) {
+		logerr("%s(%s): %s", spec->compress ? spec->compress : "fopen",
+			sink->namepart, strerror(errno));
+		return (TRUE);
+	}
+	if (spec->format == pcap) {
+		sink->dumper = pcap_dump_fopen(pcap_dead, sink->fp);
+		if (sink->dumper == NULL) {
+			logerr("pcap dump open: %s", pcap_geterr(pcap_dead));
+			return (TRUE);
+		}
+	}
+	else if (spec->format == pcapng && dump_pcapng_open(sink->fp) != DUMP_PCAPNG_OK) {
+		logerr("pcapng dump open: %s", strerror(errno));
+		return (TRUE);
+	}
+	if (dumptrace >= 1)
+		fprintf(stderr, "%s: opened %s\n", ProgramName, sink->namepart);
+
+	sink->msgcount = 0;
+	sink->bytes = 0;
+	sink->opened = TRUE;
+	return (FALSE);
+}
+
+static void
+sink_close(sink_ptr sink) {
+	const output_sink_t *spec = sink->spec;
+	char *cmd = NULL;
+	int ret;
+
+	if (!sink->opened)
+		return;
+
+	if (spec->format == pcap) {
+		/* closes sink->fp */
+		pcap_dump_close(sink->dumper);
+		sink->dumper = NULL;
+		sink->fp = NULL;
+	}
+	else if (spec->format == cbor) {
+		if ((ret = dump_cbor_close(sink->fp)) != DUMP_CBOR_OK) {
+			fprintf(stderr, "%s: output to cbor failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (spec->format == cdns) {
+		if ((ret = dump_cdns_close(sink->fp)) != DUMP_CDNS_OK) {
+			fprintf(stderr, "%s: output to cdns failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (spec->format == arrow) {
+		if ((ret = dump_arrow_close(sink->fp)) != DUMP_ARROW_OK) {
+			fprintf(stderr, "%s: output to arrow failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (spec->format == dnstap) {
+		if ((ret = dump_dnstap_close(sink->fp)) != DUMP_DNSTAP_OK) {
+			fprintf(stderr, "%s: output to dnstap failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (spec->format == pcapng) {
+		pcapng_stats(sink->fp);
+		if ((ret = dump_pcapng_close(sink->fp)) != DUMP_PCAPNG_OK) {
+			fprintf(stderr, "%s: output to pcapng failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (spec->format == cds) {
+		if ((ret = dump_cds_close(sink->fp)) != DUMP_CDS_OK) {
+			fprintf(stderr, "%s: output to cds failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	if (sink->fp != NULL) {
+		fclose(sink->fp);
+		sink->fp = NULL;
+	}
+	if (sink->compress_pid) {
+		int status;
+
+		if (waitpid(sink->compress_pid, &status, 0) < 0)
+			logerr("waitpid: %s", strerror(errno));
+		else if (!WIFEXITED(status) || WEXITSTATUS(status))
+			logerr("%s for %s failed", spec->compress, sink->name);
+		sink->compress_pid = 0;
+	}
+
+	if (dumptrace >= 1)
+		fprintf(stderr, "%s: closing %s\n", ProgramName, sink->name);
+	if (rename(sink->namepart, sink->name))
+		logerr("rename: %s", strerror(errno));
+	else if (spec->kick_cmd != NULL)
+		if (asprintf(&cmd, "%s %s &", spec->kick_cmd, sink->name) < 0) {
+			logerr("asprintf: %s", strerror(errno));
+			cmd = NULL;
+		}
+	free(sink->namepart); sink->namepart = NULL;
+	free(sink->name); sink->name = NULL;
+	if (cmd != NULL) {
+		int x = system(cmd);
+		if (x)
+			logerr("system: \"%s\" returned %d", cmd, x);
+		free(cmd);
+	}
+	sink->opened = FALSE;
+}
+
+/*
+ * Write one message to an output sink, each sink opens, rotates and
+ * closes its files on its own limits independently of -w.
+ */
+static void
+sink_output(sink_ptr sink, iaddr from, iaddr to, uint8_t proto, unsigned flags,
+    unsigned sport, unsigned dport, my_bpftimeval ts,
+    const u_char *pkt_copy, size_t olen,
+    const u_char *payload, size_t payloadlen, size_t wirelen,
+    const slim_t *slim)
+{
+	const output_sink_t *spec = sink->spec;
+	int ret = 0;
+
+	if (sink->opened && sink->next_interval != 0 && ts.tv_sec >= sink->next_interval)
+		sink_close(sink);
+	if (!sink->opened && sink_open(sink, ts)) {
+		fprintf(stderr, "%s: sink_open() failed\n", ProgramName);
+		exit(1);
+	}
+
+	if (spec->format == pcap) {
+		struct pcap_pkthdr h;
+
+		memset(&h, 0, sizeof h);
+		h.ts = ts;
+		h.len = wirelen;
+		h.caplen = olen;
+		pcap_dump((u_char *)sink->dumper, &h, pkt_copy);
+		if (flush)
+			pcap_dump_flush(sink->dumper);
+	}
+	else if (spec->format == pcapng) {
+		ret = dump_pcapng(sink->fp, output_mypcap ? output_mypcap->ifindex : 0,
+			ts, pkt_copy, olen, wirelen, slim);
+		if (ret == DUMP_PCAPNG_OK && flush)
+			fflush(sink->fp);
+		if (ret != DUMP_PCAPNG_OK) {
+			fprintf(stderr, "%s: output to pcapng failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (!(flags & DNSCAP_OUTPUT_ISDNS) || !payload) {
+		return;
+	}
+	else if (spec->format == cbor) {
+		ret = output_cbor(from, to, proto, flags, sport, dport, ts, payload, payloadlen, slim);
+		if (ret == DUMP_CBOR_FLUSH || (ret == DUMP_CBOR_OK && flush)) {
+			ret = dump_cbor(sink->fp);
+			if (ret == DUMP_CBOR_OK && flush)
+				fflush(sink->fp);
+		}
+		if (ret != DUMP_CBOR_OK) {
+			fprintf(stderr, "%s: output to cbor failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (spec->format == cdns) {
+		ret = output_cdns(from, to, proto, flags, sport, dport, ts, payload, payloadlen, slim);
+		if (ret == DUMP_CDNS_FLUSH || (ret == DUMP_CDNS_OK && flush)) {
+			ret = dump_cdns(sink->fp);
+			if (ret == DUMP_CDNS_OK && flush)
+				fflush(sink->fp);
+		}
+		if (ret != DUMP_CDNS_OK) {
+			fprintf(stderr, "%s: output to cdns failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (spec->format == arrow) {
+		ret = output_arrow(from, to, proto, flags, sport, dport, ts, payload, payloadlen, slim);
+		if (ret == DUMP_ARROW_FLUSH || (ret == DUMP_ARROW_OK && flush)) {
+			ret = dump_arrow(sink->fp);
+			if (ret == DUMP_ARROW_OK && flush)
+				fflush(sink->fp);
+		}
+		if (ret != DUMP_ARROW_OK) {
+			fprintf(stderr, "%s: output to arrow failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (spec->format == dnstap) {
+		ret = output_dnstap(from, to, proto, flags, sport, dport, ts, payload, payloadlen, slim);
+		if (ret == DUMP_DNSTAP_FLUSH || (ret == DUMP_DNSTAP_OK && flush)) {
+			ret = dump_dnstap(sink->fp);
+			if (ret == DUMP_DNSTAP_OK && flush)
+				fflush(sink->fp);
+		}
+		if (ret != DUMP_DNSTAP_OK) {
+			fprintf(stderr, "%s: output to dnstap failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (spec->format == cds) {
+		ret = output_cds(from, to, proto, flags, sport, dport, ts, pkt_copy, olen, payload, payloadlen, slim);
+		if (ret != DUMP_CDS_OK && ret != DUMP_CDS_FLUSH) {
+			fprintf(stderr, "%s: output to cds failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+
+	/* the message is in this file even if it ends here */
+	sink->msgcount++;
+	sink->bytes += olen;
+	if ((spec->limit_packets != 0U && sink->msgcount >= spec->limit_packets)
+	    || (spec->limit_size != 0U && sink->bytes >= spec->limit_size))
+		sink_close(sink);
+	/* a CDS stream restarts its dictionaries in a new file */
+	else if (spec->format == cds && ret == DUMP_CDS_FLUSH)
+		sink_close(sink);
+}
+
+/*
+ * Select the shard for a message, queries and responses of the same
+ * initiator always select the same shard.
+ */
+static unsigned
+shard_select(iaddr from, iaddr to, unsigned flags, unsigned sport,
+    unsigned dport, const u_char *payload)
+{
+	if (options.shard_key == shard_vlan)
+		return (output_vlan % options.shard_count);
+	if (options.shard_key == shard_interface)
+		return (output_mypcap ? output_mypcap->shard % options.shard_count : 0);
+	return (shard_hash(from, to, flags, dport, dns_port, payload,
+	    options.shard_key == shard_client, options.shard_count));
+}
+
+/*
+ * Hash the client or responder address of a message into one of count
+ * shards, also given to plugins through <name>_set_shard().
+ */
+static unsigned
+shard_hash(iaddr from, iaddr to, unsigned flags, unsigned dport,
+    unsigned port, const u_char *payload, int by_client, unsigned count)
+{
+	const u_char *p;
+	size_t len;
+	uint32_t hash = 2166136261U;
+	int from_initiator;
+	const iaddr *ia;
+
+	if (count < 2)
+		return (0);
+	/* fragments carry no ports and are almost always responses */
+	if ((flags & DNSCAP_OUTPUT_ISDNS) && payload)
+		from_initiator = !(payload[2] & 0x80);
+	else
+		from_initiator = (dport == port);
+	if (by_client == from_initiator)
+		ia = &from;
+	else
+		ia = &to;
+
+	if (ia->af == AF_INET6) {
+		p = (const u_char *) &ia->u.a6;
+		len = sizeof(ia->u.a6);
+	} else {
+		p = (const u_char *) &ia->u.a4;
+		len = sizeof(ia->u.a4);
+	}
+	while (len--) {
+		hash ^= *p++;
+		hash *= 16777619U;
+	}
+	return (hash % count);
+}
+
+#if HAVE_PTHREAD
+static void *
+shard_writer(void *arg) {
+	struct shard *shard = (struct shard *) arg;
+	const u_char *p, *end;
+	struct pcap_pkthdr h;
+
+	pthread_mutex_lock(&shard->lock);
+	for (;;) {
+		while (shard->pending < 0 && !shard->stop)
+			pthread_cond_wait(&shard->cond, &shard->lock);
+		if (shard->pending < 0)
+			break;
+		p = shard->buf[shard->pending];
+		end = p + shard->pending_len;
+		pthread_mutex_unlock(&shard->lock);
+
+		while (p < end) {
+			memcpy(&h, p, sizeof h);
+			p += sizeof h;
+			pcap_dump((u_char *) shard->dumper, &h, p);
+			p += (h.caplen + 7) & ~7;
+		}
+		if (flush)
+			pcap_dump_flush(shard->dumper);
+
+		pthread_mutex_lock(&shard->lock);
+		shard->pending = -1;
+		pthread_cond_broadcast(&shard->cond);
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return (NULL);
+}
+
+/* Hand the collected packets to the writer thread. */
+static void
+shard_handoff(struct shard *shard) {
+	pthread_mutex_lock(&shard->lock);
+	while (shard->pending >= 0)
+		pthread_cond_wait(&shard->cond, &shard->lock);
+	if (shard->fill) {
+		shard->pending = shard->active;
+		shard->pending_len = shard->fill;
+		shard->active ^= 1;
+		shard->fill = 0;
+		pthread_cond_broadcast(&shard->cond);
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+/* Wait until the writer thread has written everything handed to it. */
+static void
+shard_sync(struct shard *shard) {
+	shard_handoff(shard);
+	pthread_mutex_lock(&shard->lock);
+	while (shard->pending >= 0)
+		pthread_cond_wait(&shard->cond, &shard->lock);
+	pthread_mutex_unlock(&shard->lock);
+}
+#endif
+
+static void
+shard_dump(struct shard *shard, const struct pcap_pkthdr *h, const u_char *pkt) {
+#if HAVE_PTHREAD
+	if (options.shard_threads) {
+		size_t need = sizeof *h + ((h->caplen + 7) & ~7);
+
+		if (shard->fill + need > SHARD_BUFSIZE)
+			shard_handoff(shard);
+		memcpy(shard->buf[shard->active] + shard->fill, h, sizeof *h);
+		memcpy(shard->buf[shard->active] + shard->fill + sizeof *h, pkt, h->caplen);
+		shard->fill += need;
+		if (flush)
+			shard_handoff(shard);
+		return;
+	}
+#endif
+	pcap_dump((u_char *) shard->dumper, h, pkt);
+	if (flush)
+		pcap_dump_flush(shard->dumper);
+}
+
+static int
+shards_open(my_bpftimeval ts) {
+	char sbuf[64];
+	unsigned n;
+
+	strftime(sbuf, 64, "%Y%m%d.%H%M%S", gmtime((time_t *) &ts.tv_sec));
+	for (n = 0; n < options.shard_count; n++) {
+		struct shard *shard = &shards[n];
+
+		if (asprintf(&shard->name, "%s.%u.%s.%06lu%s",
+			     dump_base, n, sbuf,
+			     (u_long) ts.tv_usec, dump_suffix ? dump_suffix : "") < 0 ||
+		    asprintf(&shard->namepart, "%s.part", shard->name) < 0)
+		{
+			logerr("asprintf: %s", strerror(errno));
+			return (TRUE);
+		}
+		shard->dumper = pcap_dump_open(pcap_dead, shard->namepart);
+		if (shard->dumper == NULL) {
+			logerr("pcap dump open: %s",
+				pcap_geterr(pcap_dead));
+			return (TRUE);
+		}
+#if HAVE_PTHREAD
+		/* started here so the thread inherits the blocked signals */
+		if (options.shard_threads && !shard->started) {
+			int err;
+
+			if ((err = pthread_create(&shard->thread, NULL, shard_writer, shard))) {
+				logerr("pthread_create: %s", strerror(err));
+				return (TRUE);
+			}
+			shard->started = TRUE;
+		}
+#endif
+	}
+	return (FALSE);
+}
+
+static void
+shards_close(void) {
+	unsigned n;
+
+	for (n = 0; n < options.shard_count; n++) {
+		struct shard *shard = &shards[n];
+		char *cmd = NULL;
+
+		if (shard->dumper == NULL)
+			continue;
+#if HAVE_PTHREAD
+		if (shard->started)
+			shard_sync(shard);
+#endif
+		pcap_dump_close(shard->dumper);
+		shard->dumper = NULL;
+
+		if (dumptrace >= 1)
+			fprintf(stderr, "%s: closing %s\n",
+				ProgramName, shard->name);
+		if (rename(shard->namepart, shard->name))
+			logerr("rename: %s", strerror(errno));
+		else if (kick_cmd != NULL)
+			if (asprintf(&cmd, "%s %s &", kick_cmd, shard->name) < 0) {
+				logerr("asprintf: %s", strerror(errno));
+				cmd = NULL;
+			}
+		free(shard->namepart); shard->namepart = NULL;
+		free(shard->name); shard->name = NULL;
+		if (cmd != NULL) {
+			int x = system(cmd);
+			if (x)
+			    logerr("system: \"%s\" returned %d", cmd, x);
+			free(cmd);
+		}
+	}
+}
+
+static void
+shards_free(void) {
+#if HAVE_PTHREAD
+	unsigned n;
+
+	if (shards == NULL)
+		return;
+	for (n = 0; n < options.shard_count; n++) {
+		struct shard *shard = &shards[n];
+
+		if (!options.shard_threads)
+			continue;
+		if (shard->started) {
+			pthread_mutex_lock(&shard->lock);
+			shard->stop = TRUE;
+			pthread_cond_broadcast(&shard->cond);
+			pthread_mutex_unlock(&shard->lock);
+			pthread_join(shard->thread, NULL);
+		}
+		pthread_mutex_destroy(&shard->lock);
+		pthread_cond_destroy(&shard->cond);
+		free(shard->buf[0]);
+		free(shard->buf[1]);
+	}
+#endif
+	free(shards);
+	shards = NULL;
+}
+
+static void
+ring_evict(void) {
+	const struct ring_rec *rec = (const struct ring_rec *) (ring_buf + ring_head);
+
+	ring_head += rec->size;
+	ring_count--;
+	if (ring_wrap != 0 && ring_head == ring_wrap) {
+		ring_head = 0;
+		ring_wrap = 0;
+	}
+}
+
+/* Make room for need bytes at the tail, evicting the oldest records. */
+static struct ring_rec *
+ring_reserve(size_t need) {
+	for (;;) {
+		if (ring_count == 0) {
+			ring_head = ring_tail = ring_wrap = 0;
+			return ((struct ring_rec *) ring_buf);
+		}
+		if (ring_wrap == 0) {
+			if (options.ring_size - ring_tail >= need)
+				break;
+			ring_wrap = ring_tail;
+			ring_tail = 0;
+			continue;
+		}
+		if (ring_head - ring_tail >= need)
+			break;
+		ring_evict();
+	}
+	return ((struct ring_rec *) (ring_buf + ring_tail));
+}
+
+static void
+ring_dump_write(struct ring_dump *dump, const struct ring_rec *rec) {
+	const u_char *pkt = (const u_char *) (rec + 1);
+	const u_char *payload = rec->payloadlen ? pkt + rec->payload_off : NULL;
+	const slim_t *slim = rec->is_slim ? &rec->slim : NULL;
+	int ret;
+
+	if (options.dump_format == pcap) {
+		struct pcap_pkthdr h;
+
+		memset(&h, 0, sizeof h);
+		h.ts = rec->ts;
+		h.len = rec->wirelen;
+		h.caplen = rec->olen;
+		pcap_dump((u_char *)dump->dumper, &h, pkt);
+		if (flush)
+			pcap_dump_flush(dump->dumper);
+		return;
+	}
+	if (options.dump_format == pcapng) {
+		ret = dump_pcapng(dump->fp, rec->ifindex, rec->ts, pkt, rec->olen, rec->wirelen, slim);
+		if (ret == DUMP_PCAPNG_OK && flush)
+			fflush(dump->fp);
+		if (ret != DUMP_PCAPNG_OK) {
+			fprintf(stderr, "%s: output to pcapng failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+		return;
+	}
+	if (!(rec->flags & DNSCAP_OUTPUT_ISDNS) || !payload)
+		return;
+	if (options.dump_format == cbor) {
+		ret = output_cbor(rec->from, rec->to, rec->proto, rec->flags,
+			rec->sport, rec->dport, rec->ts, payload, rec->payloadlen, slim);
+		if (ret == DUMP_CBOR_FLUSH)
+			ret = dump_cbor(dump->fp);
+		if (ret != DUMP_CBOR_OK) {
+			fprintf(stderr, "%s: output to cbor failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (options.dump_format == cdns) {
+		ret = output_cdns(rec->from, rec->to, rec->proto, rec->flags,
+			rec->sport, rec->dport, rec->ts, payload, rec->payloadlen, slim);
+		if (ret == DUMP_CDNS_FLUSH)
+			ret = dump_cdns(dump->fp);
+		if (ret != DUMP_CDNS_OK) {
+			fprintf(stderr, "%s: output to cdns failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (options.dump_format == arrow) {
+		ret = output_arrow(rec->from, rec->to, rec->proto, rec->flags,
+			rec->sport, rec->dport, rec->ts, payload, rec->payloadlen, slim);
+		if (ret == DUMP_ARROW_FLUSH)
+			ret = dump_arrow(dump->fp);
+		if (ret != DUMP_ARROW_OK) {
+			fprintf(stderr, "%s: output to arrow failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (options.dump_format == dnstap) {
+		ret = output_dnstap(rec->from, rec->to, rec->proto, rec->flags,
+			rec->sport, rec->dport, rec->ts, payload, rec->payloadlen, slim);
+		if (ret == DUMP_DNSTAP_FLUSH)
+			ret = dump_dnstap(dump->fp);
+		if (ret != DUMP_DNSTAP_OK) {
+			fprintf(stderr, "%s: output to dnstap failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+	else if (options.dump_format == cds) {
+		ret = output_cds(rec->from, rec->to, rec->proto, rec->flags,
+			rec->sport, rec->dport, rec->ts, pkt, rec->olen,
+			payload, rec->payloadlen, slim);
+		if (ret == DUMP_CDS_FLUSH)
+			ret = dump_cds(dump->fp);
+		if (ret != DUMP_CDS_OK) {
+			fprintf(stderr, "%s: output to cds failed [%u]\n", ProgramName, ret);
+			exit(1);
+		}
+	}
+}
+
+static void
+ring_dump_close(struct ring_dump *dump) {
+	char *cmd = NULL;
+	int ret;
+
+	if (options.dump_format == pcap) {
+		pcap_dump_close(dump->dumper);
+		dump->dumper = NULL;
+	}
+	else {
+		if (options.dump_format == cbor)
+			ret = dump_cbor_close(dump->fp) == DUMP_CBOR_OK;
+		else if (options.dump_format == cdns)
+			ret = dump_cdns_close(dump->fp) == DUMP_CDNS_OK;
+		else if (options.dump_format == arrow)
+			ret = dump_arrow_close(dump->fp) == DUMP_ARROW_OK;
+		else if (options.dump_format == dnstap)
+			ret = dump_dnstap_close(dump->fp) == DUMP_DNSTAP_OK;
+		else if (options.dump_format == pcapng)
+			ret = dump_pcapng_close(dump->fp) == DUMP_PCAPNG_OK;
+		else
+			ret = dump_cds_close(dump->fp) == DUMP_CDS_OK;
+		if (!ret) {
+			fprintf(stderr, "%s: output to %s failed\n", ProgramName,
+				options.dump_format == cbor ? "cbor" :
+				options.dump_format == cdns ? "cdns" :
+				options.dump_format == arrow ? "arrow" :
+				options.dump_format == dnstap ? "dnstap" :
+				options.dump_format == pcapng ? "pcapng" : "cds");
+			exit(1);
+		}
+		fclose(dump->fp);
+		dump->fp = NULL;
+	}
+
+	if (dumptrace >= 1)
+		fprintf(stderr, "%s: closing %s\n", ProgramName, dump->name);
+	if (rename(dump->namepart, dump->name))
+		logerr("rename: %s", strerror(errno));
+	else if (kick_cmd != NULL)
+		if (asprintf(&cmd, "%s %s &", kick_cmd, dump->name) < 0) {
+			logerr("asprintf: %s", strerror(errno));
+			cmd = NULL;
+		}
+	free(dump->namepart); dump->namepart = NULL;
+	free(dump->name); dump->name = NULL;
+	if (cmd != NULL) {
+		int x = system(cmd);
+		if (x)
+			logerr("system: \"%s\" returned %d", cmd, x);
+		free(cmd);
+	}
+	dump->active = FALSE;
+}
+
+/* Start a dump for a trigger and write out what the ring holds. */
+static void
+ring_dump_start(enum ring_source source, my_bpftimeval ts) {
+	struct ring_dump *dump = &ring_dumps[source];
+	const struct ring_rec *rec;
+	char sbuf[64];
+	size_t pos;
+	unsigned n;
+
+	/* the cbor, cds, cdns, arrow and dnstap encoders can only feed one dump at a time */
+	if (options.dump_format != pcap && options.dump_format != pcapng) {
+		for (n = 0; n < ring_sources; n++)
+			if (ring_dumps[n].active)
+				dump = &ring_dumps[n];
+	}
+	if (dump->active) {
+		dump->until = ts.tv_sec + options.ring_post_seconds;
+		return;
+	}
+
+	strftime(sbuf, 64, "%Y%m%d.%H%M%S", gmtime((time_t *) &ts.tv_sec));
+	if (asprintf(&dump->name, "%s.%s.%06lu.%s%s",
+		     dump_base, sbuf, (u_long) ts.tv_usec,
+		     ring_source_names[source], dump_suffix ? dump_suffix : "") < 0 ||
+	    asprintf(&dump->namepart, "%s.part", dump->name) < 0)
+	{
+		logerr("asprintf: %s", strerror(errno));
+		exit(1);
+	}
+	if (options.dump_format == pcap) {
+		if ((dump->dumper = pcap_dump_open(pcap_dead, dump->namepart)) == NULL) {
+			logerr("pcap dump open: %s", pcap_geterr(pcap_dead));
+			exit(1);
+		}
+	}
+	else if ((dump->fp = fopen(dump->namepart, "w")) == NULL) {
+		logerr("fopen(%s): %s", dump->namepart, strerror(errno));
+		exit(1);
+	}
+	else if (options.dump_format == pcapng && dump_pcapng_open(dump->fp) != DUMP_PCAPNG_OK) {
+		logerr("pcapng dump open: %s", strerror(errno));
+		exit(1);
+	}
+	logerr("%s trigger, dumping %u messages to %s",
+		ring_source_names[source], ring_count, dump->name);
+	dump->active = TRUE;
+	dump->until = ts.tv_sec + options.ring_post_seconds;
+
+	for (pos = ring_head, n = 0; n < ring_count; n++) {
+		rec = (const struct ring_rec *) (ring_buf + pos);
+		ring_dump_write(dump, rec);
+		pos += rec->size;
+		if (ring_wrap != 0 && pos == ring_wrap)
+			pos = 0;
+	}
+	if (options.ring_post_seconds == 0)
+		ring_dump_close(dump);
+}
+
+/*
+ * Record a message in the flight recorder ring, running dumps write it
+ * directly from the ring until their post trigger time has passed.
+ */
+static void
+ring_output(iaddr from, iaddr to, uint8_t proto, unsigned flags,
+    unsigned sport, unsigned dport, my_bpftimeval ts,
+    const u_char *pkt_copy, size_t olen,
+    const u_char *payload, size_t payloadlen, size_t wirelen,
+    const slim_t *slim)
+{
+	struct ring_rec *rec;
+	size_t need = (sizeof *rec + olen + 7) & ~7;
+	unsigned n;
+
+	if (options.ring_rcode >= 0 && (flags & DNSCAP_OUTPUT_ISDNS) && payload
+	    && (payload[2] & 0x80))
+	{
+		if (ts.tv_sec >= ring_rcode_start + options.ring_rcode_seconds) {
+			ring_rcode_start = ts.tv_sec;
+			ring_rcode_seen = 0;
+		}
+		if ((payload[3] & 0xf) == options.ring_rcode
+		    && ++ring_rcode_seen == options.ring_rcode_count)
+			ring_pending |= 1 << ring_rcode;
+	}
+	if (options.ring_seconds != 0) {
+		while (ring_count > 0
+		    && ((const struct ring_rec *) (ring_buf + ring_head))->ts.tv_sec
+			+ options.ring_seconds <= ts.tv_sec)
+			ring_evict();
+	}
+	rec = ring_reserve(need);
+	memset(rec, 0, sizeof *rec);
+	rec->ts = ts;
+	rec->from = from;
+	rec->to = to;
+	rec->proto = proto;
+	rec->flags = flags;
+	rec->sport = sport;
+	rec->dport = dport;
+	rec->olen = olen;
+	rec->wirelen = wirelen;
+	rec->ifindex = output_mypcap ? output_mypcap->ifindex : 0;
+	if (slim != NULL) {
+		rec->is_slim = TRUE;
+		rec->slim = *slim;
+	}
+	if (payload && payload >= pkt_copy && payload + payloadlen <= pkt_copy + olen) {
+		rec->payload_off = payload - pkt_copy;
+		rec->payloadlen = payloadlen;
+	}
+	rec->size = need;
+	memcpy(rec + 1, pkt_copy, olen);
+	ring_tail += need;
+	ring_count++;
+
+	for (n = 0; n < ring_sources; n++) {
+		struct ring_dump *dump = &ring_dumps[n];
+
+		if (!dump->active)
+			continue;
+		if (ts.tv_sec >= dump->until)
+			ring_dump_close(dump);
+		else
+			ring_dump_write(dump, rec);
+	}
+	ring_check(ts);
+}
+
+/*
+ * Start the dumps of the triggers that fired, also called from the main
+ * loop so a signal or plugin trigger is not held back until the next
+ * message arrives.
+ */
+static void
+ring_check(my_bpftimeval ts) {
+	unsigned n;
+
+	if (ring_signalled) {
+		ring_signalled = FALSE;
+		ring_pending |= 1 << ring_signal;
+	}
+	for (n = 0; n < ring_sources; n++)
+		if (ring_pending & (1 << n))
+			ring_dump_start(n, ts);
+	ring_pending = 0;
+}
+
+/* Plugins raise an event with this function, see <name>_set_trigger(). */
+static void
+ring_trigger(const char *reason) {
+	if (ring_buf == NULL)
+		return;
+	if (dumptrace >= 1)
+		fprintf(stderr, "%s: plugin trigger: %s\n", ProgramName, reason);
+	ring_pending |= 1 << ring_plugin;
+}
+
+static void
+ring_free(void) {
+	unsigned n;
+
+	for (n = 0; n < ring_sources; n++)
+		if (ring_dumps[n].active)
+			ring_dump_close(&ring_dumps[n]);
+	free(ring_buf);
+	ring_buf = NULL;
+}
+
+static void
+sigtrigger(int signum __attribute__((unused))) {
+	ring_signalled = TRUE;
+}
+
+/*
+ * Build a slim copy of a UDP DNS response in out, keeping the IP and UDP
+ * headers, the DNS header, the question section and optionally the OPT
+ * record.  The section counts, IP and UDP lengths and checksums are
+ * fixed up to match.  Returns the new packet length, or 0 if the response
+ * can't or doesn't need to be slimmed.
+ */
+static unsigned
+slim_response(const u_char *pkt, unsigned olen, const u_char *payload,
+    unsigned payloadlen, u_char *out, unsigned *out_payloadlen)
+{
+	const u_char *eom = payload + payloadlen, *p, *opt = NULL;
+	unsigned dnsoff = payload - pkt, udplen, n, count, optlen = 0;
+	uint16_t qdcount, an_ns_ar[3], rdlen;
+	u_char *ip = out, *udp = out + dnsoff - 8, *dns = out + dnsoff;
+	int i, x;
+
+	if (payload < pkt + 8 || payloadlen < 12 || dnsoff + payloadlen > olen)
+		return (0);
+	qdcount = ns_get16(payload + 4);
+	for (i = 0; i < 3; i++)
+		an_ns_ar[i] = ns_get16(payload + 6 + 2 * i);
+
+	/* question section */
+	p = payload + 12;
+	for (n = 0; n < qdcount; n++) {
+		if ((x = dn_skipname(p, eom)) < 0 || p + x + 4 > eom)
+			return (0);
+		p += x + 4;
+	}
+	udplen = 8 + (p - payload);
+
+	/* find OPT in the additional section */
+	if (options.slim_keep_opt && an_ns_ar[2]) {
+		const u_char *rr = p;
+
+		count = an_ns_ar[0] + an_ns_ar[1] + an_ns_ar[2];
+		for (n = 0; n < count; n++) {
+			uint16_t type;
+
+			if ((x = dn_skipname(rr, eom)) < 0 || rr + x + 10 > eom)
+				break;
+			type = ns_get16(rr + x);
+			rdlen = ns_get16(rr + x + 8);
+			if (rr + x + 10 + rdlen > eom)
+				break;
+			if (n >= an_ns_ar[0] + an_ns_ar[1] && type == ns_t_opt && x == 1) {
+				opt = rr;
+				optlen = 11 + rdlen;
+				break;
+			}
+			rr += x + 10 + rdlen;
+		}
+	}
+	if (udplen - 8 + optlen >= payloadlen)
+		return (0);
+
+	memcpy(out, pkt, dnsoff);
+	memcpy(dns, payload, p - payload);
+	if (opt != NULL)
+		memcpy(dns + (p - payload), opt, optlen);
+	udplen += optlen;
+	memset(dns + 6, 0, 6);
+	if (opt != NULL)
+		dns[11] = 1;
+	*out_payloadlen = udplen - 8;
+
+	/* fix up lengths and checksums, an IPv4 UDP checksum of zero is none */
+	udp[4] = udplen >> 8;
+	udp[5] = udplen;
+	if ((ip[0] >> 4) == 4) {
+		unsigned len = (udp - ip) + udplen;
+
+		ip[2] = len >> 8;
+		ip[3] = len;
+		fix_checksums(ip, udp, udplen, IPPROTO_UDP, udp[6] || udp[7]);
+	} else {
+		unsigned len = (udp - (ip + 40)) + udplen;
+
+		ip[4] = len >> 8;
+		ip[5] = len;
+		fix_checksums(ip, udp, udplen, IPPROTO_UDP, TRUE);
+	}
+	return ((udp - ip) + udplen);
+}
+
+static void
+sigclose(int signum) {
+	if (0 == last_ts.tv_sec)
+		gettimeofday(&last_ts, NULL);
+	if (signum == SIGALRM)
+		alarm_set = FALSE;
+	if (dumper_close(last_ts))
+		breakloop_pcaps();
+}
+
+static void
+sigbreak(int signum __attribute__((unused))) {
+	logerr("%s: signalled break", ProgramName);
+	main_exit = TRUE;
+	breakloop_pcaps();
+}
+
+#if HAVE_PTHREAD
+static void *
+sigthread(void * arg) {
+    sigset_t *set = (sigset_t*)arg;
+    int sig, err;
+
+    while (1) {
+        if ((err = sigwait(set, &sig))) {
+            logerr("sigwait: %s", strerror(err));
+            return 0;
+        }
+
+        switch (sig) {
+            case SIGALRM:
+                sigclose(sig);
+                break;
+
+            case SIGUSR1:
+                sigtrigger(sig);
+                break;
+
+            default:
+                sigbreak(sig);
+                break;
+        }
+    }
+
+    return 0;
 }
 #endif
 
@@ -2871,6 +4618,53 @@ in_checksum(const u_char *ptr, size_t len) {
 	return ((uint16_t) sum);
 }
 
+/*
+ * Set the IPv4 header checksum and, if l4sum, the UDP or TCP checksum of
+ * a raw IP packet once its lengths are filled in, l4 points at the UDP or
+ * TCP header and l4len covers it and the payload.
+ */
+static void
+fix_checksums(u_char *ip, u_char *l4, size_t l4len, uint8_t proto, int l4sum)
+{
+	u_char pseudo[40], *ckp = l4 + (proto == IPPROTO_TCP ? 16 : 6);
+	size_t plen;
+	uint32_t sum;
+	uint16_t ck;
+
+	if ((ip[0] >> 4) == 4) {
+		ip[10] = ip[11] = 0;
+		ck = ~in_checksum(ip, (ip[0] & 0xf) << 2);
+		memcpy(ip + 10, &ck, 2);
+		if (!l4sum)
+			return;
+		memcpy(pseudo, ip + 12, 8);
+		pseudo[8] = 0;
+		pseudo[9] = proto;
+		pseudo[10] = l4len >> 8;
+		pseudo[11] = l4len;
+		plen = 12;
+	} else {
+		if (!l4sum)
+			return;
+		memcpy(pseudo, ip + 8, 32);
+		pseudo[32] = pseudo[33] = 0;
+		pseudo[34] = l4len >> 8;
+		pseudo[35] = l4len;
+		pseudo[36] = pseudo[37] = pseudo[38] = 0;
+		pseudo[39] = proto;
+		plen = 40;
+	}
+	ckp[0] = ckp[1] = 0;
+	sum = in_checksum(pseudo, plen) + in_checksum(l4, l4len);
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	ck = ~sum;
+	/* zero means no checksum for UDP */
+	if (ck == 0 && proto == IPPROTO_UDP)
+		ck = 0xffff;
+	memcpy(ckp, &ck, 2);
+}
+
 static int
 logerr(const char *fmt, ...)
 {
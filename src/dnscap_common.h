@@ -76,6 +76,20 @@ typedef struct {
  */
 typedef int logerr_t(const char *fmt, ...);
 
+/*
+ * plugins that export <name>_set_trigger() are given this function
+ * to dump the flight recorder ring, see ring_size
+ */
+typedef void trigger_t(const char *reason);
+
+/*
+ * plugins that export <name>_set_shard() are given this function and the
+ * DNS port, it picks one of count shards for a message so that queries
+ * and responses of the same client (by_client) or responder stay together
+ */
+typedef unsigned shard_t(iaddr from, iaddr to, unsigned flags, unsigned dport,
+        unsigned port, const u_char *payload, int by_client, unsigned count);
+
 /*
  * Prototype for the plugin "output" function
  */
@@ -92,6 +106,15 @@ typedef void output_t(const char *descr,
         const u_char *payload,
         const unsigned payloadlen);
 
+/*
+ * What slim= cut from a response before it is written, the length of the
+ * original DNS message and its answer, authority and additional counts
+ */
+typedef struct {
+        size_t                  payloadlen;
+        uint16_t                counts[3];
+} slim_t;
+
 #define DNSCAP_OUTPUT_ISFRAG (1<<0)
 #define DNSCAP_OUTPUT_ISDNS (1<<1)
 
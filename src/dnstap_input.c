@@ -0,0 +1,867 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "config.h"
+
+#include "dnstap_input.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/*
+ * dnstap (http://dnstap.info) in Frame Streams as input, the DNS message
+ * of each Dnstap protobuf message is given back with the addresses, ports
+ * and time it was sent with so it can be handled as if it was captured.
+ *
+ * A file is read frame by frame as it is asked for, the DNS messages are
+ * between a START and a STOP control frame and more than one such stream
+ * may follow each other.
+ *
+ * Listening on a Unix socket a reader thread accepts any number of writers,
+ * up to DNSTAP_INPUT_CONNECTIONS at a time, and does the bidirectional
+ * handshake with each one, READY is answered by ACCEPT and STOP by FINISH.
+ * Writers that just send START, as to a file, are taken as well. The data frames of all
+ * connections are put in a queue of DNSTAP_INPUT_QUEUE bytes which is
+ * emptied by dnstap_input_next(), if it is full the reader thread waits and
+ * the writers are left to buffer or drop the frames on their side.
+ */
+
+#define DNSTAP_CONTENT_TYPE "protobuf:dnstap.Dnstap"
+
+/* Frame Streams control frame types and fields */
+#define FSTRM_CONTROL_ACCEPT        1
+#define FSTRM_CONTROL_START         2
+#define FSTRM_CONTROL_STOP          3
+#define FSTRM_CONTROL_READY         4
+#define FSTRM_CONTROL_FINISH        5
+#define FSTRM_FIELD_CONTENT_TYPE    1
+
+/* the largest control frame accepted */
+#define FSTRM_CONTROL_MAX 512
+
+/* protobuf wire types */
+#define PB_VARINT   0
+#define PB_FIXED64  1
+#define PB_BYTES    2
+#define PB_FIXED32  5
+
+/* the fields used of Dnstap and Message */
+#define PB_FIELDS 16
+
+#define DNSTAP_FIELD_MESSAGE    14
+#define DNSTAP_FIELD_TYPE       15
+
+#define MESSAGE_FIELD_TYPE                  1
+#define MESSAGE_FIELD_SOCKET_FAMILY         2
+#define MESSAGE_FIELD_SOCKET_PROTOCOL       3
+#define MESSAGE_FIELD_QUERY_ADDRESS         4
+#define MESSAGE_FIELD_RESPONSE_ADDRESS      5
+#define MESSAGE_FIELD_QUERY_PORT            6
+#define MESSAGE_FIELD_RESPONSE_PORT         7
+#define MESSAGE_FIELD_QUERY_TIME_SEC        8
+#define MESSAGE_FIELD_QUERY_TIME_NSEC       9
+#define MESSAGE_FIELD_QUERY_MESSAGE         10
+#define MESSAGE_FIELD_RESPONSE_TIME_SEC     12
+#define MESSAGE_FIELD_RESPONSE_TIME_NSEC    13
+#define MESSAGE_FIELD_RESPONSE_MESSAGE      14
+
+/* SocketFamily and SocketProtocol */
+#define DNSTAP_INET             1
+#define DNSTAP_INET6            2
+#define DNSTAP_TCP              2
+#define DNSTAP_DOT              3
+#define DNSTAP_DOH              4
+#define DNSTAP_DNSCRYPT_TCP     6
+
+/* Dnstap.Type MESSAGE */
+#define DNSTAP_MESSAGE 1
+
+/* room for the largest frame, a 64k query and response and the other fields */
+#define DNSTAP_FRAME_MAX (2 * 65536 + 1024)
+
+#define DNSTAP_INPUT_QUEUE (4 * 1024 * 1024)
+#define DNSTAP_INPUT_CONNECTIONS 64
+#define DNSTAP_INPUT_BACKLOG 16
+
+#ifdef MSG_NOSIGNAL
+#define DNSTAP_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define DNSTAP_SEND_FLAGS 0
+#endif
+
+struct pb_field {
+    int             have;
+    uint64_t        value;
+    const u_char    *bytes;
+};
+
+static u_char input_frame[DNSTAP_FRAME_MAX];
+
+static FILE *input_fp = 0;
+static const char *input_file = 0;
+static int input_started = 0;
+static volatile sig_atomic_t input_stopped = 0;
+
+static uint32_t dnstap_be32(const u_char *p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/*
+ * Return the type of a control frame and set *content_type to 1 if it
+ * lists our content type, 0 if it lists none and -1 if only others.
+ * Returns -1 if the control frame is broken.
+ */
+static int fstrm_control_type(const u_char *p, size_t length, int *content_type) {
+    size_t offset, field_length;
+
+    if (length < 4) {
+        return -1;
+    }
+    *content_type = 0;
+    for (offset = 4; offset < length; offset += 8 + field_length) {
+        if (length - offset < 8 || (field_length = dnstap_be32(p + offset + 4)) > length - offset - 8) {
+            return -1;
+        }
+        if (dnstap_be32(p + offset) != FSTRM_FIELD_CONTENT_TYPE) {
+            continue;
+        }
+        if (field_length == sizeof(DNSTAP_CONTENT_TYPE) - 1
+            && !memcmp(p + offset + 8, DNSTAP_CONTENT_TYPE, field_length))
+        {
+            *content_type = 1;
+        }
+        else if (!*content_type) {
+            *content_type = -1;
+        }
+    }
+
+    return dnstap_be32(p);
+}
+
+/*
+ * Protobuf
+ */
+
+static int pb_varint(const u_char **p, const u_char *end, uint64_t *value) {
+    unsigned shift;
+
+    *value = 0;
+    for (shift = 0; *p < end && shift < 64; shift += 7) {
+        *value |= (uint64_t)(**p & 0x7f) << shift;
+        if (!(*(*p)++ & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static uint64_t pb_le(const u_char *p, unsigned length) {
+    uint64_t value = 0;
+
+    while (length--) {
+        value = value << 8 | p[length];
+    }
+    return value;
+}
+
+/* Read the fields below PB_FIELDS of a protobuf message, others are skipped */
+static int pb_fields(const u_char *p, const u_char *end, struct pb_field *fields) {
+    uint64_t key, value;
+    const u_char *bytes;
+
+    memset(fields, 0, PB_FIELDS * sizeof(*fields));
+    while (p < end) {
+        if (pb_varint(&p, end, &key)) {
+            return -1;
+        }
+        bytes = 0;
+        switch (key & 7) {
+        case PB_VARINT:
+            if (pb_varint(&p, end, &value)) {
+                return -1;
+            }
+            break;
+        case PB_FIXED64:
+            if (end - p < 8) {
+                return -1;
+            }
+            value = pb_le(p, 8);
+            p += 8;
+            break;
+        case PB_BYTES:
+            if (pb_varint(&p, end, &value) || value > (uint64_t)(end - p)) {
+                return -1;
+            }
+            bytes = p;
+            p += value;
+            break;
+        case PB_FIXED32:
+            if (end - p < 4) {
+                return -1;
+            }
+            value = pb_le(p, 4);
+            p += 4;
+            break;
+        default:
+            return -1;
+        }
+        if ((key >> 3) < PB_FIELDS) {
+            fields[key >> 3].have = 1;
+            fields[key >> 3].value = value;
+            fields[key >> 3].bytes = bytes;
+        }
+    }
+
+    return 0;
+}
+
+static int dnstap_address(const struct pb_field *field, int af, iaddr *address) {
+    memset(address, 0, sizeof(*address));
+    address->af = af;
+    if (!field->bytes) {
+        return 0;
+    }
+    if (af == AF_INET && field->value == sizeof(address->u.a4)) {
+        memcpy(&address->u.a4, field->bytes, sizeof(address->u.a4));
+        return 0;
+    }
+    if (af == AF_INET6 && field->value == sizeof(address->u.a6)) {
+        memcpy(&address->u.a6, field->bytes, sizeof(address->u.a6));
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Decode a Dnstap message, returns -1 if it does not hold a DNS message
+ * with the addresses it can be given with.
+ */
+static int dnstap_decode(const u_char *data, size_t length, dnstap_input_message_t *message) {
+    struct pb_field d[PB_FIELDS], m[PB_FIELDS];
+    const struct pb_field *src, *dst, *src_port, *dst_port, *sec, *nsec, *payload;
+    int af;
+
+    if (pb_fields(data, data + length, d)
+        || d[DNSTAP_FIELD_TYPE].value != DNSTAP_MESSAGE
+        || !d[DNSTAP_FIELD_MESSAGE].bytes
+        || pb_fields(d[DNSTAP_FIELD_MESSAGE].bytes, d[DNSTAP_FIELD_MESSAGE].bytes + d[DNSTAP_FIELD_MESSAGE].value, m)
+        || !m[MESSAGE_FIELD_TYPE].value)
+    {
+        return -1;
+    }
+
+    /* queries have odd types and are sent by the query address */
+    if (m[MESSAGE_FIELD_TYPE].value & 1) {
+        src = &m[MESSAGE_FIELD_QUERY_ADDRESS];
+        dst = &m[MESSAGE_FIELD_RESPONSE_ADDRESS];
+        src_port = &m[MESSAGE_FIELD_QUERY_PORT];
+        dst_port = &m[MESSAGE_FIELD_RESPONSE_PORT];
+        sec = &m[MESSAGE_FIELD_QUERY_TIME_SEC];
+        nsec = &m[MESSAGE_FIELD_QUERY_TIME_NSEC];
+        payload = &m[MESSAGE_FIELD_QUERY_MESSAGE];
+    }
+    else {
+        src = &m[MESSAGE_FIELD_RESPONSE_ADDRESS];
+        dst = &m[MESSAGE_FIELD_QUERY_ADDRESS];
+        src_port = &m[MESSAGE_FIELD_RESPONSE_PORT];
+        dst_port = &m[MESSAGE_FIELD_QUERY_PORT];
+        sec = &m[MESSAGE_FIELD_RESPONSE_TIME_SEC];
+        nsec = &m[MESSAGE_FIELD_RESPONSE_TIME_NSEC];
+        payload = &m[MESSAGE_FIELD_RESPONSE_MESSAGE];
+    }
+    if (!payload->bytes || src_port->value > 65535 || dst_port->value > 65535) {
+        return -1;
+    }
+
+    /* without a socket family go by the length of the addresses */
+    if (m[MESSAGE_FIELD_SOCKET_FAMILY].have) {
+        af = m[MESSAGE_FIELD_SOCKET_FAMILY].value == DNSTAP_INET ? AF_INET
+            : m[MESSAGE_FIELD_SOCKET_FAMILY].value == DNSTAP_INET6 ? AF_INET6 : 0;
+    }
+    else {
+        af = (src->bytes ? src->value : dst->value) == 4 ? AF_INET
+            : (src->bytes ? src->value : dst->value) == 16 ? AF_INET6 : 0;
+    }
+    if (!af || dnstap_address(src, af, &message->from) || dnstap_address(dst, af, &message->to)) {
+        return -1;
+    }
+
+    switch (m[MESSAGE_FIELD_SOCKET_PROTOCOL].value) {
+    case DNSTAP_TCP:
+    case DNSTAP_DOT:
+    case DNSTAP_DOH:
+    case DNSTAP_DNSCRYPT_TCP:
+        message->proto = IPPROTO_TCP;
+        break;
+    default:
+        message->proto = IPPROTO_UDP;
+    }
+    message->sport = src_port->value;
+    message->dport = dst_port->value;
+    message->ts.tv_sec = sec->value;
+    message->ts.tv_usec = nsec->value / 1000;
+    message->payload = payload->bytes;
+    message->payloadlen = payload->value;
+
+    return 0;
+}
+
+/*
+ * File
+ */
+
+int dnstap_input_open(const char * file) {
+    if (!file || !*file) {
+        return DNSTAP_INPUT_EINVAL;
+    }
+
+    if (!(input_fp = fopen(file, "r"))) {
+        fprintf(stderr, "dnstap_input %s: %s\n", file, strerror(errno));
+        return DNSTAP_INPUT_EREAD;
+    }
+    input_file = file;
+    input_started = 0;
+
+    return DNSTAP_INPUT_OK;
+}
+
+/* Read the next data frame into input_frame */
+static int file_frame(size_t *length) {
+    u_char head[8], control[FSTRM_CONTROL_MAX];
+    size_t n;
+    int content_type;
+
+    for (;;) {
+        if (!(n = fread(head, 1, 4, input_fp)) && !ferror(input_fp)) {
+            return DNSTAP_INPUT_EOF;
+        }
+        if (n != 4) {
+            break;
+        }
+
+        if ((*length = dnstap_be32(head))) {
+            if (!input_started || *length > DNSTAP_FRAME_MAX) {
+                fprintf(stderr, "dnstap_input %s: %s\n", input_file,
+                    input_started ? "frame too large" : "data frame before START");
+                return DNSTAP_INPUT_EREAD;
+            }
+            if (fread(input_frame, 1, *length, input_fp) != *length) {
+                break;
+            }
+            return DNSTAP_INPUT_OK;
+        }
+
+        if (fread(head + 4, 1, 4, input_fp) != 4) {
+            break;
+        }
+        if ((n = dnstap_be32(head + 4)) > sizeof(control)) {
+            fprintf(stderr, "dnstap_input %s: bad control frame\n", input_file);
+            return DNSTAP_INPUT_EREAD;
+        }
+        if (fread(control, 1, n, input_fp) != n) {
+            break;
+        }
+        switch (fstrm_control_type(control, n, &content_type)) {
+        case FSTRM_CONTROL_START:
+            if (input_started || content_type < 0) {
+                fprintf(stderr, "dnstap_input %s: %s\n", input_file,
+                    input_started ? "START without STOP" : "not a dnstap stream");
+                return DNSTAP_INPUT_EREAD;
+            }
+            input_started = 1;
+            break;
+        case FSTRM_CONTROL_STOP:
+            if (!input_started) {
+                fprintf(stderr, "dnstap_input %s: STOP without START\n", input_file);
+                return DNSTAP_INPUT_EREAD;
+            }
+            input_started = 0;
+            break;
+        default:
+            fprintf(stderr, "dnstap_input %s: bad control frame\n", input_file);
+            return DNSTAP_INPUT_EREAD;
+        }
+    }
+
+    if (ferror(input_fp)) {
+        fprintf(stderr, "dnstap_input %s: %s\n", input_file, strerror(errno));
+    }
+    else {
+        fprintf(stderr, "dnstap_input %s: truncated frame\n", input_file);
+    }
+    return DNSTAP_INPUT_EREAD;
+}
+
+/*
+ * Unix socket
+ */
+
+#if HAVE_PTHREAD
+
+struct dnstap_conn {
+    int     fd;
+    int     bidirectional;
+    int     started;
+    u_char  *buf;
+    size_t  used, size;
+};
+
+static struct sockaddr_un listen_addr;
+static int listening = 0;
+static int listen_fd = -1;
+static int wake_fd[2] = { -1, -1 };
+static struct dnstap_conn conns[DNSTAP_INPUT_CONNECTIONS];
+static size_t conns_used = 0;
+static pthread_t reader;
+static int have_reader = 0;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_data = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_space = PTHREAD_COND_INITIALIZER;
+static u_char *queue = 0;
+static size_t queue_head = 0, queue_tail = 0;
+static int queue_stopped = 0;
+
+static void queue_copy_in(const u_char *data, size_t length) {
+    size_t at = queue_tail % DNSTAP_INPUT_QUEUE, first = DNSTAP_INPUT_QUEUE - at;
+
+    if (first > length) {
+        first = length;
+    }
+    memcpy(queue + at, data, first);
+    memcpy(queue, data + first, length - first);
+    queue_tail += length;
+}
+
+static void queue_copy_out(u_char *data, size_t length) {
+    size_t at = queue_head % DNSTAP_INPUT_QUEUE, first = DNSTAP_INPUT_QUEUE - at;
+
+    if (first > length) {
+        first = length;
+    }
+    memcpy(data, queue + at, first);
+    memcpy(data + first, queue, length - first);
+    queue_head += length;
+}
+
+/* Queue a data frame, waits for room and returns -1 if stopped */
+static int queue_put(const u_char *data, size_t length) {
+    u_char head[4];
+
+    head[0] = length >> 24;
+    head[1] = length >> 16;
+    head[2] = length >> 8;
+    head[3] = length;
+
+    pthread_mutex_lock(&queue_lock);
+    while (!queue_stopped && DNSTAP_INPUT_QUEUE - (queue_tail - queue_head) < sizeof(head) + length) {
+        pthread_cond_wait(&queue_space, &queue_lock);
+    }
+    if (queue_stopped) {
+        pthread_mutex_unlock(&queue_lock);
+        return -1;
+    }
+    queue_copy_in(head, sizeof(head));
+    queue_copy_in(data, length);
+    pthread_cond_signal(&queue_data);
+    pthread_mutex_unlock(&queue_lock);
+
+    return 0;
+}
+
+/* Take the next data frame into input_frame, waits for one unless stopped */
+static int queue_get(size_t *length) {
+    u_char head[4];
+
+    pthread_mutex_lock(&queue_lock);
+    while (!queue_stopped && queue_head == queue_tail) {
+        pthread_cond_wait(&queue_data, &queue_lock);
+    }
+    if (queue_head == queue_tail) {
+        pthread_mutex_unlock(&queue_lock);
+        return DNSTAP_INPUT_EOF;
+    }
+    queue_copy_out(head, sizeof(head));
+    *length = dnstap_be32(head);
+    queue_copy_out(input_frame, *length);
+    pthread_cond_signal(&queue_space);
+    pthread_mutex_unlock(&queue_lock);
+
+    return DNSTAP_INPUT_OK;
+}
+
+static void queue_stop(void) {
+    pthread_mutex_lock(&queue_lock);
+    queue_stopped = 1;
+    pthread_cond_broadcast(&queue_data);
+    pthread_cond_broadcast(&queue_space);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+/* Write a control frame, ACCEPT carries the content type */
+static int conn_control(struct dnstap_conn *conn, unsigned type) {
+    u_char frame[64], *p = frame;
+    size_t length = 4;
+    ssize_t n;
+
+    if (type == FSTRM_CONTROL_ACCEPT) {
+        length += 8 + sizeof(DNSTAP_CONTENT_TYPE) - 1;
+    }
+    memset(frame, 0, 12);
+    frame[7] = length;
+    frame[11] = type;
+    if (type == FSTRM_CONTROL_ACCEPT) {
+        memset(frame + 12, 0, 8);
+        frame[15] = FSTRM_FIELD_CONTENT_TYPE;
+        frame[19] = sizeof(DNSTAP_CONTENT_TYPE) - 1;
+        memcpy(frame + 20, DNSTAP_CONTENT_TYPE, sizeof(DNSTAP_CONTENT_TYPE) - 1);
+    }
+    length += 8;
+
+    while (length) {
+        if ((n = send(conn->fd, p, length, DNSTAP_SEND_FLAGS)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "dnstap_listen %s: %s\n", listen_addr.sun_path, strerror(errno));
+            return -1;
+        }
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static void conn_close(size_t i) {
+    close(conns[i].fd);
+    free(conns[i].buf);
+    conns[i] = conns[--conns_used];
+}
+
+/*
+ * Read what a writer has sent and handle the complete frames, returns -1
+ * if the connection is to be closed.
+ */
+static int conn_read(struct dnstap_conn *conn) {
+    size_t offset = 0, length;
+    ssize_t n;
+    u_char *buf;
+    int content_type;
+
+    if (conn->used == conn->size) {
+        length = conn->size ? conn->size * 2 : 4096;
+        if (length > DNSTAP_FRAME_MAX + 4) {
+            length = DNSTAP_FRAME_MAX + 4;
+        }
+        if (length == conn->size || !(buf = realloc(conn->buf, length))) {
+            fprintf(stderr, "dnstap_listen %s: out of memory\n", listen_addr.sun_path);
+            return -1;
+        }
+        conn->buf = buf;
+        conn->size = length;
+    }
+    if ((n = read(conn->fd, conn->buf + conn->used, conn->size - conn->used)) < 0) {
+        if (errno == EINTR || errno == EAGAIN) {
+            return 0;
+        }
+        fprintf(stderr, "dnstap_listen %s: %s\n", listen_addr.sun_path, strerror(errno));
+        return -1;
+    }
+    if (!n) {
+        return -1;
+    }
+    conn->used += n;
+
+    while (conn->used - offset >= 4) {
+        if ((length = dnstap_be32(conn->buf + offset))) {
+            if (!conn->started || length > DNSTAP_FRAME_MAX) {
+                fprintf(stderr, "dnstap_listen %s: %s\n", listen_addr.sun_path,
+                    conn->started ? "frame too large" : "data frame before START");
+                return -1;
+            }
+            if (conn->used - offset < 4 + length) {
+                break;
+            }
+            if (queue_put(conn->buf + offset + 4, length)) {
+                return -1;
+            }
+            offset += 4 + length;
+            continue;
+        }
+
+        if (conn->used - offset < 8) {
+            break;
+        }
+        if ((length = dnstap_be32(conn->buf + offset + 4)) > FSTRM_CONTROL_MAX) {
+            fprintf(stderr, "dnstap_listen %s: bad control frame\n", listen_addr.sun_path);
+            return -1;
+        }
+        if (conn->used - offset < 8 + length) {
+            break;
+        }
+        switch (fstrm_control_type(conn->buf + offset + 8, length, &content_type)) {
+        case FSTRM_CONTROL_READY:
+            if (conn->started || content_type < 0) {
+                fprintf(stderr, "dnstap_listen %s: %s\n", listen_addr.sun_path,
+                    conn->started ? "READY after START" : "not a dnstap writer");
+                return -1;
+            }
+            if (conn_control(conn, FSTRM_CONTROL_ACCEPT)) {
+                return -1;
+            }
+            conn->bidirectional = 1;
+            break;
+        case FSTRM_CONTROL_START:
+            if (conn->started || content_type < 0) {
+                fprintf(stderr, "dnstap_listen %s: %s\n", listen_addr.sun_path,
+                    conn->started ? "START without STOP" : "not a dnstap writer");
+                return -1;
+            }
+            conn->started = 1;
+            break;
+        case FSTRM_CONTROL_STOP:
+            if (conn->started && conn->bidirectional) {
+                conn_control(conn, FSTRM_CONTROL_FINISH);
+            }
+            return -1;
+        default:
+            fprintf(stderr, "dnstap_listen %s: bad control frame\n", listen_addr.sun_path);
+            return -1;
+        }
+        offset += 8 + length;
+    }
+
+    conn->used -= offset;
+    memmove(conn->buf, conn->buf + offset, conn->used);
+
+    return 0;
+}
+
+static void *dnstap_input_reader(void *arg) {
+    struct pollfd pfds[2 + DNSTAP_INPUT_CONNECTIONS];
+    size_t i;
+    int fd;
+
+    (void)arg;
+
+    for (;;) {
+        pfds[0].fd = wake_fd[0];
+        pfds[0].events = POLLIN;
+        pfds[1].fd = listen_fd;
+        pfds[1].events = conns_used < DNSTAP_INPUT_CONNECTIONS ? POLLIN : 0;
+        for (i = 0; i < conns_used; i++) {
+            pfds[2 + i].fd = conns[i].fd;
+            pfds[2 + i].events = POLLIN;
+        }
+        if (poll(pfds, 2 + conns_used, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "dnstap_listen %s: %s\n", listen_addr.sun_path, strerror(errno));
+            break;
+        }
+        if (pfds[0].revents) {
+            break;
+        }
+
+        /* backwards as closing moves the last connection in its place */
+        for (i = conns_used; i-- > 0;) {
+            if (pfds[2 + i].revents && conn_read(&conns[i])) {
+                conn_close(i);
+            }
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            if ((fd = accept(listen_fd, 0, 0)) < 0) {
+                if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED) {
+                    fprintf(stderr, "dnstap_listen %s: %s\n", listen_addr.sun_path, strerror(errno));
+                }
+                continue;
+            }
+            memset(&conns[conns_used], 0, sizeof(conns[conns_used]));
+            conns[conns_used++].fd = fd;
+        }
+    }
+
+    while (conns_used) {
+        conn_close(conns_used - 1);
+    }
+    queue_stop();
+
+    return 0;
+}
+
+#endif /* HAVE_PTHREAD */
+
+int dnstap_input_listen(const char * path) {
+#if HAVE_PTHREAD
+    struct stat st;
+    sigset_t set, old;
+    int err;
+
+    if (!path || !*path || strlen(path) >= sizeof(listen_addr.sun_path)) {
+        return DNSTAP_INPUT_EINVAL;
+    }
+
+    memset(&listen_addr, 0, sizeof(listen_addr));
+    listen_addr.sun_family = AF_UNIX;
+    strcpy(listen_addr.sun_path, path);
+
+    if (!(queue = malloc(DNSTAP_INPUT_QUEUE))) {
+        return DNSTAP_INPUT_ENOMEM;
+    }
+
+    /* a socket left behind by an earlier run is replaced */
+    if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+        || bind(listen_fd, (struct sockaddr *)&listen_addr, sizeof(listen_addr))
+        || listen(listen_fd, DNSTAP_INPUT_BACKLOG)
+        || pipe(wake_fd))
+    {
+        fprintf(stderr, "dnstap_listen %s: %s\n", path, strerror(errno));
+        return DNSTAP_INPUT_EREAD;
+    }
+    listening = 1;
+
+    /* signals are left to the threads of dnscap */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    err = pthread_create(&reader, 0, dnstap_input_reader, 0);
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+    if (err) {
+        fprintf(stderr, "dnstap_listen %s: %s\n", path, strerror(err));
+        return DNSTAP_INPUT_EREAD;
+    }
+    have_reader = 1;
+
+    return DNSTAP_INPUT_OK;
+#else
+    (void)path;
+    return DNSTAP_INPUT_EINVAL;
+#endif
+}
+
+int dnstap_input_next(dnstap_input_message_t * message) {
+    size_t length;
+    int ret;
+
+    if (!message) {
+        return DNSTAP_INPUT_EINVAL;
+    }
+
+    for (;;) {
+#if HAVE_PTHREAD
+        if (listening) {
+            ret = queue_get(&length);
+        }
+        else
+#endif
+        if (input_fp) {
+            ret = input_stopped ? DNSTAP_INPUT_EOF : file_frame(&length);
+        }
+        else {
+            return DNSTAP_INPUT_EINVAL;
+        }
+        if (ret != DNSTAP_INPUT_OK) {
+            return ret;
+        }
+
+        if (!dnstap_decode(input_frame, length, message)) {
+            return DNSTAP_INPUT_OK;
+        }
+    }
+}
+
+void dnstap_input_stop(void) {
+#if HAVE_PTHREAD
+    ssize_t n;
+#endif
+
+    input_stopped = 1;
+#if HAVE_PTHREAD
+    if (listening) {
+        queue_stop();
+        if (wake_fd[1] != -1) {
+            n = write(wake_fd[1], "", 1);
+            (void)n;
+        }
+    }
+#endif
+}
+
+void dnstap_input_close(void) {
+    if (input_fp) {
+        fclose(input_fp);
+        input_fp = 0;
+    }
+
+#if HAVE_PTHREAD
+    if (!listening) {
+        return;
+    }
+    dnstap_input_stop();
+    if (have_reader) {
+        pthread_join(reader, 0);
+        have_reader = 0;
+    }
+    if (listen_fd != -1) {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(listen_addr.sun_path);
+    }
+    if (wake_fd[0] != -1) {
+        close(wake_fd[0]);
+        close(wake_fd[1]);
+        wake_fd[0] = wake_fd[1] = -1;
+    }
+    free(queue);
+    queue = 0;
+    listening = 0;
+#endif
+}
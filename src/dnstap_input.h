@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "dnscap_common.h"
+
+#ifndef __dnscap_dnstap_input_h
+#define __dnscap_dnstap_input_h
+
+#define DNSTAP_INPUT_OK         0
+#define DNSTAP_INPUT_EINVAL     1
+#define DNSTAP_INPUT_ENOMEM     2
+#define DNSTAP_INPUT_EREAD      3
+#define DNSTAP_INPUT_EOF        4
+
+/*
+ * A DNS message read from dnstap, the addresses and ports are the ones it
+ * was sent from and to. The payload points into a buffer of the reader and
+ * is valid until the next dnstap_input_next().
+ */
+typedef struct dnstap_input_message dnstap_input_message_t;
+struct dnstap_input_message {
+    iaddr           from, to;
+    uint8_t         proto;
+    unsigned        sport, dport;
+    my_bpftimeval   ts;
+    const u_char    *payload;
+    size_t          payloadlen;
+};
+
+int dnstap_input_open(const char * file);
+int dnstap_input_listen(const char * path);
+int dnstap_input_next(dnstap_input_message_t * message);
+void dnstap_input_stop(void);
+void dnstap_input_close(void);
+
+#endif /* __dnscap_dnstap_input_h */
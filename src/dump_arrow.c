@@ -0,0 +1,880 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "dump_arrow.h"
+#include "dns_wire.h"
+#include "dnscap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Apache Arrow IPC stream format, one row per DNS message.
+ *
+ * The stream is the schema message followed by record batches of
+ * batch_size rows and ends with the end-of-stream marker, every output file
+ * is a stream of its own. The columns are built in buffers allocated for a
+ * full batch and written as they are. QNAME is dictionary encoded, the new
+ * names of a batch are sent in a delta dictionary batch before it.
+ *
+ * Messages are encapsulated as described in the Arrow columnar format
+ * specification: the continuation marker, the length of the metadata, the
+ * Message flatbuffer padded to 8 bytes and the body. The flatbuffers are
+ * built here front to back, a table is written before the objects it refers
+ * to and the references are patched when those are written.
+ */
+
+#define ARROW_CONTINUATION 0xffffffff
+
+/* MetadataVersion V5 */
+#define ARROW_METADATA_VERSION 4
+
+/* MessageHeader */
+#define ARROW_HEADER_SCHEMA             1
+#define ARROW_HEADER_DICTIONARY_BATCH   2
+#define ARROW_HEADER_RECORD_BATCH       3
+
+/* Type */
+#define ARROW_TYPE_INT                  2
+#define ARROW_TYPE_UTF8                 5
+#define ARROW_TYPE_BOOL                 6
+#define ARROW_TYPE_TIMESTAMP            10
+#define ARROW_TYPE_FIXED_SIZE_BINARY    15
+
+/* TimeUnit MICROSECOND */
+#define ARROW_MICROSECOND 2
+
+/*
+ * The dictionary is replaced, instead of extended, by the first batch after
+ * it has this many names so it does not grow for ever.
+ */
+#define ARROW_DICT_MAX (1 << 20)
+
+enum arrow_kind {
+    arrow_timestamp,
+    arrow_uint8,
+    arrow_uint16,
+    arrow_uint32,
+    arrow_address,
+    arrow_name,
+    arrow_bool
+};
+
+struct arrow_column {
+    const char      *name;
+    enum arrow_kind kind;
+    int             nullable;
+    size_t          width;
+    uint8_t         *values;
+    uint8_t         *validity;
+    size_t          nulls;
+};
+
+enum {
+    ARROW_TIME = 0,
+    ARROW_SRC_ADDR,
+    ARROW_SRC_PORT,
+    ARROW_DST_ADDR,
+    ARROW_DST_PORT,
+    ARROW_PROTO,
+    ARROW_ID,
+    ARROW_FLAGS,
+    ARROW_RCODE,
+    ARROW_QNAME,
+    ARROW_QTYPE,
+    ARROW_QCLASS,
+    ARROW_SIZE,
+    ARROW_EDNS_UDP_SIZE,
+    ARROW_EDNS_VERSION,
+    ARROW_EDNS_DO,
+    ARROW_ORIGINAL_ANCOUNT,
+    ARROW_ORIGINAL_NSCOUNT,
+    ARROW_ORIGINAL_ARCOUNT,
+    ARROW_COLUMNS
+};
+
+static struct arrow_column columns[ARROW_COLUMNS] = {
+    { .name = "time", .kind = arrow_timestamp, .nullable = 0, .width = 8 },
+    { .name = "src_addr", .kind = arrow_address, .nullable = 0, .width = 16 },
+    { .name = "src_port", .kind = arrow_uint16, .nullable = 0, .width = 2 },
+    { .name = "dst_addr", .kind = arrow_address, .nullable = 0, .width = 16 },
+    { .name = "dst_port", .kind = arrow_uint16, .nullable = 0, .width = 2 },
+    { .name = "proto", .kind = arrow_uint8, .nullable = 0, .width = 1 },
+    { .name = "id", .kind = arrow_uint16, .nullable = 0, .width = 2 },
+    { .name = "flags", .kind = arrow_uint16, .nullable = 0, .width = 2 },
+    { .name = "rcode", .kind = arrow_uint16, .nullable = 0, .width = 2 },
+    { .name = "qname", .kind = arrow_name, .nullable = 1, .width = 4 },
+    { .name = "qtype", .kind = arrow_uint16, .nullable = 1, .width = 2 },
+    { .name = "qclass", .kind = arrow_uint16, .nullable = 1, .width = 2 },
+    { .name = "size", .kind = arrow_uint32, .nullable = 0, .width = 4 },
+    { .name = "edns_udp_size", .kind = arrow_uint16, .nullable = 1, .width = 2 },
+    { .name = "edns_version", .kind = arrow_uint8, .nullable = 1, .width = 1 },
+    { .name = "edns_do", .kind = arrow_bool, .nullable = 1, .width = 0 },
+    { .name = "original_ancount", .kind = arrow_uint16, .nullable = 1, .width = 2 },
+    { .name = "original_nscount", .kind = arrow_uint16, .nullable = 1, .width = 2 },
+    { .name = "original_arcount", .kind = arrow_uint16, .nullable = 1, .width = 2 }
+};
+
+struct arrow_name {
+    uint64_t    hash;
+    size_t      offset;
+    size_t      length;
+};
+
+struct arrow_buffer {
+    const uint8_t   *data;
+    size_t          length;
+};
+
+static size_t batch_size = ARROW_DEFAULT_BATCH_SIZE;
+static size_t rows = 0;
+static int arrow_started = 0;
+
+/* the QNAME dictionary, names_sent have been written in dictionary batches */
+static struct arrow_name *names = 0;
+static size_t names_num = 0, names_size = 0, names_sent = 0;
+static size_t *name_slots = 0;
+static size_t name_slots_size = 0;
+static uint8_t *name_data = 0;
+static size_t name_data_used = 0, name_data_size = 0;
+static uint8_t *name_offsets = 0;
+static size_t name_offsets_size = 0;
+static int names_replace = 0;
+
+/* the flatbuffer being built and the table whose fields are being added */
+static uint8_t *fb = 0;
+static size_t fb_len = 0, fb_size = 0;
+static int fb_error = 0;
+static size_t fb_table;
+static uint16_t fb_vtable[8];
+static size_t fb_fields;
+
+static uint8_t *arrow_buf = 0;
+static size_t arrow_buf_used = 0, arrow_buf_size = 0;
+
+int arrow_set_batch_size(size_t size) {
+    if (!size || size > 0x7fffffff) {
+        return DUMP_ARROW_EINVAL;
+    }
+
+    batch_size = size;
+
+    return DUMP_ARROW_OK;
+}
+
+static void arrow_le(uint8_t *p, uint64_t v, size_t width) {
+    while (width--) {
+        *p++ = v;
+        v >>= 8;
+    }
+}
+
+/*
+ * Flatbuffer building, errors are sticky in fb_error and checked when the
+ * message is done.
+ */
+
+static void fb_put(const void *data, size_t length) {
+    if (fb_len + length > fb_size) {
+        size_t size = fb_size ? fb_size : 4096;
+        uint8_t *p;
+
+        while (fb_len + length > size) {
+            size *= 2;
+        }
+        if (!(p = realloc(fb, size))) {
+            fb_error = 1;
+            return;
+        }
+        fb = p;
+        fb_size = size;
+    }
+    if (data) {
+        memcpy(fb + fb_len, data, length);
+    }
+    else {
+        memset(fb + fb_len, 0, length);
+    }
+    fb_len += length;
+}
+
+/* Pad so that fb_len + extra is aligned */
+static void fb_pad(size_t align, size_t extra) {
+    while (!fb_error && (fb_len + extra) % align) {
+        fb_put(0, 1);
+    }
+}
+
+static size_t fb_uint(uint64_t v, size_t width) {
+    uint8_t b[8];
+
+    arrow_le(b, v, width);
+    fb_pad(width, 0);
+    fb_put(b, width);
+
+    return fb_len - width;
+}
+
+/* Point the uoffset at the position to the object at target */
+static void fb_link(size_t at, size_t target) {
+    if (!fb_error) {
+        arrow_le(fb + at, target - at, 4);
+    }
+}
+
+static void fb_table_begin(void) {
+    fb_pad(4, 0);
+    fb_table = fb_uint(0, 4);
+    fb_fields = 0;
+    memset(fb_vtable, 0, sizeof(fb_vtable));
+}
+
+/* Add a scalar field, or a reference to patch later with fb_link() when width is 0 */
+static size_t fb_field(unsigned id, uint64_t v, size_t width) {
+    size_t at = fb_uint(v, width ? width : 4);
+
+    fb_vtable[id] = at - fb_table;
+    if (id >= fb_fields) {
+        fb_fields = id + 1;
+    }
+
+    return at;
+}
+
+/* Write the vtable after the table, returns the table */
+static size_t fb_table_end(void) {
+    size_t vtable, n;
+
+    fb_pad(2, 0);
+    vtable = fb_len;
+    fb_uint(4 + 2 * fb_fields, 2);
+    fb_uint(vtable - fb_table, 2);
+    for (n = 0; n < fb_fields; n++) {
+        fb_uint(fb_vtable[n], 2);
+    }
+    /* soffset from the table back to its vtable */
+    if (!fb_error) {
+        arrow_le(fb + fb_table, (uint32_t)(int32_t)(fb_table - vtable), 4);
+    }
+
+    return fb_table;
+}
+
+static size_t fb_string(const char *s) {
+    size_t length = strlen(s), at;
+
+    fb_pad(4, 0);
+    at = fb_uint(length, 4);
+    fb_put(s, length + 1);
+
+    return at;
+}
+
+/* Start a vector of count elements aligned to align, returns its position */
+static size_t fb_vector(size_t count, size_t align) {
+    fb_pad(align < 4 ? 4 : align, 4);
+
+    return fb_uint(count, 4);
+}
+
+static size_t fb_int_type(unsigned bits, int is_signed) {
+    fb_table_begin();
+    fb_field(0, bits, 4);
+    fb_field(1, is_signed, 1);
+    return fb_table_end();
+}
+
+/* The Message table, returns the reference to the header to link */
+static size_t fb_message(unsigned header_type, uint64_t body_length) {
+    size_t header;
+
+    fb_len = 0;
+    fb_error = 0;
+    fb_uint(0, 4);
+    fb_table_begin();
+    fb_field(3, body_length, 8);
+    fb_field(0, ARROW_METADATA_VERSION, 2);
+    fb_field(1, header_type, 1);
+    header = fb_field(2, 0, 0);
+    fb_link(0, fb_table_end());
+
+    return header;
+}
+
+static size_t fb_schema_field(const struct arrow_column *column) {
+    size_t field, name, type, dictionary = 0, children, index;
+    unsigned type_type;
+
+    switch (column->kind) {
+    case arrow_timestamp:
+        type_type = ARROW_TYPE_TIMESTAMP;
+        break;
+    case arrow_address:
+        type_type = ARROW_TYPE_FIXED_SIZE_BINARY;
+        break;
+    case arrow_name:
+        type_type = ARROW_TYPE_UTF8;
+        break;
+    case arrow_bool:
+        type_type = ARROW_TYPE_BOOL;
+        break;
+    default:
+        type_type = ARROW_TYPE_INT;
+    }
+
+    fb_table_begin();
+    name = fb_field(0, 0, 0);
+    fb_field(1, column->nullable, 1);
+    fb_field(2, type_type, 1);
+    type = fb_field(3, 0, 0);
+    if (column->kind == arrow_name) {
+        dictionary = fb_field(4, 0, 0);
+    }
+    children = fb_field(5, 0, 0);
+    field = fb_table_end();
+
+    fb_link(name, fb_string(column->name));
+
+    fb_table_begin();
+    switch (column->kind) {
+    case arrow_timestamp:
+        fb_field(0, ARROW_MICROSECOND, 2);
+        index = fb_field(1, 0, 0);
+        fb_link(type, fb_table_end());
+        fb_link(index, fb_string("UTC"));
+        break;
+    case arrow_address:
+        fb_field(0, column->width, 4);
+        fb_link(type, fb_table_end());
+        break;
+    case arrow_name:
+    case arrow_bool:
+        fb_link(type, fb_table_end());
+        break;
+    default:
+        fb_field(0, column->width * 8, 4);
+        fb_field(1, 0, 1);
+        fb_link(type, fb_table_end());
+    }
+
+    if (dictionary) {
+        /* DictionaryEncoding, id 0 with int32 indexes */
+        fb_table_begin();
+        fb_field(0, 0, 8);
+        index = fb_field(1, 0, 0);
+        fb_link(dictionary, fb_table_end());
+        fb_link(index, fb_int_type(32, 1));
+    }
+
+    fb_link(children, fb_vector(0, 4));
+
+    return field;
+}
+
+static void fb_schema(void) {
+    size_t header = fb_message(ARROW_HEADER_SCHEMA, 0), fields, vector, n;
+
+    fb_table_begin();
+    fields = fb_field(1, 0, 0);
+    fb_link(header, fb_table_end());
+
+    vector = fb_vector(ARROW_COLUMNS, 4);
+    fb_link(fields, vector);
+    for (n = 0; n < ARROW_COLUMNS; n++) {
+        fb_uint(0, 4);
+    }
+    for (n = 0; n < ARROW_COLUMNS; n++) {
+        fb_link(vector + 4 + n * 4, fb_schema_field(&columns[n]));
+    }
+}
+
+/* A RecordBatch table with one node per column and the buffers laid out one after the other */
+static size_t fb_record_batch(size_t length, const size_t *node_nulls, size_t node_count, const struct arrow_buffer *buffers, size_t buffer_count) {
+    size_t batch, nodes, bufs, n, offset = 0;
+
+    fb_table_begin();
+    fb_field(0, length, 8);
+    nodes = fb_field(1, 0, 0);
+    bufs = fb_field(2, 0, 0);
+    batch = fb_table_end();
+
+    fb_link(nodes, fb_vector(node_count, 8));
+    for (n = 0; n < node_count; n++) {
+        fb_uint(length, 8);
+        fb_uint(node_nulls[n], 8);
+    }
+    fb_link(bufs, fb_vector(buffer_count, 8));
+    for (n = 0; n < buffer_count; n++) {
+        fb_uint(offset, 8);
+        fb_uint(buffers[n].length, 8);
+        offset += (buffers[n].length + 7) & ~(size_t)7;
+    }
+
+    return batch;
+}
+
+static int arrow_reserve(size_t size) {
+    if (arrow_buf_used + size > arrow_buf_size) {
+        size_t want = arrow_buf_size ? arrow_buf_size : 1024 * 1024;
+        uint8_t *buf;
+
+        while (arrow_buf_used + size > want) {
+            want *= 2;
+        }
+        if (!(buf = realloc(arrow_buf, want))) {
+            return DUMP_ARROW_ENOMEM;
+        }
+        arrow_buf = buf;
+        arrow_buf_size = want;
+    }
+
+    return DUMP_ARROW_OK;
+}
+
+/* Encapsulate the flatbuffer that has been built, and the body, into the output buffer */
+static int arrow_message(const struct arrow_buffer *buffers, size_t buffer_count) {
+    size_t metadata, body = 0, n;
+    uint8_t *p;
+    int ret;
+
+    if (fb_error) {
+        return DUMP_ARROW_ENOMEM;
+    }
+    metadata = (fb_len + 7) & ~(size_t)7;
+    for (n = 0; n < buffer_count; n++) {
+        body += (buffers[n].length + 7) & ~(size_t)7;
+    }
+    if ((ret = arrow_reserve(8 + metadata + body)) != DUMP_ARROW_OK) {
+        return ret;
+    }
+
+    p = arrow_buf + arrow_buf_used;
+    arrow_le(p, ARROW_CONTINUATION, 4);
+    arrow_le(p + 4, metadata, 4);
+    memcpy(p + 8, fb, fb_len);
+    memset(p + 8 + fb_len, 0, metadata - fb_len);
+    p += 8 + metadata;
+    for (n = 0; n < buffer_count; n++) {
+        if (buffers[n].length) {
+            memcpy(p, buffers[n].data, buffers[n].length);
+        }
+        memset(p + buffers[n].length, 0, ((buffers[n].length + 7) & ~(size_t)7) - buffers[n].length);
+        p += (buffers[n].length + 7) & ~(size_t)7;
+    }
+    arrow_buf_used = p - arrow_buf;
+
+    return DUMP_ARROW_OK;
+}
+
+static uint64_t arrow_body_length(const struct arrow_buffer *buffers, size_t buffer_count) {
+    uint64_t body = 0;
+    size_t n;
+
+    for (n = 0; n < buffer_count; n++) {
+        body += (buffers[n].length + 7) & ~(size_t)7;
+    }
+
+    return body;
+}
+
+/* Write the names added since the last dictionary batch, or all of them to replace it */
+static int arrow_dictionary(void) {
+    struct arrow_buffer buffers[3];
+    size_t header, data, n, count = names_num - names_sent, base;
+    int ret;
+
+    if (names_sent && !count) {
+        return DUMP_ARROW_OK;
+    }
+    if ((count + 1) * 4 > name_offsets_size) {
+        uint8_t *p;
+
+        if (!(p = realloc(name_offsets, (count + 1) * 4))) {
+            return DUMP_ARROW_ENOMEM;
+        }
+        name_offsets = p;
+        name_offsets_size = (count + 1) * 4;
+    }
+    base = count ? names[names_sent].offset : 0;
+    for (n = 0; n < count; n++) {
+        arrow_le(name_offsets + n * 4, names[names_sent + n].offset - base, 4);
+    }
+    arrow_le(name_offsets + count * 4, name_data_used - base, 4);
+
+    buffers[0].data = 0;
+    buffers[0].length = 0;
+    buffers[1].data = name_offsets;
+    buffers[1].length = (count + 1) * 4;
+    buffers[2].data = name_data + base;
+    buffers[2].length = name_data_used - base;
+
+    header = fb_message(ARROW_HEADER_DICTIONARY_BATCH, arrow_body_length(buffers, 3));
+    fb_table_begin();
+    fb_field(0, 0, 8);
+    data = fb_field(1, 0, 0);
+    fb_field(2, names_sent && !names_replace, 1);
+    fb_link(header, fb_table_end());
+    n = 0;
+    fb_link(data, fb_record_batch(count, &n, 1, buffers, 3));
+    if ((ret = arrow_message(buffers, 3)) != DUMP_ARROW_OK) {
+        return ret;
+    }
+    names_sent = names_num;
+    names_replace = 0;
+
+    return DUMP_ARROW_OK;
+}
+
+static void arrow_names_reset(void) {
+    names_num = 0;
+    names_sent = 0;
+    name_data_used = 0;
+    if (name_slots) {
+        memset(name_slots, 0, name_slots_size * sizeof(*name_slots));
+    }
+}
+
+static int arrow_batch(void) {
+    struct arrow_buffer buffers[2 * ARROW_COLUMNS];
+    size_t nulls[ARROW_COLUMNS], header, n, bitmap = (rows + 7) / 8;
+    int ret;
+
+    if ((ret = arrow_dictionary()) != DUMP_ARROW_OK) {
+        return ret;
+    }
+
+    for (n = 0; n < ARROW_COLUMNS; n++) {
+        nulls[n] = columns[n].nulls;
+        buffers[n * 2].data = columns[n].validity;
+        buffers[n * 2].length = columns[n].nulls ? bitmap : 0;
+        buffers[n * 2 + 1].data = columns[n].values;
+        buffers[n * 2 + 1].length = columns[n].width ? rows * columns[n].width : bitmap;
+    }
+    header = fb_message(ARROW_HEADER_RECORD_BATCH, arrow_body_length(buffers, 2 * ARROW_COLUMNS));
+    fb_link(header, fb_record_batch(rows, nulls, ARROW_COLUMNS, buffers, 2 * ARROW_COLUMNS));
+    if ((ret = arrow_message(buffers, 2 * ARROW_COLUMNS)) != DUMP_ARROW_OK) {
+        return ret;
+    }
+
+    rows = 0;
+    for (n = 0; n < ARROW_COLUMNS; n++) {
+        columns[n].nulls = 0;
+        if (columns[n].validity) {
+            memset(columns[n].validity, 0, (batch_size + 7) / 8);
+        }
+        if (!columns[n].width) {
+            memset(columns[n].values, 0, (batch_size + 7) / 8);
+        }
+    }
+    if (names_num >= ARROW_DICT_MAX) {
+        arrow_names_reset();
+        names_replace = 1;
+    }
+
+    return DUMP_ARROW_OK;
+}
+
+static int arrow_begin(void) {
+    size_t n;
+    int ret;
+
+    if (!columns[0].values) {
+        for (n = 0; n < ARROW_COLUMNS; n++) {
+            if (!(columns[n].values = calloc(1, columns[n].width ? batch_size * columns[n].width : (batch_size + 7) / 8))
+                || (columns[n].nullable && !(columns[n].validity = calloc(1, (batch_size + 7) / 8))))
+            {
+                return DUMP_ARROW_ENOMEM;
+            }
+        }
+        for (name_slots_size = 1024; name_slots_size < batch_size * 2; name_slots_size *= 2);
+        if (!(name_slots = calloc(name_slots_size, sizeof(*name_slots)))) {
+            return DUMP_ARROW_ENOMEM;
+        }
+    }
+    if (!arrow_started) {
+        fb_schema();
+        if ((ret = arrow_message(0, 0)) != DUMP_ARROW_OK) {
+            return ret;
+        }
+        arrow_started = 1;
+    }
+
+    return DUMP_ARROW_OK;
+}
+
+/* Returns the dictionary index of the name, adding it if it is new */
+static int arrow_name_index(const char *text, size_t length, uint32_t *index) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t n, slot;
+
+    for (n = 0; n < length; n++) {
+        hash = (hash ^ (uint8_t)text[n]) * 1099511628211ULL;
+    }
+
+    if (names_num * 2 >= name_slots_size) {
+        size_t size = name_slots_size * 2, *slots;
+
+        if (!(slots = calloc(size, sizeof(*slots)))) {
+            return DUMP_ARROW_ENOMEM;
+        }
+        for (n = 0; n < names_num; n++) {
+            for (slot = names[n].hash & (size - 1); slots[slot]; slot = (slot + 1) & (size - 1));
+            slots[slot] = n + 1;
+        }
+        free(name_slots);
+        name_slots = slots;
+        name_slots_size = size;
+    }
+    for (slot = hash & (name_slots_size - 1); name_slots[slot]; slot = (slot + 1) & (name_slots_size - 1)) {
+        struct arrow_name *name = &names[name_slots[slot] - 1];
+
+        if (name->hash == hash && name->length == length && !memcmp(name_data + name->offset, text, length)) {
+            *index = name_slots[slot] - 1;
+            return DUMP_ARROW_OK;
+        }
+    }
+
+    if (names_num == names_size) {
+        size_t size = names_size ? names_size * 2 : 1024;
+        struct arrow_name *p;
+
+        if (!(p = realloc(names, size * sizeof(*p)))) {
+            return DUMP_ARROW_ENOMEM;
+        }
+        names = p;
+        names_size = size;
+    }
+    if (name_data_used + length > name_data_size) {
+        size_t size = name_data_size ? name_data_size : 64 * 1024;
+        uint8_t *p;
+
+        while (name_data_used + length > size) {
+            size *= 2;
+        }
+        if (!(p = realloc(name_data, size))) {
+            return DUMP_ARROW_ENOMEM;
+        }
+        name_data = p;
+        name_data_size = size;
+    }
+    names[names_num].hash = hash;
+    names[names_num].offset = name_data_used;
+    names[names_num].length = length;
+    memcpy(name_data + name_data_used, text, length);
+    name_data_used += length;
+    name_slots[slot] = names_num + 1;
+    *index = names_num++;
+
+    return DUMP_ARROW_OK;
+}
+
+static void arrow_set(unsigned column, uint64_t v) {
+    struct arrow_column *c = &columns[column];
+
+    if (c->width) {
+        arrow_le(c->values + rows * c->width, v, c->width);
+    }
+    else if (v) {
+        c->values[rows / 8] |= 1 << (rows % 8);
+    }
+    if (c->validity) {
+        c->validity[rows / 8] |= 1 << (rows % 8);
+    }
+}
+
+static void arrow_null(unsigned column) {
+    struct arrow_column *c = &columns[column];
+
+    if (c->width) {
+        memset(c->values + rows * c->width, 0, c->width);
+    }
+    c->nulls++;
+}
+
+/* Addresses are 16 bytes, IPv4 as IPv4-mapped IPv6 */
+static void arrow_set_address(unsigned column, const iaddr *ia) {
+    uint8_t *p = columns[column].values + rows * 16;
+
+    if (ia->af == AF_INET6) {
+        memcpy(p, &ia->u.a6, 16);
+    }
+    else {
+        memset(p, 0, 10);
+        p[10] = p[11] = 0xff;
+        memcpy(p + 12, &ia->u.a4, 4);
+    }
+}
+
+int output_arrow(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen, const slim_t *slim) {
+    dns_wire_rr_t rr;
+    uint8_t qname[255];
+    char text[255 * 4 + 1];
+    size_t offset = 12, count, n;
+    unsigned section, rcode;
+    uint32_t index;
+    int ret, have_question = 0, have_opt = 0;
+
+    (void)flags;
+    if (!payload) {
+        return DUMP_ARROW_EINVAL;
+    }
+    if ((ret = arrow_begin()) != DUMP_ARROW_OK) {
+        return ret;
+    }
+    /* not a DNS message */
+    if (payloadlen < 12) {
+        return DUMP_ARROW_OK;
+    }
+
+    /* the question and the OPT, the rest of the message is skipped over */
+    rcode = payload[3] & 0xf;
+    for (section = 0; section < 4; section++) {
+        count = payload[4 + section * 2] << 8 | payload[5 + section * 2];
+        for (n = 0; n < count; n++) {
+            if (!section && !n) {
+                if (!dns_wire_name(payload, payloadlen, &offset, qname) || offset + 4 > payloadlen) {
+                    break;
+                }
+                rr.type = payload[offset] << 8 | payload[offset + 1];
+                rr.class = payload[offset + 2] << 8 | payload[offset + 3];
+                offset += 4;
+                if ((ret = arrow_name_index(text, dns_wire_name_text(qname, text), &index)) != DUMP_ARROW_OK) {
+                    return ret;
+                }
+                arrow_set(ARROW_QNAME, index);
+                arrow_set(ARROW_QTYPE, rr.type);
+                arrow_set(ARROW_QCLASS, rr.class);
+                have_question = 1;
+                continue;
+            }
+            if (dns_wire_skip(payload, payloadlen, &offset, !section, &rr)) {
+                break;
+            }
+            if (section == 3 && rr.type == 41) {
+                arrow_set(ARROW_EDNS_UDP_SIZE, rr.class);
+                arrow_set(ARROW_EDNS_VERSION, (rr.ttl >> 16) & 0xff);
+                arrow_set(ARROW_EDNS_DO, (rr.ttl >> 15) & 1);
+                rcode |= (rr.ttl >> 24) << 4;
+                have_opt = 1;
+                break;
+            }
+        }
+        if (n < count) {
+            break;
+        }
+    }
+    if (!have_question) {
+        arrow_null(ARROW_QNAME);
+        arrow_null(ARROW_QTYPE);
+        arrow_null(ARROW_QCLASS);
+    }
+    if (!have_opt) {
+        arrow_null(ARROW_EDNS_UDP_SIZE);
+        arrow_null(ARROW_EDNS_VERSION);
+        arrow_null(ARROW_EDNS_DO);
+    }
+
+    arrow_set(ARROW_TIME, (uint64_t)ts.tv_sec * 1000000 + ts.tv_usec);
+    arrow_set_address(ARROW_SRC_ADDR, &from);
+    arrow_set(ARROW_SRC_PORT, sport);
+    arrow_set_address(ARROW_DST_ADDR, &to);
+    arrow_set(ARROW_DST_PORT, dport);
+    arrow_set(ARROW_PROTO, proto);
+    arrow_set(ARROW_ID, payload[0] << 8 | payload[1]);
+    arrow_set(ARROW_FLAGS, payload[2] << 8 | payload[3]);
+    arrow_set(ARROW_RCODE, rcode);
+    /* a slimmed response has the size and counts of the original */
+    if (slim) {
+        arrow_set(ARROW_SIZE, slim->payloadlen);
+        for (n = 0; n < 3; n++) {
+            arrow_set(ARROW_ORIGINAL_ANCOUNT + n, slim->counts[n]);
+        }
+    }
+    else {
+        arrow_set(ARROW_SIZE, payloadlen);
+        for (n = 0; n < 3; n++) {
+            arrow_null(ARROW_ORIGINAL_ANCOUNT + n);
+        }
+    }
+
+    if (++rows == batch_size) {
+        if ((ret = arrow_batch()) != DUMP_ARROW_OK) {
+            return ret;
+        }
+        return DUMP_ARROW_FLUSH;
+    }
+
+    return DUMP_ARROW_OK;
+}
+
+int dump_arrow(FILE * fp) {
+    if (!fp) {
+        return DUMP_ARROW_EINVAL;
+    }
+
+    if (arrow_buf_used) {
+        if (fwrite(arrow_buf, arrow_buf_used, 1, fp) != 1) {
+            return DUMP_ARROW_EWRITE;
+        }
+        arrow_buf_used = 0;
+    }
+
+    return DUMP_ARROW_OK;
+}
+
+int dump_arrow_close(FILE * fp) {
+    int ret;
+
+    if (!fp) {
+        return DUMP_ARROW_EINVAL;
+    }
+
+    /* an empty file is still a stream with the schema */
+    if ((ret = arrow_begin()) != DUMP_ARROW_OK
+        || (rows && (ret = arrow_batch()) != DUMP_ARROW_OK)
+        || (ret = arrow_reserve(8)) != DUMP_ARROW_OK)
+    {
+        return ret;
+    }
+    arrow_le(arrow_buf + arrow_buf_used, ARROW_CONTINUATION, 4);
+    arrow_le(arrow_buf + arrow_buf_used + 4, 0, 4);
+    arrow_buf_used += 8;
+    arrow_started = 0;
+    arrow_names_reset();
+    names_replace = 0;
+
+    return dump_arrow(fp);
+}
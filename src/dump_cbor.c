@@ -54,11 +54,16 @@
 #include "config.h"
 
 #include "dump_cbor.h"
+#include "dns_wire.h"
 #include "dnscap.h"
 
-#if HAVE_LIBLDNS && HAVE_LIBTINYCBOR
+#if HAVE_LIBTINYCBOR
 
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_LIBLDNS
 #include <ldns/ldns.h>
+#endif
 #if HAVE_CBOR_CBOR_H
 #include <cbor/cbor.h>
 #endif
@@ -66,14 +71,23 @@
 #include <cbor.h>
 #endif
 
+/*
+ * CBOR is encoded into a small staging buffer (cbor_size with cbor_reserve
+ * headroom for the message that crosses the limit) and drained to the open
+ * file with dump_cbor() whenever output_cbor() returns DUMP_CBOR_FLUSH.
+ * Each file is one indefinite length array of messages, the array is opened
+ * with the first message and closed by dump_cbor_close().
+ */
 static uint8_t *cbor_buf = 0;
 static size_t cbor_size = 128*1024;
 /*static size_t cbor_size = 1024;*/
 static size_t cbor_reserve = 64*1024;
 static CborEncoder cbor_root, cbor_pkts;
-/*static cbor_stringref_t *cbor_stringrefs = 0;*/
-/*static size_t cbor_stringref_size = 8192;*/
 static int cbor_flushed = 1;
+static int cbor_version = 1;
+#if HAVE_LIBLDNS
+static int cbor_compat = 0;
+#endif
 
 int cbor_set_size(size_t size) {
     if (!size) {
@@ -95,6 +109,26 @@ int cbor_set_reserve(size_t reserve) {
     return DUMP_CBOR_OK;
 }
 
+int cbor_set_version(int version) {
+    if (version != 1 && version != 2) {
+        return DUMP_CBOR_EINVAL;
+    }
+
+    cbor_version = version;
+
+    return DUMP_CBOR_OK;
+}
+
+int cbor_set_compat(int compat) {
+#if HAVE_LIBLDNS
+    cbor_compat = compat ? 1 : 0;
+
+    return DUMP_CBOR_OK;
+#else
+    return compat ? DUMP_CBOR_ENOSUP : DUMP_CBOR_OK;
+#endif
+}
+
 #define append_cbor(func, name, type) CborError func(CborEncoder *encoder, type value, int *should_flush) { \
     CborError err; \
     uint8_t *ptr = encoder->data.ptr; \
@@ -113,8 +147,9 @@ static append_cbor(append_cbor_boolean, cbor_encode_boolean, bool);
 static append_cbor(append_cbor_int, cbor_encode_int, int64_t);
 static append_cbor(append_cbor_uint, cbor_encode_uint, uint64_t);
 static append_cbor(append_cbor_double, cbor_encode_double, double);
+static append_cbor(append_cbor_tag, cbor_encode_tag, CborTag);
 
-static CborError append_cbor_bytes(CborEncoder *encoder, uint8_t *bytes, size_t length, int *should_flush) {
+static CborError append_cbor_bytes(CborEncoder *encoder, const uint8_t *bytes, size_t length, int *should_flush) {
     CborError err;
     uint8_t *ptr = encoder->data.ptr;
     err = cbor_encode_byte_string(encoder, bytes, length);
@@ -127,6 +162,19 @@ static CborError append_cbor_bytes(CborEncoder *encoder, uint8_t *bytes, size_t
     return err;
 }
 
+static CborError append_cbor_text(CborEncoder *encoder, const char *text, size_t length, int *should_flush) {
+    CborError err;
+    uint8_t *ptr = encoder->data.ptr;
+    err = cbor_encode_text_string(encoder, text, length);
+    if (err == CborErrorOutOfMemory && !*should_flush) {
+        *should_flush = 1;
+        encoder->data.ptr = ptr;
+        encoder->end = cbor_buf + cbor_size + cbor_reserve;
+        err = cbor_encode_text_string(encoder, text, length);
+    }
+    return err;
+}
+
 /*CborError append_cbor_text_stringz2(CborEncoder *encoder, const char *value, int *should_flush) {*/
 /*    CborError err;*/
 /*    uint8_t *ptr = encoder->data.ptr;*/
@@ -156,19 +204,22 @@ static CborError append_cbor_bytes(CborEncoder *encoder, uint8_t *bytes, size_t
 static append_cbor_container(append_cbor_array, cbor_encoder_create_array);
 static append_cbor_container(append_cbor_map, cbor_encoder_create_map);
 
+/*
+ * Closing takes the position and end from the container, so it is the
+ * container that gets the reserve when the break byte does not fit.
+ */
 static CborError close_cbor_container(CborEncoder *encoder, CborEncoder *container, int *should_flush) {
     CborError err;
-    uint8_t *ptr = encoder->data.ptr;
     err = cbor_encoder_close_container_checked(encoder, container);
     if (err == CborErrorOutOfMemory && !*should_flush) {
         *should_flush = 1;
-        encoder->data.ptr = ptr;
-        encoder->end = cbor_buf + cbor_size + cbor_reserve;
+        container->end = cbor_buf + cbor_size + cbor_reserve;
         err = cbor_encoder_close_container_checked(encoder, container);
     }
     return err;
 }
 
+#if HAVE_LIBLDNS
 static CborError cbor_ldns_rr_list(CborEncoder *encoder, ldns_rr_list *list, size_t count, int *should_flush) {
     CborError cbor_err = CborNoError;
     size_t n;
@@ -279,33 +330,18 @@ static CborError cbor_ldns_rr_list(CborEncoder *encoder, ldns_rr_list *list, siz
 
     return cbor_err;
 }
+#endif /* HAVE_LIBLDNS */
 
+static int cbor_begin(void) {
+    CborError cbor_err;
 
-int output_cbor(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen) {
-    ldns_pkt *pkt = 0;
-    ldns_status ldns_rc;
-
-    if (!payload) {
-        return DUMP_CBOR_EINVAL;
-    }
-    if (!payloadlen) {
-        return DUMP_CBOR_EINVAL;
-    }
-
-/*    if (!cbor_stringrefs) {*/
-/*        cbor_stringrefs = calloc(1, cbor_stringref_size);*/
-/*    }*/
     if (!cbor_buf) {
         if (!(cbor_buf = calloc(1, cbor_size + cbor_reserve))) {
             return DUMP_CBOR_ENOMEM;
         }
     }
     if (cbor_flushed) {
-        CborError cbor_err;
-
         cbor_encoder_init(&cbor_root, cbor_buf, cbor_size, 0);
-/*        cbor_err = cbor_encode_tag(&cbor_root, 256);*/
-/*        if (cbor_err == CborNoError)*/
         cbor_err = cbor_encoder_create_array(&cbor_root, &cbor_pkts, CborIndefiniteLength);
         if (cbor_err != CborNoError) {
             fprintf(stderr, "cbor init error[%d]: %s\n", cbor_err, cbor_error_string(cbor_err));
@@ -314,6 +350,18 @@ int output_cbor(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sp
         cbor_flushed = 0;
     }
 
+    return DUMP_CBOR_OK;
+}
+
+#if HAVE_LIBLDNS
+/*
+ * The encoder used with cbor_compat, the message is parsed by ldns and the
+ * output is the same as before the wire format encoder was added.
+ */
+static int output_cbor_ldns(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen) {
+    ldns_pkt *pkt = 0;
+    ldns_status ldns_rc;
+
     ldns_rc = ldns_wire2pkt(&pkt, payload, payloadlen);
 
     if (ldns_rc != LDNS_STATUS_OK) {
@@ -514,33 +562,665 @@ int output_cbor(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sp
     }
 
     if (should_flush) {
-        if ((cbor_err = cbor_encoder_close_container_checked(&cbor_root, &cbor_pkts)) != CborNoError) {
+        return DUMP_CBOR_FLUSH;
+    }
+
+    return DUMP_CBOR_OK;
+}
+#endif /* HAVE_LIBLDNS */
+
+/*
+ * The default encoder walks the message in wire format, names are rendered
+ * from their labels and addresses are written as byte strings, nothing is
+ * allocated per message.
+ */
+static CborError cbor_wire_rrs(CborEncoder *encoder, const u_char *payload, size_t len, size_t *offset, size_t count, int *should_flush, int *malformed) {
+    CborError cbor_err = CborNoError;
+    CborEncoder cbor_rrs, cbor_rr;
+    dns_wire_rr_t rr;
+    char text[255 * 4];
+    size_t n;
+
+    cbor_err = append_cbor_array(encoder, &cbor_rrs, CborIndefiniteLength, should_flush);
+    for (n = 0; cbor_err == CborNoError && n < count; n++) {
+        if (dns_wire_rr(payload, len, offset, 0, &rr)) {
+            *malformed = 1;
+            return cbor_err;
+        }
+
+        if (cbor_err == CborNoError) cbor_err = append_cbor_map(&cbor_rrs, &cbor_rr, CborIndefiniteLength, should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor_rr, "NAME", should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_text(&cbor_rr, text, dns_wire_name_text(rr.name, text), should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor_rr, "CLASS", should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, rr.class, should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor_rr, "TYPE", should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, rr.type, should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor_rr, "TTL", should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, rr.ttl, should_flush);
+        if (rr.rdlength) {
+            if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor_rr, "RDLENGTH", should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, rr.rdlength, should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor_rr, "RDATA", should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_bytes(&cbor_rr, rr.rdata, rr.rdlength, should_flush);
+        }
+        if (cbor_err == CborNoError) cbor_err = close_cbor_container(&cbor_rrs, &cbor_rr, should_flush);
+    }
+    if (cbor_err == CborNoError) cbor_err = close_cbor_container(encoder, &cbor_rrs, should_flush);
+
+    return cbor_err;
+}
+
+static CborError append_cbor_addr(CborEncoder *encoder, iaddr *ia, int *should_flush) {
+    if (ia->af == AF_INET6) {
+        return append_cbor_bytes(encoder, (const uint8_t *)&ia->u.a6, sizeof(ia->u.a6), should_flush);
+    }
+    return append_cbor_bytes(encoder, (const uint8_t *)&ia->u.a4, sizeof(ia->u.a4), should_flush);
+}
+
+static int output_cbor_wire(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen, const slim_t *slim) {
+    CborEncoder pkts = cbor_pkts, cbor, ip;
+    CborError cbor_err = CborNoError;
+    dns_wire_rr_t rr;
+    char text[255 * 4];
+    size_t n, offset = 12, count[4], header[4];
+    int should_flush = 0, malformed = 0;
+
+    /* messages that do not parse are left out */
+    if (payloadlen < 12) {
+        return DUMP_CBOR_OK;
+    }
+    for (n = 0; n < 4; n++) {
+        count[n] = payload[4 + n * 2] << 8 | payload[5 + n * 2];
+        /* a slimmed response has the counts of the original in the header */
+        header[n] = slim && n ? slim->counts[n - 1] : count[n];
+    }
+
+    cbor_err = append_cbor_map(&cbor_pkts, &cbor, CborIndefiniteLength, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "dateSeconds", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_double(&cbor, (double)ts.tv_sec + ( (double)ts.tv_usec / 1000000 ), &should_flush);
+
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "ip", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_array(&cbor, &ip, CborIndefiniteLength, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&ip, proto, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_addr(&ip, &from, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&ip, sport, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_addr(&ip, &to, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&ip, dport, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = close_cbor_container(&cbor, &ip, &should_flush);
+
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "ID", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, payload[0] << 8 | payload[1], &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "QR", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, payload[2] >> 7, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "Opcode", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, (payload[2] >> 3) & 0xf, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "AA", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, (payload[2] >> 2) & 1, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "TC", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, (payload[2] >> 1) & 1, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "RD", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, payload[2] & 1, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "RA", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, payload[3] >> 7, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "AD", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, (payload[3] >> 5) & 1, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "CD", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, (payload[3] >> 4) & 1, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "RCODE", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, payload[3] & 0xf, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "QDCOUNT", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, header[0], &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "ANCOUNT", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, header[1], &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "NSCOUNT", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, header[2], &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "ARCOUNT", &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, header[3], &should_flush);
+    if (slim) {
+        if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "originalLength", &should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, slim->payloadlen, &should_flush);
+    }
+
+    /* questionRRs */
+
+    if (count[0] > 0) {
+        if (dns_wire_rr(payload, payloadlen, &offset, 1, &rr)) {
+            malformed = 1;
+        }
+        else {
+            if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "QNAME", &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_text(&cbor, text, dns_wire_name_text(rr.name, text), &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "QCLASS", &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, rr.class, &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "QTYPE", &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, rr.type, &should_flush);
+        }
+
+        if (count[0] > 1 && !malformed) {
+            CborEncoder queries;
+
+            if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "questionRRs", &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_array(&cbor, &queries, CborIndefiniteLength, &should_flush);
+            for (n = 1; cbor_err == CborNoError && n < count[0]; n++) {
+                CborEncoder query;
+
+                if (dns_wire_rr(payload, payloadlen, &offset, 1, &rr)) {
+                    malformed = 1;
+                    break;
+                }
+
+                if (cbor_err == CborNoError) cbor_err = append_cbor_map(&queries, &query, CborIndefiniteLength, &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&query, "NAME", &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_text(&query, text, dns_wire_name_text(rr.name, text), &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&query, "CLASS", &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&query, rr.class, &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&query, "TYPE", &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&query, rr.type, &should_flush);
+                if (cbor_err == CborNoError) cbor_err = close_cbor_container(&queries, &query, &should_flush);
+            }
+            if (cbor_err == CborNoError && !malformed) cbor_err = close_cbor_container(&cbor, &queries, &should_flush);
+        }
+    }
+
+    /* answerRRs, authorityRRs and additionalRRs */
+
+    if (count[1] > 0 && !malformed) {
+        if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "answerRRs", &should_flush);
+        if (cbor_err == CborNoError) cbor_err = cbor_wire_rrs(&cbor, payload, payloadlen, &offset, count[1], &should_flush, &malformed);
+    }
+    if (count[2] > 0 && !malformed) {
+        if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "authorityRRs", &should_flush);
+        if (cbor_err == CborNoError) cbor_err = cbor_wire_rrs(&cbor, payload, payloadlen, &offset, count[2], &should_flush, &malformed);
+    }
+    if (count[3] > 0 && !malformed) {
+        if (cbor_err == CborNoError) cbor_err = append_cbor_text_stringz(&cbor, "additionalRRs", &should_flush);
+        if (cbor_err == CborNoError) cbor_err = cbor_wire_rrs(&cbor, payload, payloadlen, &offset, count[3], &should_flush, &malformed);
+    }
+
+    if (malformed) {
+        cbor_pkts = pkts;
+        return should_flush ? DUMP_CBOR_FLUSH : DUMP_CBOR_OK;
+    }
+
+    if (cbor_err == CborNoError) cbor_err = close_cbor_container(&cbor_pkts, &cbor, &should_flush);
+
+    if (cbor_err != CborNoError) {
+        fprintf(stderr, "cbor error[%d]: %s\n", cbor_err, cbor_error_string(cbor_err));
+        return DUMP_CBOR_ECBOR;
+    }
+
+    if (should_flush) {
+        return DUMP_CBOR_FLUSH;
+    }
+
+    return DUMP_CBOR_OK;
+}
+
+/*
+ * cbor_version 2, the same message content with small integer keys and the
+ * time as seconds and nanoseconds. The messages are written in stringref
+ * namespaces (tag 256), one per chunk, and names, addresses and rdata that
+ * have been seen before in the namespace are written as references (tag 25)
+ * to the first occurrence, see http://cbor.schmorp.de/stringref .
+ */
+
+enum {
+    CBOR_V2_SECONDS = 0,
+    CBOR_V2_NANOSECONDS,
+    CBOR_V2_IP,
+    CBOR_V2_ID,
+    CBOR_V2_QR,
+    CBOR_V2_OPCODE,
+    CBOR_V2_AA,
+    CBOR_V2_TC,
+    CBOR_V2_RD,
+    CBOR_V2_RA,
+    CBOR_V2_AD,
+    CBOR_V2_CD,
+    CBOR_V2_RCODE,
+    CBOR_V2_QDCOUNT,
+    CBOR_V2_ANCOUNT,
+    CBOR_V2_NSCOUNT,
+    CBOR_V2_ARCOUNT,
+    CBOR_V2_QNAME,
+    CBOR_V2_QCLASS,
+    CBOR_V2_QTYPE,
+    CBOR_V2_QUESTIONRRS,
+    CBOR_V2_ANSWERRRS,
+    CBOR_V2_AUTHORITYRRS,
+    CBOR_V2_ADDITIONALRRS,
+    CBOR_V2_ORIGINALLENGTH
+};
+
+enum {
+    CBOR_V2_RR_NAME = 0,
+    CBOR_V2_RR_CLASS,
+    CBOR_V2_RR_TYPE,
+    CBOR_V2_RR_TTL,
+    CBOR_V2_RR_RDATA
+};
+
+/*
+ * The strings that got an index in the current namespace, the table is open
+ * addressed and cleared by moving to the next generation. The strings are
+ * copied to cbor_stringref_data since the chunk they were written in can be
+ * flushed while the namespace is still open.
+ */
+#define CBOR_STRINGREF_SLOTS    65536
+#define CBOR_STRINGREF_MAX      (CBOR_STRINGREF_SLOTS / 4 * 3)
+
+struct cbor_stringref {
+    uint64_t    hash;
+    uint64_t    index;
+    size_t      offset;
+    size_t      length;
+    unsigned    generation;
+    CborType    type;
+};
+
+static struct cbor_stringref *cbor_stringrefs = 0;
+static uint8_t *cbor_stringref_data = 0;
+static size_t cbor_stringref_data_size = 0, cbor_stringref_data_used = 0, cbor_stringref_used = 0;
+static unsigned cbor_stringref_generation = 1;
+static uint64_t cbor_stringref_next = 0;
+static CborEncoder cbor_ns;
+static int cbor_ns_open = 0;
+
+static void cbor_stringref_reset(void) {
+    cbor_stringref_generation++;
+    cbor_stringref_data_used = 0;
+    cbor_stringref_used = 0;
+}
+
+/* If a string written as it is gets the next index, the minimum length grows with the index. */
+static int cbor_stringref_fits(size_t length, uint64_t index) {
+    if (index < 24) {
+        return length >= 3;
+    }
+    if (index < 256) {
+        return length >= 4;
+    }
+    if (index < 65536) {
+        return length >= 5;
+    }
+    if (index < 4294967296ULL) {
+        return length >= 7;
+    }
+    return length >= 11;
+}
+
+static CborError append_cbor_stringref(CborEncoder *encoder, CborType type, const uint8_t *string, size_t length, int *should_flush) {
+    struct cbor_stringref *ref;
+    uint64_t hash = 14695981039346656037ULL ^ type;
+    size_t n, slot;
+    CborError err;
+
+    if (length < 3) {
+        if (type == CborTextStringType) {
+            return append_cbor_text(encoder, (const char *)string, length, should_flush);
+        }
+        return append_cbor_bytes(encoder, string, length, should_flush);
+    }
+
+    for (n = 0; n < length; n++) {
+        hash = (hash ^ string[n]) * 1099511628211ULL;
+    }
+    for (slot = hash & (CBOR_STRINGREF_SLOTS - 1); ; slot = (slot + 1) & (CBOR_STRINGREF_SLOTS - 1)) {
+        ref = &cbor_stringrefs[slot];
+        if (ref->generation != cbor_stringref_generation) {
+            break;
+        }
+        if (ref->hash == hash && ref->type == type && ref->length == length
+            && !memcmp(cbor_stringref_data + ref->offset, string, length))
+        {
+            err = append_cbor_tag(encoder, 25, should_flush);
+            if (err == CborNoError) err = append_cbor_uint(encoder, ref->index, should_flush);
+            return err;
+        }
+    }
+
+    if (type == CborTextStringType) {
+        err = append_cbor_text(encoder, (const char *)string, length, should_flush);
+    }
+    else {
+        err = append_cbor_bytes(encoder, string, length, should_flush);
+    }
+    if (err != CborNoError) {
+        return err;
+    }
+
+    if (!cbor_stringref_fits(length, cbor_stringref_next)) {
+        return CborNoError;
+    }
+
+    /* the decoder counts it even if it is not remembered here */
+    if (cbor_stringref_used < CBOR_STRINGREF_MAX
+        && cbor_stringref_data_used + length <= cbor_stringref_data_size)
+    {
+        memcpy(cbor_stringref_data + cbor_stringref_data_used, string, length);
+        ref->hash = hash;
+        ref->index = cbor_stringref_next;
+        ref->offset = cbor_stringref_data_used;
+        ref->length = length;
+        ref->generation = cbor_stringref_generation;
+        ref->type = type;
+        cbor_stringref_data_used += length;
+        cbor_stringref_used++;
+    }
+    cbor_stringref_next++;
+
+    return CborNoError;
+}
+
+static CborError append_cbor_v2_name(CborEncoder *encoder, const uint8_t *name, int *should_flush) {
+    char text[255 * 4];
+
+    return append_cbor_stringref(encoder, CborTextStringType, (const uint8_t *)text, dns_wire_name_text(name, text), should_flush);
+}
+
+static CborError append_cbor_v2_addr(CborEncoder *encoder, iaddr *ia, int *should_flush) {
+    if (ia->af == AF_INET6) {
+        return append_cbor_stringref(encoder, CborByteStringType, (const uint8_t *)&ia->u.a6, sizeof(ia->u.a6), should_flush);
+    }
+    return append_cbor_stringref(encoder, CborByteStringType, (const uint8_t *)&ia->u.a4, sizeof(ia->u.a4), should_flush);
+}
+
+static CborError cbor_v2_rrs(CborEncoder *encoder, const u_char *payload, size_t len, size_t *offset, size_t count, int *should_flush, int *malformed) {
+    CborError cbor_err = CborNoError;
+    CborEncoder cbor_rrs, cbor_rr;
+    dns_wire_rr_t rr;
+    size_t n;
+
+    cbor_err = append_cbor_array(encoder, &cbor_rrs, CborIndefiniteLength, should_flush);
+    for (n = 0; cbor_err == CborNoError && n < count; n++) {
+        if (dns_wire_rr(payload, len, offset, 0, &rr)) {
+            *malformed = 1;
+            return cbor_err;
+        }
+
+        if (cbor_err == CborNoError) cbor_err = append_cbor_map(&cbor_rrs, &cbor_rr, CborIndefiniteLength, should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, CBOR_V2_RR_NAME, should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_v2_name(&cbor_rr, rr.name, should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, CBOR_V2_RR_CLASS, should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, rr.class, should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, CBOR_V2_RR_TYPE, should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, rr.type, should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, CBOR_V2_RR_TTL, should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, rr.ttl, should_flush);
+        if (rr.rdlength) {
+            if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor_rr, CBOR_V2_RR_RDATA, should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_stringref(&cbor_rr, CborByteStringType, rr.rdata, rr.rdlength, should_flush);
+        }
+        if (cbor_err == CborNoError) cbor_err = close_cbor_container(&cbor_rrs, &cbor_rr, should_flush);
+    }
+    if (cbor_err == CborNoError) cbor_err = close_cbor_container(encoder, &cbor_rrs, should_flush);
+
+    return cbor_err;
+}
+
+static int output_cbor_v2(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen, const slim_t *slim) {
+    CborEncoder msgs, cbor, ip;
+    CborError cbor_err = CborNoError;
+    dns_wire_rr_t rr;
+    size_t n, offset = 12, count[4], header[4];
+    uint64_t next;
+    int should_flush = 0, malformed = 0;
+
+    /* messages that do not parse are left out */
+    if (payloadlen < 12) {
+        return DUMP_CBOR_OK;
+    }
+    for (n = 0; n < 4; n++) {
+        count[n] = payload[4 + n * 2] << 8 | payload[5 + n * 2];
+        header[n] = slim && n ? slim->counts[n - 1] : count[n];
+    }
+
+    if (!cbor_stringrefs) {
+        cbor_stringref_data_size = cbor_size + cbor_reserve;
+        if (!(cbor_stringrefs = calloc(CBOR_STRINGREF_SLOTS, sizeof(*cbor_stringrefs)))
+            || !(cbor_stringref_data = malloc(cbor_stringref_data_size)))
+        {
+            return DUMP_CBOR_ENOMEM;
+        }
+    }
+    if (!cbor_ns_open) {
+        cbor_err = append_cbor_tag(&cbor_pkts, 256, &should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_array(&cbor_pkts, &cbor_ns, CborIndefiniteLength, &should_flush);
+        if (cbor_err != CborNoError) {
             fprintf(stderr, "cbor error[%d]: %s\n", cbor_err, cbor_error_string(cbor_err));
             return DUMP_CBOR_ECBOR;
         }
+        cbor_ns_open = 1;
+        cbor_stringref_next = 0;
+        cbor_stringref_reset();
+    }
+    msgs = cbor_ns;
+    next = cbor_stringref_next;
+
+    cbor_err = append_cbor_map(&cbor_ns, &cbor, CborIndefiniteLength, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_SECONDS, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, ts.tv_sec, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_NANOSECONDS, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, (uint64_t)ts.tv_usec * 1000, &should_flush);
+
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_IP, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_array(&cbor, &ip, CborIndefiniteLength, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&ip, proto, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_v2_addr(&ip, &from, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&ip, sport, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_v2_addr(&ip, &to, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&ip, dport, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = close_cbor_container(&cbor, &ip, &should_flush);
+
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_ID, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, payload[0] << 8 | payload[1], &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_QR, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, payload[2] >> 7, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_OPCODE, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, (payload[2] >> 3) & 0xf, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_AA, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, (payload[2] >> 2) & 1, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_TC, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, (payload[2] >> 1) & 1, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_RD, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, payload[2] & 1, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_RA, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, payload[3] >> 7, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_AD, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, (payload[3] >> 5) & 1, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_CD, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_boolean(&cbor, (payload[3] >> 4) & 1, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_RCODE, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, payload[3] & 0xf, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_QDCOUNT, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, header[0], &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_ANCOUNT, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, header[1], &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_NSCOUNT, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, header[2], &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_ARCOUNT, &should_flush);
+    if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, header[3], &should_flush);
+    if (slim) {
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_ORIGINALLENGTH, &should_flush);
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, slim->payloadlen, &should_flush);
+    }
+
+    /* questionRRs */
+
+    if (count[0] > 0) {
+        if (dns_wire_rr(payload, payloadlen, &offset, 1, &rr)) {
+            malformed = 1;
+        }
+        else {
+            if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_QNAME, &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_v2_name(&cbor, rr.name, &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_QCLASS, &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, rr.class, &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_QTYPE, &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, rr.type, &should_flush);
+        }
+
+        if (count[0] > 1 && !malformed) {
+            CborEncoder queries;
+
+            if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_QUESTIONRRS, &should_flush);
+            if (cbor_err == CborNoError) cbor_err = append_cbor_array(&cbor, &queries, CborIndefiniteLength, &should_flush);
+            for (n = 1; cbor_err == CborNoError && n < count[0]; n++) {
+                CborEncoder query;
+
+                if (dns_wire_rr(payload, payloadlen, &offset, 1, &rr)) {
+                    malformed = 1;
+                    break;
+                }
+
+                if (cbor_err == CborNoError) cbor_err = append_cbor_map(&queries, &query, CborIndefiniteLength, &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&query, CBOR_V2_RR_NAME, &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_v2_name(&query, rr.name, &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&query, CBOR_V2_RR_CLASS, &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&query, rr.class, &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&query, CBOR_V2_RR_TYPE, &should_flush);
+                if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&query, rr.type, &should_flush);
+                if (cbor_err == CborNoError) cbor_err = close_cbor_container(&queries, &query, &should_flush);
+            }
+            if (cbor_err == CborNoError && !malformed) cbor_err = close_cbor_container(&cbor, &queries, &should_flush);
+        }
+    }
+
+    /* answerRRs, authorityRRs and additionalRRs */
 
-        fprintf(stderr, "cbor output: %lu bytes\n", cbor_encoder_get_buffer_size(&cbor_root, cbor_buf));
+    if (count[1] > 0 && !malformed) {
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_ANSWERRRS, &should_flush);
+        if (cbor_err == CborNoError) cbor_err = cbor_v2_rrs(&cbor, payload, payloadlen, &offset, count[1], &should_flush, &malformed);
+    }
+    if (count[2] > 0 && !malformed) {
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_AUTHORITYRRS, &should_flush);
+        if (cbor_err == CborNoError) cbor_err = cbor_v2_rrs(&cbor, payload, payloadlen, &offset, count[2], &should_flush, &malformed);
+    }
+    if (count[3] > 0 && !malformed) {
+        if (cbor_err == CborNoError) cbor_err = append_cbor_uint(&cbor, CBOR_V2_ADDITIONALRRS, &should_flush);
+        if (cbor_err == CborNoError) cbor_err = cbor_v2_rrs(&cbor, payload, payloadlen, &offset, count[3], &should_flush, &malformed);
+    }
 
-        cbor_flushed = 1;
+    if (malformed) {
+        /*
+         * The strings of the message were never written so the indexes are
+         * given back, the table may remember some of them and is cleared.
+         */
+        cbor_ns = msgs;
+        if (cbor_stringref_next != next) {
+            cbor_stringref_next = next;
+            cbor_stringref_reset();
+        }
+    }
+    else if (cbor_err == CborNoError) {
+        cbor_err = close_cbor_container(&cbor_ns, &cbor, &should_flush);
+    }
+
+    /* the namespace ends with the chunk or when the table is full */
+    if (cbor_err == CborNoError
+        && (should_flush
+            || cbor_stringref_used >= CBOR_STRINGREF_MAX
+            || cbor_stringref_data_used + 65535 > cbor_stringref_data_size))
+    {
+        cbor_err = close_cbor_container(&cbor_pkts, &cbor_ns, &should_flush);
+        cbor_ns_open = 0;
+    }
+
+    if (cbor_err != CborNoError) {
+        fprintf(stderr, "cbor error[%d]: %s\n", cbor_err, cbor_error_string(cbor_err));
+        return DUMP_CBOR_ECBOR;
+    }
+
+    if (should_flush) {
         return DUMP_CBOR_FLUSH;
     }
 
     return DUMP_CBOR_OK;
 }
 
+int output_cbor(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen, const slim_t *slim) {
+    int ret;
+
+    if (!payload) {
+        return DUMP_CBOR_EINVAL;
+    }
+    if (!payloadlen) {
+        return DUMP_CBOR_EINVAL;
+    }
+
+    if ((ret = cbor_begin()) != DUMP_CBOR_OK) {
+        return ret;
+    }
+
+#if HAVE_LIBLDNS
+    if (cbor_compat) {
+        return output_cbor_ldns(from, to, proto, flags, sport, dport, ts, payload, payloadlen);
+    }
+#endif
+    if (cbor_version == 2) {
+        return output_cbor_v2(from, to, proto, flags, sport, dport, ts, payload, payloadlen, slim);
+    }
+    return output_cbor_wire(from, to, proto, flags, sport, dport, ts, payload, payloadlen, slim);
+}
+
 int dump_cbor(FILE * fp) {
+    CborEncoder *msgs = cbor_ns_open ? &cbor_ns : &cbor_pkts;
+    size_t size;
+
+    if (!fp) {
+        return DUMP_CBOR_EINVAL;
+    }
+    if (cbor_flushed) {
+        return DUMP_CBOR_OK;
+    }
+
+    /*
+     * Write out what has been staged so far and rewind the message array
+     * encoder to the start of the buffer, the array (and the stringref
+     * namespace if one is open) stays open.
+     */
+    if ((size = msgs->data.ptr - cbor_buf)) {
+        if (fwrite(cbor_buf, size, 1, fp) != 1) {
+            return DUMP_CBOR_EWRITE;
+        }
+    }
+    msgs->data.ptr = cbor_buf;
+    msgs->end = cbor_buf + cbor_size;
+
+    return DUMP_CBOR_OK;
+}
+
+int dump_cbor_close(FILE * fp) {
     CborError cbor_err;
+    int ret;
 
     if (!fp) {
         return DUMP_CBOR_EINVAL;
     }
 
+    /* make sure an empty file is still a valid (empty) array */
+    if ((ret = cbor_begin()) != DUMP_CBOR_OK) {
+        return ret;
+    }
+
+    if (cbor_ns_open) {
+        cbor_pkts.data.ptr = cbor_ns.data.ptr;
+        cbor_pkts.end = cbor_buf + cbor_size + cbor_reserve;
+        cbor_ns.end = cbor_pkts.end;
+        if ((cbor_err = cbor_encoder_close_container_checked(&cbor_pkts, &cbor_ns)) != CborNoError) {
+            fprintf(stderr, "cbor error[%d]: %s\n", cbor_err, cbor_error_string(cbor_err));
+            return DUMP_CBOR_ECBOR;
+        }
+        cbor_ns_open = 0;
+    }
+    cbor_root.data.ptr = cbor_pkts.data.ptr;
+    cbor_root.end = cbor_buf + cbor_size + cbor_reserve;
+    cbor_pkts.end = cbor_root.end;
     if ((cbor_err = cbor_encoder_close_container_checked(&cbor_root, &cbor_pkts)) != CborNoError) {
         fprintf(stderr, "cbor error[%d]: %s\n", cbor_err, cbor_error_string(cbor_err));
         return DUMP_CBOR_ECBOR;
     }
-
-    fprintf(stderr, "cbor output: %lu bytes\n", cbor_encoder_get_buffer_size(&cbor_root, cbor_buf));
+    cbor_flushed = 1;
 
     if (fwrite(cbor_buf, cbor_encoder_get_buffer_size(&cbor_root, cbor_buf), 1, fp) != 1) {
         return DUMP_CBOR_EWRITE;
@@ -553,7 +1233,7 @@ int have_cbor_support() {
     return 1;
 }
 
-#else /* HAVE_LIBLDNS && HAVE_LIBTINYCBOR */
+#else /* HAVE_LIBTINYCBOR */
 
 int cbor_set_size(size_t size) {
     return DUMP_CBOR_ENOSUP;
@@ -563,11 +1243,27 @@ int cbor_set_reserve(size_t reserve) {
     return DUMP_CBOR_ENOSUP;
 }
 
-int output_cbor(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen) {
+int cbor_set_version(int version) {
+    if (version != 1) {
+        return DUMP_CBOR_ENOSUP;
+    }
+
+    return DUMP_CBOR_OK;
+}
+
+int cbor_set_compat(int compat) {
+    return DUMP_CBOR_ENOSUP;
+}
+
+int output_cbor(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen, const slim_t *slim) {
+    return DUMP_CBOR_ENOSUP;
+}
+
+int dump_cbor(FILE * fp) {
     return DUMP_CBOR_ENOSUP;
 }
 
-int dump_cbor() {
+int dump_cbor_close(FILE * fp) {
     return DUMP_CBOR_ENOSUP;
 }
 
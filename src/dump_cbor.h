@@ -34,6 +34,8 @@
 
 #include "dnscap_common.h"
 
+#include <stdio.h>
+
 #ifndef __dnscap_dump_cbor_h
 #define __dnscap_dump_cbor_h
 
@@ -46,18 +48,13 @@
 #define DUMP_CBOR_FLUSH     6
 #define DUMP_CBOR_ENOSUP    7
 
-/*
-typedef struct cbor_stringref cbor_stringref_t;
-struct cbor_stringref {
-    char *string;
-    size_t ref;
-};
-*/
-
 int cbor_set_size(size_t size);
 int cbor_set_reserve(size_t reserve);
-int output_cbor(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen);
-int dump_cbor();
+int cbor_set_version(int version);
+int cbor_set_compat(int compat);
+int output_cbor(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen, const slim_t *slim);
+int dump_cbor(FILE * fp);
+int dump_cbor_close(FILE * fp);
 int have_cbor_support();
 
 #endif /* __dnscap_dump_cbor_h */
@@ -0,0 +1,1159 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "dump_cdns.h"
+#include "dns_wire.h"
+#include "dnscap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * C-DNS, RFC 8618.
+ *
+ * The file is [ "C-DNS", preamble, [_ block, ... ] ] with the blocks in an
+ * indefinite length array so a block is written out as soon as it has
+ * block_size items and a file can be read while it is written.
+ * Each block has its own tables of addresses, class/types, names and
+ * rdata, signatures, questions and resource records which the items refer
+ * to by (0-based) index, a query and its response are matched into one
+ * item while the block is open.
+ *
+ * The messages are parsed with the same wire format parser as the CBOR
+ * output, names and rdata are stored uncompressed.
+ */
+
+#define CDNS_NONE ((size_t)-1)
+
+#define CDNS_TICKS_PER_SECOND 1000000
+
+/*
+ * Implementation-specific QueryResponse key, RFC 8618 section 7.3.2, with
+ * the answer, authority and additional counts of a response that slim=
+ * cut the sections from, response-size is the length of the original.
+ */
+#define CDNS_QR_ORIGINAL_COUNTS (-1)
+
+/* CBOR major types */
+#define CDNS_CBOR_UINT  0
+#define CDNS_CBOR_NINT  1
+#define CDNS_CBOR_BYTES 2
+#define CDNS_CBOR_TEXT  3
+#define CDNS_CBOR_ARRAY 4
+#define CDNS_CBOR_MAP   5
+
+/* QueryResponseTransportFlags */
+#define CDNS_TRANSPORT_IPV6     (1 << 0)
+#define CDNS_TRANSPORT_TCP      (1 << 1)
+
+/* QueryResponseFlags */
+#define CDNS_HAS_QUERY                  (1 << 0)
+#define CDNS_HAS_RESPONSE               (1 << 1)
+#define CDNS_QUERY_HAS_OPT              (1 << 2)
+#define CDNS_RESPONSE_HAS_OPT           (1 << 3)
+#define CDNS_QUERY_HAS_NO_QUESTION      (1 << 4)
+#define CDNS_RESPONSE_HAS_NO_QUESTION   (1 << 5)
+
+/* QueryResponseSignature keys, also the bits of the signature hints */
+enum {
+    CDNS_SIG_SERVER_ADDRESS = 0,
+    CDNS_SIG_SERVER_PORT,
+    CDNS_SIG_TRANSPORT_FLAGS,
+    CDNS_SIG_QR_TYPE,
+    CDNS_SIG_QR_SIG_FLAGS,
+    CDNS_SIG_QUERY_OPCODE,
+    CDNS_SIG_QR_DNS_FLAGS,
+    CDNS_SIG_QUERY_RCODE,
+    CDNS_SIG_QUERY_CLASSTYPE,
+    CDNS_SIG_QUERY_QDCOUNT,
+    CDNS_SIG_QUERY_ANCOUNT,
+    CDNS_SIG_QUERY_NSCOUNT,
+    CDNS_SIG_QUERY_ARCOUNT,
+    CDNS_SIG_QUERY_EDNS_VERSION,
+    CDNS_SIG_QUERY_UDP_SIZE,
+    CDNS_SIG_QUERY_OPT_RDATA,
+    CDNS_SIG_RESPONSE_RCODE,
+    CDNS_SIG_FIELDS
+};
+
+/* The fields of the items and the signatures that are written */
+#define CDNS_QR_HINTS   0x3fbdf
+#define CDNS_SIG_HINTS  0x1fff7
+#define CDNS_RR_HINTS   0x3
+#define CDNS_OTHER_HINTS 0x1
+
+/* The RR types assigned by IANA, all types are stored */
+static const unsigned cdns_rr_types[] = {
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
+    21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38,
+    39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 55, 56, 57,
+    58, 59, 60, 61, 62, 63, 64, 65, 99, 100, 101, 102, 103, 104, 105, 106,
+    107, 108, 109, 249, 250, 251, 252, 253, 254, 255, 256, 257, 258, 259,
+    260, 32768, 32769
+};
+
+/*
+ * A block table, the entries are kept as the bytes of their key and are
+ * deduplicated with an open addressed hash table of entry index + 1.
+ * The memory is kept between blocks and only grows.
+ */
+struct cdns_entry {
+    uint64_t    hash;
+    size_t      offset;
+    size_t      length;
+};
+
+struct cdns_table {
+    uint8_t             *data;
+    size_t              data_used, data_size;
+    struct cdns_entry   *entries;
+    size_t              count, size;
+    size_t              *slots;
+    size_t              slots_size;
+};
+
+enum {
+    CDNS_IP_ADDRESS = 0,
+    CDNS_CLASSTYPE,
+    CDNS_NAME_RDATA,
+    CDNS_QR_SIG,
+    CDNS_QLIST,
+    CDNS_QRR,
+    CDNS_RRLIST,
+    CDNS_RR,
+    CDNS_MALFORMED_DATA,
+    CDNS_TABLES
+};
+
+struct cdns_item {
+    my_bpftimeval   ts;
+    uint8_t         client[16], server[16];
+    size_t          client_addr, server_addr;
+    unsigned        client_port, server_port, transport, id;
+    unsigned        sig_flags, opcode, dns_flags, query_rcode, response_rcode;
+    unsigned        count[4];
+    unsigned        edns_version, udp_size;
+    size_t          opt_rdata;
+    size_t          qname, classtype;
+    unsigned        query_size, response_size;
+    int             slimmed;
+    unsigned        original_counts[3];
+    int64_t         response_delay;
+    size_t          query_sections[4], response_sections[4];
+    size_t          sig;
+    size_t          next;
+};
+
+struct cdns_malformed {
+    my_bpftimeval   ts;
+    size_t          client_addr;
+    unsigned        client_port;
+    size_t          data;
+};
+
+/* What is taken from one message before it is put into an item */
+struct cdns_message {
+    size_t      qname, classtype;
+    size_t      sections[4];
+    int         has_opt;
+    unsigned    opt_rcode, edns_version, udp_size, opt_do;
+    size_t      opt_rdata;
+};
+
+static size_t block_size = CDNS_DEFAULT_BLOCK_SIZE;
+static struct cdns_table tables[CDNS_TABLES];
+static struct cdns_item *items = 0;
+static size_t items_num = 0;
+static struct cdns_malformed *malformed = 0;
+static size_t malformed_num = 0;
+static size_t processed = 0;
+/* queries waiting for their response, item index + 1 */
+static size_t *pending = 0;
+static size_t pending_size = 0;
+static uint32_t cdns_list[65536];
+static uint8_t cdns_key[12 + 65535];
+
+static uint8_t *cdns_buf = 0;
+static size_t cdns_buf_used = 0, cdns_buf_size = 0;
+static int cdns_started = 0;
+
+int cdns_set_block_size(size_t items) {
+    if (!items) {
+        return DUMP_CDNS_EINVAL;
+    }
+
+    block_size = items;
+
+    return DUMP_CDNS_OK;
+}
+
+static uint64_t cdns_hash(const uint8_t *key, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    while (length--) {
+        hash = (hash ^ *key++) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static void cdns_table_reset(struct cdns_table *table) {
+    table->data_used = 0;
+    table->count = 0;
+    if (table->slots) {
+        memset(table->slots, 0, table->slots_size * sizeof(*table->slots));
+    }
+}
+
+static int cdns_table_grow(struct cdns_table *table) {
+    size_t *slots, size = table->slots_size ? table->slots_size * 2 : 1024, n, slot;
+
+    if (!(slots = calloc(size, sizeof(*slots)))) {
+        return 1;
+    }
+    for (n = 0; n < table->count; n++) {
+        for (slot = table->entries[n].hash & (size - 1); slots[slot]; slot = (slot + 1) & (size - 1));
+        slots[slot] = n + 1;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slots_size = size;
+
+    return 0;
+}
+
+/* Returns the index of the entry with this key, adding it if needed, or CDNS_NONE if out of memory. */
+static size_t cdns_table_add(struct cdns_table *table, const void *key, size_t length) {
+    struct cdns_entry *entry;
+    uint64_t hash = cdns_hash(key, length);
+    size_t slot;
+
+    if (table->count * 2 >= table->slots_size && cdns_table_grow(table)) {
+        return CDNS_NONE;
+    }
+    for (slot = hash & (table->slots_size - 1); table->slots[slot]; slot = (slot + 1) & (table->slots_size - 1)) {
+        entry = &table->entries[table->slots[slot] - 1];
+        if (entry->hash == hash && entry->length == length && !memcmp(table->data + entry->offset, key, length)) {
+            return table->slots[slot] - 1;
+        }
+    }
+
+    if (table->count == table->size) {
+        size_t size = table->size ? table->size * 2 : 1024;
+
+        if (!(entry = realloc(table->entries, size * sizeof(*entry)))) {
+            return CDNS_NONE;
+        }
+        table->entries = entry;
+        table->size = size;
+    }
+    if (table->data_used + length > table->data_size) {
+        size_t size = table->data_size ? table->data_size : 64 * 1024;
+        uint8_t *data;
+
+        while (table->data_used + length > size) {
+            size *= 2;
+        }
+        if (!(data = realloc(table->data, size))) {
+            return CDNS_NONE;
+        }
+        table->data = data;
+        table->data_size = size;
+    }
+
+    entry = &table->entries[table->count];
+    entry->hash = hash;
+    entry->offset = table->data_used;
+    entry->length = length;
+    if (length) {
+        memcpy(table->data + table->data_used, key, length);
+    }
+    table->data_used += length;
+    table->slots[slot] = ++table->count;
+
+    return table->count - 1;
+}
+
+static size_t cdns_addr(iaddr *ia) {
+    if (ia->af == AF_INET6) {
+        return cdns_table_add(&tables[CDNS_IP_ADDRESS], &ia->u.a6, sizeof(ia->u.a6));
+    }
+    return cdns_table_add(&tables[CDNS_IP_ADDRESS], &ia->u.a4, sizeof(ia->u.a4));
+}
+
+static size_t cdns_classtype(unsigned type, unsigned class) {
+    uint32_t key[2];
+
+    key[0] = type;
+    key[1] = class;
+    return cdns_table_add(&tables[CDNS_CLASSTYPE], key, sizeof(key));
+}
+
+/*
+ * Add the questions or resource records of a section to the tables and
+ * return the index of their list, CDNS_NONE if there are none. An OPT in
+ * the additional section of a query goes into the signature and is not
+ * listed. Sets *bad if the section is malformed or out of memory.
+ */
+static size_t cdns_section(const u_char *payload, size_t len, size_t *offset, size_t count, int section, int is_query, struct cdns_message *m, int *bad) {
+    dns_wire_rr_t rr;
+    uint32_t key[4];
+    size_t n, num = 0, idx;
+
+    for (n = 0; n < count; n++) {
+        if (dns_wire_rr(payload, len, offset, !section, &rr)) {
+            *bad = 1;
+            return CDNS_NONE;
+        }
+
+        if (section == 3 && rr.type == 41 && !m->has_opt) {
+            m->has_opt = 1;
+            m->udp_size = rr.class;
+            m->opt_rcode = rr.ttl >> 24;
+            m->edns_version = (rr.ttl >> 16) & 0xff;
+            m->opt_do = (rr.ttl >> 15) & 1;
+            if (is_query) {
+                if ((m->opt_rdata = cdns_table_add(&tables[CDNS_NAME_RDATA], rr.rdata, rr.rdlength)) == CDNS_NONE) {
+                    *bad = 1;
+                    return CDNS_NONE;
+                }
+                continue;
+            }
+        }
+
+        if ((idx = cdns_table_add(&tables[CDNS_NAME_RDATA], rr.name, rr.name_len)) == CDNS_NONE) {
+            *bad = 1;
+            return CDNS_NONE;
+        }
+        key[0] = idx;
+        if ((idx = cdns_classtype(rr.type, rr.class)) == CDNS_NONE) {
+            *bad = 1;
+            return CDNS_NONE;
+        }
+        key[1] = idx;
+
+        /* the first question is given by the item itself */
+        if (!section && !n) {
+            m->qname = key[0];
+            m->classtype = key[1];
+            continue;
+        }
+
+        if (section) {
+            key[2] = rr.ttl;
+            if ((idx = cdns_table_add(&tables[CDNS_NAME_RDATA], rr.rdata, rr.rdlength)) == CDNS_NONE) {
+                *bad = 1;
+                return CDNS_NONE;
+            }
+            key[3] = idx;
+            idx = cdns_table_add(&tables[CDNS_RR], key, sizeof(key));
+        }
+        else {
+            idx = cdns_table_add(&tables[CDNS_QRR], key, 2 * sizeof(*key));
+        }
+        if (idx == CDNS_NONE) {
+            *bad = 1;
+            return CDNS_NONE;
+        }
+        cdns_list[num++] = idx;
+    }
+
+    if (!num) {
+        return CDNS_NONE;
+    }
+    if ((idx = cdns_table_add(&tables[section ? CDNS_RRLIST : CDNS_QLIST], cdns_list, num * sizeof(*cdns_list))) == CDNS_NONE) {
+        *bad = 1;
+    }
+    return idx;
+}
+
+static int cdns_alloc(void) {
+    size_t n;
+
+    if (!(items = calloc(block_size, sizeof(*items)))
+        || !(malformed = calloc(block_size, sizeof(*malformed))))
+    {
+        return DUMP_CDNS_ENOMEM;
+    }
+    for (pending_size = 1024; pending_size < block_size * 2; pending_size *= 2);
+    if (!(pending = calloc(pending_size, sizeof(*pending)))) {
+        return DUMP_CDNS_ENOMEM;
+    }
+    for (n = 0; n < CDNS_TABLES; n++) {
+        if (cdns_table_grow(&tables[n])) {
+            return DUMP_CDNS_ENOMEM;
+        }
+    }
+
+    return DUMP_CDNS_OK;
+}
+
+static void cdns_block_reset(void) {
+    size_t n;
+
+    for (n = 0; n < CDNS_TABLES; n++) {
+        cdns_table_reset(&tables[n]);
+    }
+    items_num = 0;
+    malformed_num = 0;
+    processed = 0;
+    memset(pending, 0, pending_size * sizeof(*pending));
+}
+
+static size_t cdns_pending_slot(const struct cdns_item *item) {
+    uint32_t key[8];
+
+    memset(key, 0, sizeof(key));
+    key[0] = item->client_port;
+    key[1] = item->server_port;
+    key[2] = item->transport;
+    key[3] = item->id;
+    key[4] = item->qname;
+    key[5] = item->classtype;
+    key[6] = item->client_addr;
+    key[7] = item->server_addr;
+
+    return cdns_hash((const uint8_t *)key, sizeof(key)) & (pending_size - 1);
+}
+
+/* Find and unlink the query waiting for this response */
+static struct cdns_item *cdns_match(const struct cdns_item *response) {
+    size_t slot = cdns_pending_slot(response), *link = &pending[slot];
+    struct cdns_item *item;
+
+    while (*link) {
+        item = &items[*link - 1];
+        if (item->client_addr == response->client_addr
+            && item->server_addr == response->server_addr
+            && item->client_port == response->client_port
+            && item->server_port == response->server_port
+            && item->transport == response->transport
+            && item->id == response->id
+            && item->qname == response->qname
+            && item->classtype == response->classtype)
+        {
+            *link = item->next;
+            return item;
+        }
+        link = &item->next;
+    }
+
+    return 0;
+}
+
+static int64_t cdns_ticks(my_bpftimeval ts, my_bpftimeval earliest) {
+    return ((int64_t)ts.tv_sec - (int64_t)earliest.tv_sec) * CDNS_TICKS_PER_SECOND
+        + ((int64_t)ts.tv_usec - (int64_t)earliest.tv_usec) * (CDNS_TICKS_PER_SECOND / 1000000);
+}
+
+static int cdns_reserve(size_t size) {
+    uint8_t *buf;
+    size_t want = cdns_buf_size ? cdns_buf_size : 256 * 1024;
+
+    while (cdns_buf_used + size > want) {
+        want *= 2;
+    }
+    if (want != cdns_buf_size) {
+        if (!(buf = realloc(cdns_buf, want))) {
+            return DUMP_CDNS_ENOMEM;
+        }
+        cdns_buf = buf;
+        cdns_buf_size = want;
+    }
+
+    return DUMP_CDNS_OK;
+}
+
+/*
+ * CBOR is written straight into the buffer, C-DNS needs no more than
+ * integers, strings and arrays and maps that are mostly of indefinite
+ * length.
+ */
+static int cdns_cbor_head(unsigned major, uint64_t value) {
+    uint8_t *p;
+    size_t n;
+    int ret;
+
+    if ((ret = cdns_reserve(9)) != DUMP_CDNS_OK) {
+        return ret;
+    }
+    p = cdns_buf + cdns_buf_used;
+    if (value < 24) {
+        *p = major << 5 | value;
+        n = 0;
+    }
+    else if (value <= 0xff) {
+        *p = major << 5 | 24;
+        n = 1;
+    }
+    else if (value <= 0xffff) {
+        *p = major << 5 | 25;
+        n = 2;
+    }
+    else if (value <= 0xffffffff) {
+        *p = major << 5 | 26;
+        n = 4;
+    }
+    else {
+        *p = major << 5 | 27;
+        n = 8;
+    }
+    cdns_buf_used += 1 + n;
+    for (; n; n--, value >>= 8) {
+        p[n] = value & 0xff;
+    }
+
+    return DUMP_CDNS_OK;
+}
+
+static int cdns_cbor_int(int64_t value) {
+    if (value < 0) {
+        return cdns_cbor_head(CDNS_CBOR_NINT, -1 - value);
+    }
+    return cdns_cbor_head(CDNS_CBOR_UINT, value);
+}
+
+static int cdns_cbor_string(unsigned major, const void *data, size_t length) {
+    int ret;
+
+    if ((ret = cdns_cbor_head(major, length)) != DUMP_CDNS_OK
+        || (ret = cdns_reserve(length)) != DUMP_CDNS_OK)
+    {
+        return ret;
+    }
+    memcpy(cdns_buf + cdns_buf_used, data, length);
+    cdns_buf_used += length;
+
+    return DUMP_CDNS_OK;
+}
+
+/* Start an array or map of indefinite length */
+static int cdns_cbor_open(unsigned major) {
+    int ret;
+
+    if ((ret = cdns_reserve(1)) != DUMP_CDNS_OK) {
+        return ret;
+    }
+    cdns_buf[cdns_buf_used++] = major << 5 | 31;
+
+    return DUMP_CDNS_OK;
+}
+
+static int cdns_cbor_close(void) {
+    int ret;
+
+    if ((ret = cdns_reserve(1)) != DUMP_CDNS_OK) {
+        return ret;
+    }
+    cdns_buf[cdns_buf_used++] = 0xff;
+
+    return DUMP_CDNS_OK;
+}
+
+static int cdns_uint(unsigned key, uint64_t value) {
+    int ret = cdns_cbor_head(CDNS_CBOR_UINT, key);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, value);
+    return ret;
+}
+
+static int cdns_preamble(void) {
+    int ret;
+    size_t n;
+
+    ret = cdns_cbor_string(CDNS_CBOR_TEXT, "C-DNS", 5);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_MAP);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(0, 1); /* major-format-version */
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(1, 0); /* minor-format-version */
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 3); /* block-parameters */
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_ARRAY);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_MAP);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 0); /* storage-parameters */
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_MAP);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(0, CDNS_TICKS_PER_SECOND);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(1, block_size);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 2); /* storage-hints */
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_MAP);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(0, CDNS_QR_HINTS);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(1, CDNS_SIG_HINTS);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(2, CDNS_RR_HINTS);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(3, CDNS_OTHER_HINTS);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 3); /* opcodes */
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_ARRAY);
+    for (n = 0; ret == DUMP_CDNS_OK && n < 16; n++) {
+        ret = cdns_cbor_head(CDNS_CBOR_UINT, n);
+    }
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 4); /* rr-types */
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_ARRAY);
+    for (n = 0; ret == DUMP_CDNS_OK && n < sizeof(cdns_rr_types) / sizeof(*cdns_rr_types); n++) {
+        ret = cdns_cbor_head(CDNS_CBOR_UINT, cdns_rr_types[n]);
+    }
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+
+    return ret;
+}
+
+static int cdns_bytes_table(unsigned key, struct cdns_table *table) {
+    int ret;
+    size_t n;
+
+    if (!table->count) {
+        return DUMP_CDNS_OK;
+    }
+    ret = cdns_cbor_head(CDNS_CBOR_UINT, key);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_ARRAY);
+    for (n = 0; ret == DUMP_CDNS_OK && n < table->count; n++) {
+        ret = cdns_cbor_string(CDNS_CBOR_BYTES, table->data + table->entries[n].offset, table->entries[n].length);
+    }
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+
+    return ret;
+}
+
+/*
+ * Tables of fixed records of uint32_t, written as maps with keys from 0 up
+ * unless the field is not present, or as arrays for the lists.
+ */
+static int cdns_uint_table(unsigned key, struct cdns_table *table, int is_list, int has_mask) {
+    int ret;
+    const uint32_t *v;
+    size_t n, f, fields;
+    uint32_t mask;
+
+    if (!table->count) {
+        return DUMP_CDNS_OK;
+    }
+    ret = cdns_cbor_head(CDNS_CBOR_UINT, key);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_ARRAY);
+    for (n = 0; ret == DUMP_CDNS_OK && n < table->count; n++) {
+        v = (const uint32_t *)(table->data + table->entries[n].offset);
+        fields = table->entries[n].length / sizeof(*v);
+        mask = 0xffffffff;
+        if (has_mask) {
+            mask = *v++;
+            fields--;
+        }
+
+        if (is_list) {
+            ret = cdns_cbor_open(CDNS_CBOR_ARRAY);
+        }
+        else {
+            ret = cdns_cbor_open(CDNS_CBOR_MAP);
+        }
+        for (f = 0; ret == DUMP_CDNS_OK && f < fields; f++) {
+            if (is_list) {
+                ret = cdns_cbor_head(CDNS_CBOR_UINT, v[f]);
+            }
+            else if (mask & (1 << f)) {
+                ret = cdns_uint(f, v[f]);
+            }
+        }
+        if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+    }
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+
+    return ret;
+}
+
+static int cdns_malformed_table(unsigned key, struct cdns_table *table) {
+    int ret;
+    const uint8_t *data;
+    uint32_t v[3];
+    size_t n;
+
+    if (!table->count) {
+        return DUMP_CDNS_OK;
+    }
+    ret = cdns_cbor_head(CDNS_CBOR_UINT, key);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_ARRAY);
+    for (n = 0; ret == DUMP_CDNS_OK && n < table->count; n++) {
+        data = table->data + table->entries[n].offset;
+        memcpy(v, data, sizeof(v));
+
+        ret = cdns_cbor_open(CDNS_CBOR_MAP);
+        if (ret == DUMP_CDNS_OK) ret = cdns_uint(0, v[0]); /* server-address-index */
+        if (ret == DUMP_CDNS_OK) ret = cdns_uint(1, v[1]); /* server-port */
+        if (ret == DUMP_CDNS_OK) ret = cdns_uint(2, v[2]); /* mm-transport-flags */
+        if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 3); /* mm-payload */
+        if (ret == DUMP_CDNS_OK) ret = cdns_cbor_string(CDNS_CBOR_BYTES, data + sizeof(v), table->entries[n].length - sizeof(v));
+        if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+    }
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+
+    return ret;
+}
+
+static int cdns_sections(unsigned key, const size_t *sections) {
+    int ret;
+    size_t n;
+
+    for (n = 0; n < 4 && sections[n] == CDNS_NONE; n++);
+    if (n == 4) {
+        return DUMP_CDNS_OK;
+    }
+    ret = cdns_cbor_head(CDNS_CBOR_UINT, key);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_MAP);
+    for (n = 0; ret == DUMP_CDNS_OK && n < 4; n++) {
+        if (sections[n] != CDNS_NONE) {
+            ret = cdns_uint(n, sections[n]);
+        }
+    }
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+
+    return ret;
+}
+
+static int cdns_block(my_bpftimeval earliest) {
+    int ret;
+    size_t n, unmatched_queries = 0, unmatched_responses = 0;
+
+    for (n = 0; n < items_num; n++) {
+        if (!(items[n].sig_flags & CDNS_HAS_RESPONSE)) {
+            unmatched_queries++;
+        }
+        else if (!(items[n].sig_flags & CDNS_HAS_QUERY)) {
+            unmatched_responses++;
+        }
+    }
+
+    ret = cdns_cbor_open(CDNS_CBOR_MAP);
+
+    /* block-preamble */
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 0);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_MAP);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 0); /* earliest-time */
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_ARRAY, 2);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, earliest.tv_sec);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, (uint64_t)earliest.tv_usec * (CDNS_TICKS_PER_SECOND / 1000000));
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+
+    /* block-statistics */
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 1);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_MAP);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(0, processed);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(1, items_num);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(2, unmatched_queries);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(3, unmatched_responses);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint(5, malformed_num);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+
+    /* block-tables */
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 2);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_MAP);
+    if (ret == DUMP_CDNS_OK) ret = cdns_bytes_table(0, &tables[CDNS_IP_ADDRESS]);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint_table(1, &tables[CDNS_CLASSTYPE], 0, 0);
+    if (ret == DUMP_CDNS_OK) ret = cdns_bytes_table(2, &tables[CDNS_NAME_RDATA]);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint_table(3, &tables[CDNS_QR_SIG], 0, 1);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint_table(4, &tables[CDNS_QLIST], 1, 0);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint_table(5, &tables[CDNS_QRR], 0, 0);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint_table(6, &tables[CDNS_RRLIST], 1, 0);
+    if (ret == DUMP_CDNS_OK) ret = cdns_uint_table(7, &tables[CDNS_RR], 0, 0);
+    if (ret == DUMP_CDNS_OK) ret = cdns_malformed_table(8, &tables[CDNS_MALFORMED_DATA]);
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+
+    /* query-responses */
+    if (items_num) {
+        if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 3);
+        if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_ARRAY);
+        for (n = 0; ret == DUMP_CDNS_OK && n < items_num; n++) {
+            struct cdns_item *item = &items[n];
+            size_t f;
+
+            ret = cdns_cbor_open(CDNS_CBOR_MAP);
+            if (ret == DUMP_CDNS_OK) ret = cdns_uint(0, cdns_ticks(item->ts, earliest));
+            if (ret == DUMP_CDNS_OK) ret = cdns_uint(1, item->client_addr);
+            if (ret == DUMP_CDNS_OK) ret = cdns_uint(2, item->client_port);
+            if (ret == DUMP_CDNS_OK) ret = cdns_uint(3, item->id);
+            if (ret == DUMP_CDNS_OK) ret = cdns_uint(4, item->sig);
+            if ((item->sig_flags & CDNS_HAS_QUERY) && (item->sig_flags & CDNS_HAS_RESPONSE)) {
+                if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 6);
+                if (ret == DUMP_CDNS_OK) ret = cdns_cbor_int(item->response_delay);
+            }
+            if (item->qname != CDNS_NONE) {
+                if (ret == DUMP_CDNS_OK) ret = cdns_uint(7, item->qname);
+            }
+            if (item->sig_flags & CDNS_HAS_QUERY) {
+                if (ret == DUMP_CDNS_OK) ret = cdns_uint(8, item->query_size);
+            }
+            if (item->sig_flags & CDNS_HAS_RESPONSE) {
+                if (ret == DUMP_CDNS_OK) ret = cdns_uint(9, item->response_size);
+            }
+            if (ret == DUMP_CDNS_OK) ret = cdns_sections(11, item->query_sections);
+            if (ret == DUMP_CDNS_OK) ret = cdns_sections(12, item->response_sections);
+            if (item->slimmed) {
+                if (ret == DUMP_CDNS_OK) ret = cdns_cbor_int(CDNS_QR_ORIGINAL_COUNTS);
+                if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_ARRAY, 3);
+                for (f = 0; ret == DUMP_CDNS_OK && f < 3; f++) {
+                    ret = cdns_cbor_head(CDNS_CBOR_UINT, item->original_counts[f]);
+                }
+            }
+            if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+        }
+        if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+    }
+
+    /* malformed-messages */
+    if (malformed_num) {
+        if (ret == DUMP_CDNS_OK) ret = cdns_cbor_head(CDNS_CBOR_UINT, 5);
+        if (ret == DUMP_CDNS_OK) ret = cdns_cbor_open(CDNS_CBOR_ARRAY);
+        for (n = 0; ret == DUMP_CDNS_OK && n < malformed_num; n++) {
+            ret = cdns_cbor_open(CDNS_CBOR_MAP);
+            if (ret == DUMP_CDNS_OK) ret = cdns_uint(0, cdns_ticks(malformed[n].ts, earliest));
+            if (ret == DUMP_CDNS_OK) ret = cdns_uint(1, malformed[n].client_addr);
+            if (ret == DUMP_CDNS_OK) ret = cdns_uint(2, malformed[n].client_port);
+            if (ret == DUMP_CDNS_OK) ret = cdns_uint(3, malformed[n].data);
+            if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+        }
+        if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+    }
+
+    if (ret == DUMP_CDNS_OK) ret = cdns_cbor_close();
+
+    return ret;
+}
+
+/* Encode the preamble or a block at the end of the buffer */
+static int cdns_encode(int is_block) {
+    my_bpftimeval earliest = { 0, 0 };
+    size_t n, used = cdns_buf_used;
+    int ret;
+
+    if (is_block) {
+        earliest = items_num ? items[0].ts : malformed[0].ts;
+        for (n = 0; n < items_num; n++) {
+            if (cdns_ticks(items[n].ts, earliest) < 0) {
+                earliest = items[n].ts;
+            }
+        }
+        for (n = 0; n < malformed_num; n++) {
+            if (cdns_ticks(malformed[n].ts, earliest) < 0) {
+                earliest = malformed[n].ts;
+            }
+        }
+    }
+
+    ret = is_block ? cdns_block(earliest) : cdns_preamble();
+    if (ret != DUMP_CDNS_OK) {
+        cdns_buf_used = used;
+    }
+
+    return ret;
+}
+
+/* The signature of each item is only known once the block is written */
+static int cdns_signatures(void) {
+    uint32_t sig[1 + CDNS_SIG_FIELDS];
+    struct cdns_item *item;
+    size_t n;
+
+    for (n = 0; n < items_num; n++) {
+        item = &items[n];
+        memset(sig, 0, sizeof(sig));
+
+#define cdns_sig(field, value) sig[0] |= 1 << field; sig[1 + field] = value
+
+        cdns_sig(CDNS_SIG_SERVER_ADDRESS, item->server_addr);
+        cdns_sig(CDNS_SIG_SERVER_PORT, item->server_port);
+        cdns_sig(CDNS_SIG_TRANSPORT_FLAGS, item->transport);
+        cdns_sig(CDNS_SIG_QR_SIG_FLAGS, item->sig_flags);
+        cdns_sig(CDNS_SIG_QUERY_OPCODE, item->opcode);
+        cdns_sig(CDNS_SIG_QR_DNS_FLAGS, item->dns_flags);
+        if (item->classtype != CDNS_NONE) {
+            cdns_sig(CDNS_SIG_QUERY_CLASSTYPE, item->classtype);
+        }
+        if (item->sig_flags & CDNS_HAS_QUERY) {
+            cdns_sig(CDNS_SIG_QUERY_RCODE, item->query_rcode);
+            cdns_sig(CDNS_SIG_QUERY_QDCOUNT, item->count[0]);
+            cdns_sig(CDNS_SIG_QUERY_ANCOUNT, item->count[1]);
+            cdns_sig(CDNS_SIG_QUERY_NSCOUNT, item->count[2]);
+            cdns_sig(CDNS_SIG_QUERY_ARCOUNT, item->count[3]);
+        }
+        if (item->sig_flags & CDNS_QUERY_HAS_OPT) {
+            cdns_sig(CDNS_SIG_QUERY_EDNS_VERSION, item->edns_version);
+            cdns_sig(CDNS_SIG_QUERY_UDP_SIZE, item->udp_size);
+            cdns_sig(CDNS_SIG_QUERY_OPT_RDATA, item->opt_rdata);
+        }
+        if (item->sig_flags & CDNS_HAS_RESPONSE) {
+            cdns_sig(CDNS_SIG_RESPONSE_RCODE, item->response_rcode);
+        }
+
+#undef cdns_sig
+
+        if ((item->sig = cdns_table_add(&tables[CDNS_QR_SIG], sig, sizeof(sig))) == CDNS_NONE) {
+            return DUMP_CDNS_ENOMEM;
+        }
+    }
+
+    return DUMP_CDNS_OK;
+}
+
+static int cdns_flush_block(void) {
+    int ret;
+
+    if (!items_num && !malformed_num) {
+        return DUMP_CDNS_OK;
+    }
+    if ((ret = cdns_signatures()) != DUMP_CDNS_OK
+        || (ret = cdns_encode(1)) != DUMP_CDNS_OK)
+    {
+        return ret;
+    }
+    cdns_block_reset();
+
+    return DUMP_CDNS_OK;
+}
+
+static int cdns_begin(void) {
+    int ret;
+
+    if (!items && (ret = cdns_alloc()) != DUMP_CDNS_OK) {
+        return ret;
+    }
+    if (!cdns_started) {
+        /* [ "C-DNS", preamble, [_ blocks ... ] ] */
+        if ((ret = cdns_reserve(1)) != DUMP_CDNS_OK) {
+            return ret;
+        }
+        cdns_buf[cdns_buf_used++] = 0x83;
+        if ((ret = cdns_encode(0)) != DUMP_CDNS_OK
+            || (ret = cdns_reserve(1)) != DUMP_CDNS_OK)
+        {
+            return ret;
+        }
+        cdns_buf[cdns_buf_used++] = 0x9f;
+        cdns_started = 1;
+    }
+
+    return DUMP_CDNS_OK;
+}
+
+static int cdns_malformed(iaddr *from, iaddr *to, unsigned sport, unsigned dport, unsigned transport, my_bpftimeval ts, const u_char *payload, size_t payloadlen) {
+    struct cdns_malformed *mm = &malformed[malformed_num];
+    uint32_t v[3];
+    size_t idx;
+
+    if ((mm->client_addr = cdns_addr(from)) == CDNS_NONE
+        || (idx = cdns_addr(to)) == CDNS_NONE)
+    {
+        return DUMP_CDNS_ENOMEM;
+    }
+    v[0] = idx;
+    v[1] = dport;
+    v[2] = transport;
+    memcpy(cdns_key, v, sizeof(v));
+    memcpy(cdns_key + sizeof(v), payload, payloadlen);
+    if ((mm->data = cdns_table_add(&tables[CDNS_MALFORMED_DATA], cdns_key, sizeof(v) + payloadlen)) == CDNS_NONE) {
+        return DUMP_CDNS_ENOMEM;
+    }
+    mm->ts = ts;
+    mm->client_port = sport;
+    malformed_num++;
+
+    return DUMP_CDNS_OK;
+}
+
+int output_cdns(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen, const slim_t *slim) {
+    struct cdns_message m;
+    struct cdns_item *item, *query;
+    iaddr *client, *server;
+    size_t offset = 12, n, count[4];
+    unsigned transport, dns_flags;
+    int ret, is_query, bad = 0;
+
+    (void)flags;
+    if (!payload) {
+        return DUMP_CDNS_EINVAL;
+    }
+    if (!payloadlen) {
+        return DUMP_CDNS_EINVAL;
+    }
+    if ((ret = cdns_begin()) != DUMP_CDNS_OK) {
+        return ret;
+    }
+
+    processed++;
+    transport = (from.af == AF_INET6 ? CDNS_TRANSPORT_IPV6 : 0) | (proto == IPPROTO_TCP ? CDNS_TRANSPORT_TCP : 0);
+
+    memset(&m, 0, sizeof(m));
+    m.qname = m.classtype = CDNS_NONE;
+    if (payloadlen < 12 || payloadlen > 65535) {
+        bad = 1;
+    }
+    else {
+        for (n = 0; n < 4; n++) {
+            count[n] = payload[4 + n * 2] << 8 | payload[5 + n * 2];
+        }
+        is_query = !(payload[2] & 0x80);
+        for (n = 0; !bad && n < 4; n++) {
+            m.sections[n] = cdns_section(payload, payloadlen, &offset, count[n], n, is_query, &m, &bad);
+        }
+    }
+    if (bad) {
+        if ((ret = cdns_malformed(&from, &to, sport, dport, transport, ts, payload, payloadlen)) != DUMP_CDNS_OK) {
+            return ret;
+        }
+    }
+    else {
+        /* CD, AD, Z, RA, RD, TC, AA and DO */
+        dns_flags = (payload[3] >> 4 & 0xf) | (payload[2] & 7) << 4 | m.opt_do << 7;
+
+        client = is_query ? &from : &to;
+        server = is_query ? &to : &from;
+        item = &items[items_num];
+        memset(item, 0, sizeof(*item));
+        if ((item->client_addr = cdns_addr(client)) == CDNS_NONE
+            || (item->server_addr = cdns_addr(server)) == CDNS_NONE)
+        {
+            return DUMP_CDNS_ENOMEM;
+        }
+        item->client_port = is_query ? sport : dport;
+        item->server_port = is_query ? dport : sport;
+        item->transport = transport;
+        item->id = payload[0] << 8 | payload[1];
+        item->qname = m.qname;
+        item->classtype = m.classtype;
+
+        if (!is_query && (query = cdns_match(item))) {
+            item = query;
+        }
+        else {
+            item->ts = ts;
+            item->opcode = (payload[2] >> 3) & 0xf;
+            for (n = 0; n < 4; n++) {
+                item->query_sections[n] = item->response_sections[n] = CDNS_NONE;
+            }
+            items_num++;
+        }
+
+        if (is_query) {
+            item->sig_flags |= CDNS_HAS_QUERY;
+            if (m.has_opt) {
+                item->sig_flags |= CDNS_QUERY_HAS_OPT;
+                item->edns_version = m.edns_version;
+                item->udp_size = m.udp_size;
+                item->opt_rdata = m.opt_rdata;
+            }
+            if (!count[0]) {
+                item->sig_flags |= CDNS_QUERY_HAS_NO_QUESTION;
+            }
+            item->dns_flags |= dns_flags;
+            item->query_rcode = (payload[3] & 0xf) | m.opt_rcode << 4;
+            for (n = 0; n < 4; n++) {
+                item->count[n] = count[n];
+                item->query_sections[n] = m.sections[n];
+            }
+            item->query_size = payloadlen;
+
+            item->next = pending[cdns_pending_slot(item)];
+            pending[cdns_pending_slot(item)] = item - items + 1;
+        }
+        else {
+            item->sig_flags |= CDNS_HAS_RESPONSE;
+            if (m.has_opt) {
+                item->sig_flags |= CDNS_RESPONSE_HAS_OPT;
+            }
+            if (!count[0]) {
+                item->sig_flags |= CDNS_RESPONSE_HAS_NO_QUESTION;
+            }
+            /* the DO bit is only kept for the query */
+            item->dns_flags |= (dns_flags & 0x7f) << 8;
+            item->response_rcode = (payload[3] & 0xf) | m.opt_rcode << 4;
+            for (n = 0; n < 4; n++) {
+                item->response_sections[n] = m.sections[n];
+            }
+            item->response_size = payloadlen;
+            if (slim) {
+                item->slimmed = 1;
+                item->response_size = slim->payloadlen;
+                for (n = 0; n < 3; n++) {
+                    item->original_counts[n] = slim->counts[n];
+                }
+            }
+            if (item->sig_flags & CDNS_HAS_QUERY) {
+                item->response_delay = cdns_ticks(ts, item->ts);
+            }
+        }
+    }
+
+    if (items_num + malformed_num >= block_size) {
+        if ((ret = cdns_flush_block()) != DUMP_CDNS_OK) {
+            return ret;
+        }
+        return DUMP_CDNS_FLUSH;
+    }
+
+    return DUMP_CDNS_OK;
+}
+
+int dump_cdns(FILE * fp) {
+    if (!fp) {
+        return DUMP_CDNS_EINVAL;
+    }
+
+    if (cdns_buf_used) {
+        if (fwrite(cdns_buf, cdns_buf_used, 1, fp) != 1) {
+            return DUMP_CDNS_EWRITE;
+        }
+        cdns_buf_used = 0;
+    }
+
+    return DUMP_CDNS_OK;
+}
+
+int dump_cdns_close(FILE * fp) {
+    int ret;
+
+    if (!fp) {
+        return DUMP_CDNS_EINVAL;
+    }
+
+    /* make sure an empty file still has the preamble and no blocks */
+    if ((ret = cdns_begin()) != DUMP_CDNS_OK
+        || (ret = cdns_flush_block()) != DUMP_CDNS_OK
+        || (ret = cdns_reserve(1)) != DUMP_CDNS_OK)
+    {
+        return ret;
+    }
+    cdns_buf[cdns_buf_used++] = 0xff;
+    cdns_started = 0;
+
+    return dump_cdns(fp);
+}
@@ -36,11 +36,12 @@
 
 #include "dump_cds.h"
 #include "dnscap.h"
-#include "hashtbl.h"
 
 #if HAVE_LIBTINYCBOR
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
 #if HAVE_CBOR_CBOR_H
 #include <cbor/cbor.h>
 #endif
@@ -48,6 +49,21 @@
 #include <cbor.h>
 #endif
 #include <assert.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "cds_decode.h"
+
+/*
+ * The encoder state is kept per thread so that segments of the stream can
+ * be encoded by a pool of workers, each with its own buffers and indexes.
+ */
+#if HAVE_PTHREAD
+#define CDS_TLS __thread
+#else
+#define CDS_TLS
+#endif
 
 #define need8(v, p, l, d) \
     if (l < 1) { \
@@ -102,13 +118,12 @@
     p += x; \
     l -= x
 
-static uint8_t *cbor_buf = 0;
-static uint8_t *cbor_buf_p = 0;
+static CDS_TLS uint8_t *cbor_buf = 0;
+static CDS_TLS uint8_t *cbor_buf_p = 0;
 static size_t cbor_size = 1024*1024;
-static uint8_t *message_buf = 0;
+static CDS_TLS uint8_t *message_buf = 0;
 static size_t message_size = 64*1024;
-static int cbor_flushed = 1;
-static hashtbl* rdata_tbl = 0;
+static CDS_TLS int cbor_flushed = 1;
 static size_t MAX_RLABELS = CDS_DEFAULT_MAX_RLABELS;
 static size_t MIN_RLABEL_SIZE = CDS_DEFAULT_MIN_RLABEL_SIZE;
 static int use_rdata_index = 0;
@@ -116,16 +131,233 @@ static int use_rdata_rindex = 0;
 static size_t RDATA_RINDEX_SIZE = CDS_DEFAULT_RDATA_RINDEX_SIZE;
 static size_t RDATA_RINDEX_MIN_SIZE = CDS_DEFAULT_RDATA_RINDEX_MIN_SIZE;
 static size_t RDATA_INDEX_MIN_SIZE = CDS_DEFAULT_RDATA_INDEX_MIN_SIZE;
+static size_t RDATA_INDEX_SIZE = 0;
+
+/*
+ * Segments restart the stream with a new stream initiator and empty
+ * indexes every number of messages and/or seconds, so they can be encoded
+ * and decoded independently.  With workers the messages of a segment are
+ * copied and the segment is encoded by the pool, the encoded segments are
+ * written in the order they were cut.
+ */
+static size_t segment_messages = 0;
+static unsigned segment_seconds = 0;
+static CDS_TLS int cbor_restart = 0;
+static CDS_TLS size_t segment_count = 0;
+static CDS_TLS long segment_start = 0;
+
+/*
+ * With the file index every stream started in a file is an index point.
+ * Points get their offset within the encode buffer and are rebased to the
+ * file offset when the buffer is written, the index element and a footer
+ * pointing at it are written when the file is closed.
+ */
+struct cds_index_point {
+    uint64_t        offset;
+    my_bpftimeval   earliest;
+    my_bpftimeval   latest;
+    size_t          messages;
+};
+
+static int use_index = 0;
+static CDS_TLS struct cds_index_point* index_points = 0;
+static CDS_TLS size_t index_num = 0;
+static CDS_TLS size_t index_size = 0;
+static CDS_TLS size_t index_rebased = 0;
+static CDS_TLS uint64_t index_file_bytes = 0;
+
+/*
+ * The dictionary is loaded once and put in the indexes at the start of
+ * every stream, the reverse label index keys of its names are packed when
+ * it is loaded.
+ */
+struct cds_dict_key {
+    size_t  offset;
+    size_t  size;
+    size_t  label_bytes;
+};
+
+static cds_dict_t* dict = 0;
+static struct cds_dict_key* dict_keys = 0;
+static uint8_t* dict_key_data = 0;
+
+#if HAVE_PTHREAD
+struct cds_record {
+    iaddr           from;
+    iaddr           to;
+    my_bpftimeval   ts;
+    unsigned        flags;
+    unsigned        sport;
+    unsigned        dport;
+    size_t          payloadlen;
+    uint8_t         proto;
+    int             is_slim;
+    slim_t          slim;
+};
 
-struct rdata;
+#define CDS_RECORD_SIZE(len)    ((sizeof(struct cds_record) + (len) + 7) & ~7)
+
+struct cds_segment;
+struct cds_segment {
+    struct cds_segment* next;
+    uint8_t* in;
+    size_t in_len;
+    size_t in_size;
+    uint8_t* out;
+    size_t out_len;
+    size_t out_size;
+    uint8_t* index;
+    size_t index_len;
+    size_t index_size;
+    int done;
+    int ret;
+};
+
+static size_t pool_workers = 0;
+static size_t pool_started = 0;
+static pthread_t* pool_threads = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static struct cds_segment* pool_head = 0;
+static struct cds_segment* pool_tail = 0;
+static struct cds_segment* pool_next = 0;
+static struct cds_segment* pool_free = 0;
+static struct cds_segment* pool_fill = 0;
+static size_t pool_pending = 0;
+static size_t pool_ready = 0;
+static size_t pool_ready_bytes = 0;
+static int pool_flush = 0;
+static int pool_flushed = 0;
+static int pool_stop = 0;
+static cds_rdata_index_stats_t pool_stats;
+#endif
+
+/*
+ * Most recently used index, the index of an entry is its position in the
+ * list.  Entries are found through a hash table and their position is
+ * computed from a Fenwick tree counting the entries by the stamp they were
+ * last used at, stamps are renumbered in list order when they run out.
+ * Entries are allocated from arenas by size class.
+ */
+struct mru_entry;
+struct mru_entry {
+    struct mru_entry* prev;
+    struct mru_entry* next;
+    struct mru_entry* hnext;
+    unsigned int hash;
+    size_t stamp;
+    size_t size;
+    uint8_t key[1];
+};
+
+#define MRU_KEY_SIZE    (64 * 1024)
+#define MRU_CLASS_SIZE  16
+#define MRU_CLASSES     ((offsetof(struct mru_entry, key) + MRU_KEY_SIZE) / MRU_CLASS_SIZE + 1)
+#define MRU_ARENA_SIZE  (64 * 1024)
+
+struct mru_arena;
+struct mru_arena {
+    struct mru_arena* next;
+    size_t size;
+    size_t used;
+    uint8_t data[1];
+};
+
+struct mru {
+    struct mru_entry* head;
+    struct mru_entry* tail;
+    size_t entries;
+    struct mru_entry** tbl;
+    size_t tbl_mask;
+    uint32_t* rank;
+    size_t rank_size;
+    size_t stamp;
+    struct mru_arena* arena;
+    struct mru_entry* free[MRU_CLASSES];
+};
+
+/*
+ * Reverse label index keys start with the number of labels followed by
+ * each label as either the label size and label or RLABEL_KEY_N_OFFSET
+ * and the n_offset.
+ */
+#define RLABEL_KEY_N_OFFSET     0xff
+#define RLABEL_KEY_LABEL        64
+#define RLABEL_KEY_SIZE         (1 + 255 * (1 + RLABEL_KEY_LABEL))
+
+static CDS_TLS uint8_t rlabel_key[RLABEL_KEY_SIZE];
+static CDS_TLS struct mru rlabel_mru;
+static CDS_TLS struct mru rdata_mru;
+
+/*
+ * Arena for the parse state of a message, blocks are sized from the
+ * message size and kept between messages so that the parse state is
+ * allocated without calling malloc() once the arena has grown to fit.
+ */
+struct parse_arena;
+struct parse_arena {
+    struct parse_arena* next;
+    size_t size;
+    size_t used;
+    uint8_t data[1];
+};
+
+#define PARSE_ALIGN     sizeof(size_t)
+
+static CDS_TLS struct parse_arena* parse_arena = 0;
+static CDS_TLS struct parse_arena* parse_arena_p = 0;
+
+/*
+ * Map of the offsets of labels and compression pointers in the message
+ * to their index in the order they were parsed, filled while parsing so
+ * compression pointers can be resolved directly.  Only offsets that can be
+ * pointed to are mapped, the map holds the index plus one and is cleared
+ * by the list of mapped offsets after each message.
+ */
+#define OFFSET_MAP_SIZE     (1 << 14)
+
+static CDS_TLS uint8_t* offset_base = 0;
+static CDS_TLS size_t offset_num = 0;
+static CDS_TLS uint32_t offset_map[OFFSET_MAP_SIZE];
+static CDS_TLS uint16_t offset_list[OFFSET_MAP_SIZE];
+static CDS_TLS size_t offset_list_num = 0;
+
+/*
+ * Resource data index, entries are numbered in the order they are added
+ * and found through an open addressing hash table.  With a memory limit
+ * entries are evicted using CLOCK over the index with a small use counter,
+ * entries used by the current message are never evicted.  Evicted indexes
+ * are announced in a stream control element before the message and reused
+ * in that order.
+ */
 struct rdata {
-    struct rdata* prev;
-    struct rdata* next;
-    uint8_t* data;
-    size_t len;
+    uint64_t hash;
     size_t idx;
+    size_t len;
+    size_t message;
+    uint8_t uses;
+    uint8_t data[1];
 };
 
+#define RDATA_USES_MAX  3
+#define RDATA_SIZE(len) (offsetof(struct rdata, data) + (len))
+
+static CDS_TLS struct rdata** rdata_tbl = 0;
+static CDS_TLS size_t rdata_tbl_size = 0;
+static CDS_TLS struct rdata** rdata_idx = 0;
+static CDS_TLS size_t rdata_idx_size = 0;
+static CDS_TLS size_t rdata_hand = 0;
+static CDS_TLS size_t* rdata_reuse = 0;
+static CDS_TLS size_t rdata_reuse_head = 0;
+static CDS_TLS size_t rdata_reuse_tail = 0;
+static CDS_TLS size_t rdata_reuse_size = 0;
+static CDS_TLS size_t* rdata_evicted = 0;
+static CDS_TLS size_t rdata_evicted_num = 0;
+static CDS_TLS size_t rdata_evicted_size = 0;
+static CDS_TLS size_t rdata_message = 0;
+static CDS_TLS size_t rdata_bytes = 0;
+static CDS_TLS cds_rdata_index_stats_t rdata_stats;
+
 struct last {
     my_bpftimeval       ts;
     ip_header_t         ip;
@@ -134,16 +366,9 @@ struct last {
     uint16_t            dns_class;
     uint32_t            dns_ttl;
 
-    dns_rlabel_t*       dns_rlabel;
-    dns_rlabel_t*       dns_rlabel_last;
-    size_t              dns_rlabels;
-
     size_t              rdata_index;
-    size_t              rdata_num;
-    struct rdata*       rdata;
-    struct rdata*       rdata_last;
 };
-static struct last last;
+static CDS_TLS struct last last;
 
 /*
  * Set/Get
@@ -217,6 +442,114 @@ int cds_set_rdata_index_min_size(size_t size) {
     return DUMP_CDS_OK;
 }
 
+int cds_set_rdata_index_size(size_t size) {
+    RDATA_INDEX_SIZE = size;
+
+    return DUMP_CDS_OK;
+}
+
+static size_t rdata_memory(void) {
+    return rdata_bytes
+        + rdata_tbl_size * sizeof(*rdata_tbl)
+        + rdata_idx_size * sizeof(*rdata_idx)
+        + (rdata_reuse_size + rdata_evicted_size) * sizeof(size_t);
+}
+
+int cds_set_segment(size_t messages, unsigned seconds) {
+    segment_messages = messages;
+    segment_seconds = seconds;
+
+    return DUMP_CDS_OK;
+}
+
+int cds_set_workers(size_t workers) {
+#if HAVE_PTHREAD
+    if (pool_started) {
+        return DUMP_CDS_EINVAL;
+    }
+
+    pool_workers = workers;
+
+    return DUMP_CDS_OK;
+#else
+    return workers ? DUMP_CDS_ENOSUP : DUMP_CDS_OK;
+#endif
+}
+
+int cds_set_index(int use) {
+    use_index = use;
+
+    return DUMP_CDS_OK;
+}
+
+int cds_set_dictionary(const char* file) {
+    FILE* fp;
+    const uint8_t* name;
+    uint8_t* p;
+    size_t n, len, size = 0;
+    int ret;
+
+    if (!(fp = fopen(file, "r"))) {
+        fprintf(stderr, "cds dictionary %s: %s\n", file, strerror(errno));
+        return DUMP_CDS_EINVAL;
+    }
+    ret = cds_dict_load(fp, &dict);
+    fclose(fp);
+    if (ret != CDS_DECODE_OK) {
+        fprintf(stderr, "cds dictionary %s: %s\n", file, cds_decoder_strerror(ret));
+        return ret == CDS_DECODE_ENOMEM ? DUMP_CDS_ENOMEM : DUMP_CDS_EINVAL;
+    }
+
+    /* keys are the number of labels and each label, one byte longer than the name */
+    for (n = 0; n < cds_dict_names(dict); n++) {
+        cds_dict_name(dict, n, &len);
+        size += len + 1;
+    }
+    if (!(dict_keys = calloc(cds_dict_names(dict) + 1, sizeof(*dict_keys)))
+        || !(dict_key_data = malloc(size + 1)))
+    {
+        return DUMP_CDS_ENOMEM;
+    }
+    for (n = 0, p = dict_key_data; n < cds_dict_names(dict); n++) {
+        name = cds_dict_name(dict, n, &len);
+        dict_keys[n].offset = p - dict_key_data;
+        *p++ = 0;
+        while (1) {
+            dict_key_data[dict_keys[n].offset]++;
+            dict_keys[n].label_bytes += *name;
+            memcpy(p, name, 1 + *name);
+            p += 1 + *name;
+            if (!*name) {
+                break;
+            }
+            name += 1 + *name;
+        }
+        dict_keys[n].size = p - dict_key_data - dict_keys[n].offset;
+    }
+
+    return DUMP_CDS_OK;
+}
+
+int cds_get_rdata_index_stats(cds_rdata_index_stats_t* stats) {
+    if (!stats) {
+        return DUMP_CDS_EINVAL;
+    }
+
+#if HAVE_PTHREAD
+    if (pool_workers) {
+        pthread_mutex_lock(&pool_lock);
+        *stats = pool_stats;
+        pthread_mutex_unlock(&pool_lock);
+        return DUMP_CDS_OK;
+    }
+#endif
+
+    *stats = rdata_stats;
+    stats->memory = rdata_memory();
+
+    return DUMP_CDS_OK;
+}
+
 int cds_set_rdata_rindex_min_size(size_t size) {
     if (!size) {
         return DUMP_CDS_EINVAL;
@@ -237,6 +570,236 @@ int cds_set_rdata_rindex_size(size_t size) {
     return DUMP_CDS_OK;
 }
 
+/*
+ * MRU index
+ */
+
+static unsigned int mru_hash(const uint8_t* key, size_t size) {
+    unsigned int hash = 2166136261U;
+
+    while (size--) {
+        hash = (hash ^ *key++) * 16777619U;
+    }
+    return hash;
+}
+
+static void mru_rank_add(struct mru* mru, size_t stamp, int v) {
+    for (; stamp <= mru->rank_size; stamp += stamp & -stamp) {
+        mru->rank[stamp] += v;
+    }
+}
+
+static size_t mru_rank_sum(struct mru* mru, size_t stamp) {
+    size_t sum = 0;
+
+    for (; stamp; stamp -= stamp & -stamp) {
+        sum += mru->rank[stamp];
+    }
+    return sum;
+}
+
+static void mru_renumber(struct mru* mru) {
+    struct mru_entry* entry;
+    size_t n, parent;
+
+    memset(mru->rank, 0, (mru->rank_size + 1) * sizeof(*(mru->rank)));
+    mru->stamp = 0;
+    for (entry = mru->tail; entry; entry = entry->prev) {
+        entry->stamp = ++mru->stamp;
+        mru->rank[mru->stamp] = 1;
+    }
+    for (n = 1; n <= mru->rank_size; n++) {
+        parent = n + (n & -n);
+        if (parent <= mru->rank_size) {
+            mru->rank[parent] += mru->rank[n];
+        }
+    }
+}
+
+static void mru_push(struct mru* mru, struct mru_entry* entry) {
+    if (mru->stamp == mru->rank_size) {
+        mru_renumber(mru);
+    }
+    entry->stamp = ++mru->stamp;
+    mru_rank_add(mru, entry->stamp, 1);
+
+    entry->prev = 0;
+    entry->next = mru->head;
+    if (mru->head) {
+        mru->head->prev = entry;
+    }
+    else {
+        mru->tail = entry;
+    }
+    mru->head = entry;
+    mru->entries++;
+}
+
+static void mru_unlink(struct mru* mru, struct mru_entry* entry) {
+    mru_rank_add(mru, entry->stamp, -1);
+
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    }
+    else {
+        mru->head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    }
+    else {
+        mru->tail = entry->prev;
+    }
+    mru->entries--;
+}
+
+static struct mru_entry* mru_alloc(struct mru* mru, size_t size) {
+    struct mru_entry* entry;
+    struct mru_arena* arena;
+    size_t class = (offsetof(struct mru_entry, key) + size + MRU_CLASS_SIZE - 1) / MRU_CLASS_SIZE;
+
+    if ((entry = mru->free[class])) {
+        mru->free[class] = entry->hnext;
+        return entry;
+    }
+    if (!mru->arena || mru->arena->size - mru->arena->used < class * MRU_CLASS_SIZE) {
+        size_t arena_size = MRU_ARENA_SIZE;
+
+        if (arena_size < class * MRU_CLASS_SIZE) {
+            arena_size = class * MRU_CLASS_SIZE;
+        }
+        if (!(arena = malloc(offsetof(struct mru_arena, data) + arena_size))) {
+            return 0;
+        }
+        arena->size = arena_size;
+        arena->used = 0;
+        if (mru->arena && arena_size > MRU_ARENA_SIZE) {
+            arena->next = mru->arena->next;
+            mru->arena->next = arena;
+        }
+        else {
+            arena->next = mru->arena;
+            mru->arena = arena;
+        }
+    }
+    else {
+        arena = mru->arena;
+    }
+    entry = (struct mru_entry*)&(arena->data[arena->used]);
+    arena->used += class * MRU_CLASS_SIZE;
+    return entry;
+}
+
+static void mru_release(struct mru* mru, struct mru_entry* entry) {
+    size_t class = (offsetof(struct mru_entry, key) + entry->size + MRU_CLASS_SIZE - 1) / MRU_CLASS_SIZE;
+    struct mru_entry** hp = &(mru->tbl[entry->hash & mru->tbl_mask]);
+
+    while (*hp != entry) {
+        hp = &((*hp)->hnext);
+    }
+    *hp = entry->hnext;
+
+    entry->hnext = mru->free[class];
+    mru->free[class] = entry;
+}
+
+static void mru_reset(struct mru* mru) {
+    struct mru_arena* arena;
+
+    while ((arena = mru->arena)) {
+        mru->arena = arena->next;
+        free(arena);
+    }
+    free(mru->tbl);
+    free(mru->rank);
+    memset(mru, 0, sizeof(*mru));
+}
+
+static int mru_init(struct mru* mru, size_t max) {
+    size_t size = 64;
+
+    while (size < max * 2) {
+        size <<= 1;
+    }
+    if (!(mru->tbl = calloc(size, sizeof(*(mru->tbl))))) {
+        return -1;
+    }
+    mru->tbl_mask = size - 1;
+
+    mru->rank_size = max * 2;
+    if (!(mru->rank = calloc(mru->rank_size + 1, sizeof(*(mru->rank))))) {
+        free(mru->tbl);
+        mru->tbl = 0;
+        return -1;
+    }
+    mru->stamp = 0;
+
+    return 0;
+}
+
+/*
+ * Find the key and return 0 with the index of it in idx, the entry then
+ * becomes the most recently used.  Returns 1 if not found.
+ */
+static int mru_find(struct mru* mru, const uint8_t* key, size_t size, unsigned int hash, size_t* idx) {
+    struct mru_entry* entry;
+
+    if (!mru->tbl) {
+        return 1;
+    }
+
+    for (entry = mru->tbl[hash & mru->tbl_mask]; entry; entry = entry->hnext) {
+        if (entry->hash == hash
+            && entry->size == size
+            && !memcmp(entry->key, key, size))
+        {
+            break;
+        }
+    }
+    if (!entry) {
+        return 1;
+    }
+
+    *idx = mru->entries - mru_rank_sum(mru, entry->stamp);
+    if (mru->head != entry) {
+        mru_unlink(mru, entry);
+        mru_push(mru, entry);
+    }
+
+    return 0;
+}
+
+/*
+ * Add the key as the most recently used, evicting the least recently used
+ * entry when holding max entries.
+ */
+static int mru_add(struct mru* mru, size_t max, const uint8_t* key, size_t size, unsigned int hash) {
+    struct mru_entry* entry;
+
+    assert(size <= MRU_KEY_SIZE);
+    if (!mru->tbl && mru_init(mru, max)) {
+        return -1;
+    }
+    if (!(entry = mru_alloc(mru, size))) {
+        return -1;
+    }
+
+    entry->hash = hash;
+    entry->size = size;
+    memcpy(entry->key, key, size);
+    entry->hnext = mru->tbl[hash & mru->tbl_mask];
+    mru->tbl[hash & mru->tbl_mask] = entry;
+
+    mru_push(mru, entry);
+    if (mru->entries > 1 && mru->entries >= max) {
+        entry = mru->tail;
+        mru_unlink(mru, entry);
+        mru_release(mru, entry);
+    }
+
+    return 0;
+}
+
 /*
  * DNS
  */
@@ -245,6 +808,14 @@ static int check_dns_label(size_t * labels, uint8_t ** p, size_t * l) {
     uint8_t len;
 
     while (1) {
+        /*
+         * A name cut short before a label is counted with that label left
+         * unfilled so it is not mistaken for a name ending with the root.
+         */
+        if (*labels && !*l) {
+            *labels += 1;
+            return 1;
+        }
         need8(len, *p, *l, "");
         *labels += 1;
 
@@ -266,205 +837,471 @@ static int check_dns_label(size_t * labels, uint8_t ** p, size_t * l) {
     return 0;
 }
 
-static unsigned int rdata_hash(const struct rdata* item) {
-    size_t n, o, p;
-    unsigned int key = 0;
+static uint64_t rdata_hash(const uint8_t* p, size_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len * 0xff51afd7ed558ccdULL), k;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&k, p, 8);
+        k *= 0x87c37b91114253d5ULL;
+        k = (k << 31) | (k >> 33);
+        k *= 0x4cf5ad432745937fULL;
+        h ^= k;
+        h = ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+    }
+    if (len) {
+        k = 0;
+        memcpy(&k, p, len);
+        k *= 0x87c37b91114253d5ULL;
+        k = (k << 31) | (k >> 33);
+        k *= 0x4cf5ad432745937fULL;
+        h ^= k;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
 
-    for (n = 0, o = 0, p = 0; n < item->len; n++) {
-        p |= item->data[n] << (o * 8);
-        o++;
-        if (o > 3) {
-            key ^= p;
-            p = 0;
-            o = 0;
-        }
+static int rdata_tbl_resize(size_t size) {
+    struct rdata** tbl;
+    size_t n, i;
+
+    if (!(tbl = calloc(size, sizeof(*tbl)))) {
+        return -1;
     }
-    if (o) {
-        key ^= p;
+    for (n = 0; n < rdata_tbl_size; n++) {
+        if (rdata_tbl[n]) {
+            for (i = rdata_tbl[n]->hash & (size - 1); tbl[i]; i = (i + 1) & (size - 1));
+            tbl[i] = rdata_tbl[n];
+        }
     }
+    free(rdata_tbl);
+    rdata_tbl = tbl;
+    rdata_tbl_size = size;
 
-    return key;
+    return 0;
 }
 
-static unsigned int rdata_cmp(const struct rdata* a, const struct rdata* b) {
-    if (a->len == b->len) {
-        return memcmp(a->data, b->data, a->len);
+static void rdata_tbl_remove(struct rdata* r) {
+    size_t mask = rdata_tbl_size - 1, i, j, home;
+
+    for (i = r->hash & mask; rdata_tbl[i] != r; i = (i + 1) & mask);
+    rdata_tbl[i] = 0;
+
+    /* shift back entries that probed past the removed one */
+    for (j = (i + 1) & mask; rdata_tbl[j]; j = (j + 1) & mask) {
+        home = rdata_tbl[j]->hash & mask;
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+            rdata_tbl[i] = rdata_tbl[j];
+            rdata_tbl[j] = 0;
+            i = j;
+        }
     }
-    else if (a->len < b->len)
-        return -1;
-    return 1;
 }
 
-static void rdata_free(struct rdata* item) {
-    if (item) {
-        if (item->data) {
-            free(item->data);
+/*
+ * Evicted indexes are only handed out again once the message they were
+ * evicted for has been written, the decoder sees all evictions of a
+ * message before any of its rdata.
+ */
+static int rdata_reuse_push(size_t idx) {
+    size_t* p;
+
+    if (rdata_reuse_tail == rdata_reuse_size) {
+        if (rdata_reuse_head) {
+            memmove(rdata_reuse, &(rdata_reuse[rdata_reuse_head]), (rdata_reuse_tail - rdata_reuse_head) * sizeof(size_t));
+            rdata_reuse_tail -= rdata_reuse_head;
+            rdata_reuse_head = 0;
+        }
+        else {
+            if (!(p = realloc(rdata_reuse, (rdata_reuse_size + 64) * sizeof(size_t)))) {
+                return -1;
+            }
+            rdata_reuse = p;
+            rdata_reuse_size += 64;
+        }
+    }
+    rdata_reuse[rdata_reuse_tail++] = idx;
+
+    return 0;
+}
+
+static int rdata_evict(void) {
+    struct rdata* r;
+    size_t n, *p;
+
+    if (!last.rdata_index) {
+        return 1;
+    }
+    for (n = 0; n < (RDATA_USES_MAX + 1) * last.rdata_index + 1; n++) {
+        if (rdata_hand >= last.rdata_index) {
+            rdata_hand = 0;
+        }
+        r = rdata_idx[rdata_hand++];
+        if (!r || r->message == rdata_message) {
+            continue;
+        }
+        if (r->uses) {
+            r->uses--;
+            continue;
+        }
+
+        if (rdata_evicted_num == rdata_evicted_size) {
+            if (!(p = realloc(rdata_evicted, (rdata_evicted_size + 64) * sizeof(size_t)))) {
+                return -1;
+            }
+            rdata_evicted = p;
+            rdata_evicted_size += 64;
         }
-        free(item);
+        rdata_evicted[rdata_evicted_num++] = r->idx;
+
+        rdata_tbl_remove(r);
+        rdata_idx[r->idx] = 0;
+        rdata_bytes -= RDATA_SIZE(r->len);
+        rdata_stats.entries--;
+        rdata_stats.evictions++;
+        free(r);
+
+        return 0;
     }
+
+    return 1;
+}
+
+static void rdata_reset(void) {
+    size_t n;
+
+    for (n = 0; n < rdata_idx_size; n++) {
+        free(rdata_idx[n]);
+    }
+    free(rdata_idx);
+    rdata_idx = 0;
+    rdata_idx_size = 0;
+    free(rdata_tbl);
+    rdata_tbl = 0;
+    rdata_tbl_size = 0;
+    free(rdata_reuse);
+    rdata_reuse = 0;
+    rdata_reuse_head = rdata_reuse_tail = rdata_reuse_size = 0;
+    free(rdata_evicted);
+    rdata_evicted = 0;
+    rdata_evicted_num = rdata_evicted_size = 0;
+    rdata_hand = 0;
+    rdata_bytes = 0;
+    rdata_stats.entries = 0;
 }
 
 static int rdata_add(uint8_t * p, size_t len) {
-    struct rdata* key;
+    struct rdata* r;
+    size_t i, idx;
 
     if (len < RDATA_INDEX_MIN_SIZE)
         return 1;
 
-    if (!(key = calloc(1, sizeof(struct rdata)))) {
-        return 0;
+    if (RDATA_INDEX_SIZE) {
+        while (rdata_bytes + RDATA_SIZE(len) > RDATA_INDEX_SIZE) {
+            if (rdata_evict()) {
+                break;
+            }
+        }
     }
-    if (!(key->data = calloc(1, len))) {
-        free(key);
-        return 0;
+
+    if ((rdata_stats.entries + 1) * 2 > rdata_tbl_size
+        && rdata_tbl_resize(rdata_tbl_size ? rdata_tbl_size * 2 : 1024))
+    {
+        return -1;
+    }
+    if (rdata_reuse_head < rdata_reuse_tail) {
+        idx = rdata_reuse[rdata_reuse_head++];
+    }
+    else {
+        idx = last.rdata_index;
+        if (idx >= rdata_idx_size) {
+            struct rdata** tmp;
+            size_t size = rdata_idx_size ? rdata_idx_size * 2 : 1024;
+
+            if (!(tmp = realloc(rdata_idx, size * sizeof(*rdata_idx)))) {
+                return -1;
+            }
+            memset(&(tmp[rdata_idx_size]), 0, (size - rdata_idx_size) * sizeof(*rdata_idx));
+            rdata_idx = tmp;
+            rdata_idx_size = size;
+        }
+        last.rdata_index++;
     }
 
-    key->len = len;
-    memcpy(key->data, p, len);
-    key->idx = last.rdata_index++;
+    if (!(r = malloc(RDATA_SIZE(len)))) {
+        return -1;
+    }
+    r->hash = rdata_hash(p, len);
+    r->idx = idx;
+    r->len = len;
+    r->message = rdata_message;
+    r->uses = 0;
+    memcpy(r->data, p, len);
 
-/*    printf("rdata_add  %u: ", rdata_hash(key));*/
-/*    {*/
-/*        size_t n = len;*/
-/*        uint8_t* x = p;*/
-/*        while (n--) {*/
-/*            printf("%02x", *x);*/
-/*            x++;*/
-/*        }*/
-/*    }*/
-/*    printf("\n");*/
-    hash_add(key, key, rdata_tbl);
+    for (i = r->hash & (rdata_tbl_size - 1); rdata_tbl[i]; i = (i + 1) & (rdata_tbl_size - 1));
+    rdata_tbl[i] = r;
+    rdata_idx[idx] = r;
+    rdata_bytes += RDATA_SIZE(len);
+    rdata_stats.entries++;
 
     return 0;
 }
 
 static size_t rdata_find(uint8_t * p, size_t len, size_t* found) {
-    struct rdata key;
     struct rdata* r;
+    uint64_t hash;
+    size_t i;
 
     if (len < RDATA_INDEX_MIN_SIZE)
         return 1;
 
-    key.data = p;
-    key.len = len;
-
-/*    printf("rdata_find %u: ", rdata_hash(&key));*/
-/*    {*/
-/*        size_t n = len;*/
-/*        uint8_t* x = p;*/
-/*        while (n--) {*/
-/*            printf("%02x", *x);*/
-/*            x++;*/
-/*        }*/
-/*    }*/
-/*    printf("\n");*/
+    rdata_stats.lookups++;
+    if (!rdata_tbl_size) {
+        return 1;
+    }
 
-    if ((r = hash_find(&key, rdata_tbl))) {
-/*        printf("rdata found %lu at %lu\n", len, found->idx);*/
-        *found = r->idx;
-        return 0;
+    hash = rdata_hash(p, len);
+    for (i = hash & (rdata_tbl_size - 1); (r = rdata_tbl[i]); i = (i + 1) & (rdata_tbl_size - 1)) {
+        if (r->hash == hash && r->len == len && !memcmp(r->data, p, len)) {
+/*            printf("rdata found %lu at %lu\n", len, r->idx);*/
+            if (r->uses < RDATA_USES_MAX) {
+                r->uses++;
+            }
+            r->message = rdata_message;
+            rdata_stats.hits++;
+            *found = r->idx;
+            return 0;
+        }
     }
 
     return 1;
 }
 
-
 int rdata_find2(uint8_t * p, size_t len, size_t* found) {
-    struct rdata* r = last.rdata;
-    size_t n = 0;
+    if (len < RDATA_RINDEX_MIN_SIZE)
+        return 1;
+
+    return mru_find(&rdata_mru, p, len, mru_hash(p, len), found);
+}
 
+int rdata_add2(uint8_t* p, size_t len) {
     if (len < RDATA_RINDEX_MIN_SIZE)
         return 1;
 
-    while (r) {
-        if (r->len == len && !memcmp(p, r->data, len)) {
-            break;
-        }
-        r = r->next;
-        n++;
-    }
-    if (r) {
-/*        printf("rdata found at %lu: ", n);*/
-/*        {*/
-/*            size_t n = len;*/
-/*            uint8_t* x = p;*/
-/*            while (n--) {*/
-/*                printf("%02x", *x);*/
-/*                x++;*/
-/*            }*/
-/*        }*/
-/*        printf("\n");*/
+    return mru_add(&rdata_mru, RDATA_RINDEX_SIZE, p, len, mru_hash(p, len));
+}
 
-        if (last.rdata != r) {
-            struct rdata* prev = r->prev, *next = r->next;
+static void* parse_alloc(size_t nmemb, size_t size) {
+    struct parse_arena* arena;
+    size_t need, arena_size;
+    void* p;
 
-            if (prev) {
-                prev->next = next;
-            }
-            if (next) {
-                next->prev = prev;
-            }
+    if (size && nmemb > ((size_t)-1 - PARSE_ALIGN) / size) {
+        return 0;
+    }
+    need = (nmemb * size + PARSE_ALIGN - 1) & ~(PARSE_ALIGN - 1);
 
-            r->prev = 0;
-            r->next = last.rdata;
-            last.rdata->prev = r;
-            last.rdata = r;
+    while (parse_arena_p) {
+        if (parse_arena_p->size - parse_arena_p->used >= need) {
+            p = &(parse_arena_p->data[parse_arena_p->used]);
+            parse_arena_p->used += need;
+            memset(p, 0, nmemb * size);
+            return p;
+        }
+        if (!parse_arena_p->next) {
+            break;
         }
+        parse_arena_p = parse_arena_p->next;
+    }
 
-        *found = n;
+    arena_size = message_size;
+    if (arena_size < need) {
+        arena_size = need;
+    }
+    if (!(arena = malloc(offsetof(struct parse_arena, data) + arena_size))) {
         return 0;
     }
+    arena->next = 0;
+    arena->size = arena_size;
+    arena->used = need;
+    if (parse_arena_p) {
+        parse_arena_p->next = arena;
+    }
+    else {
+        parse_arena = arena;
+    }
+    parse_arena_p = arena;
 
-    return 1;
+    memset(arena->data, 0, nmemb * size);
+    return arena->data;
 }
 
-int rdata_add2(uint8_t* p, size_t len) {
-    struct rdata* r;
+static void offset_add(const uint8_t* p) {
+    size_t offset = p - offset_base;
 
-    if (len < RDATA_RINDEX_MIN_SIZE)
+    if (offset < OFFSET_MAP_SIZE) {
+        offset_map[offset] = offset_num + 1;
+        offset_list[offset_list_num++] = offset;
+    }
+    offset_num++;
+}
+
+static int offset_find(uint16_t offset, size_t* n_offset) {
+    if (offset >= OFFSET_MAP_SIZE || !offset_map[offset]) {
         return 1;
+    }
+    *n_offset = offset_map[offset] - 1;
+    return 0;
+}
 
-    if (!(r = calloc(1, sizeof(struct rdata)))) {
-        return -1;
+static void offset_rewind(size_t num, size_t list_num) {
+    while (offset_list_num > list_num) {
+        offset_map[offset_list[--offset_list_num]] = 0;
     }
-    if (!(r->data = calloc(1, len))) {
-        free(r);
-        return -1;
+    offset_num = num;
+}
+
+static void parse_reset(void) {
+    struct parse_arena* arena;
+
+    for (arena = parse_arena; arena; arena = arena->next) {
+        arena->used = 0;
     }
+    parse_arena_p = parse_arena;
 
-    r->len = len;
-    memcpy(r->data, p, len);
+    offset_rewind(0, 0);
+}
 
-/*    printf("rdata_add: ");*/
-/*    {*/
-/*        size_t n = len;*/
-/*        uint8_t* x = p;*/
-/*        while (n--) {*/
-/*            printf("%02x", *x);*/
-/*            x++;*/
-/*        }*/
-/*    }*/
-/*    printf("\n");*/
+/*
+ * Find where the name in NAPTR rdata starts, after the order, preference,
+ * flags, services and regexp fields.
+ */
+static int naptr_offset(uint8_t * p, size_t l, size_t * offset) {
+    uint8_t * p2 = p;
+    uint8_t len;
+
+    advancexb(2, p2, l, "naptr int16 #1");
+    advancexb(2, p2, l, "naptr int16 #2");
+    need8(len, p2, l, "naptr str len #1");
+    advancexb(len, p2, l, "naptr str #1");
+    need8(len, p2, l, "naptr str len #2");
+    advancexb(len, p2, l, "naptr str #2");
+    need8(len, p2, l, "naptr str len #3");
+    advancexb(len, p2, l, "naptr str #3");
+    *offset = p2 - p;
 
-    if (last.rdata) {
-        last.rdata->prev = r;
+    return 0;
+}
+
+/*
+ * Split the rdata of the record into the bytes before, the names in and
+ * the bytes after the names.  Returns 1 if the names do not parse within
+ * the rdata.
+ */
+static int parse_mixed_rdata(dns_rr_t* rr, size_t num_labels, size_t offset) {
+    uint8_t len;
+    uint8_t * p2;
+    size_t l2;
+    dns_label_t* label;
+    dns_rdata_t* rdata;
+
+    rr->mixed_rdatas = num_labels + (offset ? 1 : 0) + 1;
+    if (!(rr->mixed_rdata = parse_alloc(rr->mixed_rdatas, sizeof(dns_rdata_t)))) {
+        fprintf(stderr, "cds out of memory\n");
+        return -1;
+    }
+
+    p2 = rr->rdata;
+    l2 = rr->rdlength;
+    rdata = rr->mixed_rdata;
+    rr->have_mixed_rdata = 1;
+
+    if (offset) {
+        rdata->rdata_len = offset;
+        rdata->rdata = p2;
+        advancexb((int)offset, p2, l2, "mixed rdata");
+        rdata->have_rdata = 1;
+        rdata->is_complete = 1;
+        rdata++;
     }
-    r->next = last.rdata;
-    last.rdata = r;
-    last.rdata_num++;
+    while (num_labels--) {
+        uint8_t* p3;
+        size_t l3;
+
+        /* first pass check number of rdata labels */
+
+        p3 = p2;
+        l3 = l2;
+
+        if (check_dns_label(&(rdata->labels), &p3, &l3)) {
+            if (!rdata->labels) {
+                fprintf(stderr, "cds mixed rdata no labels\n");
+                return 1;
+            }
+        }
+
+        /* second pass, allocate mixed rdata */
+        if (!(rdata->label = parse_alloc(rdata->labels, sizeof(dns_label_t)))) {
+            fprintf(stderr, "cds out of memory\n");
+            return -1;
+        }
+
+        label = rdata->label;
+        rdata->have_labels = 1;
+        while (1) {
+            need8(len, p2, l2, "name length");
 
-    if (last.rdata_last) {
-        if (last.rdata_num >= RDATA_RINDEX_SIZE) {
-            r = last.rdata_last;
+            if ((len & 0xc0) == 0xc0) {
+                label->offset_p = p2;
+                need8(label->offset, p2, l2, "name offset");
+                label->offset |= (len & 0x3f) << 8;
+                label->have_offset = 1;
+                offset_add(label->offset_p - 1);
+                label->is_complete = 1;
+                break;
+            }
+            else if (len & 0xc0) {
+                label->extension_bits = len;
+                label->have_extension_bits = 1;
+                label->is_complete = 1;
+                break;
+            }
+            else if (len) {
+                label->size = len;
+                label->have_size = 1;
+                label->label = p2;
+                label->offset = p2 - offset_base - 1;
+                offset_add(p2 - 1);
+                advancexb(len, p2, l2, "name label");
+                label->have_label = 1;
+            }
+            else {
+                label->have_size = 1;
+                label->is_complete = 1;
+                break;
+            }
 
-            last.rdata_last = r->prev;
-            last.rdata_last->next = 0;
-            last.rdata_num--;
-            free(r->data);
-            free(r);
+            label->is_complete = 1;
+            label++;
         }
+        rdata->is_complete = 1;
+        rdata++;
+    }
+    if (l2) {
+        rdata->rdata_len = l2;
+        rdata->rdata = p2;
+        advancexb((int)l2, p2, l2, "mixed rdata");
+        rdata->have_rdata = 1;
+        rdata->is_complete = 1;
     }
     else {
-        last.rdata_last = r;
+        rr->mixed_rdatas--;
     }
 
     return 0;
@@ -490,7 +1327,7 @@ static int parse_dns_rr(char is_q, dns_rr_t* rr, size_t expected_rrs, size_t * a
         }
 
         /* second pass, allocate labels and fill */
-        if (!(rr->label = calloc(rr->labels, sizeof(dns_label_t)))) {
+        if (!(rr->label = parse_alloc(rr->labels, sizeof(dns_label_t)))) {
             fprintf(stderr, "cds out of memory\n");
             return -1;
         }
@@ -508,6 +1345,7 @@ static int parse_dns_rr(char is_q, dns_rr_t* rr, size_t expected_rrs, size_t * a
                 need8(label->offset, *p, *l, "name offset");
                 label->offset |= (len & 0x3f) << 8;
                 label->have_offset = 1;
+                offset_add(label->offset_p - 1);
                 label->is_complete = 1;
                 break;
             }
@@ -521,6 +1359,8 @@ static int parse_dns_rr(char is_q, dns_rr_t* rr, size_t expected_rrs, size_t * a
                 label->size = len;
                 label->have_size = 1;
                 label->label = *p;
+                label->offset = *p - offset_base - 1;
+                offset_add(*p - 1);
                 advancexb(len, *p, *l, "name label");
                 label->have_label = 1;
             }
@@ -616,115 +1456,31 @@ static int parse_dns_rr(char is_q, dns_rr_t* rr, size_t expected_rrs, size_t * a
 
                 case 35: /* NAPTR */
                     num_labels = 1;
-                    p2 = *p;
-                    l2 = *l;
-                    advancexb(2, p2, l2, "naptr int16 #1");
-                    advancexb(2, p2, l2, "naptr int16 #2");
-                    need8(len, p2, l2, "naptr str len #1");
-                    advancexb(len, p2, l2, "naptr str #1");
-                    need8(len, p2, l2, "naptr str len #2");
-                    advancexb(len, p2, l2, "naptr str #2");
-                    need8(len, p2, l2, "naptr str len #3");
-                    advancexb(len, p2, l2, "naptr str #3");
-                    offset = p2 - *p;
+                    if (naptr_offset(rr->rdata, rr->rdlength, &offset)) {
+                        num_labels = 0;
+                    }
                     break;
 
                 case 55: /* HIP TODO */
                     break;
             }
 
-            if (num_labels) {
-                dns_rdata_t* rdata;
-
-                rr->mixed_rdatas = num_labels + (offset ? 1 : 0) + 1;
-                if (!(rr->mixed_rdata = calloc(rr->mixed_rdatas, sizeof(dns_rdata_t)))) {
-                    fprintf(stderr, "cds out of memory\n");
-                    return -1;
-                }
-
-                p2 = rr->rdata;
-                l2 = rr->rdlength;
-                rdata = rr->mixed_rdata;
-                rr->have_mixed_rdata = 1;
-
-                if (offset) {
-                    rdata->rdata_len = offset;
-                    rdata->rdata = p2;
-                    advancexb((int)offset, p2, l2, "mixed rdata");
-                    rdata->have_rdata = 1;
-                    rdata->is_complete = 1;
-                    rdata++;
-                }
-                while (num_labels--) {
-                    uint8_t* p3;
-                    size_t l3;
-
-                    /* first pass check number of rdata labels */
+            /*
+             * Names in rdata that is given by an index are not looked at,
+             * the decoder only sees the index.
+             */
+            if (num_labels && !rr->have_rdata_index && !rr->have_rdata_rindex) {
+                size_t mark = offset_num, list_mark = offset_list_num;
+                int ret = parse_mixed_rdata(rr, num_labels, offset);
 
-                    p3 = p2;
-                    l3 = l2;
-
-                    if (check_dns_label(&(rdata->labels), &p3, &l3)) {
-                        if (!rdata->labels) {
-                            fprintf(stderr, "cds mixed rdata no labels\n");
-                            return 1;
-                        }
-                    }
-
-                    /* second pass, allocate mixed rdata */
-                    if (!(rdata->label = calloc(rdata->labels, sizeof(dns_label_t)))) {
-                        fprintf(stderr, "cds out of memory\n");
-                        return -1;
-                    }
-
-                    label = rdata->label;
-                    rdata->have_labels = 1;
-                    while (1) {
-                        need8(len, p2, l2, "name length");
-
-                        if ((len & 0xc0) == 0xc0) {
-                            label->offset_p = p2;
-                            need8(label->offset, p2, l2, "name offset");
-                            label->offset |= (len & 0x3f) << 8;
-                            label->have_offset = 1;
-                            label->is_complete = 1;
-                            break;
-                        }
-                        else if (len & 0xc0) {
-                            label->extension_bits = len;
-                            label->have_extension_bits = 1;
-                            label->is_complete = 1;
-                            break;
-                        }
-                        else if (len) {
-                            label->size = len;
-                            label->have_size = 1;
-                            label->label = p2;
-                            advancexb(len, p2, l2, "name label");
-                            label->have_label = 1;
-                        }
-                        else {
-                            label->have_size = 1;
-                            label->is_complete = 1;
-                            break;
-                        }
-
-                        label->is_complete = 1;
-                        label++;
-                    }
-                    rdata->is_complete = 1;
-                    rdata++;
+                if (ret < 0) {
+                    return ret;
                 }
-                if (l2) {
-/*printf("last rdata %lu\n", l2);*/
-                    rdata->rdata_len = l2;
-                    rdata->rdata = p2;
-                    advancexb((int)l2, p2, l2, "mixed rdata");
-                    rdata->have_rdata = 1;
-                    rdata->is_complete = 1;
-                }
-                else {
-                    rr->mixed_rdatas--;
+                if (ret) {
+                    /* names in the rdata do not parse, keep it as is */
+                    offset_rewind(mark, list_mark);
+                    rr->have_mixed_rdata = 0;
+                    rr->mixed_rdatas = 0;
                 }
             }
             rr->have_rdata = 1;
@@ -739,9 +1495,23 @@ static int parse_dns_rr(char is_q, dns_rr_t* rr, size_t expected_rrs, size_t * a
 
 int print_cbor = 0;
 
+/*
+ * Each record takes at least 5 bytes so a count larger than what is left of
+ * the message can not be parsed, this keeps bogus counts from growing the
+ * parse arena.
+ */
+static size_t parse_rrs(size_t count, size_t l) {
+    if (count > l / 5 + 1) {
+        return l / 5 + 1;
+    }
+    return count;
+}
+
 static int parse_dns(dns_t * dns, uint8_t ** p, size_t * l) {
     int ret;
 
+    offset_base = *p;
+
     need16(dns->id, *p, *l, "dns id");
     dns->have_id = 1;
     need16(dns->raw, *p, *l, "raw dns bits");
@@ -758,11 +1528,11 @@ static int parse_dns(dns_t * dns, uint8_t ** p, size_t * l) {
     dns->header_is_complete = 1;
 
     if (dns->qdcount) {
-        if (!(dns->question = calloc(dns->qdcount, sizeof(dns_rr_t)))) {
+        if (!(dns->question = parse_alloc(parse_rrs(dns->qdcount, *l), sizeof(dns_rr_t)))) {
             fprintf(stderr, "cds out of memory\n");
             return -1;
         }
-        ret = parse_dns_rr(1, dns->question, dns->qdcount, &(dns->questions), p, l);
+        ret = parse_dns_rr(1, dns->question, parse_rrs(dns->qdcount, *l), &(dns->questions), p, l);
 /*if (ret) printf("qr %d\n", ret);*/
         if (ret > -1 && dns->questions) {
             dns->have_questions = 1;
@@ -773,11 +1543,11 @@ static int parse_dns(dns_t * dns, uint8_t ** p, size_t * l) {
     }
 
     if (dns->ancount) {
-        if (!(dns->answer = calloc(dns->ancount, sizeof(dns_rr_t)))) {
+        if (!(dns->answer = parse_alloc(parse_rrs(dns->ancount, *l), sizeof(dns_rr_t)))) {
             fprintf(stderr, "cds out of memory\n");
             return -1;
         }
-        ret = parse_dns_rr(0, dns->answer, dns->ancount, &(dns->answers), p, l);
+        ret = parse_dns_rr(0, dns->answer, parse_rrs(dns->ancount, *l), &(dns->answers), p, l);
 /*if (ret) printf("an %d\n", ret);*/
         if (ret > -1 && dns->answers) {
             dns->have_answers = 1;
@@ -788,11 +1558,11 @@ static int parse_dns(dns_t * dns, uint8_t ** p, size_t * l) {
     }
 
     if (dns->nscount) {
-        if (!(dns->authority = calloc(dns->nscount, sizeof(dns_rr_t)))) {
+        if (!(dns->authority = parse_alloc(parse_rrs(dns->nscount, *l), sizeof(dns_rr_t)))) {
             fprintf(stderr, "cds out of memory\n");
             return -1;
         }
-        ret = parse_dns_rr(0, dns->authority, dns->nscount, &(dns->authorities), p, l);
+        ret = parse_dns_rr(0, dns->authority, parse_rrs(dns->nscount, *l), &(dns->authorities), p, l);
 /*if (ret) { printf("ns %d %lu\n", ret, dns->authorities);*/
 /*{*/
 /*    size_t n;*/
@@ -810,11 +1580,11 @@ static int parse_dns(dns_t * dns, uint8_t ** p, size_t * l) {
     }
 
     if (dns->arcount) {
-        if (!(dns->additional = calloc(dns->arcount, sizeof(dns_rr_t)))) {
+        if (!(dns->additional = parse_alloc(parse_rrs(dns->arcount, *l), sizeof(dns_rr_t)))) {
             fprintf(stderr, "cds out of memory\n");
             return -1;
         }
-        ret = parse_dns_rr(0, dns->additional, dns->arcount, &(dns->additionals), p, l);
+        ret = parse_dns_rr(0, dns->additional, parse_rrs(dns->arcount, *l), &(dns->additionals), p, l);
 /*if (ret) printf("ar %d\n", ret);*/
         if (ret > -1 && dns->additionals) {
             dns->have_additionals = 1;
@@ -891,32 +1661,47 @@ int print_label(dns_label_t* label, size_t labels) {
     return 0;
 }
 
-int print_rlabel(dns_rlabel_t* label) {
-    size_t n;
+int print_rlabel(const uint8_t* key) {
+    size_t n, labels = *key;
+    const uint8_t* p = key + 1;
+
+    for (n = 0; n < labels; n++) {
+        if (*p == RLABEL_KEY_N_OFFSET) {
+            size_t n_offset;
 
-    for (n = 0; n < label->labels; n++) {
-        if (label->label[n].size) {
-            printf(" %.*s", label->label[n].size, label->label[n].label);
+            memcpy(&n_offset, p + 1, sizeof(n_offset));
+            printf(" %lu", n_offset);
+            p += 1 + sizeof(n_offset);
         }
-        else if (label->label[n].have_n_offset) {
-            printf(" %lu", label->label[n].n_offset);
+        else if (*p) {
+            printf(" %.*s", *p, p + 1);
+            p += 1 + *p;
         }
         else {
             printf(" $");
+            p++;
         }
     }
     return 0;
 }
 
-int dns_rlabel_add(dns_label_t* label, size_t labels) {
-    dns_rlabel_t* copy;
+/*
+ * Pack the labels into rlabel_key, returns the size of the key or 0 if
+ * the labels can not be used in the reverse label index.
+ */
+static size_t rlabel_pack(dns_label_t* label, size_t labels) {
     size_t n, size = 0;
+    uint8_t* p = rlabel_key;
 
+    if (labels > 255) {
+        return 0;
+    }
     for (n = 0; n < labels; n++) {
-        if ((label[n].have_offset && !label[n].have_n_offset)
+        if (!label[n].is_complete
+            || (label[n].have_offset && !label[n].have_n_offset)
             || label[n].have_extension_bits)
         {
-            return 1;
+            return 0;
         }
         if (label[n].have_size) {
             size += label[n].size;
@@ -924,249 +1709,75 @@ int dns_rlabel_add(dns_label_t* label, size_t labels) {
     }
 /*printf("label size: %lu\n", size);*/
     if (size < MIN_RLABEL_SIZE) {
-        return 1;
-    }
-
-    if (!(copy = calloc(1, sizeof(dns_rlabel_t)))) {
-        return -1;
+        return 0;
     }
 
-    assert(labels <= CDS_RLABEL_T_LABELS);
-    copy->labels = labels;
-
+    *p++ = labels;
     for (n = 0; n < labels; n++) {
         if (label[n].have_n_offset) {
-            copy->label[n].have_n_offset = 1;
-            copy->label[n].n_offset = label[n].n_offset;
-            continue;
-        }
-        if (label[n].size) {
-            assert(label[n].size <= CDS_RLABEL_LABEL_T_LABEL);
-
-            copy->label[n].size = label[n].size;
-            memcpy(&(copy->label[n].label), label[n].label, label[n].size);
+            *p = RLABEL_KEY_N_OFFSET;
+            memcpy(p + 1, &(label[n].n_offset), sizeof(label[n].n_offset));
+            p += 1 + sizeof(label[n].n_offset);
         }
-    }
-
-/*printf("add"); print_label(label, labels); printf("\n");*/
-
-    if (last.dns_rlabel) {
-        last.dns_rlabel->prev = copy;
-    }
-    copy->next = last.dns_rlabel;
-    last.dns_rlabel = copy;
-    last.dns_rlabels++;
-    if (last.dns_rlabel_last) {
-        if (last.dns_rlabels >= MAX_RLABELS) {
-            dns_rlabel_t* remove = last.dns_rlabel_last;
-
-/*printf("remove %p %p\n", remove, remove->prev);*/
-
-            last.dns_rlabel_last = remove->prev;
-            last.dns_rlabel_last->next = 0;
-            free(remove);
-            last.dns_rlabels--;
+        else {
+            assert(label[n].size < RLABEL_KEY_LABEL);
+            *p = label[n].size;
+            if (label[n].size) {
+                memcpy(p + 1, label[n].label, label[n].size);
+            }
+            p += 1 + label[n].size;
         }
     }
-    else {
-        last.dns_rlabel_last = copy;
-    }
 
-    return 0;
+    return p - rlabel_key;
 }
 
-static size_t dns_rlabel_find(dns_label_t* label, size_t labels, size_t * rlabel_idx) {
-    size_t n, n2, size = 0;
-    dns_rlabel_t* rlabel;
+int dns_rlabel_add(dns_label_t* label, size_t labels) {
+    size_t size;
 
-    for (n = 0; n < labels; n++) {
-        if ((label[n].have_offset && !label[n].have_n_offset)
-            || label[n].have_extension_bits)
-        {
-            return 1;
-        }
-        if (label[n].have_size) {
-            size += label[n].size;
-        }
-    }
-/*printf("label size: %lu\n", size);*/
-    if (size < MIN_RLABEL_SIZE) {
+    if (!(size = rlabel_pack(label, labels))) {
         return 1;
     }
 
-/*printf("find"); print_label(label, labels); printf("\n");*/
-
-    n = 0;
-    rlabel = last.dns_rlabel;
-    while (rlabel) {
-        if (rlabel->labels == labels) {
-/*printf("check"); print_rlabel(rlabel); printf("\n");*/
-
-            for (n2 = 0; n2 < labels; n2++) {
-/*printf("%d %lu <> %d %lu\n", label[n2].have_n_offset, label[n2].n_offset, rlabel->label[n2].have_n_offset, rlabel->label[n2].n_offset);*/
-                if (label[n2].have_n_offset
-                    || rlabel->label[n2].have_n_offset)
-                {
-                    if (label[n2].n_offset == rlabel->label[n2].n_offset)
-                        continue;
-                }
-                else if (label[n2].size == rlabel->label[n2].size
-                    && !memcmp(label[n2].label, rlabel->label[n2].label, label[n2].size))
-                {
-                    continue;
-                }
-                break;
-            }
-
-            if (n2 == labels) {
-/*printf("found at %lu: ", n); print_rlabel(rlabel); printf("\n");*/
-                break;
-            }
-        }
-        rlabel = rlabel->next;
-        n++;
-    }
-    if (rlabel) {
-        if (last.dns_rlabel != rlabel) {
-            dns_rlabel_t* prev = rlabel->prev, *next = rlabel->next;
-
-            if (prev) {
-                prev->next = next;
-            }
-            if (next) {
-                next->prev = prev;
-            }
-
-            rlabel->prev = 0;
-            rlabel->next = last.dns_rlabel;
-            last.dns_rlabel->prev = rlabel;
-            last.dns_rlabel = rlabel;
-        }
-
-        *rlabel_idx = n;
-        return 0;
-    }
-
-    return 1;
-}
+/*printf("add"); print_label(label, labels); printf("\n");*/
 
-static void free_rdata(dns_rdata_t* rdata) {
-    if (rdata->label) {
-        free(rdata->label);
-    }
+    return mru_add(&rlabel_mru, MAX_RLABELS, rlabel_key, size, mru_hash(rlabel_key, size));
 }
 
-static void free_rr(dns_rr_t* rr) {
-    size_t n;
+static size_t dns_rlabel_find(dns_label_t* label, size_t labels, size_t * rlabel_idx) {
+    size_t size;
 
-    if (rr->label) {
-        free(rr->label);
-    }
-    for (n = 0; n < rr->mixed_rdatas; n++) {
-        free_rdata(&(rr->mixed_rdata[n]));
-    }
-    if (rr->mixed_rdata) {
-        free(rr->mixed_rdata);
+    if (!(size = rlabel_pack(label, labels))) {
+        return 1;
     }
-}
 
-static void free_dns(dns_t* dns) {
-    size_t n;
+/*printf("find"); print_label(label, labels); printf("\n");*/
 
-    for(n = 0; n < dns->questions; n++) {
-        free_rr(&(dns->question[n]));
-    }
-    for(n = 0; n < dns->answers; n++) {
-        free_rr(&(dns->answer[n]));
-    }
-    for(n = 0; n < dns->authorities; n++) {
-        free_rr(&(dns->authority[n]));
-    }
-    for(n = 0; n < dns->additionals; n++) {
-        free_rr(&(dns->additional[n]));
-    }
+    return mru_find(&rlabel_mru, rlabel_key, size, mru_hash(rlabel_key, size), rlabel_idx);
 }
 
-void dns_rr_build_offset(dns_rr_t* rr_list, size_t count, uint16_t* offset, size_t offsets, size_t* n_offset, const u_char *payload) {
+void dns_rr_set_offset(dns_rr_t* rr_list, size_t count) {
     dns_rr_t* rrp;
     size_t rr, n, n2;
 
-    for (rr = 0; rr < count && *n_offset < offsets; rr++) {
-        rrp = &(rr_list[rr]);
-
-        for (n = 0; n < rrp->labels && *n_offset < offsets; n++) {
-            if (rrp->label[n].size) {
-                rrp->label[n].offset = rrp->label[n].label - payload - 1;
-                offset[*n_offset] = rrp->label[n].offset;
-                *n_offset += 1;
-            }
-            else if (rrp->label[n].have_offset) {
-                offset[*n_offset] = rrp->label[n].offset_p - payload - 1;
-                *n_offset += 1;
-            }
-
-/*                printf("%u %u %u %.*s\n",*/
-/*                    rrp->label[n].size,*/
-/*                    rrp->label[n].extension_bits,*/
-/*                    rrp->label[n].offset,*/
-/*                    rrp->label[n].size ? rrp->label[n].size : 0,*/
-/*                    rrp->label[n].size ? (char*)rrp->label[n].label : ""*/
-/*                );*/
-        }
-        for (n = 0; n < rrp->mixed_rdatas && *n_offset < offsets; n++) {
-            for (n2 = 0; n2 < rrp->mixed_rdata[n].labels; n2++) {
-                if (rrp->mixed_rdata[n].label[n2].size) {
-                    rrp->mixed_rdata[n].label[n2].offset = rrp->mixed_rdata[n].label[n2].label - payload - 1;
-                    offset[*n_offset] = rrp->mixed_rdata[n].label[n2].offset;
-                    *n_offset += 1;
-                }
-                else if (rrp->mixed_rdata[n].label[n2].have_offset) {
-                    offset[*n_offset] = rrp->mixed_rdata[n].label[n2].offset_p - payload - 1;
-                    *n_offset += 1;
-                }
-
-/*                    printf(" %u %u %u %.*s\n",*/
-/*                        rrp->mixed_rdata[n].label[n2].size,*/
-/*                        rrp->mixed_rdata[n].label[n2].extension_bits,*/
-/*                        rrp->mixed_rdata[n].label[n2].offset,*/
-/*                        rrp->mixed_rdata[n].label[n2].size ? rrp->mixed_rdata[n].label[n2].size : 0,*/
-/*                        rrp->mixed_rdata[n].label[n2].size ? (char*)rrp->mixed_rdata[n].label[n2].label : ""*/
-/*                    );*/
-            }
-        }
-    }
-}
-
-void dns_rr_set_offset(dns_rr_t* rr_list, size_t count, uint16_t* offset, size_t n_offset) {
-    dns_rr_t* rrp;
-    size_t rr, n, n2, n3;
-
     for (rr = 0; rr < count; rr++) {
         rrp = &(rr_list[rr]);
 
         for (n = 0; n < rrp->labels; n++) {
-            if (!rrp->label[n].size && rrp->label[n].offset) {
-                for (n3 = 0; n3 < n_offset; n3++) {
-                    if (rrp->label[n].offset == offset[n3]) {
-/*                            printf("%u => %lu\n", rrp->label[n].offset, n3);*/
-                        rrp->label[n].n_offset = n3;
-                        rrp->label[n].have_n_offset = 1;
-                        break;
-                    }
-                }
+            if (!rrp->label[n].size && rrp->label[n].offset
+                && !offset_find(rrp->label[n].offset, &(rrp->label[n].n_offset)))
+            {
+/*                printf("%u => %lu\n", rrp->label[n].offset, rrp->label[n].n_offset);*/
+                rrp->label[n].have_n_offset = 1;
             }
         }
         for (n = 0; n < rrp->mixed_rdatas; n++) {
             for (n2 = 0; n2 < rrp->mixed_rdata[n].labels; n2++) {
-                if (!rrp->mixed_rdata[n].label[n2].size && rrp->mixed_rdata[n].label[n2].offset) {
-                    for (n3 = 0; n3 < n_offset; n3++) {
-                        if (rrp->mixed_rdata[n].label[n2].offset == offset[n3]) {
-/*                                printf("%u => %lu\n", rrp->mixed_rdata[n].label[n2].offset, n3);*/
-                            rrp->mixed_rdata[n].label[n2].n_offset = n3;
-                            rrp->mixed_rdata[n].label[n2].have_n_offset = 1;
-                            break;
-                        }
-                    }
+                if (!rrp->mixed_rdata[n].label[n2].size && rrp->mixed_rdata[n].label[n2].offset
+                    && !offset_find(rrp->mixed_rdata[n].label[n2].offset, &(rrp->mixed_rdata[n].label[n2].n_offset)))
+                {
+/*                    printf("%u => %lu\n", rrp->mixed_rdata[n].label[n2].offset, rrp->mixed_rdata[n].label[n2].n_offset);*/
+                    rrp->mixed_rdata[n].label[n2].have_n_offset = 1;
                 }
             }
         }
@@ -1298,14 +1909,148 @@ CborError dns_build_rrs(CborEncoder* message, dns_rr_t* rr_list, size_t count) {
                 last.dns_ttl = rr->ttl;
             }
         }
-        rr++;
+        rr++;
+    }
+    if (cbor_err == CborNoError) cbor_err = cbor_encoder_close_container_checked(message, &rrs);
+
+    return cbor_err;
+}
+
+/* Put the dictionary in the indexes, the decoder does the same. */
+static int dict_seed(void) {
+    const uint8_t* rdata;
+    size_t n, len;
+
+    for (n = 0; n < cds_dict_names(dict); n++) {
+        uint8_t* key = &dict_key_data[dict_keys[n].offset];
+
+        if (dict_keys[n].label_bytes < MIN_RLABEL_SIZE) {
+            continue;
+        }
+        if (mru_add(&rlabel_mru, MAX_RLABELS, key, dict_keys[n].size, mru_hash(key, dict_keys[n].size))) {
+            return DUMP_CDS_ENOMEM;
+        }
+    }
+    for (n = 0; n < cds_dict_rdatas(dict); n++) {
+        rdata = cds_dict_rdata(dict, n, &len);
+        if (use_rdata_index) {
+            if (rdata_add((uint8_t*)rdata, len) < 0) {
+                return DUMP_CDS_ENOMEM;
+            }
+        }
+        else if (use_rdata_rindex) {
+            if (rdata_add2((uint8_t*)rdata, len) < 0) {
+                return DUMP_CDS_ENOMEM;
+            }
+        }
+        else {
+            break;
+        }
     }
-    if (cbor_err == CborNoError) cbor_err = cbor_encoder_close_container_checked(message, &rrs);
 
-    return cbor_err;
+    return DUMP_CDS_OK;
+}
+
+static int index_add(uint64_t offset) {
+    if (index_num >= index_size) {
+        size_t size = index_size ? index_size * 2 : 64;
+        struct cds_index_point* points;
+
+        if (!(points = realloc(index_points, size * sizeof(*points)))) {
+            return DUMP_CDS_ENOMEM;
+        }
+        index_points = points;
+        index_size = size;
+    }
+    memset(&index_points[index_num], 0, sizeof(*index_points));
+    index_points[index_num].offset = offset;
+    index_num++;
+
+    return DUMP_CDS_OK;
+}
+
+static int index_before(my_bpftimeval a, my_bpftimeval b) {
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_usec < b.tv_usec);
+}
+
+/* Count a message against the last index point, capture times may go back. */
+static void index_count(my_bpftimeval ts) {
+    struct cds_index_point* point = &index_points[index_num - 1];
+
+    if (!point->messages || index_before(ts, point->earliest)) {
+        point->earliest = ts;
+    }
+    if (!point->messages || index_before(point->latest, ts)) {
+        point->latest = ts;
+    }
+    point->messages++;
+}
+
+/* Make the offsets of the points added since the last rebase relative to base. */
+static void index_rebase(uint64_t base) {
+    for (; index_rebased < index_num; index_rebased++) {
+        index_points[index_rebased].offset += base;
+    }
+}
+
+/*
+ * Write the index element followed by the footer, the footer always
+ * encodes the offset of the index element in 8 bytes so it can be found
+ * at a fixed distance from the end of the file.
+ */
+static int index_write(FILE* fp) {
+    CborEncoder cbor, control, points, point;
+    CborError cbor_err;
+    uint8_t footer[CDS_INDEX_FOOTER_SIZE];
+    uint8_t* buf;
+    size_t size, n;
+    int i;
+
+    size = 16 + index_num * 64;
+    if (!(buf = malloc(size))) {
+        return DUMP_CDS_ENOMEM;
+    }
+    cbor_encoder_init(&cbor, buf, size, 0);
+    cbor_err = cbor_encoder_create_array(&cbor, &control, 2);
+    if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&control, CDS_CONTROL_INDEX);
+    if (cbor_err == CborNoError) cbor_err = cbor_encoder_create_array(&control, &points, index_num);
+    for (n = 0; n < index_num; n++) {
+        if (cbor_err == CborNoError) cbor_err = cbor_encoder_create_array(&points, &point, 6);
+        if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&point, index_points[n].offset);
+        if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&point, index_points[n].earliest.tv_sec);
+        if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&point, index_points[n].earliest.tv_usec);
+        if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&point, index_points[n].latest.tv_sec);
+        if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&point, index_points[n].latest.tv_usec);
+        if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&point, index_points[n].messages);
+        if (cbor_err == CborNoError) cbor_err = cbor_encoder_close_container_checked(&points, &point);
+    }
+    if (cbor_err == CborNoError) cbor_err = cbor_encoder_close_container_checked(&control, &points);
+    if (cbor_err == CborNoError) cbor_err = cbor_encoder_close_container_checked(&cbor, &control);
+    if (cbor_err != CborNoError) {
+        fprintf(stderr, "cbor error[%d]: %s\n", cbor_err, cbor_error_string(cbor_err));
+        free(buf);
+        return DUMP_CDS_ECBOR;
+    }
+
+    footer[0] = 0x82;
+    footer[1] = CDS_CONTROL_INDEX_FOOTER;
+    footer[2] = 0x1b;
+    for (i = 0; i < 8; i++) {
+        footer[3 + i] = (uint8_t)(index_file_bytes >> (56 - i * 8));
+    }
+
+    if (fwrite(buf, cbor_encoder_get_buffer_size(&cbor, buf), 1, fp) != 1
+        || fwrite(footer, sizeof(footer), 1, fp) != 1)
+    {
+        free(buf);
+        return DUMP_CDS_EWRITE;
+    }
+    free(buf);
+
+    return DUMP_CDS_OK;
 }
 
-int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *pkt_copy, size_t olen, const u_char *payload, size_t payloadlen) {
+static int cds_encode(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen, const slim_t *slim) {
     CborEncoder cbor, message;
     CborError cbor_err = CborNoError;
     ip_header_t ip;
@@ -1335,29 +2080,23 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
             return DUMP_CDS_ENOMEM;
         }
     }
-    if (cbor_flushed) {
-        dns_rlabel_t* rlabel;
-        struct rdata* r;
-
-        cbor_buf_p = cbor_buf;
-        while ((rlabel = last.dns_rlabel)) {
-            last.dns_rlabel = rlabel->next;
-            free(rlabel);
-        }
-        while ((r = last.rdata)) {
-            last.rdata = r->next;
-            rdata_free(r);
+    if (cbor_flushed || cbor_restart) {
+        if (cbor_flushed) {
+            cbor_buf_p = cbor_buf;
         }
+        mru_reset(&rlabel_mru);
+        mru_reset(&rdata_mru);
+        rdata_reset();
         memset(&last, 0, sizeof(last));
-        if (rdata_tbl) {
-            hash_free(rdata_tbl);
-            rdata_tbl = 0;
+        if (dict && dict_seed() != DUMP_CDS_OK) {
+            return DUMP_CDS_ENOMEM;
         }
 
         cbor_encoder_init(&cbor, message_buf, message_size, 0);
         cbor_err = cbor_encoder_create_array(&cbor, &message, 5
-            + ( use_rdata_index ? 3 : 0 )
+            + ( use_rdata_index ? 3 + ( RDATA_INDEX_SIZE ? 2 : 0 ) : 0 )
             + ( use_rdata_rindex ? 4 : 0 )
+            + ( dict ? 2 : 0 )
         );
         if (cbor_err == CborNoError) cbor_err = cbor_encode_text_stringz(&message, "CDSv1");
         if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, CDS_OPTION_RLABELS);
@@ -1368,6 +2107,10 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
             if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, CDS_OPTION_USE_RDATA_INDEX);
             if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, CDS_OPTION_RDATA_INDEX_MIN_SIZE);
             if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, RDATA_INDEX_MIN_SIZE);
+            if (RDATA_INDEX_SIZE) {
+                if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, CDS_OPTION_RDATA_INDEX_SIZE);
+                if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, RDATA_INDEX_SIZE);
+            }
         }
         else if (use_rdata_rindex) {
             if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, CDS_OPTION_RDATA_RINDEX_SIZE);
@@ -1375,6 +2118,10 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
             if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, CDS_OPTION_RDATA_RINDEX_MIN_SIZE);
             if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, RDATA_RINDEX_MIN_SIZE);
         }
+        if (dict) {
+            if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, CDS_OPTION_DICTIONARY);
+            if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, cds_dict_hash(dict));
+        }
         if (cbor_err == CborNoError) cbor_err = cbor_encoder_close_container_checked(&cbor, &message);
         if (cbor_err != CborNoError) {
             fprintf(stderr, "cbor error[%d]: %s\n", cbor_err, cbor_error_string(cbor_err));
@@ -1384,17 +2131,19 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
 /*        *cbor_buf_p = 0x9f;*/
 /*        cbor_buf_p++;*/
 
-        if ((cbor_size - (cbor_buf_p - cbor_buf)) < cbor_encoder_get_buffer_size(&cbor, message_buf)) {
+        if (((cbor_size+message_size) - (cbor_buf_p - cbor_buf)) < cbor_encoder_get_buffer_size(&cbor, message_buf)) {
             return DUMP_CDS_EBUF;
         }
+        if (use_index && index_add(cbor_buf_p - cbor_buf) != DUMP_CDS_OK) {
+            return DUMP_CDS_ENOMEM;
+        }
         memcpy(cbor_buf_p, message_buf, cbor_encoder_get_buffer_size(&cbor, message_buf));
         cbor_buf_p += cbor_encoder_get_buffer_size(&cbor, message_buf);
 
         cbor_flushed = 0;
+        cbor_restart = 0;
     }
-    if (!rdata_tbl) {
-        rdata_tbl = hash_create(64*1024, (hashfunc*)rdata_hash, (hashkeycmp*)rdata_cmp, (hashfree*)rdata_free);
-    }
+    rdata_message++;
 
     /*
      * IP Header
@@ -1542,20 +2291,17 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
      * DNS Message
      */
 
+    memset(&dns, 0, sizeof(dns));
     if ( flags & DNSCAP_OUTPUT_ISDNS ) {
         uint8_t * p = (uint8_t*)payload;
         size_t l = payloadlen, rr, n, n2, n3;
         int ret;
         dns_rr_t* rrp;
 
-        size_t n_offset = 0;
-        uint16_t offset[256]; /* TODO: Handle offsets better */
-
-        memset(&dns, 0, sizeof(dns));
         ret = parse_dns(&dns, &p, &l);
 
         if (ret < 0) {
-            free_dns(&dns);
+            parse_reset();
             return DUMP_CDS_ENOMEM;
         }
         else if (ret > 0) {
@@ -1563,6 +2309,16 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
             malformed_size = l;
         }
 
+        /* a slimmed response is stored with the counts of the original */
+        if (slim && dns.header_is_complete) {
+            dns.ancount = slim->counts[0];
+            dns.nscount = slim->counts[1];
+            dns.arcount = slim->counts[2];
+        }
+        else {
+            slim = 0;
+        }
+
         if ( dns.have_qdcount && dns.qdcount == dns.questions ) {
             dns.have_qdcount = 0;
         }
@@ -1593,19 +2349,10 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
         }
 
 
-        dns_rr_build_offset(dns.question, dns.questions, &offset[0], sizeof(offset), &n_offset, payload);
-        dns_rr_build_offset(dns.answer, dns.answers, &offset[0], sizeof(offset), &n_offset, payload);
-        dns_rr_build_offset(dns.authority, dns.authorities, &offset[0], sizeof(offset), &n_offset, payload);
-        dns_rr_build_offset(dns.additional, dns.additionals, &offset[0], sizeof(offset), &n_offset, payload);
-
-/*        for (n = 0; n < n_offset; n++) {*/
-/*            printf("%lu: %u\n", n, offset[n]);*/
-/*        }*/
-
-        dns_rr_set_offset(dns.question, dns.questions, &offset[0], n_offset);
-        dns_rr_set_offset(dns.answer, dns.answers, &offset[0], n_offset);
-        dns_rr_set_offset(dns.authority, dns.authorities, &offset[0], n_offset);
-        dns_rr_set_offset(dns.additional, dns.additionals, &offset[0], n_offset);
+        dns_rr_set_offset(dns.question, dns.questions);
+        dns_rr_set_offset(dns.answer, dns.answers);
+        dns_rr_set_offset(dns.authority, dns.authorities);
+        dns_rr_set_offset(dns.additional, dns.additionals);
 
         dns_rr_build_rlabel(dns.question, dns.questions);
         dns_rr_build_rlabel(dns.answer, dns.answers);
@@ -1630,6 +2377,7 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
         + dns.have_cnt_bits + dns.have_qdcount + dns.have_ancount + dns.have_nscount + dns.have_arcount
         + dns.have_rr_bits + dns.have_questions + dns.have_answers + dns.have_authorities + dns.have_additionals
         + ( malformed ? 1 : 0 )
+        + ( slim ? 1 : 0 )
         );
 
     /*
@@ -1664,6 +2412,7 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
                 : 0 )
             + ( flags & DNSCAP_OUTPUT_ISFRAG ? 1<<2 : 0 )
             + ( malformed ? 1<<3 : 0 )
+            + ( slim ? 1<<4 : 0 )
         );
 
     /*
@@ -1681,7 +2430,7 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
         if (ip.have_src_addr && cbor_err == CborNoError) cbor_err = cbor_encode_byte_string(&message, (uint8_t*)&(ip.src_addr6), sizeof(struct in6_addr));
         if (ip.have_dest_addr && cbor_err == CborNoError) cbor_err = cbor_encode_byte_string(&message, (uint8_t*)&(ip.dest_addr6), sizeof(struct in6_addr));
         if (ip.have_src_port && ip.have_dest_port) {
-            if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, (ip.dest_port6 << 16) | ip.src_port6);
+            if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, ((uint32_t)ip.dest_port6 << 16) | ip.src_port6);
         } else if (ip.have_src_port) {
             if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, ip.src_port6);
         } else if (ip.have_dest_port) {
@@ -1692,7 +2441,7 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
         if (ip.have_src_addr && cbor_err == CborNoError) cbor_err = cbor_encode_byte_string(&message, (uint8_t*)&(ip.src_addr4), sizeof(struct in_addr));
         if (ip.have_dest_addr && cbor_err == CborNoError) cbor_err = cbor_encode_byte_string(&message, (uint8_t*)&(ip.dest_addr4), sizeof(struct in_addr));
         if (ip.have_src_port && ip.have_dest_port) {
-            if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, (ip.dest_port4 << 16) | ip.src_port4);
+            if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, ((uint32_t)ip.dest_port4 << 16) | ip.src_port4);
         } else if (ip.have_src_port) {
             if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, ip.src_port4);
         } else if (ip.have_dest_port) {
@@ -1769,11 +2518,17 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
 
     if (malformed && cbor_err == CborNoError) cbor_err = cbor_encode_byte_string(&message, (uint8_t*)malformed, malformed_size);
 
+    /*
+     * Encode the length of the original message if slimmed
+     */
+
+    if (slim && cbor_err == CborNoError) cbor_err = cbor_encode_uint(&message, slim->payloadlen);
+
     /*
      * Close
      */
 
-    free_dns(&dns);
+    parse_reset();
 
     if (cbor_err == CborNoError) cbor_err = cbor_encoder_close_container_checked(&cbor, &message);
     if (cbor_err != CborNoError) {
@@ -1792,11 +2547,47 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
 /*        printf("\n");*/
 /*    }*/
 
+    /*
+     * Announce evicted rdata index entries before the message they were evicted for
+     */
+
+    if (rdata_evicted_num) {
+        CborEncoder control_cbor, control, evicted;
+        size_t n;
+
+        cbor_encoder_init(&control_cbor, cbor_buf_p, (cbor_size+message_size) - (cbor_buf_p - cbor_buf), 0);
+        cbor_err = cbor_encoder_create_array(&control_cbor, &control, 2);
+        if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&control, CDS_CONTROL_RDATA_INDEX_EVICT);
+        if (cbor_err == CborNoError) cbor_err = cbor_encoder_create_array(&control, &evicted, rdata_evicted_num);
+        for (n = 0; n < rdata_evicted_num; n++) {
+            if (cbor_err == CborNoError) cbor_err = cbor_encode_uint(&evicted, rdata_evicted[n]);
+        }
+        if (cbor_err == CborNoError) cbor_err = cbor_encoder_close_container_checked(&control, &evicted);
+        if (cbor_err == CborNoError) cbor_err = cbor_encoder_close_container_checked(&control_cbor, &control);
+        if (cbor_err == CborErrorOutOfMemory) {
+            return DUMP_CDS_EBUF;
+        }
+        if (cbor_err != CborNoError) {
+            fprintf(stderr, "cbor error[%d]: %s\n", cbor_err, cbor_error_string(cbor_err));
+            return DUMP_CDS_ECBOR;
+        }
+        cbor_buf_p += cbor_encoder_get_buffer_size(&control_cbor, cbor_buf_p);
+        for (n = 0; n < rdata_evicted_num; n++) {
+            if (rdata_reuse_push(rdata_evicted[n])) {
+                return DUMP_CDS_ENOMEM;
+            }
+        }
+        rdata_evicted_num = 0;
+    }
+
     if (((cbor_size+message_size) - (cbor_buf_p - cbor_buf)) < cbor_encoder_get_buffer_size(&cbor, message_buf)) {
         return DUMP_CDS_EBUF;
     }
     memcpy(cbor_buf_p, message_buf, cbor_encoder_get_buffer_size(&cbor, message_buf));
     cbor_buf_p += cbor_encoder_get_buffer_size(&cbor, message_buf);
+    if (use_index && index_num) {
+        index_count(ts);
+    }
 
     if (cbor_buf_p < (cbor_buf + cbor_size)) {
         return DUMP_CDS_OK;
@@ -1806,6 +2597,364 @@ int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned spo
     return DUMP_CDS_FLUSH;
 }
 
+/*
+ * Count the message against the current segment, returns 1 if it starts
+ * a new segment.
+ */
+static int segment_next(my_bpftimeval ts) {
+    if ((segment_messages && segment_count >= segment_messages)
+        || (segment_seconds && segment_count && (long)ts.tv_sec - segment_start >= (long)segment_seconds))
+    {
+        segment_count = 0;
+    }
+    if (!segment_count++) {
+        segment_start = ts.tv_sec;
+        return 1;
+    }
+    return 0;
+}
+
+/* Free the encoder state of the calling thread. */
+static void cds_tls_free(void) {
+    struct parse_arena* arena;
+
+    free(cbor_buf);
+    cbor_buf = 0;
+    cbor_buf_p = 0;
+    cbor_flushed = 1;
+    free(message_buf);
+    message_buf = 0;
+    free(index_points);
+    index_points = 0;
+    index_num = 0;
+    index_size = 0;
+    while ((arena = parse_arena)) {
+        parse_arena = arena->next;
+        free(arena);
+    }
+    parse_arena_p = 0;
+    mru_reset(&rlabel_mru);
+    mru_reset(&rdata_mru);
+    rdata_reset();
+}
+
+#if HAVE_PTHREAD
+static int pool_append(uint8_t** buf, size_t* len, size_t* size, const uint8_t* data, size_t data_len) {
+    if (*len + data_len > *size) {
+        size_t new_size = *size ? *size : 64 * 1024;
+        uint8_t* p;
+
+        while (new_size < *len + data_len) {
+            new_size *= 2;
+        }
+        if (!(p = realloc(*buf, new_size))) {
+            return DUMP_CDS_ENOMEM;
+        }
+        *buf = p;
+        *size = new_size;
+    }
+    memcpy(*buf + *len, data, data_len);
+    *len += data_len;
+
+    return DUMP_CDS_OK;
+}
+
+/*
+ * Encode all messages of a segment as a stream of its own, if the buffer
+ * fills up a new stream is started within the segment.
+ */
+static void pool_encode(struct cds_segment* segment) {
+    const uint8_t* p = segment->in;
+    const uint8_t* end = segment->in + segment->in_len;
+    struct cds_record record;
+    int ret = DUMP_CDS_OK;
+
+    segment->out_len = 0;
+    segment->index_len = 0;
+    cbor_buf_p = cbor_buf;
+    cbor_restart = 1;
+    while (p < end) {
+        memcpy(&record, p, sizeof(record));
+        ret = cds_encode(record.from, record.to, record.proto, record.flags, record.sport, record.dport, record.ts, p + sizeof(record), record.payloadlen, record.is_slim ? &record.slim : 0);
+        if (ret == DUMP_CDS_FLUSH) {
+            ret = DUMP_CDS_OK;
+        }
+        else if (ret != DUMP_CDS_OK) {
+            break;
+        }
+        if (cbor_flushed || p + CDS_RECORD_SIZE(record.payloadlen) >= end) {
+            index_rebase(segment->out_len);
+            if ((ret = pool_append(&(segment->out), &(segment->out_len), &(segment->out_size), cbor_buf, cbor_buf_p - cbor_buf)) != DUMP_CDS_OK) {
+                break;
+            }
+            cbor_buf_p = cbor_buf;
+        }
+        p += CDS_RECORD_SIZE(record.payloadlen);
+    }
+    if (ret == DUMP_CDS_OK && index_num) {
+        ret = pool_append(&(segment->index), &(segment->index_len), &(segment->index_size), (uint8_t*)index_points, index_num * sizeof(*index_points));
+    }
+    index_num = 0;
+    index_rebased = 0;
+    segment->ret = ret;
+}
+
+static void* pool_worker(void* arg) {
+    struct cds_segment* segment;
+    cds_rdata_index_stats_t stats;
+
+    pthread_mutex_lock(&pool_lock);
+    while (1) {
+        while (!pool_next && !pool_stop) {
+            pthread_cond_wait(&pool_cond, &pool_lock);
+        }
+        if (!pool_next) {
+            break;
+        }
+        segment = pool_next;
+        pool_next = segment->next;
+        pthread_mutex_unlock(&pool_lock);
+
+        stats = rdata_stats;
+        pool_encode(segment);
+
+        pthread_mutex_lock(&pool_lock);
+        pool_stats.lookups += rdata_stats.lookups - stats.lookups;
+        pool_stats.hits += rdata_stats.hits - stats.hits;
+        pool_stats.evictions += rdata_stats.evictions - stats.evictions;
+        if (rdata_stats.entries > pool_stats.entries) {
+            pool_stats.entries = rdata_stats.entries;
+        }
+        if (rdata_memory() > pool_stats.memory) {
+            pool_stats.memory = rdata_memory();
+        }
+        segment->done = 1;
+        pool_pending--;
+        pthread_cond_broadcast(&pool_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    cds_tls_free();
+
+    return 0;
+}
+
+static void pool_segments_free(struct cds_segment* segment) {
+    struct cds_segment* next;
+
+    for (; segment; segment = next) {
+        next = segment->next;
+        free(segment->in);
+        free(segment->out);
+        free(segment->index);
+        free(segment);
+    }
+}
+
+/* Hand the segment being filled to the workers. */
+static int pool_submit(void) {
+    struct cds_segment* segment = pool_fill;
+    int err;
+
+    pool_fill = 0;
+    if (!segment) {
+        return DUMP_CDS_OK;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if (!pool_threads) {
+        if (!(pool_threads = calloc(pool_workers, sizeof(*pool_threads)))) {
+            pthread_mutex_unlock(&pool_lock);
+            return DUMP_CDS_ENOMEM;
+        }
+    }
+    /* started here so the threads inherit the blocked signals */
+    while (pool_started < pool_workers) {
+        if ((err = pthread_create(&pool_threads[pool_started], 0, pool_worker, 0))) {
+            fprintf(stderr, "cds pthread_create: %s\n", strerror(err));
+            pthread_mutex_unlock(&pool_lock);
+            return DUMP_CDS_ENOMEM;
+        }
+        pool_started++;
+    }
+    while (pool_pending >= pool_workers * 2) {
+        pthread_cond_wait(&pool_cond, &pool_lock);
+    }
+    segment->next = 0;
+    segment->done = 0;
+    if (pool_tail) {
+        pool_tail->next = segment;
+    }
+    else {
+        pool_head = segment;
+    }
+    pool_tail = segment;
+    if (!pool_next) {
+        pool_next = segment;
+    }
+    pool_pending++;
+    pool_flushed = 0;
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+
+    return DUMP_CDS_OK;
+}
+
+static int pool_output(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen, const slim_t *slim) {
+    static const uint8_t pad[8] = { 0 };
+    struct cds_record record;
+    struct cds_segment* segment;
+    size_t n;
+    int ret;
+
+    if (segment_next(ts) && (ret = pool_submit()) != DUMP_CDS_OK) {
+        return ret;
+    }
+    if (!pool_fill) {
+        if ((pool_fill = pool_free)) {
+            pool_free = pool_fill->next;
+        }
+        else if (!(pool_fill = calloc(1, sizeof(*pool_fill)))) {
+            return DUMP_CDS_ENOMEM;
+        }
+        pool_fill->in_len = 0;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.from = from;
+    record.to = to;
+    record.ts = ts;
+    record.flags = flags;
+    record.sport = sport;
+    record.dport = dport;
+    record.payloadlen = payloadlen;
+    record.proto = proto;
+    if (slim) {
+        record.is_slim = 1;
+        record.slim = *slim;
+    }
+    /* records are padded so the next one is aligned, see CDS_RECORD_SIZE() */
+    if ((ret = pool_append(&(pool_fill->in), &(pool_fill->in_len), &(pool_fill->in_size), (uint8_t*)&record, sizeof(record))) != DUMP_CDS_OK
+        || (ret = pool_append(&(pool_fill->in), &(pool_fill->in_len), &(pool_fill->in_size), payload, payloadlen)) != DUMP_CDS_OK
+        || (ret = pool_append(&(pool_fill->in), &(pool_fill->in_len), &(pool_fill->in_size), pad, CDS_RECORD_SIZE(payloadlen) - sizeof(record) - payloadlen)) != DUMP_CDS_OK)
+    {
+        return ret;
+    }
+
+    /* count the encoded segments that are ready to be written in order */
+    pthread_mutex_lock(&pool_lock);
+    for (segment = pool_head, n = 0; segment && segment->done && pool_ready_bytes < cbor_size; segment = segment->next, n++) {
+        if (segment->ret != DUMP_CDS_OK) {
+            pthread_mutex_unlock(&pool_lock);
+            return segment->ret;
+        }
+        if (n >= pool_ready) {
+            pool_ready++;
+            pool_ready_bytes += segment->out_len;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    /* flush at most once per segment so each file is named after a later message */
+    if (pool_ready_bytes < cbor_size || pool_flushed) {
+        return DUMP_CDS_OK;
+    }
+
+    pool_flush = 1;
+    pool_flushed = 1;
+    return DUMP_CDS_FLUSH;
+}
+
+/* Add the index points of a segment written at the current file offset. */
+static int pool_index(const struct cds_segment* segment) {
+    const struct cds_index_point* point = (const struct cds_index_point*)segment->index;
+    size_t n;
+
+    for (n = segment->index_len / sizeof(*point); n--; point++) {
+        if (index_add(point->offset) != DUMP_CDS_OK) {
+            return DUMP_CDS_ENOMEM;
+        }
+        index_points[index_num - 1] = *point;
+    }
+    index_rebase(index_file_bytes);
+    index_file_bytes += segment->out_len;
+
+    return DUMP_CDS_OK;
+}
+
+/*
+ * Write the ready segments after a flush, otherwise cut the segment being
+ * filled and write everything once encoded.
+ */
+static int pool_dump(FILE * fp) {
+    struct cds_segment* segment;
+    size_t n;
+    int ret = DUMP_CDS_OK;
+
+    pthread_mutex_lock(&pool_lock);
+    if (pool_flush) {
+        n = pool_ready;
+    }
+    else {
+        pthread_mutex_unlock(&pool_lock);
+        if ((ret = pool_submit()) != DUMP_CDS_OK) {
+            return ret;
+        }
+        segment_count = 0;
+        pthread_mutex_lock(&pool_lock);
+        while (pool_pending) {
+            pthread_cond_wait(&pool_cond, &pool_lock);
+        }
+        n = (size_t)-1;
+    }
+    while (n-- && (segment = pool_head) && segment->done) {
+        if (!(pool_head = segment->next)) {
+            pool_tail = 0;
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        if (ret == DUMP_CDS_OK) {
+            if (segment->ret != DUMP_CDS_OK) {
+                ret = segment->ret;
+            }
+            else if (segment->out_len && fwrite(segment->out, segment->out_len, 1, fp) != 1) {
+                ret = DUMP_CDS_EWRITE;
+            }
+            else if (use_index) {
+                ret = pool_index(segment);
+            }
+        }
+        segment->next = pool_free;
+        pool_free = segment;
+
+        pthread_mutex_lock(&pool_lock);
+    }
+    pool_ready = 0;
+    pool_ready_bytes = 0;
+    pool_flush = 0;
+    pthread_mutex_unlock(&pool_lock);
+
+    return ret;
+}
+#endif
+
+int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *pkt_copy, size_t olen, const u_char *payload, size_t payloadlen, const slim_t *slim) {
+    /* TCP segments without data such as SYN and FIN have nothing to store */
+    if (!payload || !payloadlen) {
+        return DUMP_CDS_OK;
+    }
+
+#if HAVE_PTHREAD
+    if (pool_workers) {
+        return pool_output(from, to, proto, flags, sport, dport, ts, payload, payloadlen, slim);
+    }
+#endif
+
+    if (segment_next(ts)) {
+        cbor_restart = 1;
+    }
+    return cds_encode(from, to, proto, flags, sport, dport, ts, payload, payloadlen, slim);
+}
+
 int dump_cds(FILE * fp) {
     CborError cbor_err;
 
@@ -1813,18 +2962,93 @@ int dump_cds(FILE * fp) {
         return DUMP_CDS_EINVAL;
     }
 
+#if HAVE_PTHREAD
+    if (pool_workers) {
+        return pool_dump(fp);
+    }
+#endif
+
 /*    *cbor_buf_p = 0xff;*/
 /*    cbor_buf_p++;*/
 
 /*    fprintf(stderr, "cds output: %lu bytes\n", cbor_buf_p - cbor_buf);*/
 
-    if (fwrite(cbor_buf, cbor_buf_p - cbor_buf, 1, fp) != 1) {
+    if (cbor_buf_p > cbor_buf
+        && fwrite(cbor_buf, cbor_buf_p - cbor_buf, 1, fp) != 1)
+    {
         return DUMP_CDS_EWRITE;
     }
+    index_rebase(index_file_bytes);
+    index_file_bytes += cbor_buf_p - cbor_buf;
+
+    /* the next file starts a new stream with its own header and indexes */
+    cbor_buf_p = cbor_buf;
+    cbor_flushed = 1;
+    segment_count = 0;
 
     return DUMP_CDS_OK;
 }
 
+/*
+ * Write what is left and end the file, with the file index this writes
+ * the index and the footer.
+ */
+int dump_cds_close(FILE * fp) {
+    int ret;
+
+    if ((ret = dump_cds(fp)) != DUMP_CDS_OK) {
+        return ret;
+    }
+    if (use_index && index_num) {
+        ret = index_write(fp);
+    }
+    index_num = 0;
+    index_rebased = 0;
+    index_file_bytes = 0;
+
+    return ret;
+}
+
+/*
+ * Stop and join the workers and free everything the encoder holds, each
+ * worker frees its own thread-local state before it ends.
+ */
+void cds_free() {
+#if HAVE_PTHREAD
+    size_t n;
+
+    if (pool_started) {
+        pthread_mutex_lock(&pool_lock);
+        pool_stop = 1;
+        pthread_cond_broadcast(&pool_cond);
+        pthread_mutex_unlock(&pool_lock);
+        for (n = 0; n < pool_started; n++) {
+            pthread_join(pool_threads[n], 0);
+        }
+    }
+    free(pool_threads);
+    pool_threads = 0;
+    pool_started = 0;
+    pool_stop = 0;
+    pool_segments_free(pool_head);
+    pool_head = pool_tail = pool_next = 0;
+    pool_segments_free(pool_free);
+    pool_free = 0;
+    pool_segments_free(pool_fill);
+    pool_fill = 0;
+    pool_pending = pool_ready = pool_ready_bytes = 0;
+#endif
+    cds_tls_free();
+    free(dict_keys);
+    dict_keys = 0;
+    free(dict_key_data);
+    dict_key_data = 0;
+    if (dict) {
+        cds_dict_free(dict);
+        dict = 0;
+    }
+}
+
 int have_cds_support() {
     return 1;
 }
@@ -1867,7 +3091,31 @@ int cds_set_rdata_rindex_size(size_t size) {
     return DUMP_CDS_ENOSUP;
 }
 
-int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *pkt_copy, size_t olen, const u_char *payload, size_t payloadlen) {
+int cds_set_rdata_index_size(size_t size) {
+    return DUMP_CDS_ENOSUP;
+}
+
+int cds_set_segment(size_t messages, unsigned seconds) {
+    return DUMP_CDS_ENOSUP;
+}
+
+int cds_set_workers(size_t workers) {
+    return DUMP_CDS_ENOSUP;
+}
+
+int cds_set_index(int use) {
+    return DUMP_CDS_ENOSUP;
+}
+
+int cds_set_dictionary(const char* file) {
+    return DUMP_CDS_ENOSUP;
+}
+
+int cds_get_rdata_index_stats(cds_rdata_index_stats_t* stats) {
+    return DUMP_CDS_ENOSUP;
+}
+
+int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *pkt_copy, size_t olen, const u_char *payload, size_t payloadlen, const slim_t *slim) {
     return DUMP_CDS_ENOSUP;
 }
 
@@ -1875,6 +3123,13 @@ int dump_cds() {
     return DUMP_CDS_ENOSUP;
 }
 
+int dump_cds_close() {
+    return DUMP_CDS_ENOSUP;
+}
+
+void cds_free() {
+}
+
 int have_cds_support() {
     return 0;
 }
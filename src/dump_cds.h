@@ -57,6 +57,14 @@
 #define CDS_OPTION_RDATA_RINDEX_MIN_SIZE    3
 #define CDS_OPTION_USE_RDATA_INDEX          4
 #define CDS_OPTION_RDATA_INDEX_MIN_SIZE     5
+#define CDS_OPTION_RDATA_INDEX_SIZE         6
+#define CDS_OPTION_DICTIONARY               7
+
+#define CDS_CONTROL_RDATA_INDEX_EVICT       0
+#define CDS_CONTROL_INDEX                   1
+#define CDS_CONTROL_INDEX_FOOTER            2
+
+#define CDS_INDEX_FOOTER_SIZE               11
 
 #define CDS_DEFAULT_MAX_RLABELS             255
 #define CDS_DEFAULT_MIN_RLABEL_SIZE         3
@@ -101,28 +109,6 @@ struct dns_label {
     size_t          n_offset;
 };
 
-#define CDS_RLABEL_LABEL_T_LABEL 64
-
-typedef struct dns_rlabel_label dns_rlabel_label_t;
-struct dns_rlabel_label {
-    unsigned short have_n_offset : 1;
-
-    uint8_t         size;
-    uint8_t         label[CDS_RLABEL_LABEL_T_LABEL];
-    size_t          n_offset;
-};
-
-#define CDS_RLABEL_T_LABELS 256
-
-typedef struct dns_rlabel dns_rlabel_t;
-struct dns_rlabel {
-    dns_rlabel_t*       next;
-    dns_rlabel_t*       prev;
-
-    uint8_t             labels;
-    dns_rlabel_label_t  label[CDS_RLABEL_T_LABELS];
-};
-
 typedef struct dns_rdata dns_rdata_t;
 struct dns_rdata {
     unsigned short is_complete : 1;
@@ -210,8 +196,26 @@ int cds_set_use_rdata_rindex(int use);
 int cds_set_rdata_index_min_size(size_t size);
 int cds_set_rdata_rindex_min_size(size_t size);
 int cds_set_rdata_rindex_size(size_t size);
-int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *pkt_copy, size_t olen, const u_char *payload, size_t payloadlen);
+int cds_set_rdata_index_size(size_t size);
+int cds_set_segment(size_t messages, unsigned seconds);
+int cds_set_workers(size_t workers);
+int cds_set_index(int use);
+int cds_set_dictionary(const char* file);
+
+typedef struct cds_rdata_index_stats cds_rdata_index_stats_t;
+struct cds_rdata_index_stats {
+    size_t  entries;
+    size_t  memory;
+    size_t  lookups;
+    size_t  hits;
+    size_t  evictions;
+};
+
+int cds_get_rdata_index_stats(cds_rdata_index_stats_t* stats);
+int output_cds(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *pkt_copy, size_t olen, const u_char *payload, size_t payloadlen, const slim_t *slim);
 int dump_cds();
+int dump_cds_close();
+void cds_free();
 int have_cds_support();
 
 #endif /* __dnscap_dump_cds_h */
@@ -0,0 +1,551 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "dump_dnstap.h"
+#include "dnscap.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * dnstap (http://dnstap.info) in Frame Streams, one Dnstap protobuf message
+ * per DNS message.
+ *
+ * The frames are encoded into a static buffer, a data frame is the 32 bit
+ * big endian length of the protobuf message followed by it. The protobuf
+ * is written in place, the length of the embedded Message is worked out
+ * before it is written so nothing is allocated per message.
+ *
+ * Written to a file the frames are put between a START and a STOP control
+ * frame and every output file is a stream of its own. Written to a Unix
+ * socket the bidirectional handshake is done first, READY is sent and
+ * ACCEPT read back before START, and STOP is answered by FINISH. If the
+ * connection is lost the frames are dropped until it can be made again,
+ * which is tried at most every DNSTAP_RECONNECT_SECONDS.
+ */
+
+#define DNSTAP_CONTENT_TYPE "protobuf:dnstap.Dnstap"
+#define DNSTAP_VERSION "dnscap " PACKAGE_VERSION
+
+/* Frame Streams control frame types and fields */
+#define FSTRM_CONTROL_ACCEPT        1
+#define FSTRM_CONTROL_START         2
+#define FSTRM_CONTROL_STOP          3
+#define FSTRM_CONTROL_READY         4
+#define FSTRM_CONTROL_FINISH        5
+#define FSTRM_FIELD_CONTENT_TYPE    1
+
+/* the largest control frame accepted from the reader */
+#define FSTRM_CONTROL_MAX 512
+
+/* protobuf wire types */
+#define PB_VARINT   0
+#define PB_BYTES    2
+#define PB_FIXED32  5
+
+#define PB_TAG(field, type) ((field) << 3 | (type))
+
+/* SocketFamily and SocketProtocol */
+#define DNSTAP_INET     1
+#define DNSTAP_INET6    2
+#define DNSTAP_UDP      1
+#define DNSTAP_TCP      2
+
+/* Dnstap.Type MESSAGE */
+#define DNSTAP_MESSAGE 1
+
+#define DNSTAP_BUF_SIZE (256 * 1024)
+
+/* room for the largest frame, a 64k DNS message and the other fields */
+#define DNSTAP_FRAME_MAX (65536 + 1024)
+
+#define DNSTAP_IDENTITY_MAX 255
+#define DNSTAP_HANDSHAKE_TIMEOUT 5000
+#define DNSTAP_RECONNECT_SECONDS 1
+
+#ifdef MSG_NOSIGNAL
+#define DNSTAP_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define DNSTAP_SEND_FLAGS 0
+#endif
+
+static u_char dnstap_buf[DNSTAP_BUF_SIZE];
+static size_t dnstap_buf_used = 0, dnstap_buf_frames = 0;
+static time_t dnstap_buf_first = 0;
+static int dnstap_started = 0;
+
+static int dnstap_type = DNSTAP_DEFAULT_TYPE;
+static char dnstap_identity[DNSTAP_IDENTITY_MAX + 1];
+static size_t dnstap_identity_len = 0;
+
+static struct sockaddr_un dnstap_addr;
+static int have_socket = 0;
+static int dnstap_fd = -1;
+static time_t dnstap_reconnect = 0;
+static unsigned long dnstap_dropped = 0;
+
+int dnstap_set_type(int type) {
+    switch (type) {
+    case DNSTAP_TYPE_AUTH:
+    case DNSTAP_TYPE_RESOLVER:
+    case DNSTAP_TYPE_CLIENT:
+    case DNSTAP_TYPE_FORWARDER:
+    case DNSTAP_TYPE_STUB:
+    case DNSTAP_TYPE_TOOL:
+        dnstap_type = type;
+        return DUMP_DNSTAP_OK;
+    }
+
+    return DUMP_DNSTAP_EINVAL;
+}
+
+int dnstap_set_identity(const char * identity) {
+    size_t length;
+
+    if (!identity || (length = strlen(identity)) > DNSTAP_IDENTITY_MAX) {
+        return DUMP_DNSTAP_EINVAL;
+    }
+
+    memcpy(dnstap_identity, identity, length);
+    dnstap_identity_len = length;
+
+    return DUMP_DNSTAP_OK;
+}
+
+int dnstap_set_socket(const char * path) {
+    if (!path || !*path || strlen(path) >= sizeof(dnstap_addr.sun_path)) {
+        return DUMP_DNSTAP_EINVAL;
+    }
+
+    memset(&dnstap_addr, 0, sizeof(dnstap_addr));
+    dnstap_addr.sun_family = AF_UNIX;
+    strcpy(dnstap_addr.sun_path, path);
+    have_socket = 1;
+
+    return DUMP_DNSTAP_OK;
+}
+
+static void dnstap_be32(u_char *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static size_t pb_varint_size(uint64_t v) {
+    size_t n = 1;
+
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static u_char *pb_varint(u_char *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static size_t pb_bytes_size(size_t length) {
+    return 1 + pb_varint_size(length) + length;
+}
+
+static u_char *pb_bytes(u_char *p, unsigned field, const void *data, size_t length) {
+    *p++ = PB_TAG(field, PB_BYTES);
+    p = pb_varint(p, length);
+    memcpy(p, data, length);
+    return p + length;
+}
+
+/* Write a control frame, START and READY carry the content type */
+static size_t fstrm_control(u_char *p, unsigned type) {
+    size_t length = 4;
+
+    if (type == FSTRM_CONTROL_START || type == FSTRM_CONTROL_READY) {
+        dnstap_be32(p + 12, FSTRM_FIELD_CONTENT_TYPE);
+        dnstap_be32(p + 16, sizeof(DNSTAP_CONTENT_TYPE) - 1);
+        memcpy(p + 20, DNSTAP_CONTENT_TYPE, sizeof(DNSTAP_CONTENT_TYPE) - 1);
+        length += 8 + sizeof(DNSTAP_CONTENT_TYPE) - 1;
+    }
+    dnstap_be32(p, 0);
+    dnstap_be32(p + 4, length);
+    dnstap_be32(p + 8, type);
+
+    return 8 + length;
+}
+
+/*
+ * Unix socket
+ */
+
+static int dnstap_write(const u_char *data, size_t length) {
+    ssize_t n;
+
+    while (length) {
+        if ((n = send(dnstap_fd, data, length, DNSTAP_SEND_FLAGS)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int dnstap_read(u_char *data, size_t length) {
+    struct pollfd pfd;
+    ssize_t n;
+    int ret;
+
+    pfd.fd = dnstap_fd;
+    pfd.events = POLLIN;
+    while (length) {
+        if ((ret = poll(&pfd, 1, DNSTAP_HANDSHAKE_TIMEOUT)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (!ret) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if ((n = read(dnstap_fd, data, length)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (!n) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/* Read a control frame of the given type, ACCEPT must list our content type */
+static int dnstap_read_control(unsigned type) {
+    u_char frame[FSTRM_CONTROL_MAX];
+    size_t length, offset, field_length;
+    int have_content_type = 0;
+
+    if (dnstap_read(frame, 8)) {
+        return -1;
+    }
+    length = frame[4] << 24 | frame[5] << 16 | frame[6] << 8 | frame[7];
+    if (frame[0] || frame[1] || frame[2] || frame[3] || length < 4 || length > sizeof(frame)) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (dnstap_read(frame, length)) {
+        return -1;
+    }
+    if ((unsigned)(frame[0] << 24 | frame[1] << 16 | frame[2] << 8 | frame[3]) != type) {
+        errno = EPROTO;
+        return -1;
+    }
+    for (offset = 4; offset + 8 <= length; offset += 8 + field_length) {
+        field_length = frame[offset + 4] << 24 | frame[offset + 5] << 16 | frame[offset + 6] << 8 | frame[offset + 7];
+        if (field_length > length - offset - 8) {
+            break;
+        }
+        if (frame[offset + 3] == FSTRM_FIELD_CONTENT_TYPE && !frame[offset] && !frame[offset + 1] && !frame[offset + 2]
+            && field_length == sizeof(DNSTAP_CONTENT_TYPE) - 1
+            && !memcmp(frame + offset + 8, DNSTAP_CONTENT_TYPE, field_length))
+        {
+            have_content_type = 1;
+        }
+    }
+    if (type == FSTRM_CONTROL_ACCEPT && !have_content_type) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+int dnstap_connect(void) {
+    u_char frame[64];
+
+    if (!have_socket) {
+        return DUMP_DNSTAP_EINVAL;
+    }
+    if (dnstap_fd != -1) {
+        return DUMP_DNSTAP_OK;
+    }
+
+    if ((dnstap_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf(stderr, "dnstap %s: %s\n", dnstap_addr.sun_path, strerror(errno));
+        return DUMP_DNSTAP_ECONNECT;
+    }
+    if (connect(dnstap_fd, (struct sockaddr *)&dnstap_addr, sizeof(dnstap_addr))
+        || dnstap_write(frame, fstrm_control(frame, FSTRM_CONTROL_READY))
+        || dnstap_read_control(FSTRM_CONTROL_ACCEPT)
+        || dnstap_write(frame, fstrm_control(frame, FSTRM_CONTROL_START)))
+    {
+        fprintf(stderr, "dnstap %s: %s\n", dnstap_addr.sun_path, strerror(errno));
+        close(dnstap_fd);
+        dnstap_fd = -1;
+        return DUMP_DNSTAP_ECONNECT;
+    }
+
+    return DUMP_DNSTAP_OK;
+}
+
+/* Send the buffer to the socket, reconnecting if needed, or drop it */
+static void dnstap_send(void) {
+    time_t now = time(0);
+
+    if (dnstap_fd == -1 && now >= dnstap_reconnect) {
+        if (dnstap_connect() == DUMP_DNSTAP_OK) {
+            fprintf(stderr, "dnstap %s: reconnected, %lu messages dropped\n", dnstap_addr.sun_path, dnstap_dropped);
+            dnstap_dropped = 0;
+        }
+        else {
+            dnstap_reconnect = now + DNSTAP_RECONNECT_SECONDS;
+        }
+    }
+    if (dnstap_fd != -1 && dnstap_write(dnstap_buf, dnstap_buf_used)) {
+        fprintf(stderr, "dnstap %s: %s\n", dnstap_addr.sun_path, strerror(errno));
+        close(dnstap_fd);
+        dnstap_fd = -1;
+        dnstap_reconnect = 0;
+    }
+    if (dnstap_fd == -1) {
+        dnstap_dropped += dnstap_buf_frames;
+    }
+}
+
+/*
+ * Output
+ */
+
+int output_dnstap(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen, const slim_t *slim) {
+    const void *query_address, *response_address;
+    unsigned query_port, response_port, protocol;
+    size_t address_length, message_length, length, extra_length = 0;
+    char extra[128];
+    int response;
+    u_char *p;
+
+    if (!payload) {
+        return DUMP_DNSTAP_EINVAL;
+    }
+    if (dnstap_buf_used + DNSTAP_FRAME_MAX > sizeof(dnstap_buf)) {
+        /* the buffer was not dumped after DUMP_DNSTAP_FLUSH */
+        return DUMP_DNSTAP_EINVAL;
+    }
+    /* not a DNS message */
+    if (payloadlen < 12 || payloadlen > 0xffff) {
+        return DUMP_DNSTAP_OK;
+    }
+    if (from.af == AF_INET && to.af == AF_INET) {
+        address_length = 4;
+    }
+    else if (from.af == AF_INET6 && to.af == AF_INET6) {
+        address_length = 16;
+    }
+    else {
+        return DUMP_DNSTAP_OK;
+    }
+
+    /* a socket stream is started by the handshake */
+    if (!dnstap_started && !have_socket) {
+        dnstap_buf_used += fstrm_control(dnstap_buf + dnstap_buf_used, FSTRM_CONTROL_START);
+    }
+    dnstap_started = 1;
+
+    /* the query address and port are those of the initiator */
+    if ((response = payload[2] & 0x80)) {
+        query_address = &to.u;
+        query_port = dport;
+        response_address = &from.u;
+        response_port = sport;
+    }
+    else {
+        query_address = &from.u;
+        query_port = sport;
+        response_address = &to.u;
+        response_port = dport;
+    }
+    protocol = proto == IPPROTO_UDP ? DNSTAP_UDP : proto == IPPROTO_TCP ? DNSTAP_TCP : 0;
+
+    /* what slim= cut from a response goes in Dnstap.extra */
+    if (slim) {
+        extra_length = snprintf(extra, sizeof(extra), "slim: length=%zu ancount=%u nscount=%u arcount=%u",
+            slim->payloadlen, slim->counts[0], slim->counts[1], slim->counts[2]);
+    }
+
+    message_length = 2 + 2 + (protocol ? 2 : 0)
+        + 2 * pb_bytes_size(address_length)
+        + 1 + pb_varint_size(query_port)
+        + 1 + pb_varint_size(response_port)
+        + 1 + pb_varint_size(ts.tv_sec) + 5
+        + pb_bytes_size(payloadlen);
+    length = (dnstap_identity_len ? pb_bytes_size(dnstap_identity_len) : 0)
+        + pb_bytes_size(sizeof(DNSTAP_VERSION) - 1)
+        + (extra_length ? pb_bytes_size(extra_length) : 0)
+        + pb_bytes_size(message_length)
+        + 2;
+
+    p = dnstap_buf + dnstap_buf_used;
+    dnstap_be32(p, length);
+    p += 4;
+
+    /* Dnstap */
+    if (dnstap_identity_len) {
+        p = pb_bytes(p, 1, dnstap_identity, dnstap_identity_len);
+    }
+    p = pb_bytes(p, 2, DNSTAP_VERSION, sizeof(DNSTAP_VERSION) - 1);
+    if (extra_length) {
+        p = pb_bytes(p, 3, extra, extra_length);
+    }
+    *p++ = PB_TAG(14, PB_BYTES);
+    p = pb_varint(p, message_length);
+
+    /* Message */
+    *p++ = PB_TAG(1, PB_VARINT);
+    *p++ = dnstap_type + (response ? 1 : 0);
+    *p++ = PB_TAG(2, PB_VARINT);
+    *p++ = address_length == 4 ? DNSTAP_INET : DNSTAP_INET6;
+    if (protocol) {
+        *p++ = PB_TAG(3, PB_VARINT);
+        *p++ = protocol;
+    }
+    p = pb_bytes(p, 4, query_address, address_length);
+    p = pb_bytes(p, 5, response_address, address_length);
+    *p++ = PB_TAG(6, PB_VARINT);
+    p = pb_varint(p, query_port);
+    *p++ = PB_TAG(7, PB_VARINT);
+    p = pb_varint(p, response_port);
+    /* query_time and query_message or response_time and response_message */
+    *p++ = PB_TAG(response ? 12 : 8, PB_VARINT);
+    p = pb_varint(p, ts.tv_sec);
+    *p++ = PB_TAG(response ? 13 : 9, PB_FIXED32);
+    p[0] = ts.tv_usec * 1000;
+    p[1] = (ts.tv_usec * 1000) >> 8;
+    p[2] = (ts.tv_usec * 1000) >> 16;
+    p[3] = (ts.tv_usec * 1000) >> 24;
+    p += 4;
+    p = pb_bytes(p, response ? 14 : 10, payload, payloadlen);
+
+    *p++ = PB_TAG(15, PB_VARINT);
+    *p++ = DNSTAP_MESSAGE;
+
+    dnstap_buf_used = p - dnstap_buf;
+    if (!dnstap_buf_frames++) {
+        dnstap_buf_first = ts.tv_sec;
+    }
+
+    /* dump when full or holding a second worth of messages */
+    if (dnstap_buf_used + DNSTAP_FRAME_MAX > sizeof(dnstap_buf) || ts.tv_sec - dnstap_buf_first >= 1) {
+        return DUMP_DNSTAP_FLUSH;
+    }
+
+    return DUMP_DNSTAP_OK;
+}
+
+/* Write the buffered frames to fp, or to the socket if fp is NULL */
+int dump_dnstap(FILE * fp) {
+    if (!fp && !have_socket) {
+        return DUMP_DNSTAP_EINVAL;
+    }
+
+    if (dnstap_buf_used) {
+        if (!fp) {
+            dnstap_send();
+        }
+        else if (fwrite(dnstap_buf, dnstap_buf_used, 1, fp) != 1) {
+            return DUMP_DNSTAP_EWRITE;
+        }
+        dnstap_buf_used = 0;
+        dnstap_buf_frames = 0;
+    }
+
+    return DUMP_DNSTAP_OK;
+}
+
+int dump_dnstap_close(FILE * fp) {
+    u_char frame[64];
+
+    if (!fp && !have_socket) {
+        return DUMP_DNSTAP_EINVAL;
+    }
+
+    if (fp) {
+        /* an empty file is still a stream */
+        if (!dnstap_started) {
+            dnstap_buf_used += fstrm_control(dnstap_buf + dnstap_buf_used, FSTRM_CONTROL_START);
+        }
+        dnstap_buf_used += fstrm_control(dnstap_buf + dnstap_buf_used, FSTRM_CONTROL_STOP);
+        dnstap_started = 0;
+
+        return dump_dnstap(fp);
+    }
+
+    dump_dnstap(0);
+    if (dnstap_fd != -1) {
+        if (dnstap_write(frame, fstrm_control(frame, FSTRM_CONTROL_STOP))
+            || dnstap_read_control(FSTRM_CONTROL_FINISH))
+        {
+            fprintf(stderr, "dnstap %s: %s\n", dnstap_addr.sun_path, strerror(errno));
+        }
+        close(dnstap_fd);
+        dnstap_fd = -1;
+    }
+    if (dnstap_dropped) {
+        fprintf(stderr, "dnstap %s: %lu messages dropped\n", dnstap_addr.sun_path, dnstap_dropped);
+        dnstap_dropped = 0;
+    }
+    dnstap_started = 0;
+
+    return DUMP_DNSTAP_OK;
+}
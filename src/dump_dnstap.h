@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dnscap_common.h"
+
+#include <stdio.h>
+
+#ifndef __dnscap_dump_dnstap_h
+#define __dnscap_dump_dnstap_h
+
+#define DUMP_DNSTAP_OK          0
+#define DUMP_DNSTAP_EINVAL      1
+#define DUMP_DNSTAP_EWRITE      2
+#define DUMP_DNSTAP_FLUSH       3
+#define DUMP_DNSTAP_ECONNECT    4
+
+/* Message.Type of a query, the response is the type after it */
+#define DNSTAP_TYPE_AUTH        1
+#define DNSTAP_TYPE_RESOLVER    3
+#define DNSTAP_TYPE_CLIENT      5
+#define DNSTAP_TYPE_FORWARDER   7
+#define DNSTAP_TYPE_STUB        9
+#define DNSTAP_TYPE_TOOL        11
+
+#define DNSTAP_DEFAULT_TYPE DNSTAP_TYPE_AUTH
+
+int dnstap_set_type(int type);
+int dnstap_set_identity(const char * identity);
+int dnstap_set_socket(const char * path);
+int dnstap_connect(void);
+int output_dnstap(iaddr from, iaddr to, uint8_t proto, unsigned flags, unsigned sport, unsigned dport, my_bpftimeval ts, const u_char *payload, size_t payloadlen, const slim_t *slim);
+int dump_dnstap(FILE * fp);
+int dump_dnstap_close(FILE * fp);
+
+#endif /* __dnscap_dump_dnstap_h */
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "config.h"
+
+#include "dump_pcapng.h"
+#include "dnscap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * pcapng (draft-ietf-opsawg-pcapng) with one Interface Description Block
+ * per capture interface, so the packets keep which one they came from.
+ *
+ * Every file is a section of its own, it starts with a Section Header
+ * Block followed by the IDBs of all interfaces added with
+ * pcapng_add_interface() in the order they were added, the interface of a
+ * packet is that index. The packets are Enhanced Packet Blocks with the
+ * timestamp in nanoseconds (if_tsresol 9) and Interface Statistics Blocks
+ * may be written before the file is closed.
+ *
+ * The blocks are written in host byte order as readers go by the byte
+ * order magic of the SHB, nothing is kept per file so any number of files
+ * can be written at the same time.
+ */
+
+#define PCAPNG_BLOCK_SHB    0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB    1
+#define PCAPNG_BLOCK_ISB    5
+#define PCAPNG_BLOCK_EPB    6
+
+#define PCAPNG_MAGIC        0x1a2b3c4d
+
+#define PCAPNG_OPT_END          0
+#define PCAPNG_OPT_COMMENT      1
+#define PCAPNG_OPT_USERAPPL     4
+#define PCAPNG_OPT_IF_NAME      2
+#define PCAPNG_OPT_IF_TSRESOL   9
+#define PCAPNG_OPT_ISB_STARTTIME 2
+#define PCAPNG_OPT_ISB_IFRECV   4
+#define PCAPNG_OPT_ISB_IFDROP   5
+#define PCAPNG_OPT_ISB_OSDROP   7
+
+/* nanoseconds */
+#define PCAPNG_TSRESOL 9
+
+#define PCAPNG_USERAPPL "dnscap " PACKAGE_VERSION
+
+#define PCAPNG_PAD(length) (((length) + 3) & ~3)
+
+/* room for the fixed part of any block and its options */
+#define PCAPNG_HEADER_MAX 128
+
+struct pcapng_interface {
+    char        *name;
+    unsigned    linktype;
+    unsigned    snaplen;
+};
+
+static struct pcapng_interface *interfaces = 0;
+static size_t interfaces_used = 0;
+static my_bpftimeval pcapng_start;
+static int have_start = 0;
+
+int pcapng_add_interface(const char * name, unsigned linktype, unsigned snaplen) {
+    struct pcapng_interface *p;
+
+    if (!name || linktype > 0xffff) {
+        return -1;
+    }
+    if (!(p = realloc(interfaces, (interfaces_used + 1) * sizeof(*interfaces)))) {
+        return -1;
+    }
+    interfaces = p;
+    p += interfaces_used;
+    if (!(p->name = strdup(name))) {
+        return -1;
+    }
+    p->linktype = linktype;
+    p->snaplen = snaplen;
+
+    return interfaces_used++;
+}
+
+static u_char *pcapng_u16(u_char *p, uint16_t v) {
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static u_char *pcapng_u32(u_char *p, uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+/* A 64 bit value as the high and low 32 bits, as timestamps are */
+static u_char *pcapng_u64(u_char *p, uint64_t v) {
+    p = pcapng_u32(p, v >> 32);
+    return pcapng_u32(p, v);
+}
+
+static uint64_t pcapng_ts(my_bpftimeval ts) {
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_usec * 1000;
+}
+
+/* Write an option, the value is padded to 32 bits */
+static u_char *pcapng_option(u_char *p, unsigned code, const void *value, size_t length) {
+    p = pcapng_u16(p, code);
+    p = pcapng_u16(p, length);
+    if (length)
+        memcpy(p, value, length);
+    memset(p + length, 0, PCAPNG_PAD(length) - length);
+    return p + PCAPNG_PAD(length);
+}
+
+/* Fill in the lengths of a block from start to p and write it out */
+static int pcapng_block(FILE *fp, u_char *start, u_char *p) {
+    uint32_t length = (p - start) + 4;
+
+    memcpy(start + 4, &length, sizeof(length));
+    p = pcapng_u32(p, length);
+    if (fwrite(start, 1, p - start, fp) != (size_t)(p - start)) {
+        return DUMP_PCAPNG_EWRITE;
+    }
+    return DUMP_PCAPNG_OK;
+}
+
+int dump_pcapng_open(FILE * fp) {
+    u_char block[PCAPNG_HEADER_MAX + 256], *p;
+    uint8_t tsresol = PCAPNG_TSRESOL;
+    size_t n, length;
+    int ret;
+
+    if (!fp) {
+        return DUMP_PCAPNG_EINVAL;
+    }
+
+    p = pcapng_u32(block, PCAPNG_BLOCK_SHB);
+    p += 4;
+    p = pcapng_u32(p, PCAPNG_MAGIC);
+    p = pcapng_u16(p, 1);
+    p = pcapng_u16(p, 0);
+    /* section length not known */
+    p = pcapng_u32(p, 0xffffffff);
+    p = pcapng_u32(p, 0xffffffff);
+    p = pcapng_option(p, PCAPNG_OPT_USERAPPL, PCAPNG_USERAPPL, sizeof(PCAPNG_USERAPPL) - 1);
+    p = pcapng_option(p, PCAPNG_OPT_END, 0, 0);
+    if ((ret = pcapng_block(fp, block, p)) != DUMP_PCAPNG_OK) {
+        return ret;
+    }
+
+    for (n = 0; n < interfaces_used; n++) {
+        /* if_name is cut to what fits, it is only informative */
+        if ((length = strlen(interfaces[n].name)) > 255) {
+            length = 255;
+        }
+        p = pcapng_u32(block, PCAPNG_BLOCK_IDB);
+        p += 4;
+        p = pcapng_u16(p, interfaces[n].linktype);
+        p = pcapng_u16(p, 0);
+        p = pcapng_u32(p, interfaces[n].snaplen);
+        p = pcapng_option(p, PCAPNG_OPT_IF_NAME, interfaces[n].name, length);
+        p = pcapng_option(p, PCAPNG_OPT_IF_TSRESOL, &tsresol, sizeof(tsresol));
+        p = pcapng_option(p, PCAPNG_OPT_END, 0, 0);
+        if ((ret = pcapng_block(fp, block, p)) != DUMP_PCAPNG_OK) {
+            return ret;
+        }
+    }
+
+    return DUMP_PCAPNG_OK;
+}
+
+/*
+ * A response cut down by slim= has its original counts in an opt_comment,
+ * the original length is the packet length of the block.
+ */
+int dump_pcapng(FILE * fp, unsigned interface, my_bpftimeval ts, const u_char *pkt, size_t caplen, size_t len, const slim_t *slim) {
+    static const u_char pad[3] = { 0, 0, 0 };
+    u_char head[28], tail[4], options[PCAPNG_HEADER_MAX], *p = options;
+    char comment[64];
+    uint32_t length;
+
+    if (!fp || !pkt || interface >= interfaces_used || caplen > len || caplen > 0xffffffff - 32) {
+        return DUMP_PCAPNG_EINVAL;
+    }
+
+    if (!have_start) {
+        pcapng_start = ts;
+        have_start = 1;
+    }
+
+    if (slim) {
+        snprintf(comment, sizeof(comment), "slim: ancount=%u nscount=%u arcount=%u",
+            slim->counts[0], slim->counts[1], slim->counts[2]);
+        p = pcapng_option(p, PCAPNG_OPT_COMMENT, comment, strlen(comment));
+        p = pcapng_option(p, PCAPNG_OPT_END, 0, 0);
+    }
+
+    length = 32 + PCAPNG_PAD(caplen) + (p - options);
+    pcapng_u32(head, PCAPNG_BLOCK_EPB);
+    pcapng_u32(head + 4, length);
+    pcapng_u32(head + 8, interface);
+    pcapng_u64(head + 12, pcapng_ts(ts));
+    pcapng_u32(head + 20, caplen);
+    pcapng_u32(head + 24, len);
+    pcapng_u32(tail, length);
+
+    if (fwrite(head, 1, sizeof(head), fp) != sizeof(head)
+        || fwrite(pkt, 1, caplen, fp) != caplen
+        || fwrite(pad, 1, PCAPNG_PAD(caplen) - caplen, fp) != PCAPNG_PAD(caplen) - caplen
+        || fwrite(options, 1, p - options, fp) != (size_t)(p - options)
+        || fwrite(tail, 1, sizeof(tail), fp) != sizeof(tail))
+    {
+        return DUMP_PCAPNG_EWRITE;
+    }
+
+    return DUMP_PCAPNG_OK;
+}
+
+/*
+ * The counters are the totals since the capture started, isb_starttime is
+ * the time of the first packet written.
+ */
+int dump_pcapng_stats(FILE * fp, unsigned interface, my_bpftimeval ts, uint64_t recv, uint64_t drop, uint64_t osdrop) {
+    u_char block[PCAPNG_HEADER_MAX], *p, value[8];
+
+    if (!fp || interface >= interfaces_used) {
+        return DUMP_PCAPNG_EINVAL;
+    }
+
+    p = pcapng_u32(block, PCAPNG_BLOCK_ISB);
+    p += 4;
+    p = pcapng_u32(p, interface);
+    p = pcapng_u64(p, pcapng_ts(ts));
+    if (have_start) {
+        pcapng_u64(value, pcapng_ts(pcapng_start));
+        p = pcapng_option(p, PCAPNG_OPT_ISB_STARTTIME, value, sizeof(value));
+    }
+    p = pcapng_option(p, PCAPNG_OPT_ISB_IFRECV, &recv, sizeof(recv));
+    p = pcapng_option(p, PCAPNG_OPT_ISB_IFDROP, &drop, sizeof(drop));
+    p = pcapng_option(p, PCAPNG_OPT_ISB_OSDROP, &osdrop, sizeof(osdrop));
+    p = pcapng_option(p, PCAPNG_OPT_END, 0, 0);
+
+    return pcapng_block(fp, block, p);
+}
+
+int dump_pcapng_close(FILE * fp) {
+    if (!fp) {
+        return DUMP_PCAPNG_EINVAL;
+    }
+    if (fflush(fp) || ferror(fp)) {
+        return DUMP_PCAPNG_EWRITE;
+    }
+    return DUMP_PCAPNG_OK;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "dnscap_common.h"
+
+#include <stdio.h>
+
+#ifndef __dnscap_dump_pcapng_h
+#define __dnscap_dump_pcapng_h
+
+#define DUMP_PCAPNG_OK          0
+#define DUMP_PCAPNG_EINVAL      1
+#define DUMP_PCAPNG_ENOMEM      2
+#define DUMP_PCAPNG_EWRITE      3
+
+/* the link type of the IP packets dnscap writes */
+#define PCAPNG_LINKTYPE_RAW     101
+
+int pcapng_add_interface(const char * name, unsigned linktype, unsigned snaplen);
+int dump_pcapng_open(FILE * fp);
+int dump_pcapng(FILE * fp, unsigned interface, my_bpftimeval ts, const u_char *pkt, size_t caplen, size_t len, const slim_t *slim);
+int dump_pcapng_stats(FILE * fp, unsigned interface, my_bpftimeval ts, uint64_t recv, uint64_t drop, uint64_t osdrop);
+int dump_pcapng_close(FILE * fp);
+
+#endif /* __dnscap_dump_pcapng_h */
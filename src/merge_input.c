@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "config.h"
+
+#include "merge_input.h"
+#include "decompress_input.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+/*
+ * A k-way merge of offline inputs on a binary min-heap keyed on the
+ * timestamp of the next packet of each input, taking the top packet costs
+ * O(log k) so any number of files can be merged.
+ *
+ * The next packet of an input is left where its reader put it, in the
+ * buffer of its pcap_t or in the mapping, which stays valid until that
+ * input is read again and that is only done after the packet was handled.
+ * Files read with libpcap get a MERGE_INPUT_BUFFER stdio buffer to read
+ * ahead with, mapped files are read ahead by the kernel and compressed
+ * files are decoded ahead by their own thread and program, all of them
+ * at the same time.
+ */
+
+struct merge_source {
+    const char          *name;
+    u_char              *user;
+    int                 dlt;
+    unsigned            index;
+    FILE                *fp;
+    char                *buffer;
+    pcap_t              *pcap;
+    mmap_input_t        *mmap;
+    decompress_input_t  *decompress;
+    struct pcap_pkthdr  hdr;
+    const u_char        *pkt;
+};
+
+struct merge_input {
+    struct merge_source **sources;
+    unsigned            count, size;
+    volatile sig_atomic_t stopped;
+};
+
+int merge_input_open(merge_input_t ** merge) {
+    if (!merge) {
+        return MERGE_INPUT_EINVAL;
+    }
+    if (!(*merge = calloc(1, sizeof(**merge)))) {
+        return MERGE_INPUT_ENOMEM;
+    }
+    return MERGE_INPUT_OK;
+}
+
+static struct merge_source *merge_input_source(merge_input_t *merge, const char *name, u_char *user) {
+    struct merge_source *source, **sources;
+
+    if (merge->count == merge->size) {
+        if (!(sources = realloc(merge->sources, (merge->size ? merge->size * 2 : 16) * sizeof(*sources)))) {
+            return 0;
+        }
+        merge->sources = sources;
+        merge->size = merge->size ? merge->size * 2 : 16;
+    }
+    if (!(source = calloc(1, sizeof(*source)))) {
+        return 0;
+    }
+    source->name = name;
+    source->user = user;
+    source->index = merge->count;
+    merge->sources[merge->count++] = source;
+
+    return source;
+}
+
+int merge_input_add_pcap(merge_input_t * merge, const char * file, const char * filter, u_char * user, char * errbuf) {
+    struct merge_source *source;
+    struct bpf_program program;
+    const char *decompress;
+
+    if (!merge || !file) {
+        strcpy(errbuf, "invalid argument");
+        return MERGE_INPUT_EINVAL;
+    }
+    if (!(source = merge_input_source(merge, file, user))) {
+        strcpy(errbuf, "out of memory");
+        return MERGE_INPUT_ENOMEM;
+    }
+
+    if (!strcmp(file, "-")) {
+        source->fp = stdin;
+    }
+    else if ((decompress = decompress_input_program(file))) {
+        if (decompress_input_open(&source->decompress, file, decompress, errbuf) != DECOMPRESS_INPUT_OK) {
+            return MERGE_INPUT_EINVAL;
+        }
+        source->fp = decompress_input_file(source->decompress);
+    }
+    else if (!(source->fp = fopen(file, "r"))) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", strerror(errno));
+        return MERGE_INPUT_EINVAL;
+    }
+    if (source->fp != stdin && (source->buffer = malloc(MERGE_INPUT_BUFFER))) {
+        setvbuf(source->fp, source->buffer, _IOFBF, MERGE_INPUT_BUFFER);
+    }
+    if (!(source->pcap = pcap_fopen_offline(source->fp, errbuf))) {
+        if (source->decompress) {
+            /* says why if the program could not be run */
+            fclose(source->fp);
+            source->fp = 0;
+        }
+        return MERGE_INPUT_EINVAL;
+    }
+    source->dlt = pcap_datalink(source->pcap);
+
+    if (filter && *filter) {
+        if (pcap_compile(source->pcap, &program, filter, 1, 0)) {
+            snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(source->pcap));
+            return MERGE_INPUT_EINVAL;
+        }
+        if (pcap_setfilter(source->pcap, &program)) {
+            snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(source->pcap));
+            pcap_freecode(&program);
+            return MERGE_INPUT_EINVAL;
+        }
+        pcap_freecode(&program);
+    }
+
+    return MERGE_INPUT_OK;
+}
+
+int merge_input_add_mmap(merge_input_t * merge, mmap_input_t * input, const char * name, u_char * user) {
+    struct merge_source *source;
+
+    if (!merge || !input) {
+        return MERGE_INPUT_EINVAL;
+    }
+    if (!(source = merge_input_source(merge, name, user))) {
+        mmap_input_close(input);
+        return MERGE_INPUT_ENOMEM;
+    }
+    source->mmap = input;
+    source->dlt = mmap_input_datalink(input);
+
+    return MERGE_INPUT_OK;
+}
+
+/* Read the next packet of a source, returns 0 at its end or on an error */
+static int merge_source_next(struct merge_source *source) {
+    struct pcap_pkthdr *hdr;
+    int err;
+
+    if (source->mmap) {
+        return mmap_input_next(source->mmap, &source->hdr, &source->pkt) == MMAP_INPUT_OK;
+    }
+
+    if ((err = pcap_next_ex(source->pcap, &hdr, &source->pkt)) == 1) {
+        source->hdr = *hdr;
+        return 1;
+    }
+    if (err == -1) {
+        fprintf(stderr, "%s: %s\n", source->name, pcap_geterr(source->pcap));
+    }
+    return 0;
+}
+
+static int merge_source_before(const struct merge_source *a, const struct merge_source *b) {
+    if (timercmp(&a->hdr.ts, &b->hdr.ts, ==)) {
+        return a->index < b->index;
+    }
+    return timercmp(&a->hdr.ts, &b->hdr.ts, <);
+}
+
+static void merge_input_down(struct merge_source **heap, unsigned size, unsigned at) {
+    struct merge_source *source = heap[at];
+    unsigned child;
+
+    while ((child = 2 * at + 1) < size) {
+        if (child + 1 < size && merge_source_before(heap[child + 1], heap[child])) {
+            child++;
+        }
+        if (!merge_source_before(heap[child], source)) {
+            break;
+        }
+        heap[at] = heap[child];
+        at = child;
+    }
+    heap[at] = source;
+}
+
+void merge_input_run(merge_input_t * merge, merge_input_callback_t callback) {
+    struct merge_source **heap, *source;
+    unsigned size = 0, n;
+
+    if (!merge || !merge->count) {
+        return;
+    }
+    if (!(heap = malloc(merge->count * sizeof(*heap)))) {
+        fprintf(stderr, "merge_input: out of memory\n");
+        return;
+    }
+
+    for (n = 0; n < merge->count; n++) {
+        decompress_input_start(merge->sources[n]->decompress);
+    }
+    for (n = 0; n < merge->count; n++) {
+        if (merge_source_next(merge->sources[n])) {
+            heap[size++] = merge->sources[n];
+        }
+    }
+    for (n = size / 2; n-- > 0;) {
+        merge_input_down(heap, size, n);
+    }
+
+    while (size && !merge->stopped) {
+        source = heap[0];
+        callback(source->user, &source->hdr, source->pkt, source->name, source->dlt);
+        if (!merge_source_next(source)) {
+            heap[0] = heap[--size];
+        }
+        if (size) {
+            merge_input_down(heap, size, 0);
+        }
+    }
+
+    free(heap);
+}
+
+void merge_input_stop(merge_input_t * merge) {
+    if (merge) {
+        merge->stopped = 1;
+    }
+}
+
+void merge_input_close(merge_input_t * merge) {
+    struct merge_source *source;
+    unsigned n;
+
+    if (!merge) {
+        return;
+    }
+
+    for (n = 0; n < merge->count; n++) {
+        source = merge->sources[n];
+        if (source->mmap) {
+            mmap_input_close(source->mmap);
+        }
+        if (source->pcap) {
+            pcap_close(source->pcap);
+        }
+        else if (source->fp && source->fp != stdin) {
+            fclose(source->fp);
+        }
+        free(source->buffer);
+        free(source);
+    }
+    free(merge->sources);
+    free(merge);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "dnscap_common.h"
+#include "mmap_input.h"
+
+#ifndef __dnscap_merge_input_h
+#define __dnscap_merge_input_h
+
+#include <pcap.h>
+
+#define MERGE_INPUT_OK      0
+#define MERGE_INPUT_EINVAL  1
+#define MERGE_INPUT_ENOMEM  2
+
+/* read-ahead buffer of each file read with libpcap */
+#define MERGE_INPUT_BUFFER  (256 * 1024)
+
+typedef void (*merge_input_callback_t)(u_char * user, const struct pcap_pkthdr * hdr, const u_char * pkt, const char * name, int dlt);
+
+typedef struct merge_input merge_input_t;
+
+/*
+ * Offline inputs merged in time order, the packet with the earliest
+ * timestamp of all inputs is given to the callback first and inputs with
+ * the same timestamp are taken in the order they were added.
+ */
+int merge_input_open(merge_input_t ** merge);
+
+/*
+ * Add a pcap or pcapng file, or standard input as "-", read with libpcap
+ * and the filter expression if not NULL. On error errbuf says why.
+ */
+int merge_input_add_pcap(merge_input_t * merge, const char * file, const char * filter, u_char * user, char * errbuf);
+
+/* Add a mapped file, it is closed with the merge */
+int merge_input_add_mmap(merge_input_t * merge, mmap_input_t * input, const char * name, u_char * user);
+
+void merge_input_run(merge_input_t * merge, merge_input_callback_t callback);
+void merge_input_stop(merge_input_t * merge);
+void merge_input_close(merge_input_t * merge);
+
+#endif /* __dnscap_merge_input_h */
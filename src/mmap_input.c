@@ -0,0 +1,608 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "config.h"
+
+#include "mmap_input.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/*
+ * A classic pcap file read from a private read-only mapping, the record
+ * headers are decoded in place and the packets are given back as pointers
+ * into the mapping so nothing is copied.
+ *
+ * With more than one thread the records are split in byte ranges, each
+ * range after the first starts at the first offset from which a chain of
+ * MMAP_INPUT_RESYNC records all look sane (or that reaches the end of the
+ * file exactly). A thread per range walks its records, which faults the
+ * pages in, and runs the filter, the offsets of the records that pass are
+ * queued for mmap_input_next() which takes the ranges one after the other
+ * or, ordered by time, merges them on the timestamp of their next record.
+ * The walk of one range must end where the next one was found to start,
+ * if not the split was wrong and it is reported like a corrupt record.
+ */
+
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_MAGIC_NSEC     0xa1b23c4d
+#define PCAP_FILE_HEADER    24
+#define PCAP_RECORD_HEADER  16
+
+/* as libpcap, larger captured lengths are taken as a corrupt file */
+#define MMAP_INPUT_MAX_CAPLEN   262144
+/* ... and what more a record must look like to resync on it */
+#define MMAP_INPUT_MAX_LEN      (16 * 1024 * 1024)
+#define MMAP_INPUT_MAX_GAP      86400
+#define MMAP_INPUT_RESYNC       16
+
+/* the smallest range worth a thread */
+#define MMAP_INPUT_RANGE_MIN    (64 * 1024)
+/* record offsets queued per range, and how many are handed over at once */
+#define MMAP_INPUT_QUEUE        65536
+#define MMAP_INPUT_BATCH        256
+
+#define LINKTYPE_RAW    101
+#define LINKTYPE_LOOP   108
+
+struct mmap_range {
+    mmap_input_t    *input;
+    uint64_t        start, end;
+    uint64_t        pos;
+    int             error;
+    /* the record to merge on when ordered by time */
+    int             eof;
+    int             have_next;
+    uint64_t        next;
+    struct timeval  next_ts;
+#if HAVE_PTHREAD
+    pthread_t       thread;
+    int             have_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  data, space;
+    uint64_t        *queue;
+    /* records queued, taken and known to be taken by the thread */
+    uint64_t        tail, head, taken;
+    uint64_t        avail;
+    int             done;
+#endif
+};
+
+struct mmap_input {
+    const char          *file;
+    int                 fd;
+    const u_char        *map;
+    uint64_t            size;
+    int                 swapped, nsec;
+    int                 datalink;
+    unsigned            snaplen;
+    int                 order;
+    int                 have_filter;
+    struct bpf_program  filter;
+    struct mmap_range   *ranges;
+    unsigned            nranges, current;
+    int                 started;
+    volatile sig_atomic_t stopped;
+    volatile int        quit;
+};
+
+static uint32_t mmap_input_u32(const mmap_input_t *input, const u_char *p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    if (input->swapped) {
+        v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+    }
+    return v;
+}
+
+/*
+ * Decode the record header at offset into hdr and set *next to the offset
+ * of the record after it, the captured length is cut to snaplen.
+ * Returns MMAP_INPUT_EOF at the end of the file and MMAP_INPUT_EREAD if the
+ * record is truncated or its captured length is not sane.
+ */
+static int mmap_input_record(const mmap_input_t *input, uint64_t offset, struct pcap_pkthdr *hdr, uint64_t *next) {
+    const u_char *p = input->map + offset;
+    uint32_t caplen;
+
+    if (offset == input->size) {
+        return MMAP_INPUT_EOF;
+    }
+    if (input->size - offset < PCAP_RECORD_HEADER) {
+        return MMAP_INPUT_EREAD;
+    }
+    caplen = mmap_input_u32(input, p + 8);
+    if (caplen > MMAP_INPUT_MAX_CAPLEN || input->size - offset - PCAP_RECORD_HEADER < caplen) {
+        return MMAP_INPUT_EREAD;
+    }
+
+    hdr->ts.tv_sec = mmap_input_u32(input, p);
+    hdr->ts.tv_usec = mmap_input_u32(input, p + 4);
+    if (input->nsec) {
+        hdr->ts.tv_usec /= 1000;
+    }
+    hdr->caplen = caplen > input->snaplen ? input->snaplen : caplen;
+    hdr->len = mmap_input_u32(input, p + 12);
+    *next = offset + PCAP_RECORD_HEADER + caplen;
+
+    return MMAP_INPUT_OK;
+}
+
+/* Check that a chain of records starting at offset all look sane */
+static int mmap_input_resync_at(const mmap_input_t *input, uint64_t offset) {
+    const u_char *p;
+    uint32_t sec, frac, caplen, len;
+    int64_t last = -1;
+    unsigned n;
+
+    for (n = 0; n < MMAP_INPUT_RESYNC && offset < input->size; n++) {
+        if (input->size - offset < PCAP_RECORD_HEADER) {
+            return 0;
+        }
+        p = input->map + offset;
+        sec = mmap_input_u32(input, p);
+        frac = mmap_input_u32(input, p + 4);
+        caplen = mmap_input_u32(input, p + 8);
+        len = mmap_input_u32(input, p + 12);
+        if (frac >= (input->nsec ? 1000000000 : 1000000)
+            || caplen > MMAP_INPUT_MAX_CAPLEN || caplen > len || len > MMAP_INPUT_MAX_LEN
+            || input->size - offset - PCAP_RECORD_HEADER < caplen
+            || (last >= 0 && (sec > last + MMAP_INPUT_MAX_GAP || sec + MMAP_INPUT_MAX_GAP < last)))
+        {
+            return 0;
+        }
+        last = sec;
+        offset += PCAP_RECORD_HEADER + caplen;
+    }
+
+    return 1;
+}
+
+/* The first offset from offset on to resync on, or the end of the file */
+static uint64_t mmap_input_resync(const mmap_input_t *input, uint64_t offset) {
+    for (; offset < input->size; offset++) {
+        if (mmap_input_resync_at(input, offset)) {
+            return offset;
+        }
+    }
+    return input->size;
+}
+
+static int mmap_input_filter(const mmap_input_t *input, const struct pcap_pkthdr *hdr, uint64_t offset) {
+    return !input->have_filter
+        || pcap_offline_filter(&input->filter, hdr, input->map + offset + PCAP_RECORD_HEADER);
+}
+
+static void mmap_input_corrupt(const mmap_input_t *input, uint64_t offset) {
+    fprintf(stderr, "offline_mmap %s: truncated or corrupt record at offset %llu\n",
+        input->file, (unsigned long long)offset);
+}
+
+/*
+ * Walk a range from pos for the next record that passes the filter,
+ * sets range->error on a bad record and on not ending where the next range
+ * starts.
+ */
+static int mmap_input_walk(mmap_input_t *input, struct mmap_range *range, uint64_t *offset) {
+    struct pcap_pkthdr hdr;
+    uint64_t next;
+    int err;
+
+    while (range->pos < range->end && !input->quit) {
+        if ((err = mmap_input_record(input, range->pos, &hdr, &next)) != MMAP_INPUT_OK) {
+            range->error = 1;
+            return MMAP_INPUT_EREAD;
+        }
+        *offset = range->pos;
+        range->pos = next;
+        if (mmap_input_filter(input, &hdr, *offset)) {
+            return MMAP_INPUT_OK;
+        }
+    }
+    if (range->pos != range->end && !input->quit) {
+        range->error = 1;
+        range->pos = range->end;
+        return MMAP_INPUT_EREAD;
+    }
+    return MMAP_INPUT_EOF;
+}
+
+#if HAVE_PTHREAD
+
+/* Hand over a batch of offsets, returns -1 if told to quit */
+static int mmap_range_put(struct mmap_range *range, const uint64_t *offsets, size_t n) {
+    mmap_input_t *input = range->input;
+    size_t i;
+
+    pthread_mutex_lock(&range->lock);
+    while (!input->quit && MMAP_INPUT_QUEUE - (range->tail - range->taken) < n) {
+        pthread_cond_wait(&range->space, &range->lock);
+    }
+    if (input->quit) {
+        pthread_mutex_unlock(&range->lock);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        range->queue[(range->tail + i) % MMAP_INPUT_QUEUE] = offsets[i];
+    }
+    range->tail += n;
+    pthread_cond_signal(&range->data);
+    pthread_mutex_unlock(&range->lock);
+
+    return 0;
+}
+
+static void *mmap_range_thread(void *arg) {
+    struct mmap_range *range = arg;
+    uint64_t offsets[MMAP_INPUT_BATCH];
+    size_t n = 0;
+    int err;
+
+    while ((err = mmap_input_walk(range->input, range, &offsets[n])) == MMAP_INPUT_OK) {
+        if (++n == MMAP_INPUT_BATCH) {
+            if (mmap_range_put(range, offsets, n)) {
+                return 0;
+            }
+            n = 0;
+        }
+    }
+    if (n) {
+        mmap_range_put(range, offsets, n);
+    }
+
+    pthread_mutex_lock(&range->lock);
+    range->done = 1;
+    pthread_cond_signal(&range->data);
+    pthread_mutex_unlock(&range->lock);
+
+    return 0;
+}
+
+/* Take the next offset queued by the thread of the range */
+static int mmap_range_get(struct mmap_range *range, uint64_t *offset) {
+    if (range->head == range->avail || range->head - range->taken >= MMAP_INPUT_QUEUE / 2) {
+        pthread_mutex_lock(&range->lock);
+        range->taken = range->head;
+        pthread_cond_signal(&range->space);
+        while (!range->done && range->tail == range->head) {
+            pthread_cond_wait(&range->data, &range->lock);
+        }
+        range->avail = range->tail;
+        pthread_mutex_unlock(&range->lock);
+
+        if (range->head == range->avail) {
+            if (range->error) {
+                mmap_input_corrupt(range->input, range->pos);
+                return MMAP_INPUT_EREAD;
+            }
+            return MMAP_INPUT_EOF;
+        }
+    }
+    *offset = range->queue[range->head++ % MMAP_INPUT_QUEUE];
+
+    return MMAP_INPUT_OK;
+}
+
+#endif
+
+/* The next offset of a range, from its thread if it has one */
+static int mmap_range_next(struct mmap_range *range, uint64_t *offset) {
+    int err;
+
+#if HAVE_PTHREAD
+    if (range->have_thread) {
+        return mmap_range_get(range, offset);
+    }
+#endif
+    if ((err = mmap_input_walk(range->input, range, offset)) == MMAP_INPUT_EREAD) {
+        mmap_input_corrupt(range->input, range->pos);
+    }
+    return err;
+}
+
+int mmap_input_open(mmap_input_t ** input, const char * file, unsigned threads, int order, const char * filter, unsigned snaplen) {
+    mmap_input_t *in;
+    struct stat st;
+    uint32_t magic, linktype;
+    uint64_t start;
+    unsigned n;
+    pcap_t *dead;
+    void *map;
+
+    if (!input || !file || !strcmp(file, "-") || !threads || !snaplen) {
+        return MMAP_INPUT_EINVAL;
+    }
+    if (!(in = calloc(1, sizeof(*in)))) {
+        return MMAP_INPUT_ENOMEM;
+    }
+    in->file = file;
+    in->order = order;
+    in->snaplen = snaplen;
+
+    if ((in->fd = open(file, O_RDONLY)) < 0 || fstat(in->fd, &st) || !S_ISREG(st.st_mode)
+        || st.st_size < PCAP_FILE_HEADER || (uint64_t)st.st_size > (size_t)-1)
+    {
+        if (in->fd >= 0) {
+            close(in->fd);
+        }
+        free(in);
+        return MMAP_INPUT_EINVAL;
+    }
+    in->size = st.st_size;
+    if ((map = mmap(0, in->size, PROT_READ, MAP_PRIVATE, in->fd, 0)) == MAP_FAILED) {
+        close(in->fd);
+        free(in);
+        return MMAP_INPUT_EINVAL;
+    }
+    in->map = map;
+#ifdef MADV_SEQUENTIAL
+    madvise(map, in->size, MADV_SEQUENTIAL);
+#endif
+
+    memcpy(&magic, in->map, sizeof(magic));
+    if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC) {
+        in->nsec = magic == PCAP_MAGIC_NSEC;
+    }
+    else {
+        in->swapped = 1;
+        magic = mmap_input_u32(in, in->map);
+        if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC) {
+            mmap_input_close(in);
+            return MMAP_INPUT_EINVAL;
+        }
+        in->nsec = magic == PCAP_MAGIC_NSEC;
+    }
+    linktype = mmap_input_u32(in, in->map + 20) & 0x03ffffff;
+    switch (linktype) {
+    case LINKTYPE_RAW:
+        in->datalink = DLT_RAW;
+        break;
+    case LINKTYPE_LOOP:
+        in->datalink = DLT_LOOP;
+        break;
+    default:
+        in->datalink = linktype;
+    }
+
+    if (filter && *filter) {
+        if (!(dead = pcap_open_dead(in->datalink, snaplen))) {
+            mmap_input_close(in);
+            return MMAP_INPUT_ENOMEM;
+        }
+        if (pcap_compile(dead, &in->filter, filter, 1, 0)) {
+            pcap_close(dead);
+            mmap_input_close(in);
+            return MMAP_INPUT_EINVAL;
+        }
+        in->have_filter = 1;
+        pcap_close(dead);
+    }
+
+#if HAVE_PTHREAD
+    if ((in->size - PCAP_FILE_HEADER) / MMAP_INPUT_RANGE_MIN < threads) {
+        threads = (in->size - PCAP_FILE_HEADER) / MMAP_INPUT_RANGE_MIN;
+    }
+#else
+    threads = 1;
+#endif
+    if (threads < 2) {
+        threads = 1;
+    }
+    if (!(in->ranges = calloc(threads, sizeof(*in->ranges)))) {
+        mmap_input_close(in);
+        return MMAP_INPUT_ENOMEM;
+    }
+
+    /*
+     * Split on record boundaries, a range can swallow the ones after it if
+     * no boundary is found before where they were to start.
+     */
+    start = PCAP_FILE_HEADER;
+    for (n = 0; n < threads && start < in->size; n++) {
+        in->ranges[n].input = in;
+        in->ranges[n].start = in->ranges[n].pos = start;
+        if (n) {
+            in->ranges[n - 1].end = start;
+        }
+        start = PCAP_FILE_HEADER + (in->size - PCAP_FILE_HEADER) / threads * (n + 1);
+        if (start < in->ranges[n].start + 1) {
+            start = in->ranges[n].start + 1;
+        }
+        if (n + 1 < threads) {
+            start = mmap_input_resync(in, start);
+        }
+    }
+    if (!n) {
+        in->ranges[n++].input = in;
+        in->ranges[0].start = in->ranges[0].pos = PCAP_FILE_HEADER;
+    }
+    in->ranges[n - 1].end = in->size;
+    in->nranges = n;
+
+    *input = in;
+    return MMAP_INPUT_OK;
+}
+
+#if HAVE_PTHREAD
+/*
+ * Start the threads when the first record is asked for and not at open,
+ * which may be before the process is daemonized. A range that does not
+ * get its thread is walked by mmap_input_next() itself.
+ */
+static void mmap_input_start(mmap_input_t *input) {
+    unsigned n;
+
+    for (n = 0; n < input->nranges; n++) {
+        struct mmap_range *range = &input->ranges[n];
+
+        if (!(range->queue = malloc(MMAP_INPUT_QUEUE * sizeof(*range->queue)))) {
+            continue;
+        }
+        pthread_mutex_init(&range->lock, 0);
+        pthread_cond_init(&range->data, 0);
+        pthread_cond_init(&range->space, 0);
+        if (pthread_create(&range->thread, 0, mmap_range_thread, range)) {
+            pthread_mutex_destroy(&range->lock);
+            pthread_cond_destroy(&range->data);
+            pthread_cond_destroy(&range->space);
+            free(range->queue);
+            range->queue = 0;
+            continue;
+        }
+        range->have_thread = 1;
+    }
+}
+#endif
+
+int mmap_input_datalink(const mmap_input_t * input) {
+    return input->datalink;
+}
+
+int mmap_input_next(mmap_input_t * input, struct pcap_pkthdr * hdr, const u_char ** pkt) {
+    struct mmap_range *range, *first;
+    uint64_t offset, next;
+    unsigned n;
+    int err;
+
+    if (input->stopped) {
+        return MMAP_INPUT_EOF;
+    }
+#if HAVE_PTHREAD
+    if (!input->started && input->nranges > 1) {
+        mmap_input_start(input);
+    }
+#endif
+    input->started = 1;
+
+    if (input->order == MMAP_INPUT_ORDER_TIME && input->nranges > 1) {
+        first = 0;
+        for (n = 0; n < input->nranges; n++) {
+            range = &input->ranges[n];
+            if (range->eof) {
+                continue;
+            }
+            if (!range->have_next) {
+                if ((err = mmap_range_next(range, &range->next)) == MMAP_INPUT_EOF) {
+                    range->eof = 1;
+                    continue;
+                }
+                if (err != MMAP_INPUT_OK) {
+                    return err;
+                }
+                mmap_input_record(input, range->next, hdr, &next);
+                range->next_ts = hdr->ts;
+                range->have_next = 1;
+            }
+            if (!first || timercmp(&range->next_ts, &first->next_ts, <)) {
+                first = range;
+            }
+        }
+        if (!first) {
+            return MMAP_INPUT_EOF;
+        }
+        first->have_next = 0;
+        offset = first->next;
+    }
+    else {
+        for (;;) {
+            if (input->current >= input->nranges) {
+                return MMAP_INPUT_EOF;
+            }
+            if ((err = mmap_range_next(&input->ranges[input->current], &offset)) != MMAP_INPUT_EOF) {
+                break;
+            }
+            input->current++;
+        }
+        if (err != MMAP_INPUT_OK) {
+            return err;
+        }
+    }
+
+    mmap_input_record(input, offset, hdr, &next);
+    *pkt = input->map + offset + PCAP_RECORD_HEADER;
+
+    return MMAP_INPUT_OK;
+}
+
+void mmap_input_stop(mmap_input_t * input) {
+    input->stopped = 1;
+}
+
+void mmap_input_close(mmap_input_t * input) {
+#if HAVE_PTHREAD
+    unsigned n;
+#endif
+
+    if (!input) {
+        return;
+    }
+
+#if HAVE_PTHREAD
+    for (n = 0; n < input->nranges; n++) {
+        struct mmap_range *range = &input->ranges[n];
+
+        if (!range->have_thread) {
+            continue;
+        }
+        pthread_mutex_lock(&range->lock);
+        input->quit = 1;
+        pthread_cond_signal(&range->space);
+        pthread_mutex_unlock(&range->lock);
+        pthread_join(range->thread, 0);
+        pthread_mutex_destroy(&range->lock);
+        pthread_cond_destroy(&range->data);
+        pthread_cond_destroy(&range->space);
+        free(range->queue);
+    }
+#endif
+    free(input->ranges);
+    if (input->have_filter) {
+        pcap_freecode(&input->filter);
+    }
+    munmap((void *)input->map, input->size);
+    close(input->fd);
+    free(input);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "dnscap_common.h"
+
+#ifndef __dnscap_mmap_input_h
+#define __dnscap_mmap_input_h
+
+#include <pcap.h>
+
+#define MMAP_INPUT_OK       0
+#define MMAP_INPUT_EINVAL   1
+#define MMAP_INPUT_ENOMEM   2
+#define MMAP_INPUT_EREAD    3
+#define MMAP_INPUT_EOF      4
+
+/* Order the records of the ranges read in parallel are given back in */
+#define MMAP_INPUT_ORDER_FILE   0
+#define MMAP_INPUT_ORDER_TIME   1
+
+typedef struct mmap_input mmap_input_t;
+
+/*
+ * Open a classic pcap file by mapping it, MMAP_INPUT_EINVAL is returned if
+ * it is not one (pcapng, standard input) so it can be read with libpcap.
+ * With more than one thread the file is split in as many byte ranges that
+ * are scanned in parallel, the filter expression, if not NULL, is compiled
+ * for the link type of the file and run by the threads. A filter that
+ * does not compile also gives MMAP_INPUT_EINVAL.
+ * Records longer than snaplen are cut, as libpcap does.
+ */
+int mmap_input_open(mmap_input_t ** input, const char * file, unsigned threads, int order, const char * filter, unsigned snaplen);
+int mmap_input_datalink(const mmap_input_t * input);
+
+/*
+ * The next record that passed the filter, the packet points into the
+ * mapped file and is valid until mmap_input_close(). MMAP_INPUT_EREAD is
+ * returned, after saying where, for a truncated or corrupt record.
+ */
+int mmap_input_next(mmap_input_t * input, struct pcap_pkthdr * hdr, const u_char ** pkt);
+void mmap_input_stop(mmap_input_t * input);
+void mmap_input_close(mmap_input_t * input);
+
+#endif /* __dnscap_mmap_input_h */
@@ -43,6 +43,124 @@
 
 #define have(a) option_length == (sizeof(a) - 1) && !strncmp(option, a, (sizeof(a) - 1))
 
+static void output_sink_free(output_sink_t * sink) {
+    if (sink) {
+        free(sink->base);
+        free(sink->suffix);
+        free(sink->kick_cmd);
+        free(sink->compress);
+        free(sink);
+    }
+}
+
+/*
+ * Parse an output sink specification:
+ *   <format>,w=<base>[,W=<suffix>][,t=<sec>][,c=<count>][,C=<bytes>]
+ *   [,k=<cmd>][,compress=<gzip|bzip2|xz>]
+ */
+static int output_parse(options_t * options, const char * argument) {
+    output_sink_t * sink, ** last;
+    char * spec, * key, * value, * next, * p;
+    unsigned long ul;
+    int ret = 1;
+
+    if (!(sink = calloc(1, sizeof(output_sink_t)))) {
+        return -1;
+    }
+    if (!(spec = strdup(argument))) {
+        free(sink);
+        return -1;
+    }
+
+    next = spec;
+    key = strsep(&next, ",");
+    if (!strcmp(key, "pcap")) {
+        sink->format = pcap;
+    }
+    else if (!strcmp(key, "cbor")) {
+        sink->format = cbor;
+    }
+    else if (!strcmp(key, "cds")) {
+        sink->format = cds;
+    }
+    else if (!strcmp(key, "cdns")) {
+        sink->format = cdns;
+    }
+    else if (!strcmp(key, "arrow")) {
+        sink->format = arrow;
+    }
+    else if (!strcmp(key, "dnstap")) {
+        sink->format = dnstap;
+    }
+    else if (!strcmp(key, "pcapng")) {
+        sink->format = pcapng;
+    }
+    else {
+        goto done;
+    }
+
+    while ((value = strsep(&next, ","))) {
+        key = strsep(&value, "=");
+        if (!value || !*value) {
+            goto done;
+        }
+
+        if (!strcmp(key, "w")) {
+            if (sink->base || !strcmp(value, "-") || !(sink->base = strdup(value))) {
+                goto done;
+            }
+        }
+        else if (!strcmp(key, "W")) {
+            if (sink->suffix || !(sink->suffix = strdup(value))) {
+                goto done;
+            }
+        }
+        else if (!strcmp(key, "k")) {
+            if (sink->kick_cmd || !(sink->kick_cmd = strdup(value))) {
+                goto done;
+            }
+        }
+        else if (!strcmp(key, "compress")) {
+            if (sink->compress
+                || (strcmp(value, "gzip") && strcmp(value, "bzip2") && strcmp(value, "xz"))
+                || !(sink->compress = strdup(value)))
+            {
+                goto done;
+            }
+        }
+        else if (!strcmp(key, "t") || !strcmp(key, "c") || !strcmp(key, "C")) {
+            ul = strtoul(value, &p, 0);
+            if (!p || *p) {
+                goto done;
+            }
+            if (*key == 't') {
+                sink->limit_seconds = (unsigned)ul;
+            }
+            else if (*key == 'c') {
+                sink->limit_packets = (unsigned)ul;
+            }
+            else {
+                sink->limit_size = (size_t)ul;
+            }
+        }
+        else {
+            goto done;
+        }
+    }
+
+    if (sink->base) {
+        for (last = &(options->outputs); *last; last = &((*last)->next));
+        *last = sink;
+        sink = 0;
+        ret = 0;
+    }
+
+done:
+    free(spec);
+    output_sink_free(sink);
+    return ret;
+}
+
 int option_parse(options_t * options, const char * option) {
     const char * argument;
     int option_length;
@@ -75,6 +193,19 @@ int option_parse(options_t * options, const char * option) {
             return 0;
         }
     }
+    else if (have("cbor_compat")) {
+        if (!strcmp(argument, "yes")) {
+            options->cbor_compat = 1;
+            return 0;
+        }
+    }
+    else if (have("cbor_version")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p && (s == 1 || s == 2)) {
+            options->cbor_version = s;
+            return 0;
+        }
+    }
     else if (have("cds_cbor_size")) {
         s = strtoul(argument, &p, 0);
         if (p && !*p && s > 0) {
@@ -116,6 +247,13 @@ int option_parse(options_t * options, const char * option) {
             return 0;
         }
     }
+    else if (have("cds_rdata_index_size")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p) {
+            options->cds_rdata_index_size = s;
+            return 0;
+        }
+    }
     else if (have("cds_use_rdata_rindex")) {
         if (!strcmp(argument, "yes")) {
             options->cds_use_rdata_rindex = 1;
@@ -136,6 +274,142 @@ int option_parse(options_t * options, const char * option) {
             return 0;
         }
     }
+    else if (have("cds_segment_messages")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p) {
+            options->cds_segment_messages = s;
+            return 0;
+        }
+    }
+    else if (have("cds_segment_seconds")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p) {
+            options->cds_segment_seconds = s;
+            return 0;
+        }
+    }
+    else if (have("cds_workers")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p) {
+            options->cds_workers = s;
+            return 0;
+        }
+    }
+    else if (have("cds_index")) {
+        if (!strcmp(argument, "yes")) {
+            options->cds_index = 1;
+            return 0;
+        }
+    }
+    else if (have("cds_dictionary")) {
+        if (options->cds_dictionary) {
+            free(options->cds_dictionary);
+        }
+        if ((options->cds_dictionary = strdup(argument))) {
+            return 0;
+        }
+    }
+    else if (have("cdns_block_size")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p && s > 0) {
+            options->cdns_block_size = s;
+            return 0;
+        }
+    }
+    else if (have("arrow_batch_size")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p && s > 0 && s <= 0x7fffffff) {
+            options->arrow_batch_size = s;
+            return 0;
+        }
+    }
+    else if (have("dnstap_type")) {
+        if (!strcmp(argument, "auth")) {
+            options->dnstap_type = DNSTAP_TYPE_AUTH;
+            return 0;
+        }
+        else if (!strcmp(argument, "resolver")) {
+            options->dnstap_type = DNSTAP_TYPE_RESOLVER;
+            return 0;
+        }
+        else if (!strcmp(argument, "client")) {
+            options->dnstap_type = DNSTAP_TYPE_CLIENT;
+            return 0;
+        }
+        else if (!strcmp(argument, "forwarder")) {
+            options->dnstap_type = DNSTAP_TYPE_FORWARDER;
+            return 0;
+        }
+        else if (!strcmp(argument, "stub")) {
+            options->dnstap_type = DNSTAP_TYPE_STUB;
+            return 0;
+        }
+        else if (!strcmp(argument, "tool")) {
+            options->dnstap_type = DNSTAP_TYPE_TOOL;
+            return 0;
+        }
+    }
+    else if (have("dnstap_identity")) {
+        if (options->dnstap_identity) {
+            free(options->dnstap_identity);
+        }
+        if ((options->dnstap_identity = strdup(argument))) {
+            return 0;
+        }
+    }
+    else if (have("dnstap_socket")) {
+        if (options->dnstap_socket) {
+            free(options->dnstap_socket);
+        }
+        if ((options->dnstap_socket = strdup(argument))) {
+            return 0;
+        }
+    }
+    else if (have("pcapng_stats")) {
+        if (!strcmp(argument, "yes")) {
+            options->pcapng_stats = 1;
+            return 0;
+        }
+    }
+    else if (have("offline_mmap")) {
+        if (!strcmp(argument, "yes")) {
+            options->offline_mmap = 1;
+            return 0;
+        }
+    }
+    else if (have("offline_threads")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p && s > 0 && s <= 256) {
+            options->offline_threads = s;
+            return 0;
+        }
+    }
+    else if (have("offline_order")) {
+        if (!strcmp(argument, "file")) {
+            options->offline_order = offline_order_file;
+            return 0;
+        }
+        else if (!strcmp(argument, "time")) {
+            options->offline_order = offline_order_time;
+            return 0;
+        }
+    }
+    else if (have("dnstap_input")) {
+        if (options->dnstap_input) {
+            free(options->dnstap_input);
+        }
+        if ((options->dnstap_input = strdup(argument))) {
+            return 0;
+        }
+    }
+    else if (have("dnstap_listen")) {
+        if (options->dnstap_listen) {
+            free(options->dnstap_listen);
+        }
+        if ((options->dnstap_listen = strdup(argument))) {
+            return 0;
+        }
+    }
     else if (have("dump_format")) {
         if (!strcmp(argument, "pcap")) {
             options->dump_format = pcap;
@@ -149,6 +423,152 @@ int option_parse(options_t * options, const char * option) {
             options->dump_format = cds;
             return 0;
         }
+        else if (!strcmp(argument, "cdns")) {
+            options->dump_format = cdns;
+            return 0;
+        }
+        else if (!strcmp(argument, "arrow")) {
+            options->dump_format = arrow;
+            return 0;
+        }
+        else if (!strcmp(argument, "dnstap")) {
+            options->dump_format = dnstap;
+            return 0;
+        }
+        else if (!strcmp(argument, "pcapng")) {
+            options->dump_format = pcapng;
+            return 0;
+        }
+    }
+    else if (have("output")) {
+        return output_parse(options, argument);
+    }
+    else if (have("shard_key")) {
+        if (!strcmp(argument, "client")) {
+            options->shard_key = shard_client;
+            return 0;
+        }
+        else if (!strcmp(argument, "responder")) {
+            options->shard_key = shard_responder;
+            return 0;
+        }
+        else if (!strcmp(argument, "vlan")) {
+            options->shard_key = shard_vlan;
+            return 0;
+        }
+        else if (!strcmp(argument, "interface")) {
+            options->shard_key = shard_interface;
+            return 0;
+        }
+    }
+    else if (have("shard_count")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p && s > 0) {
+            options->shard_count = s;
+            return 0;
+        }
+    }
+    else if (have("shard_threads")) {
+        if (!strcmp(argument, "yes")) {
+            options->shard_threads = 1;
+            return 0;
+        }
+    }
+    else if (have("ring_size")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p && s > 0) {
+            options->ring_size = s;
+            return 0;
+        }
+    }
+    else if (have("ring_seconds")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p && s > 0) {
+            options->ring_seconds = s;
+            return 0;
+        }
+    }
+    else if (have("ring_post_seconds")) {
+        s = strtoul(argument, &p, 0);
+        if (p && !*p) {
+            options->ring_post_seconds = s;
+            return 0;
+        }
+    }
+    else if (have("ring_regex")) {
+        if (!strcmp(argument, "yes")) {
+            options->ring_regex = 1;
+            return 0;
+        }
+    }
+    else if (have("ring_rcode")) {
+        unsigned long rcode, count, seconds;
+
+        /* <rcode>,<count>,<seconds> */
+        rcode = strtoul(argument, &p, 0);
+        if (p && *p == ',' && rcode < 16) {
+            count = strtoul(p + 1, &p, 0);
+            if (p && *p == ',' && count > 0) {
+                seconds = strtoul(p + 1, &p, 0);
+                if (p && !*p && seconds > 0) {
+                    options->ring_rcode = rcode;
+                    options->ring_rcode_count = count;
+                    options->ring_rcode_seconds = seconds;
+                    return 0;
+                }
+            }
+        }
+    }
+    else if (have("slim")) {
+        char * formats, * format, * next;
+        unsigned slim = 0;
+
+        if (!(formats = strdup(argument))) {
+            return -1;
+        }
+        next = formats;
+        while ((format = strsep(&next, ","))) {
+            if (!strcmp(format, "pcap")) {
+                slim |= OPTIONS_SLIM(pcap);
+            }
+            else if (!strcmp(format, "cbor")) {
+                slim |= OPTIONS_SLIM(cbor);
+            }
+            else if (!strcmp(format, "cds")) {
+                slim |= OPTIONS_SLIM(cds);
+            }
+            else if (!strcmp(format, "cdns")) {
+                slim |= OPTIONS_SLIM(cdns);
+            }
+            else if (!strcmp(format, "arrow")) {
+                slim |= OPTIONS_SLIM(arrow);
+            }
+            else if (!strcmp(format, "dnstap")) {
+                slim |= OPTIONS_SLIM(dnstap);
+            }
+            else if (!strcmp(format, "pcapng")) {
+                slim |= OPTIONS_SLIM(pcapng);
+            }
+            else if (!strcmp(format, "all")) {
+                slim |= OPTIONS_SLIM(pcap) | OPTIONS_SLIM(cbor) | OPTIONS_SLIM(cds) | OPTIONS_SLIM(cdns)
+                    | OPTIONS_SLIM(arrow) | OPTIONS_SLIM(dnstap) | OPTIONS_SLIM(pcapng);
+            }
+            else {
+                slim = 0;
+                break;
+            }
+        }
+        free(formats);
+        if (slim) {
+            options->slim = slim;
+            return 0;
+        }
+    }
+    else if (have("slim_keep_opt")) {
+        if (!strcmp(argument, "yes")) {
+            options->slim_keep_opt = 1;
+            return 0;
+        }
     }
     else if (have("user")) {
         if (options->user) {
@@ -180,5 +600,31 @@ void options_free(options_t * options) {
             free(options->group);
             options->group = 0;
         }
+        if (options->cds_dictionary) {
+            free(options->cds_dictionary);
+            options->cds_dictionary = 0;
+        }
+        if (options->dnstap_identity) {
+            free(options->dnstap_identity);
+            options->dnstap_identity = 0;
+        }
+        if (options->dnstap_socket) {
+            free(options->dnstap_socket);
+            options->dnstap_socket = 0;
+        }
+        if (options->dnstap_input) {
+            free(options->dnstap_input);
+            options->dnstap_input = 0;
+        }
+        if (options->dnstap_listen) {
+            free(options->dnstap_listen);
+            options->dnstap_listen = 0;
+        }
+        while (options->outputs) {
+            output_sink_t * sink = options->outputs;
+
+            options->outputs = sink->next;
+            output_sink_free(sink);
+        }
     }
 }
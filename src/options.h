@@ -35,6 +35,9 @@
 #include <sys/types.h>
 
 #include "dump_cds.h"
+#include "dump_cdns.h"
+#include "dump_arrow.h"
+#include "dump_dnstap.h"
 
 #ifndef __dnscap_options_h
 #define __dnscap_options_h
@@ -43,11 +46,48 @@ typedef enum dump_format dump_format_t;
 enum dump_format {
     pcap,
     cbor,
-    cds
+    cds,
+    cdns,
+    arrow,
+    dnstap,
+    pcapng
+};
+
+#define OPTIONS_SLIM(format) (1 << (format))
+
+typedef enum shard_key shard_key_t;
+enum shard_key {
+    shard_none,
+    shard_client,
+    shard_responder,
+    shard_vlan,
+    shard_interface
+};
+
+typedef enum offline_order offline_order_t;
+enum offline_order {
+    offline_order_file,
+    offline_order_time
+};
+
+typedef struct output_sink output_sink_t;
+struct output_sink {
+    output_sink_t*  next;
+
+    dump_format_t   format;
+    char*           base;
+    char*           suffix;
+    char*           kick_cmd;
+    char*           compress;
+    unsigned        limit_seconds;
+    unsigned        limit_packets;
+    size_t          limit_size;
 };
 
 #define OPTIONS_T_DEFAULTS { \
     1024 * 1024, \
+    0, \
+    1, \
 \
     1024 * 1024, \
     64 * 1024, \
@@ -56,10 +96,48 @@ enum dump_format {
     0, \
     CDS_DEFAULT_RDATA_INDEX_MIN_SIZE, \
     0, \
+    0, \
     CDS_DEFAULT_RDATA_RINDEX_SIZE, \
     CDS_DEFAULT_RDATA_RINDEX_MIN_SIZE, \
+    0, \
+    0, \
+    0, \
+    0, \
+    0, \
+\
+    CDNS_DEFAULT_BLOCK_SIZE, \
+\
+    ARROW_DEFAULT_BATCH_SIZE, \
+\
+    DNSTAP_DEFAULT_TYPE, \
+    0, \
+    0, \
+    0, \
+    0, \
+\
+    0, \
+\
+    0, \
+    1, \
+    offline_order_file, \
 \
     pcap, \
+    0, \
+\
+    shard_none, \
+    0, \
+    0, \
+\
+    0, \
+    0, \
+    0, \
+    0, \
+    -1, \
+    0, \
+    0, \
+\
+    0, \
+    0, \
 \
     0, \
     0 \
@@ -68,6 +146,8 @@ enum dump_format {
 typedef struct options options_t;
 struct options {
     size_t          cbor_chunk_size;
+    int             cbor_compat;
+    int             cbor_version;
 
     size_t          cds_cbor_size;
     size_t          cds_message_size;
@@ -75,11 +155,49 @@ struct options {
     size_t          cds_min_rlabel_size;
     int             cds_use_rdata_index;
     size_t          cds_rdata_index_min_size;
+    size_t          cds_rdata_index_size;
     int             cds_use_rdata_rindex;
     size_t          cds_rdata_rindex_size;
     size_t          cds_rdata_rindex_min_size;
+    size_t          cds_segment_messages;
+    unsigned        cds_segment_seconds;
+    size_t          cds_workers;
+    int             cds_index;
+    char *          cds_dictionary;
+
+    size_t          cdns_block_size;
+
+    size_t          arrow_batch_size;
+
+    int             dnstap_type;
+    char *          dnstap_identity;
+    char *          dnstap_socket;
+    char *          dnstap_input;
+    char *          dnstap_listen;
+
+    int             pcapng_stats;
+
+    int             offline_mmap;
+    unsigned        offline_threads;
+    offline_order_t offline_order;
 
     dump_format_t   dump_format;
+    output_sink_t*  outputs;
+
+    shard_key_t     shard_key;
+    unsigned        shard_count;
+    int             shard_threads;
+
+    size_t          ring_size;
+    unsigned        ring_seconds;
+    unsigned        ring_post_seconds;
+    int             ring_regex;
+    int             ring_rcode;
+    unsigned        ring_rcode_count;
+    unsigned        ring_rcode_seconds;
+
+    unsigned        slim;
+    int             slim_keep_opt;
 
     char *          user;
     char *          group;
@@ -0,0 +1,461 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Read the Apache Arrow IPC streams written by dnscap -F arrow and print
+ * the schema with -s, or the time, ID and QNAME of every row, with -l also
+ * the size and original counts, so the test can check them without pyarrow.  Only what dnscap writes is understood,
+ * the flatbuffers are read with a small reader of its own.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CONTINUATION 0xffffffff
+
+/* MessageHeader */
+#define HEADER_SCHEMA           1
+#define HEADER_DICTIONARY_BATCH 2
+#define HEADER_RECORD_BATCH     3
+
+/* Type */
+#define TYPE_INT                2
+#define TYPE_UTF8               5
+#define TYPE_BOOL               6
+#define TYPE_TIMESTAMP          10
+#define TYPE_FIXED_SIZE_BINARY  15
+
+#define MAX_FIELDS 32
+
+struct field {
+    char        name[32];
+    unsigned    type;
+};
+
+static const char* progname = "arrowdump";
+
+/* The flatbuffer of the message being read and the file it is from */
+static const uint8_t* fb;
+static size_t fb_len;
+static const char* where;
+
+/* The fields of the schema, the index of the columns printed and the dictionary */
+static struct field fields[MAX_FIELDS];
+static size_t fields_num = 0, time_col, id_col, qname_col, size_col, original_col[3];
+static int print_sizes = 0;
+static char** dict = 0;
+static size_t dict_num = 0;
+
+static void fail(const char* msg) {
+    fprintf(stderr, "%s: %s: %s\n", progname, where, msg);
+    exit(1);
+}
+
+static uint64_t le(const uint8_t* p, size_t width) {
+    uint64_t v = 0;
+
+    while (width--) {
+        v = v << 8 | p[width];
+    }
+    return v;
+}
+
+static void get(int fd, uint8_t* data, size_t len) {
+    ssize_t n;
+
+    while (len) {
+        if ((n = read(fd, data, len)) < 0) {
+            fail(strerror(errno));
+        }
+        if (!n) {
+            fail("unexpected end of stream");
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/*
+ * Flatbuffer reading, tables and vectors are given by their position in
+ * the flatbuffer and everything is checked to be within it.
+ */
+
+static size_t fb_check(size_t pos, size_t len) {
+    if (pos > fb_len || len > fb_len - pos) {
+        fail("flatbuffer out of bounds");
+    }
+    return pos;
+}
+
+/* The position of a field of the table, 0 if it is not present */
+static size_t fb_field(size_t table, unsigned id) {
+    size_t vtable, off;
+
+    vtable = table - (int32_t)le(fb + fb_check(table, 4), 4);
+    if (4 + id * 2 + 2 > le(fb + fb_check(vtable, 4), 2)) {
+        return 0;
+    }
+    off = le(fb + fb_check(vtable + 4 + id * 2, 2), 2);
+    return off ? fb_check(table + off, 1) : 0;
+}
+
+static uint64_t fb_uint(size_t table, unsigned id, size_t width) {
+    size_t pos = fb_field(table, id);
+
+    return pos ? le(fb + fb_check(pos, width), width) : 0;
+}
+
+/* Follow the uoffset at pos to the table, vector or string it points to */
+static size_t fb_deref(size_t pos) {
+    return fb_check(pos + le(fb + fb_check(pos, 4), 4), 4);
+}
+
+static size_t fb_ref(size_t table, unsigned id) {
+    size_t pos = fb_field(table, id);
+
+    if (!pos) {
+        fail("flatbuffer field missing");
+    }
+    return fb_deref(pos);
+}
+
+/* The elements of a vector field of the table, their number in *count */
+static size_t fb_vector(size_t table, unsigned id, size_t width, size_t* count) {
+    size_t vector = fb_ref(table, id);
+
+    *count = le(fb + vector, 4);
+    if (*count > fb_len / width) {
+        fail("flatbuffer vector too long");
+    }
+    return fb_check(vector + 4, *count * width);
+}
+
+static size_t field_index(const char* name) {
+    size_t n;
+
+    for (n = 0; n < fields_num; n++) {
+        if (!strcmp(fields[n].name, name)) {
+            return n;
+        }
+    }
+    fail("column missing");
+    return 0;
+}
+
+static void read_schema(size_t schema, int print) {
+    size_t vector, field, type, name, len, n;
+
+    vector = fb_vector(schema, 1, 4, &fields_num);
+    if (fields_num > MAX_FIELDS) {
+        fail("too many columns");
+    }
+    for (n = 0; n < fields_num; n++) {
+        field = fb_deref(vector + n * 4);
+        name = fb_ref(field, 0);
+        if ((len = le(fb + name, 4)) >= sizeof(fields[n].name)) {
+            fail("column name too long");
+        }
+        memcpy(fields[n].name, fb + fb_check(name + 4, len), len);
+        fields[n].name[len] = 0;
+        fields[n].type = fb_uint(field, 2, 1);
+        if (!print) {
+            continue;
+        }
+
+        printf("%s ", fields[n].name);
+        type = fb_ref(field, 3);
+        switch (fields[n].type) {
+        case TYPE_INT:
+            printf("%sint%u", fb_uint(type, 1, 1) ? "" : "u", (unsigned)fb_uint(type, 0, 4));
+            break;
+        case TYPE_UTF8:
+            printf("utf8");
+            break;
+        case TYPE_BOOL:
+            printf("bool");
+            break;
+        case TYPE_TIMESTAMP:
+            name = fb_ref(type, 1);
+            printf("timestamp[%s, %.*s]", fb_uint(type, 0, 2) == 2 ? "us" : "?",
+                (int)le(fb + name, 4), fb + fb_check(name + 4, le(fb + name, 4)));
+            break;
+        case TYPE_FIXED_SIZE_BINARY:
+            printf("binary[%u]", (unsigned)fb_uint(type, 0, 4));
+            break;
+        default:
+            printf("type %u", fields[n].type);
+        }
+        if (fb_field(field, 4)) {
+            printf(" dictionary");
+        }
+        printf("%s\n", fb_uint(field, 1, 1) ? " null" : "");
+    }
+
+    time_col = field_index("time");
+    id_col = field_index("id");
+    qname_col = field_index("qname");
+    if (fields[time_col].type != TYPE_TIMESTAMP || fields[id_col].type != TYPE_INT || fields[qname_col].type != TYPE_UTF8) {
+        fail("unexpected column type");
+    }
+    if (print_sizes) {
+        size_col = field_index("size");
+        original_col[0] = field_index("original_ancount");
+        original_col[1] = field_index("original_nscount");
+        original_col[2] = field_index("original_arcount");
+    }
+}
+
+/* Buffer n of a record batch in the body, with its length in *len */
+static const uint8_t* buffer(size_t batch, size_t n, const uint8_t* body, size_t body_len, size_t* len) {
+    size_t vector, count;
+    uint64_t offset;
+
+    vector = fb_vector(batch, 2, 16, &count);
+    if (n >= count) {
+        fail("buffer missing");
+    }
+    offset = le(fb + vector + n * 16, 8);
+    *len = le(fb + vector + n * 16 + 8, 8);
+    if (offset > body_len || *len > body_len - offset) {
+        fail("buffer out of bounds");
+    }
+    return body + offset;
+}
+
+/* Add the names to the dictionary, or replace it if it is not a delta */
+static void read_dictionary(size_t header, const uint8_t* body, size_t body_len) {
+    size_t batch = fb_ref(header, 1), rows, offsets_len, data_len, n;
+    const uint8_t *offsets, *data;
+    uint64_t start, end;
+
+    if (!fb_uint(header, 2, 1)) {
+        while (dict_num) {
+            free(dict[--dict_num]);
+        }
+    }
+    rows = fb_uint(batch, 0, 8);
+    offsets = buffer(batch, 1, body, body_len, &offsets_len);
+    data = buffer(batch, 2, body, body_len, &data_len);
+    if (offsets_len < (rows + 1) * 4) {
+        fail("dictionary offsets too short");
+    }
+    if (!(dict = realloc(dict, (dict_num + rows) * sizeof(*dict)))) {
+        fail(strerror(errno));
+    }
+    for (n = 0; n < rows; n++) {
+        start = le(offsets + n * 4, 4);
+        end = le(offsets + n * 4 + 4, 4);
+        if (start > end || end > data_len) {
+            fail("bad dictionary offsets");
+        }
+        if (!(dict[dict_num] = malloc(end - start + 1))) {
+            fail(strerror(errno));
+        }
+        memcpy(dict[dict_num], data + start, end - start);
+        dict[dict_num++][end - start] = 0;
+    }
+}
+
+/*
+ * Print the time, ID and QNAME of the rows, a QNAME without the root dot,
+ * and with -l the size and the original counts of slimmed responses.
+ */
+static void read_batch(size_t batch, const uint8_t* body, size_t body_len) {
+    size_t rows = fb_uint(batch, 0, 8), times_len, ids_len, valid_len, qnames_len, len, n, i;
+    size_t sizes_len = 0, counts_len[3], counts_valid_len[3];
+    const uint8_t *times, *ids, *valid, *qnames, *sizes = 0, *counts[3], *counts_valid[3];
+    const char* qname;
+    char when[64];
+    uint64_t us, index;
+    time_t t;
+
+    /* two buffers per column, the validity bitmap and the values */
+    times = buffer(batch, time_col * 2 + 1, body, body_len, &times_len);
+    ids = buffer(batch, id_col * 2 + 1, body, body_len, &ids_len);
+    valid = buffer(batch, qname_col * 2, body, body_len, &valid_len);
+    qnames = buffer(batch, qname_col * 2 + 1, body, body_len, &qnames_len);
+    if (times_len < rows * 8 || ids_len < rows * 2 || qnames_len < rows * 4 || (valid_len && valid_len < (rows + 7) / 8)) {
+        fail("column too short");
+    }
+    if (print_sizes) {
+        sizes = buffer(batch, size_col * 2 + 1, body, body_len, &sizes_len);
+        if (sizes_len < rows * 4) {
+            fail("column too short");
+        }
+        for (i = 0; i < 3; i++) {
+            counts_valid[i] = buffer(batch, original_col[i] * 2, body, body_len, &counts_valid_len[i]);
+            counts[i] = buffer(batch, original_col[i] * 2 + 1, body, body_len, &counts_len[i]);
+            if (counts_len[i] < rows * 2 || (counts_valid_len[i] && counts_valid_len[i] < (rows + 7) / 8)) {
+                fail("column too short");
+            }
+        }
+    }
+    for (n = 0; n < rows; n++) {
+        us = le(times + n * 8, 8);
+        t = (time_t)(us / 1000000);
+        strftime(when, sizeof when, "%Y-%m-%d %T", gmtime(&t));
+        qname = "";
+        /* without a validity bitmap every row is valid */
+        if (!valid_len || valid[n / 8] & (1 << (n % 8))) {
+            if ((index = le(qnames + n * 4, 4)) >= dict_num) {
+                fail("dictionary index out of range");
+            }
+            qname = dict[index];
+        }
+        len = strlen(qname);
+        if (len && qname[len - 1] == '.') {
+            len--;
+        }
+        printf("%s.%06lu %u %.*s", when, (unsigned long)(us % 1000000), (unsigned)le(ids + n * 2, 2), (int)len, qname);
+        if (print_sizes) {
+            printf(" %u", (unsigned)le(sizes + n * 4, 4));
+            for (i = 0; i < 3; i++) {
+                if (!counts_valid_len[i] || counts_valid[i][n / 8] & (1 << (n % 8))) {
+                    printf(" %u", (unsigned)le(counts[i] + n * 2, 2));
+                }
+                else {
+                    printf(" -");
+                }
+            }
+        }
+        putchar('\n');
+    }
+}
+
+static void read_file(const char* file, int schema) {
+    static uint8_t *meta = 0, *body = 0;
+    static size_t meta_size = 0, body_size = 0;
+    uint8_t head[8], byte;
+    size_t message, header, body_len;
+    int fd, have_schema = 0;
+
+    where = file;
+    if ((fd = open(file, O_RDONLY)) < 0) {
+        fail(strerror(errno));
+    }
+    while (1) {
+        get(fd, head, 8);
+        if (le(head, 4) != CONTINUATION) {
+            fail("no continuation marker");
+        }
+        if (!(fb_len = le(head + 4, 4))) {
+            break;
+        }
+        if (fb_len > meta_size) {
+            meta_size = fb_len;
+            if (!(meta = realloc(meta, meta_size))) {
+                fail(strerror(errno));
+            }
+        }
+        get(fd, meta, fb_len);
+        fb = meta;
+        message = fb_deref(0);
+        header = fb_ref(message, 2);
+        if ((body_len = fb_uint(message, 3, 8)) > body_size) {
+            body_size = body_len;
+            if (!(body = realloc(body, body_size))) {
+                fail(strerror(errno));
+            }
+        }
+        get(fd, body, body_len);
+
+        switch (fb_uint(message, 1, 1)) {
+        case HEADER_SCHEMA:
+            if (have_schema) {
+                fail("more than one schema");
+            }
+            read_schema(header, schema);
+            have_schema = 1;
+            break;
+        case HEADER_DICTIONARY_BATCH:
+        case HEADER_RECORD_BATCH:
+            if (!have_schema) {
+                fail("no schema");
+            }
+            if (schema) {
+                break;
+            }
+            if (fb_uint(message, 1, 1) == HEADER_DICTIONARY_BATCH) {
+                read_dictionary(header, body, body_len);
+            }
+            else {
+                read_batch(header, body, body_len);
+            }
+            break;
+        default:
+            fail("unexpected message");
+        }
+    }
+    if (!have_schema) {
+        fail("no schema");
+    }
+    if (read(fd, &byte, 1) > 0) {
+        fail("data after end-of-stream marker");
+    }
+    close(fd);
+}
+
+int main(int argc, char* argv[]) {
+    int i = 1, schema = 0;
+
+    if (argc > 1 && !strcmp(argv[1], "-s")) {
+        schema = 1;
+        i++;
+    }
+    else if (argc > 1 && !strcmp(argv[1], "-l")) {
+        print_sizes = 1;
+        i++;
+    }
+    if (i >= argc) {
+        fprintf(stderr, "usage: %s [-s|-l] file ...\n", progname);
+        exit(1);
+    }
+    for (; i < argc; i++) {
+        read_file(argv[i], schema);
+        /* every file is a stream of its own */
+        while (dict_num) {
+            free(dict[--dict_num]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#!/bin/sh -e
+#
+# Time the CBOR encoder walking the wire format, the compact cbor_version=2
+# layout and the ldns based encoder used with cbor_compat=yes and report the
+# size and messages encoded per second, the encoder runs on the capture
+# thread so this is per core.
+# The input defaults to the test capture but a larger capture from a busy
+# resolver can be given as arguments to get useful numbers.
+#
+#   make bench
+#   sh bench_cbor.sh /path/to/capture.pcap ...
+#
+# If bench_malloc.so is built the heap calls are also reported.
+#
+
+DNSCAP=${DNSCAP:-../dnscap}
+BENCH_MALLOC=${BENCH_MALLOC:-./bench_malloc.so}
+TIME=${TIME:-/usr/bin/time}
+
+if [ ! -x "$TIME" ]; then
+    echo "$TIME not found, set TIME to a time utility that supports -p" >&2
+    exit 1
+fi
+
+if [ $# -eq 0 ]; then
+    set -- dns.pcap.dist
+fi
+
+input=""
+for file in "$@"; do
+    input="$input -r $file"
+done
+
+messages=`$DNSCAP -s ir -g $input 2>&1 >/dev/null | grep -c '^\['`
+
+bench() {
+    name="$1"
+    shift
+    rm -f bench.out.*
+    echo "$name"
+    if ! $DNSCAP -s ir $input -F cbor -w bench.out "$@" >/dev/null 2>bench.err; then
+        cat bench.err
+        rm -f bench.out.* bench.err
+        return
+    fi
+    ls -l bench.out.* | awk '{ size += $5 } END { print "size " size }'
+    rm -f bench.out.*
+    seconds=`$TIME -p $DNSCAP -s ir $input -F cbor -w bench.out "$@" 2>&1 >/dev/null | awk '/^real/ { print $2 }'`
+    awk "BEGIN { printf(\"messages %d seconds %s messages/sec %.0f\\n\", $messages, ${seconds:-0}, ${seconds:-0} > 0 ? $messages / ${seconds:-0} : 0) }"
+    if [ -f "$BENCH_MALLOC" ]; then
+        rm -f bench.out.*
+        LD_PRELOAD="$BENCH_MALLOC" $DNSCAP -s ir $input -F cbor -w bench.out "$@" 2>&1 >/dev/null | \
+            awk '/^heap calls/ { print "heap calls " $3 }'
+    fi
+    rm -f bench.out.* bench.err
+}
+
+bench "wire format"
+bench "cbor_version=2" -o cbor_version=2
+bench "cbor_compat=yes" -o cbor_compat=yes
@@ -0,0 +1,72 @@
+#!/bin/sh -e
+#
+# Time the CDS encoder with different index settings, the input defaults
+# to the test capture but a larger capture from a busy resolver can be
+# given as arguments to get useful numbers.
+#
+#   make bench
+#   sh bench_cds.sh /path/to/capture.pcap ...
+#
+# If bench_malloc.so is built the heap calls per message are also reported,
+# counted as the difference between the first input and the same input
+# repeated four times so that setup costs are left out.
+#
+
+DNSCAP=${DNSCAP:-../dnscap}
+BENCH_MALLOC=${BENCH_MALLOC:-./bench_malloc.so}
+TIME=${TIME:-/usr/bin/time}
+
+# time is not a shell keyword in every sh, use the utility and its -p output
+if [ ! -x "$TIME" ]; then
+    echo "$TIME not found, set TIME to a time utility that supports -p" >&2
+    exit 1
+fi
+
+if [ $# -eq 0 ]; then
+    set -- dns.pcap.dist
+fi
+
+input=""
+for file in "$@"; do
+    input="$input -r $file"
+done
+
+bench() {
+    name="$1"
+    shift
+    rm -f bench.out.*
+    echo "$name"
+    $TIME -p $DNSCAP $input -F cds -w bench.out "$@" >/dev/null
+    ls -l bench.out.* | awk '{ size += $5 } END { print "size " size }'
+    rm -f bench.out.*
+}
+
+for size in 255 4095 65535; do
+    bench "cds_max_rlabels=$size" -o cds_max_rlabels=$size
+done
+
+for size in 255 4095 65535; do
+    bench "cds_rdata_rindex_size=$size" \
+        -o cds_use_rdata_rindex=yes -o cds_rdata_rindex_size=$size
+done
+
+if [ -f "$BENCH_MALLOC" ]; then
+    messages() {
+        $DNSCAP -g -r "$1" 2>&1 >/dev/null | grep -c '^\['
+    }
+    heap() {
+        rm -f bench.out.*
+        LD_PRELOAD="$BENCH_MALLOC" $DNSCAP -r "$1" -F cds -w bench.out 2>&1 >/dev/null | \
+            awk '/^heap calls/ { print $3 }'
+        rm -f bench.out.*
+    }
+
+    { cat "$1"; tail -c +25 "$1"; tail -c +25 "$1"; tail -c +25 "$1"; } >bench.4x.pcap
+    msgs1=`messages "$1"`
+    msgs4=`messages bench.4x.pcap`
+    calls1=`heap "$1"`
+    calls4=`heap bench.4x.pcap`
+    rm -f bench.4x.pcap
+    echo "heap calls $calls1 for $msgs1 messages, $calls4 for $msgs4 messages"
+    awk "BEGIN { printf(\"heap calls per message %.2f\\n\", ($calls4 - $calls1) / ($msgs4 - $msgs1)) }"
+fi
@@ -0,0 +1,41 @@
+#!/bin/sh -e
+#
+# Time the CDS decoder, the input is encoded with different index settings
+# and decoded without output and back to pcap to report the messages
+# decoded per second.
+# The input defaults to the test capture but a larger capture from a busy
+# resolver can be given as arguments to get useful numbers.
+#
+#   make bench
+#   sh bench_cdsdump.sh /path/to/capture.pcap ...
+#
+
+DNSCAP=${DNSCAP:-../dnscap}
+CDSDUMP=${CDSDUMP:-../cdsdump}
+CDS2PCAP=${CDS2PCAP:-../cds2pcap}
+
+if [ $# -eq 0 ]; then
+    set -- dns.pcap.dist
+fi
+
+input=""
+for file in "$@"; do
+    input="$input -r $file"
+done
+
+bench() {
+    name="$1"
+    shift
+    rm -f bench.out.*
+    echo "$name"
+    $DNSCAP $input -F cds -w bench.out "$@" >/dev/null
+    ls -l bench.out.* | awk '{ size += $5 } END { print "size " size }'
+    $CDSDUMP -q -s bench.out.*
+    $CDS2PCAP -s -w /dev/null bench.out.*
+    rm -f bench.out.*
+}
+
+bench "default"
+bench "cds_max_rlabels=4095" -o cds_max_rlabels=4095
+bench "cds_use_rdata_index=yes" -o cds_use_rdata_index=yes
+bench "cds_use_rdata_rindex=yes" -o cds_use_rdata_rindex=yes
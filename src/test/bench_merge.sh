@@ -0,0 +1,52 @@
+#!/bin/sh -e
+#
+# Time merging many offline inputs in time order against reading the same
+# packets from one file, the input is copied to BENCH_FILES (default 128)
+# files that all cover the same time so every packet goes through the heap.
+# The input defaults to the test capture but a larger capture can be given
+# as argument to get useful numbers.
+#
+#   make bench
+#   sh bench_merge.sh /path/to/capture.pcap
+#
+
+DNSCAP=${DNSCAP:-../dnscap}
+BENCH_FILES=${BENCH_FILES:-128}
+TIME=${TIME:-/usr/bin/time}
+
+if [ ! -x "$TIME" ]; then
+    echo "$TIME not found, set TIME to a time utility that supports -p" >&2
+    exit 1
+fi
+
+capture=${1:-dns.pcap.dist}
+
+rm -f bench.merge.*
+head -c 24 "$capture" >bench.merge.all.pcap
+input=""
+n=0
+while [ $n -lt $BENCH_FILES ]; do
+    file=`printf 'bench.merge.%03d.pcap' $n`
+    cp "$capture" $file
+    tail -c +25 "$capture" >>bench.merge.all.pcap
+    input="$input -r $file"
+    n=`expr $n + 1`
+done
+
+messages=`$DNSCAP -s ir -g -r bench.merge.all.pcap 2>&1 >/dev/null | grep -c '^\['`
+
+bench() {
+    name="$1"
+    shift
+    rm -f bench.out.*
+    echo "$name"
+    seconds=`$TIME -p $DNSCAP -s ir "$@" -w bench.out 2>&1 >/dev/null | awk '/^real/ { print $2 }'`
+    awk "BEGIN { printf(\"messages %d seconds %s messages/sec %.0f\\n\", $messages, ${seconds:-0}, ${seconds:-0} > 0 ? $messages / ${seconds:-0} : 0) }"
+    rm -f bench.out.*
+}
+
+bench "one file" -r bench.merge.all.pcap
+bench "$BENCH_FILES files merged" $input
+bench "$BENCH_FILES files merged, offline_mmap=yes" $input -o offline_mmap=yes
+
+rm -f bench.merge.*
@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Decode the CBOR files written by dnscap -F cbor back into DNS messages
+ * and print them like cdsdump so the test can compare them with dns.gold.
+ * Both the text keys of the default encoder and the integer keys and
+ * stringrefs of cbor_version=2 are understood, the CBOR is read with a
+ * small reader of its own so the test does not need more than dnscap does.
+ */
+
+#include "config.h"
+
+#include "dnscap_common.h"
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dump_dns.h"
+
+static const char* progname = "cbordump";
+
+struct node {
+    int major;
+    uint64_t value;
+    const uint8_t* bytes;
+    struct node* kids;
+    size_t count;
+};
+
+static const uint8_t *cur, *end;
+
+/* the strings of the open stringref namespaces, the innermost starts at ns_start */
+static struct node* ns = 0;
+static size_t ns_num = 0, ns_size = 0, ns_start = 0;
+static int ns_open = 0;
+
+static void fail(const char* file, const char* msg) {
+    fprintf(stderr, "%s: %s: %s\n", progname, file, msg);
+    exit(1);
+}
+
+/* The minimum length of a string that gets the next index, see http://cbor.schmorp.de/stringref */
+static int stringref_fits(uint64_t length, uint64_t index) {
+    if (index < 24) {
+        return length >= 3;
+    }
+    if (index < 256) {
+        return length >= 4;
+    }
+    if (index < 65536) {
+        return length >= 5;
+    }
+    if (index < 4294967296ULL) {
+        return length >= 7;
+    }
+    return length >= 11;
+}
+
+static int parse(struct node* n) {
+    uint64_t v = 0, want;
+    size_t size = 0, start;
+    int ai, i, open, ret;
+
+    memset(n, 0, sizeof(*n));
+    if (cur >= end) {
+        return -1;
+    }
+    n->major = *cur >> 5;
+    ai = *cur++ & 31;
+    if (ai < 24) {
+        v = ai;
+    }
+    else if (ai < 28) {
+        if (end - cur < 1 << (ai - 24)) {
+            return -1;
+        }
+        for (i = 0; i < 1 << (ai - 24); i++) {
+            v = v << 8 | *cur++;
+        }
+    }
+    else if (ai != 31 || n->major < 4 || n->major > 5) {
+        return -1;
+    }
+    n->value = v;
+
+    switch (n->major) {
+    case 2:
+    case 3:
+        if ((uint64_t)(end - cur) < v) {
+            return -1;
+        }
+        n->bytes = cur;
+        cur += v;
+        if (ns_open && stringref_fits(v, ns_num - ns_start)) {
+            if (ns_num == ns_size) {
+                ns_size = ns_size ? ns_size * 2 : 1024;
+                if (!(ns = realloc(ns, ns_size * sizeof(*ns)))) {
+                    return -1;
+                }
+            }
+            ns[ns_num++] = *n;
+        }
+        break;
+    case 4:
+    case 5:
+        want = ai == 31 ? (uint64_t)-1 : n->major == 5 ? v * 2 : v;
+        while (n->count < want) {
+            if (ai == 31) {
+                if (cur >= end) {
+                    return -1;
+                }
+                if (*cur == 0xff) {
+                    cur++;
+                    break;
+                }
+            }
+            if (n->count == size) {
+                size = size ? size * 2 : 8;
+                if (!(n->kids = realloc(n->kids, size * sizeof(*n->kids)))) {
+                    return -1;
+                }
+            }
+            if (parse(&n->kids[n->count++])) {
+                return -1;
+            }
+        }
+        if (n->major == 5 && n->count & 1) {
+            return -1;
+        }
+        break;
+    case 6:
+        if (v == 256) {
+            /* a new namespace, the strings of the outer one come back after it */
+            start = ns_start;
+            open = ns_open;
+            ns_start = ns_num;
+            ns_open = 1;
+            ret = parse(n);
+            ns_num = ns_start;
+            ns_start = start;
+            ns_open = open;
+            return ret;
+        }
+        if (v == 25) {
+            if (parse(n) || n->major || !ns_open || n->value >= ns_num - ns_start) {
+                return -1;
+            }
+            *n = ns[ns_start + n->value];
+            return 0;
+        }
+        return parse(n);
+    }
+
+    return 0;
+}
+
+/* Messages have text keys and those of cbor_version=2 small integers */
+static const struct node* get(const struct node* map, const char* name, uint64_t key) {
+    const struct node* k;
+    size_t n;
+
+    if (map && map->major == 5) {
+        for (n = 0; n < map->count; n += 2) {
+            k = &map->kids[n];
+            if ((!k->major && k->value == key)
+                || (k->major == 3 && k->value == strlen(name) && !memcmp(k->bytes, name, k->value)))
+            {
+                return &map->kids[n + 1];
+            }
+        }
+    }
+    return 0;
+}
+
+static uint64_t uget(const struct node* map, const char* name, uint64_t key) {
+    const struct node* n = get(map, name, key);
+
+    return n && !n->major ? n->value : 0;
+}
+
+static unsigned bget(const struct node* map, const char* name, uint64_t key) {
+    const struct node* n = get(map, name, key);
+
+    return n && n->major == 7 && n->value == 21;
+}
+
+static uint8_t wire[65536 + 1024];
+static size_t wire_len;
+
+static void put(const void* data, size_t len, const char* file) {
+    if (wire_len + len > sizeof(wire)) {
+        fail(file, "message too large");
+    }
+    memcpy(wire + wire_len, data, len);
+    wire_len += len;
+}
+
+static void put16(unsigned v, const char* file) {
+    uint8_t b[2] = { v >> 8, v };
+    put(b, 2, file);
+}
+
+static void put32(uint32_t v, const char* file) {
+    uint8_t b[4] = { v >> 24, v >> 16, v >> 8, v };
+    put(b, 4, file);
+}
+
+/* Add a name given as text like dns_wire_name_text() prints it */
+static void put_name(const struct node* n, const char* file) {
+    uint8_t label[64];
+    size_t p = 0, len = 0;
+    const uint8_t* text;
+
+    if (!n || n->major != 3) {
+        fail(file, "expected a name");
+    }
+    text = n->bytes;
+    if (n->value == 1 && *text == '.') {
+        put("", 1, file);
+        return;
+    }
+    while (p < n->value) {
+        if (text[p] == '.') {
+            put(&(uint8_t){ len }, 1, file);
+            put(label, len, file);
+            len = 0;
+            p++;
+            continue;
+        }
+        if (len == 63) {
+            fail(file, "label too long");
+        }
+        if (text[p] == '\\' && p + 3 < n->value && text[p + 1] >= '0' && text[p + 1] <= '9') {
+            label[len++] = (text[p + 1] - '0') * 100 + (text[p + 2] - '0') * 10 + (text[p + 3] - '0');
+            p += 4;
+        }
+        else if (text[p] == '\\' && p + 1 < n->value) {
+            label[len++] = text[p + 1];
+            p += 2;
+        }
+        else {
+            label[len++] = text[p++];
+        }
+    }
+    if (len) {
+        fail(file, "name does not end with a dot");
+    }
+    put("", 1, file);
+}
+
+/* Add the resource records of a section, returns how many */
+static unsigned put_rrs(const struct node* list, int is_question, const char* file) {
+    const struct node *rr, *rdata;
+    size_t n;
+
+    if (!list) {
+        return 0;
+    }
+    if (list->major != 4) {
+        fail(file, "expected a list of resource records");
+    }
+    for (n = 0; n < list->count; n++) {
+        rr = &list->kids[n];
+        put_name(get(rr, "NAME", 0), file);
+        put16(uget(rr, "TYPE", 2), file);
+        put16(uget(rr, "CLASS", 1), file);
+        if (is_question) {
+            continue;
+        }
+        put32(uget(rr, "TTL", 3), file);
+        if ((rdata = get(rr, "RDATA", 4))) {
+            if (rdata->major != 2) {
+                fail(file, "expected a byte string");
+            }
+            put16(rdata->value, file);
+            put(rdata->bytes, rdata->value, file);
+        }
+        else {
+            put16(0, file);
+        }
+    }
+
+    return list->count;
+}
+
+static void print_message(const struct node* msg, size_t num, const char* file) {
+    char when[64], src[INET6_ADDRSTRLEN], dest[INET6_ADDRSTRLEN];
+    const struct node *ip, *seconds;
+    unsigned counts[4], n;
+    int64_t usec;
+    double d;
+    time_t t;
+    int af;
+
+    /* the default encoder gives the time as a double */
+    seconds = get(msg, "dateSeconds", 0);
+    if (seconds && seconds->major == 7) {
+        memcpy(&d, &seconds->value, sizeof(d));
+        usec = (int64_t)(d * 1000000 + 0.5);
+    }
+    else {
+        usec = (int64_t)uget(msg, "", 0) * 1000000 + (int64_t)(uget(msg, "", 1) / 1000);
+    }
+
+    ip = get(msg, "ip", 2);
+    if (!ip || ip->major != 4 || ip->count != 5
+        || ip->kids[1].major != 2 || ip->kids[3].major != 2
+        || ip->kids[1].value != ip->kids[3].value
+        || (ip->kids[1].value != 4 && ip->kids[1].value != 16))
+    {
+        fail(file, "bad ip");
+    }
+    af = ip->kids[1].value == 16 ? AF_INET6 : AF_INET;
+
+    wire_len = 12;
+    memset(counts, 0, sizeof(counts));
+    if (get(msg, "QNAME", 17)) {
+        put_name(get(msg, "QNAME", 17), file);
+        put16(uget(msg, "QTYPE", 19), file);
+        put16(uget(msg, "QCLASS", 18), file);
+        counts[0] = 1 + put_rrs(get(msg, "questionRRs", 20), 1, file);
+    }
+    counts[1] = put_rrs(get(msg, "answerRRs", 21), 0, file);
+    counts[2] = put_rrs(get(msg, "authorityRRs", 22), 0, file);
+    counts[3] = put_rrs(get(msg, "additionalRRs", 23), 0, file);
+
+    wire[0] = uget(msg, "ID", 3) >> 8;
+    wire[1] = uget(msg, "ID", 3);
+    wire[2] = bget(msg, "QR", 4) << 7 | (uget(msg, "Opcode", 5) & 0xf) << 3
+              | bget(msg, "AA", 6) << 2 | bget(msg, "TC", 7) << 1 | bget(msg, "RD", 8);
+    wire[3] = bget(msg, "RA", 9) << 7 | bget(msg, "AD", 10) << 5 | bget(msg, "CD", 11) << 4
+              | (uget(msg, "RCODE", 12) & 0xf);
+    for (n = 0; n < 4; n++) {
+        wire[4 + n * 2] = counts[n] >> 8;
+        wire[5 + n * 2] = counts[n];
+    }
+
+    t = (time_t)(usec / 1000000);
+    strftime(when, sizeof when, "%Y-%m-%d %T", gmtime(&t));
+    printf("[%lu] %s.%06lu [#%lu %s] \\\n",
+        (unsigned long)wire_len, when, (unsigned long)(usec % 1000000),
+        (unsigned long)num, file);
+
+    if (!inet_ntop(af, ip->kids[1].bytes, src, sizeof src)) {
+        snprintf(src, sizeof src, "?");
+    }
+    if (!inet_ntop(af, ip->kids[3].bytes, dest, sizeof dest)) {
+        snprintf(dest, sizeof dest, "?");
+    }
+    printf("\t[%s].%u [%s].%u ", src, (unsigned)ip->kids[2].value, dest, (unsigned)ip->kids[4].value);
+    dump_dns(wire, wire_len, stdout, "\\\n\t");
+    putchar('\n');
+}
+
+static size_t read_file(const char* file, size_t num) {
+    FILE* fp;
+    uint8_t* data = 0;
+    size_t size = 0, used = 0, n, m;
+    struct node root;
+    const struct node* kid;
+
+    if (!(fp = fopen(file, "r"))) {
+        fail(file, strerror(errno));
+    }
+    for (;;) {
+        if (used == size) {
+            size = size ? size * 2 : 64 * 1024;
+            if (!(data = realloc(data, size))) {
+                fail(file, strerror(errno));
+            }
+        }
+        if (!(n = fread(data + used, 1, size - used, fp))) {
+            break;
+        }
+        used += n;
+    }
+    fclose(fp);
+
+    cur = data;
+    end = data + used;
+    if (parse(&root) || cur != end) {
+        fail(file, "bad CBOR");
+    }
+    if (root.major != 4) {
+        fail(file, "not an array of messages");
+    }
+
+    /* cbor_version=2 has the messages in a namespace per chunk */
+    for (n = 0; n < root.count; n++) {
+        kid = &root.kids[n];
+        if (kid->major == 4) {
+            for (m = 0; m < kid->count; m++) {
+                print_message(&kid->kids[m], num++, file);
+            }
+        }
+        else {
+            print_message(kid, num++, file);
+        }
+    }
+
+    return num;
+}
+
+int main(int argc, char* argv[]) {
+    size_t num = 0;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s file ...\n", progname);
+        exit(1);
+    }
+
+    for (i = 1; i < argc; i++) {
+        num = read_file(argv[i], num);
+    }
+
+    return 0;
+}
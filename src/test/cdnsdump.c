@@ -0,0 +1,533 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Decode the C-DNS files written by dnscap -F cdns back into DNS messages
+ * and print them like cdsdump so the test can compare them with dns.gold,
+ * or with -l the original counts and size of the slimmed responses.
+ * Only what dnscap writes is understood, the CBOR is read with a small
+ * reader of its own so the test does not need more than dnscap does.
+ */
+
+#include "config.h"
+
+#include "dnscap_common.h"
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dump_dns.h"
+
+static const char* progname = "cdnsdump";
+
+struct node {
+    int major;
+    uint64_t value;
+    const uint8_t* bytes;
+    struct node* kids;
+    size_t count;
+};
+
+struct message {
+    int64_t usec;
+    size_t seq;
+    int is_v6;
+    uint8_t src[16], dest[16];
+    unsigned src_port, dest_port;
+    uint8_t* payload;
+    size_t payload_len, size;
+    int slimmed;
+    unsigned original_counts[3];
+};
+
+static const uint8_t *cur, *end;
+static struct message* messages = 0;
+static size_t messages_num = 0, messages_size = 0;
+
+static void fail(const char* file, const char* msg) {
+    fprintf(stderr, "%s: %s: %s\n", progname, file, msg);
+    exit(1);
+}
+
+static int parse(struct node* n) {
+    uint64_t v = 0, want;
+    size_t size = 0;
+    int ai, i;
+
+    memset(n, 0, sizeof(*n));
+    if (cur >= end) {
+        return -1;
+    }
+    n->major = *cur >> 5;
+    ai = *cur++ & 31;
+    if (ai < 24) {
+        v = ai;
+    }
+    else if (ai < 28) {
+        if (end - cur < 1 << (ai - 24)) {
+            return -1;
+        }
+        for (i = 0; i < 1 << (ai - 24); i++) {
+            v = v << 8 | *cur++;
+        }
+    }
+    else if (ai != 31 || n->major < 4 || n->major > 5) {
+        return -1;
+    }
+    n->value = v;
+
+    switch (n->major) {
+    case 2:
+    case 3:
+        if ((uint64_t)(end - cur) < v) {
+            return -1;
+        }
+        n->bytes = cur;
+        cur += v;
+        break;
+    case 4:
+    case 5:
+        want = ai == 31 ? (uint64_t)-1 : n->major == 5 ? v * 2 : v;
+        while (n->count < want) {
+            if (ai == 31) {
+                if (cur >= end) {
+                    return -1;
+                }
+                if (*cur == 0xff) {
+                    cur++;
+                    break;
+                }
+            }
+            if (n->count == size) {
+                size = size ? size * 2 : 8;
+                if (!(n->kids = realloc(n->kids, size * sizeof(*n->kids)))) {
+                    return -1;
+                }
+            }
+            if (parse(&n->kids[n->count++])) {
+                return -1;
+            }
+        }
+        if (n->major == 5 && n->count & 1) {
+            return -1;
+        }
+        break;
+    case 6:
+        return parse(n);
+    }
+
+    return 0;
+}
+
+static const struct node* get(const struct node* map, uint64_t key) {
+    size_t n;
+
+    if (map && map->major == 5) {
+        for (n = 0; n < map->count; n += 2) {
+            if (!map->kids[n].major && map->kids[n].value == key) {
+                return &map->kids[n + 1];
+            }
+        }
+    }
+    return 0;
+}
+
+static uint64_t uget(const struct node* map, uint64_t key, uint64_t def) {
+    const struct node* n = get(map, key);
+
+    return n && !n->major ? n->value : def;
+}
+
+/* The original counts dnscap keeps for a slimmed response under the key -1 */
+static const struct node* original_counts(const struct node* item) {
+    size_t n;
+
+    for (n = 0; n < item->count; n += 2) {
+        if (item->kids[n].major == 1 && !item->kids[n].value) {
+            if (item->kids[n + 1].major != 4 || item->kids[n + 1].count != 3) {
+                return 0;
+            }
+            return &item->kids[n + 1];
+        }
+    }
+    return 0;
+}
+
+static const struct node* at(const struct node* array, uint64_t idx, const char* file) {
+    if (!array || array->major != 4 || idx >= array->count) {
+        fail(file, "bad table index");
+    }
+    return &array->kids[idx];
+}
+
+static uint8_t wire[65536 + 1024];
+static size_t wire_len;
+
+static void put(const void* data, size_t len, const char* file) {
+    if (wire_len + len > sizeof(wire)) {
+        fail(file, "message too large");
+    }
+    memcpy(wire + wire_len, data, len);
+    wire_len += len;
+}
+
+static void put16(unsigned v, const char* file) {
+    uint8_t b[2] = { v >> 8, v };
+    put(b, 2, file);
+}
+
+static void put32(uint32_t v, const char* file) {
+    uint8_t b[4] = { v >> 24, v >> 16, v >> 8, v };
+    put(b, 4, file);
+}
+
+static void put_bytes(const struct node* n, const char* file) {
+    if (n->major != 2) {
+        fail(file, "expected a byte string");
+    }
+    put(n->bytes, n->value, file);
+}
+
+static void put_question(const struct node* tables, uint64_t name, uint64_t classtype, const char* file) {
+    const struct node* ct = at(get(tables, 1), classtype, file);
+
+    put_bytes(at(get(tables, 2), name, file), file);
+    put16(uget(ct, 0, 0), file);
+    put16(uget(ct, 1, 0), file);
+}
+
+/* Add the questions or resource records of a list, returns how many */
+static unsigned put_list(const struct node* tables, const struct node* extended, int section, const char* file) {
+    const struct node *list, *entry, *ct, *rdata;
+    size_t n;
+
+    if (!get(extended, section)) {
+        return 0;
+    }
+    list = at(get(tables, section ? 6 : 4), uget(extended, section, 0), file);
+    for (n = 0; n < list->count; n++) {
+        entry = at(get(tables, section ? 7 : 5), list->kids[n].value, file);
+        if (!section) {
+            put_question(tables, uget(entry, 0, 0), uget(entry, 1, 0), file);
+            continue;
+        }
+        ct = at(get(tables, 1), uget(entry, 1, 0), file);
+        rdata = at(get(tables, 2), uget(entry, 3, 0), file);
+        put_bytes(at(get(tables, 2), uget(entry, 0, 0), file), file);
+        put16(uget(ct, 0, 0), file);
+        put16(uget(ct, 1, 0), file);
+        put32(uget(entry, 2, 0), file);
+        put16(rdata->value, file);
+        put_bytes(rdata, file);
+    }
+
+    return list->count;
+}
+
+static void add_message(int64_t usec, size_t size, int is_v6, const uint8_t* src, const uint8_t* dest, unsigned src_port, unsigned dest_port, const char* file) {
+    struct message* m;
+
+    if (messages_num == messages_size) {
+        messages_size = messages_size ? messages_size * 2 : 1024;
+        if (!(messages = realloc(messages, messages_size * sizeof(*messages)))) {
+            fail(file, strerror(errno));
+        }
+    }
+    m = &messages[messages_num];
+    memset(m, 0, sizeof(*m));
+    m->usec = usec;
+    m->seq = messages_num++;
+    m->size = size;
+    m->is_v6 = is_v6;
+    memcpy(m->src, src, is_v6 ? 16 : 4);
+    memcpy(m->dest, dest, is_v6 ? 16 : 4);
+    m->src_port = src_port;
+    m->dest_port = dest_port;
+    if (!(m->payload = malloc(wire_len))) {
+        fail(file, strerror(errno));
+    }
+    memcpy(m->payload, wire, wire_len);
+    m->payload_len = wire_len;
+}
+
+static void addr(const struct node* tables, uint64_t idx, int is_v6, uint8_t* out, const char* file) {
+    const struct node* a = at(get(tables, 0), idx, file);
+
+    if (a->major != 2 || a->value != (is_v6 ? 16 : 4)) {
+        fail(file, "bad address");
+    }
+    memcpy(out, a->bytes, a->value);
+}
+
+/*
+ * Rebuild the query or the response of an item, the first question comes
+ * from the item and the query OPT from the signature.
+ */
+static void item_message(const struct node* tables, const struct node* item, const struct node* sig, int64_t usec, int is_response, const char* file) {
+    unsigned flags = uget(sig, 4, 0), dns_flags = uget(sig, 6, 0), rcode, counts[4], n;
+    int is_v6 = uget(sig, 2, 0) & 1;
+    uint8_t client[16], server[16];
+    const struct node *rdata, *original;
+
+    addr(tables, uget(item, 1, 0), is_v6, client, file);
+    addr(tables, uget(sig, 0, 0), is_v6, server, file);
+    if (is_response) {
+        dns_flags >>= 8;
+        rcode = uget(sig, 16, 0);
+    }
+    else {
+        rcode = uget(sig, 7, 0);
+    }
+
+    wire_len = 12;
+    memset(counts, 0, sizeof(counts));
+    if (!(flags & (is_response ? 0x20 : 0x10)) && get(item, 7)) {
+        put_question(tables, uget(item, 7, 0), uget(sig, 8, 0), file);
+        counts[0]++;
+    }
+    for (n = 0; n < 4; n++) {
+        counts[n] += put_list(tables, get(item, is_response ? 12 : 11), n, file);
+    }
+    if (!is_response && flags & 0x4) {
+        rdata = at(get(tables, 2), uget(sig, 15, 0), file);
+        put("", 1, file);
+        put16(41, file);
+        put16(uget(sig, 14, 0), file);
+        put32((rcode >> 4) << 24 | uget(sig, 13, 0) << 16 | (dns_flags & 0x80) << 8, file);
+        put16(rdata->value, file);
+        put_bytes(rdata, file);
+        counts[3]++;
+    }
+
+    /* qr-dns-flags are CD, AD, Z, RA, RD, TC, AA and DO from bit 0 */
+    wire[0] = uget(item, 3, 0) >> 8;
+    wire[1] = uget(item, 3, 0);
+    wire[2] = is_response << 7 | (uget(sig, 5, 0) & 0xf) << 3 | (dns_flags >> 4 & 7);
+    wire[3] = (dns_flags & 0xf) << 4 | (rcode & 0xf);
+    for (n = 0; n < 4; n++) {
+        wire[4 + n * 2] = counts[n] >> 8;
+        wire[5 + n * 2] = counts[n];
+    }
+
+    if (is_response) {
+        add_message(usec, uget(item, 9, 0), is_v6, server, client, uget(sig, 1, 0), uget(item, 2, 0), file);
+        if ((original = original_counts(item))) {
+            messages[messages_num - 1].slimmed = 1;
+            for (n = 0; n < 3; n++) {
+                messages[messages_num - 1].original_counts[n] = original->kids[n].value;
+            }
+        }
+    }
+    else {
+        add_message(usec, uget(item, 8, 0), is_v6, client, server, uget(item, 2, 0), uget(sig, 1, 0), file);
+    }
+}
+
+static void read_block(const struct node* block, uint64_t ticks, const char* file) {
+    const struct node *earliest = get(get(block, 0), 0), *tables = get(block, 2), *list, *item, *sig, *data;
+    int64_t start, usec;
+    unsigned flags;
+    size_t n;
+
+    if (!earliest || earliest->major != 4 || earliest->count != 2) {
+        fail(file, "block has no earliest time");
+    }
+    start = (int64_t)earliest->kids[0].value * 1000000 + (int64_t)(earliest->kids[1].value * 1000000 / ticks);
+
+    if ((list = get(block, 3))) {
+        for (n = 0; n < list->count; n++) {
+            item = &list->kids[n];
+            sig = at(get(tables, 3), uget(item, 4, 0), file);
+            flags = uget(sig, 4, 0);
+            usec = start + (int64_t)(uget(item, 0, 0) * 1000000 / ticks);
+            if (flags & 0x1) {
+                item_message(tables, item, sig, usec, 0, file);
+            }
+            if (flags & 0x2) {
+                data = get(item, 6);
+                if (data && data->major == 1) {
+                    usec -= (int64_t)((data->value + 1) * 1000000 / ticks);
+                }
+                else if (data) {
+                    usec += (int64_t)(data->value * 1000000 / ticks);
+                }
+                item_message(tables, item, sig, usec, 1, file);
+            }
+        }
+    }
+
+    if ((list = get(block, 5))) {
+        for (n = 0; n < list->count; n++) {
+            uint8_t client[16], server[16];
+            int is_v6;
+
+            item = &list->kids[n];
+            data = at(get(tables, 8), uget(item, 3, 0), file);
+            is_v6 = uget(data, 2, 0) & 1;
+            addr(tables, uget(item, 1, 0), is_v6, client, file);
+            addr(tables, uget(data, 0, 0), is_v6, server, file);
+            wire_len = 0;
+            put_bytes(get(data, 3), file);
+            add_message(start + (int64_t)(uget(item, 0, 0) * 1000000 / ticks), wire_len, is_v6, client, server, uget(item, 2, 0), uget(data, 1, 0), file);
+        }
+    }
+}
+
+static int by_time(const void* a, const void* b) {
+    const struct message *x = a, *y = b;
+
+    if (x->usec != y->usec) {
+        return x->usec < y->usec ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void read_file(const char* file) {
+    FILE* fp;
+    uint8_t* data = 0;
+    size_t size = 0, used = 0, n;
+    struct node root;
+    const struct node* params;
+    uint64_t ticks;
+
+    if (!(fp = fopen(file, "r"))) {
+        fail(file, strerror(errno));
+    }
+    for (;;) {
+        if (used == size) {
+            size = size ? size * 2 : 64 * 1024;
+            if (!(data = realloc(data, size))) {
+                fail(file, strerror(errno));
+            }
+        }
+        if (!(n = fread(data + used, 1, size - used, fp))) {
+            break;
+        }
+        used += n;
+    }
+    fclose(fp);
+
+    cur = data;
+    end = data + used;
+    if (parse(&root) || cur != end) {
+        fail(file, "bad CBOR");
+    }
+    if (root.major != 4 || root.count != 3
+        || root.kids[0].major != 3 || root.kids[0].value != 5 || memcmp(root.kids[0].bytes, "C-DNS", 5)
+        || root.kids[2].major != 4)
+    {
+        fail(file, "not a C-DNS file");
+    }
+    if (uget(&root.kids[1], 0, 0) != 1) {
+        fail(file, "unsupported C-DNS version");
+    }
+    params = get(&root.kids[1], 3);
+    ticks = uget(get(at(params, 0, file), 0), 0, 1000000);
+    if (!ticks) {
+        fail(file, "bad ticks per second");
+    }
+
+    for (n = 0; n < root.kids[2].count; n++) {
+        if (uget(get(&root.kids[2].kids[n], 0), 1, 0)) {
+            fail(file, "only one block parameters supported");
+        }
+        read_block(&root.kids[2].kids[n], ticks, file);
+    }
+}
+
+static void print_text(const struct message* message, size_t num, const char* file) {
+    char when[64], src[INET6_ADDRSTRLEN], dest[INET6_ADDRSTRLEN];
+    time_t t = (time_t)(message->usec / 1000000);
+
+    strftime(when, sizeof when, "%Y-%m-%d %T", gmtime(&t));
+    printf("[%lu] %s.%06lu [#%lu %s] \\\n",
+        (unsigned long)message->size, when, (unsigned long)(message->usec % 1000000),
+        (unsigned long)num, file);
+
+    if (!inet_ntop(message->is_v6 ? AF_INET6 : AF_INET, message->src, src, sizeof src)) {
+        snprintf(src, sizeof src, "?");
+    }
+    if (!inet_ntop(message->is_v6 ? AF_INET6 : AF_INET, message->dest, dest, sizeof dest)) {
+        snprintf(dest, sizeof dest, "?");
+    }
+    printf("\t[%s].%u [%s].%u ", src, message->src_port, dest, message->dest_port);
+    dump_dns(message->payload, message->payload_len, stdout, "\\\n\t");
+    putchar('\n');
+}
+
+/* The ID, original counts and size of a slimmed response */
+static void print_slim(const struct message* message) {
+    if (message->slimmed && message->payload_len >= 2) {
+        printf("%u %u %u %u %lu\n", message->payload[0] << 8 | message->payload[1],
+            message->original_counts[0], message->original_counts[1], message->original_counts[2],
+            (unsigned long)message->size);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t n, total = 0;
+    int i = 1, slim = 0;
+
+    if (argc > 1 && !strcmp(argv[1], "-l")) {
+        slim = 1;
+        i++;
+    }
+    if (i >= argc) {
+        fprintf(stderr, "usage: %s [-l] file ...\n", progname);
+        exit(1);
+    }
+
+    /* messages are printed in time order per file as a query and its response share an item */
+    for (; i < argc; i++) {
+        messages_num = 0;
+        read_file(argv[i]);
+        qsort(messages, messages_num, sizeof(*messages), by_time);
+        for (n = 0; n < messages_num; n++) {
+            if (slim) {
+                print_slim(&messages[n]);
+            }
+            else {
+                print_text(&messages[n], total++, argv[i]);
+            }
+            free(messages[n].payload);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2016, OARC, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Read the dnstap Frame Streams written by dnscap -F dnstap, from files or
+ * as the reader end of a Unix socket with -u, and print the DNS messages
+ * like cdsdump so the test can compare them with dns.gold.  Only what
+ * dnscap writes is understood, the protobuf is read with a small reader of
+ * its own so the test does not need more than dnscap does.
+ */
+
+#include "config.h"
+
+#include "dnscap_common.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dump_dns.h"
+
+#define CONTENT_TYPE "protobuf:dnstap.Dnstap"
+
+#define CONTROL_ACCEPT  1
+#define CONTROL_START   2
+#define CONTROL_STOP    3
+#define CONTROL_READY   4
+#define CONTROL_FINISH  5
+
+static const char* progname = "dnstapdump";
+static size_t total = 0;
+
+static void fail(const char* where, const char* msg) {
+    fprintf(stderr, "%s: %s: %s\n", progname, where, msg);
+    exit(1);
+}
+
+static uint32_t be32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void get(int fd, uint8_t* data, size_t len, const char* where) {
+    ssize_t n;
+
+    while (len) {
+        if ((n = read(fd, data, len)) < 0) {
+            fail(where, strerror(errno));
+        }
+        if (!n) {
+            fail(where, "unexpected end of stream");
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static void put_control(int fd, unsigned type, const char* where) {
+    uint8_t frame[20 + sizeof(CONTENT_TYPE) - 1];
+    size_t len = 4;
+
+    if (type == CONTROL_ACCEPT) {
+        frame[12] = frame[13] = frame[14] = 0;
+        frame[15] = 1;
+        frame[16] = frame[17] = frame[18] = 0;
+        frame[19] = sizeof(CONTENT_TYPE) - 1;
+        memcpy(frame + 20, CONTENT_TYPE, sizeof(CONTENT_TYPE) - 1);
+        len += 8 + sizeof(CONTENT_TYPE) - 1;
+    }
+    memset(frame, 0, 12);
+    frame[7] = len;
+    frame[11] = type;
+    if (write(fd, frame, 8 + len) != (ssize_t)(8 + len)) {
+        fail(where, strerror(errno));
+    }
+}
+
+static int has_content_type(const uint8_t* p, size_t len) {
+    size_t off, flen;
+
+    for (off = 4; off + 8 <= len; off += 8 + flen) {
+        flen = be32(p + off + 4);
+        if (flen > len - off - 8) {
+            break;
+        }
+        if (be32(p + off) == 1 && flen == sizeof(CONTENT_TYPE) - 1 && !memcmp(p + off + 8, CONTENT_TYPE, flen)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Read one frame into *data, returns the control type or 0 for a data frame */
+static unsigned get_frame(int fd, uint8_t** data, size_t* len, const char* where) {
+    static uint8_t* buf = 0;
+    static size_t size = 0;
+    uint8_t head[4];
+    unsigned control = 0;
+
+    get(fd, head, 4, where);
+    if (!(*len = be32(head))) {
+        get(fd, head, 4, where);
+        *len = be32(head);
+        if (*len < 4 || *len > 512) {
+            fail(where, "bad control frame");
+        }
+        control = 1;
+    }
+    if (*len > size) {
+        size = *len;
+        if (!(buf = realloc(buf, size))) {
+            fail(where, strerror(errno));
+        }
+    }
+    get(fd, buf, *len, where);
+    *data = buf;
+    if (control) {
+        control = be32(buf);
+        if (!control
+            || ((control == CONTROL_START || control == CONTROL_READY) && !has_content_type(buf, *len)))
+        {
+            fail(where, "bad control frame");
+        }
+    }
+    return control;
+}
+
+static uint64_t varint(const uint8_t** p, const uint8_t* end, const char* where) {
+    uint64_t v = 0;
+    unsigned shift = 0;
+
+    while (*p < end && shift < 64) {
+        v |= (uint64_t)(**p & 0x7f) << shift;
+        if (!(*(*p)++ & 0x80)) {
+            return v;
+        }
+        shift += 7;
+    }
+    fail(where, "bad protobuf");
+    return 0;
+}
+
+struct field {
+    int present;
+    uint64_t value;
+    const uint8_t* bytes;
+};
+
+/* Read the fields 1 to 15 of a protobuf message, later ones are ignored */
+static void fields(const uint8_t* p, const uint8_t* end, struct field* f, const char* where) {
+    uint64_t key, len;
+    unsigned n;
+
+    memset(f, 0, 16 * sizeof(*f));
+    while (p < end) {
+        key = varint(&p, end, where);
+        n = key >> 3 < 16 ? key >> 3 : 0;
+        f[n].present = 1;
+        switch (key & 7) {
+        case 0:
+            f[n].value = varint(&p, end, where);
+            break;
+        case 2:
+            len = varint(&p, end, where);
+            if (len > (uint64_t)(end - p)) {
+                fail(where, "bad protobuf");
+            }
+            f[n].bytes = p;
+            f[n].value = len;
+            p += len;
+            break;
+        case 5:
+            if (end - p < 4) {
+                fail(where, "bad protobuf");
+            }
+            f[n].value = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+            p += 4;
+            break;
+        default:
+            fail(where, "unexpected protobuf wire type");
+        }
+    }
+}
+
+static void print_dnstap(const uint8_t* data, size_t len, const char* where) {
+    struct field d[16], m[16];
+    const struct field *src, *dest, *src_port, *dest_port, *sec, *nsec, *msg;
+    char when[64], src_text[INET6_ADDRSTRLEN], dest_text[INET6_ADDRSTRLEN];
+    time_t t;
+    int af;
+
+    fields(data, data + len, d, where);
+    if (!d[15].present || d[15].value != 1 || !d[14].bytes) {
+        fail(where, "not a dnstap message");
+    }
+    fields(d[14].bytes, d[14].bytes + d[14].value, m, where);
+    if (!m[1].present || !m[2].present) {
+        fail(where, "message without type or socket family");
+    }
+    af = m[2].value == 2 ? AF_INET6 : AF_INET;
+
+    /* odd types are queries, sent from the query address */
+    if (m[1].value & 1) {
+        src = &m[4], src_port = &m[6], dest = &m[5], dest_port = &m[7];
+        sec = &m[8], nsec = &m[9], msg = &m[10];
+    }
+    else {
+        src = &m[5], src_port = &m[7], dest = &m[4], dest_port = &m[6];
+        sec = &m[12], nsec = &m[13], msg = &m[14];
+    }
+    if (!src->bytes || !dest->bytes || src->value != (af == AF_INET ? 4 : 16) || dest->value != src->value
+        || !sec->present || !nsec->present || !msg->bytes)
+    {
+        fail(where, "incomplete message");
+    }
+
+    t = (time_t)sec->value;
+    strftime(when, sizeof when, "%Y-%m-%d %T", gmtime(&t));
+    printf("[%lu] %s.%06lu [#%lu %s] \\\n",
+        (unsigned long)msg->value, when, (unsigned long)(nsec->value / 1000),
+        (unsigned long)total++, where);
+    if (!inet_ntop(af, src->bytes, src_text, sizeof src_text)) {
+        snprintf(src_text, sizeof src_text, "?");
+    }
+    if (!inet_ntop(af, dest->bytes, dest_text, sizeof dest_text)) {
+        snprintf(dest_text, sizeof dest_text, "?");
+    }
+    printf("\t[%s].%u [%s].%u ", src_text, (unsigned)src_port->value, dest_text, (unsigned)dest_port->value);
+    dump_dns(msg->bytes, msg->value, stdout, "\\\n\t");
+    putchar('\n');
+}
+
+/* Print the data frames up to STOP */
+static void read_frames(int fd, const char* where) {
+    uint8_t* data;
+    size_t len;
+    unsigned control;
+
+    while ((control = get_frame(fd, &data, &len, where)) != CONTROL_STOP) {
+        if (control) {
+            fail(where, "unexpected control frame");
+        }
+        print_dnstap(data, len, where);
+    }
+}
+
+static void read_file(const char* file) {
+    uint8_t *data, byte;
+    size_t len;
+    int fd;
+
+    if ((fd = open(file, O_RDONLY)) < 0) {
+        fail(file, strerror(errno));
+    }
+    if (get_frame(fd, &data, &len, file) != CONTROL_START) {
+        fail(file, "no START frame");
+    }
+    read_frames(fd, file);
+    if (read(fd, &byte, 1) > 0) {
+        fail(file, "data after STOP frame");
+    }
+    close(fd);
+}
+
+/* Accept one writer on the socket and do the bidirectional handshake */
+static void read_socket(const char* path) {
+    struct sockaddr_un addr;
+    uint8_t* data;
+    size_t len;
+    int s, fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fail(path, "path too long");
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+        || bind(s, (struct sockaddr*)&addr, sizeof(addr))
+        || listen(s, 1))
+    {
+        fail(path, strerror(errno));
+    }
+    /* tell the test it can connect */
+    fprintf(stderr, "%s: listening on %s\n", progname, path);
+    if ((fd = accept(s, 0, 0)) < 0) {
+        fail(path, strerror(errno));
+    }
+    if (get_frame(fd, &data, &len, path) != CONTROL_READY) {
+        fail(path, "no READY frame");
+    }
+    put_control(fd, CONTROL_ACCEPT, path);
+    if (get_frame(fd, &data, &len, path) != CONTROL_START) {
+        fail(path, "no START frame");
+    }
+    read_frames(fd, path);
+    put_control(fd, CONTROL_FINISH, path);
+    close(fd);
+    close(s);
+    unlink(path);
+}
+
+int main(int argc, char* argv[]) {
+    int i;
+
+    if (argc == 3 && !strcmp(argv[1], "-u")) {
+        read_socket(argv[2]);
+        return 0;
+    }
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s file ... | -u socket\n", progname);
+        exit(1);
+    }
+    for (i = 1; i < argc; i++) {
+        read_file(argv[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+# Sourced by the tests that check what dnscap -g, cdsdump and the other
+# dump tools print against dns.gold.  The header line of each message
+# holds the capture file and interface, only the rest is compared.
+
+# print a dump without the capture file and interface of each message
+strip_header() {
+    sed -e 's/^\[[0-9]*\] \(.*\) \[#[0-9]* .*\] \\$/\1/' "$@"
+}
+
+# compare a dump with dns.gold
+compare_gold() {
+    strip_header "$srcdir/dns.gold" >dns.gold.cmp
+    strip_header "$1" >"$1.cmp"
+    diff "$1.cmp" dns.gold.cmp
+}
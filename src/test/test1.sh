@@ -3,3 +3,8 @@
 ../dnscap -g -r dns.pcap.dist 2>dns.out
 
 diff dns.out "$srcdir/dns.gold"
+
+# a response with an IPv4 total length of 512
+../dnscap -g -r iplen.pcap.dist 2>iplen.out
+
+diff iplen.out "$srcdir/iplen.gold"
@@ -0,0 +1,13 @@
+#!/bin/sh -xe
+
+# 16 copies of the records, large enough to be split in 4 ranges
+head -c 24 dns.pcap.dist >mmap.16x.pcap
+for n in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16; do
+    tail -c +25 dns.pcap.dist >>mmap.16x.pcap
+done
+
+../dnscap -g -r mmap.16x.pcap 2>mmap.libpcap
+../dnscap -g -r mmap.16x.pcap -o offline_mmap=yes 2>mmap.mmap
+diff mmap.mmap mmap.libpcap
+../dnscap -g -r mmap.16x.pcap -o offline_threads=4 2>mmap.threads
+diff mmap.threads mmap.libpcap
@@ -0,0 +1,12 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+# queries and responses written to two files are merged back in time order
+rm -f merge.q.* merge.r.*
+../dnscap -r dns.pcap.dist -s i -w merge.q
+../dnscap -r dns.pcap.dist -s r -w merge.r
+../dnscap -g -r merge.r.* -r merge.q.* 2>merge.g
+compare_gold merge.g
+../dnscap -g -r merge.r.* -r merge.q.* -o offline_mmap=yes 2>merge.mmap.g
+diff merge.mmap.g merge.g
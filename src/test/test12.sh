@@ -0,0 +1,16 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+# a compressed capture reads the same as the plain one
+rm -f decompress.*
+gzip -c dns.pcap.dist >decompress.pcap.gz
+../dnscap -g -r decompress.pcap.gz 2>decompress.g
+compare_gold decompress.g
+
+# and merges with plain files
+../dnscap -r dns.pcap.dist -s i -w decompress.q
+../dnscap -r dns.pcap.dist -s r -w decompress.r
+gzip decompress.q.*
+../dnscap -g -r decompress.r.* -r decompress.q.* 2>decompress.merge.g
+compare_gold decompress.merge.g
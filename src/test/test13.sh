@@ -0,0 +1,71 @@
+#!/bin/sh -xe
+
+# the answer, authority and additional counts and the DNS length of every
+# response in dns.gold, the packets are IPv4 with 28 bytes of IP and UDP
+awk '
+function flush() {
+    if (rec == "") {
+        return
+    }
+    n = split(rec, t, " ")
+    for (i = 1; i <= n && t[i] != "dns"; i++);
+    split(t[i + 1], h, ",")
+    if (h[4] ~ /qr/) {
+        i += 2
+        for (s = 0; s < 4; s++) {
+            c[s] = t[i]
+            i += 1 + t[i]
+        }
+        print h[3], c[1], c[2], c[3], len - 28
+    }
+    rec = ""
+}
+/^\[/ { flush(); len = substr($1, 2, length($1) - 2) }
+{ sub(/ \\$/, ""); rec = rec " " $0 }
+END { flush() }
+' "$srcdir/dns.gold" >slim.gold
+
+# slimmed responses keep them in cds, if it is built in
+rm -f slim.out.*
+if ../dnscap -r dns.pcap.dist -F cds -w slim.out -o slim=cds 2>slim.err; then
+    ../cdsdump -j slim.out.* >slim.json
+    sed -n -e 's/.*"slim":{"length":\([0-9]*\),"ancount":\([0-9]*\),"nscount":\([0-9]*\),"arcount":\([0-9]*\)},"dns":{"id":\([0-9]*\),.*/\5 \2 \3 \4 \1/p' slim.json >slim.cmp
+    diff slim.cmp slim.gold
+
+    # and with the workers
+    rm -f slim.out.*
+    ../dnscap -r dns.pcap.dist -F cds -w slim.out -o slim=cds -o cds_workers=2 -o cds_segment_messages=10
+    ../cdsdump -j slim.out.* >slim.workers.json
+    diff slim.workers.json slim.json
+
+    # the sections are gone, the message is what is left
+    test "`grep -c '"dns":{[^}]*"qr":1,[^}]*"ancount":0,"nscount":0,"arcount":0' slim.json`" = 41
+else
+    grep -q "no built in cds support" slim.err
+fi
+
+# pcapng has them in a comment on the packet
+rm -f slim.out.*
+../dnscap -r dns.pcap.dist -F pcapng -w slim.out -o slim=pcapng
+grep -a -o 'slim: ancount=[0-9]* nscount=[0-9]* arcount=[0-9]*' slim.out.* | sed -e 's/[a-z:]*=*//g' -e 's/^ *//' >slim.pcapng
+awk '{ print $2, $3, $4 }' slim.gold | diff slim.pcapng -
+
+# arrow has the original size and counts in the row of a response
+rm -f slim.out.*
+../dnscap -r dns.pcap.dist -F arrow -w slim.out -o slim=arrow
+./arrowdump -l slim.out.* | awk '$6 != "-" { print $3, $6, $7, $8, $5 }' >slim.arrow
+diff slim.arrow slim.gold
+
+# cdns has them in the item of a response
+rm -f slim.out.*
+../dnscap -r dns.pcap.dist -F cdns -w slim.out -o slim=cdns
+./cdnsdump -l slim.out.* >slim.cdns
+diff slim.cdns slim.gold
+
+# dnstap has them in the extra field of the response
+rm -f slim.out.*
+../dnscap -r dns.pcap.dist -F dnstap -w slim.out -o slim=dnstap
+grep -a -o 'slim: length=[0-9]* ancount=[0-9]* nscount=[0-9]* arcount=[0-9]*' slim.out.* | sed -e 's/[a-z:]*=*//g' -e 's/^ *//' >slim.dnstap
+awk '{ print $5, $2, $3, $4 }' slim.gold | diff slim.dnstap -
+./dnstapdump slim.out.* >slim.dnstapdump
+test "`grep -c '^\[' slim.dnstapdump`" = 82
@@ -0,0 +1,39 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+# the dns.gold messages at or after time $1 and before $2
+gold_range() {
+    awk -v from="$1" -v to="$2" '/^\[/ { keep = $3 >= from && $3 < to } keep' "$srcdir/dns.gold" |
+        strip_header
+}
+
+# the messages of a dump
+dump_g() {
+    ../dnscap -g -r "$1" 2>&1 | strip_header
+}
+
+# the 4th response within the hour triggers, the messages of the last
+# 9 seconds before it and the 45 seconds after it are dumped
+rm -f ring.out.*
+../dnscap -r dns.pcap.dist -w ring.out -o ring_size=1000000 -o ring_seconds=9 \
+    -o ring_post_seconds=45 -o ring_rcode=0,4,3600
+test "`ls ring.out.*`" = "ring.out.20161020.152310.323399.rcode"
+dump_g ring.out.20161020.152310.323399.rcode >ring.cmp
+gold_range 15:23:02 15:23:55 >ring.gold
+diff ring.cmp ring.gold
+
+# the first PTR triggers, the next extends the dump until the following
+# message is more than 5 seconds later and the PTR after that starts the
+# next dump with everything that is left in the ring
+rm -f ring.out.*
+../dnscap -r dns.pcap.dist -w ring.out -o ring_size=1000000 -o ring_regex=yes \
+    -o ring_post_seconds=5 -x 'in-addr'
+test -f ring.out.20161020.152301.082865.regex
+test -f ring.out.20161020.152310.328324.regex
+dump_g ring.out.20161020.152301.082865.regex >ring.cmp
+gold_range 15:23:01 15:23:10 >ring.gold
+diff ring.cmp ring.gold
+dump_g ring.out.20161020.152310.328324.regex >ring.cmp
+gold_range 15:23:01 15:23:11 >ring.gold
+diff ring.cmp ring.gold
@@ -0,0 +1,42 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+# the client address and DNS id of every message in a -g dump
+clients() {
+    awk '/^\t\[/ { c = ($2 ~ /\.53$/) ? $1 : $2; sub(/\.[0-9]*$/, "", c) }
+        /^\tdns / { split($2, h, ","); print c, h[3] }' "$@"
+}
+
+strip_header "$srcdir/shard.gold" >shard.gold.cmp
+
+# every query and its response land in the same shard as the rest of
+# their client and all shards together are the input
+rm -f shard.out.* shard.clients
+../dnscap -r "$srcdir/shard.pcap" -w shard.out -o shard_key=client -o shard_count=3
+for n in 0 1 2; do
+    ../dnscap -g -r shard.out.$n.* 2>shard.$n.g
+    clients shard.$n.g | sed -e "s/\$/ $n/" >>shard.clients
+done
+test -z "`awk '{ print $1, $3 }' shard.clients | sort -u | awk '{ print $1 }' | uniq -d`"
+test -z "`sort shard.clients | uniq -c | awk '$1 != 2'`"
+test "`awk '{ print $3 }' shard.clients | sort -u | wc -l`" -gt 1
+../dnscap -g -r shard.out.0.* -r shard.out.1.* -r shard.out.2.* 2>shard.g
+strip_header shard.g >shard.cmp
+diff shard.cmp shard.gold.cmp
+
+# the same by responder, dns.pcap has only one
+rm -f shard.out.*
+../dnscap -r dns.pcap.dist -w shard.out -o shard_key=responder -o shard_count=2
+../dnscap -g -r shard.out.0.* -r shard.out.1.* 2>shard.g
+compare_gold shard.g
+
+# by interface each input is a shard, also when read with offline_mmap
+rm -f shard.out.*
+../dnscap -r dns.pcap.dist -r "$srcdir/shard.pcap" -o offline_mmap=yes -w shard.out \
+    -o shard_key=interface -o shard_count=2
+../dnscap -g -r shard.out.0.* 2>shard.g
+compare_gold shard.g
+../dnscap -g -r shard.out.1.* 2>shard.g
+strip_header shard.g >shard.cmp
+diff shard.cmp shard.gold.cmp
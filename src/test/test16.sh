@@ -0,0 +1,70 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+rm -f cbor.out.*
+if ! ../dnscap -r dns.pcap.dist -F cbor -w cbor.out 2>cbor.err; then
+    grep -q "no built in cbor support" cbor.err && exit 77
+    cat cbor.err
+    exit 1
+fi
+
+# the streamed array of messages decodes back to the capture
+./cbordump cbor.out.* >cbordump.out
+compare_gold cbordump.out
+
+# and with chunks that end inside most messages
+rm -f cbor.out.*
+../dnscap -r dns.pcap.dist -F cbor -w cbor.out -o cbor_chunk_size=683
+./cbordump cbor.out.* >cbordump.out
+compare_gold cbordump.out
+
+# integer keys and stringrefs, a namespace per chunk
+rm -f cbor.out.*
+../dnscap -r dns.pcap.dist -F cbor -w cbor.out -o cbor_version=2
+./cbordump cbor.out.* >cbordump.out
+compare_gold cbordump.out
+
+rm -f cbor.out.*
+../dnscap -r dns.pcap.dist -F cbor -w cbor.out -o cbor_version=2 -o cbor_chunk_size=683
+./cbordump cbor.out.* >cbordump.out
+compare_gold cbordump.out
+
+# output sinks next to -g, rotated on time, count and compressed
+rm -f sink.out.*
+../dnscap -r dns.pcap.dist -g -o output=cbor,w=sink.out.w 2>sink.g
+compare_gold sink.g
+./cbordump sink.out.w.* >cbordump.out
+compare_gold cbordump.out
+
+rm -f sink.out.*
+../dnscap -r dns.pcap.dist -o output=cbor,w=sink.out.t,t=20
+test "`ls sink.out.t.* | wc -l`" -gt 1
+./cbordump sink.out.t.* >cbordump.out
+compare_gold cbordump.out
+
+rm -f sink.out.*
+../dnscap -r dns.pcap.dist -o output=cbor,w=sink.out.c,c=10
+test "`ls sink.out.c.* | wc -l`" = 9
+./cbordump sink.out.c.* >cbordump.out
+compare_gold cbordump.out
+
+rm -f sink.out.*
+../dnscap -r dns.pcap.dist -o output=cbor,w=sink.out.z,c=30,compress=gzip
+test "`ls sink.out.z.*.gz | wc -l`" = 3
+gzip -d sink.out.z.*.gz
+./cbordump sink.out.z.* >cbordump.out
+compare_gold cbordump.out
+
+# a CDS sink that ends a file with its buffer still counts that message
+# against c= so no file holds more
+rm -f sink.out.*
+if ../dnscap -r dns.pcap.dist -o output=cds,w=sink.out.s,c=12 -o cds_cbor_size=1000 2>cds.err; then
+    for f in sink.out.s.*; do
+        test "`../cdsdump $f | grep -c '^\['`" -le 12
+    done
+    ../cdsdump sink.out.s.* >cbordump.out
+    compare_gold cbordump.out
+else
+    grep -q "no built in cds support" cds.err
+fi
@@ -0,0 +1,56 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+# encode a capture to cds, decode it again and compare with what dnscap -g
+# shows for the same capture
+roundtrip() {
+    pcap="$1"
+    shift
+    rm -f cds.out.*
+    ../dnscap -r "$pcap" -F cds -w cds.out "$@"
+    ../cdsdump cds.out.* >cdsdump.out
+    ../dnscap -g -r "$pcap" 2>dns.out
+    strip_header cdsdump.out >cdsdump.cmp
+    strip_header dns.out >dns.cmp
+    diff cdsdump.cmp dns.cmp
+}
+
+rm -f cds.out.*
+if ! ../dnscap -r dns.pcap.dist -F cds -w cds.out 2>cds.err; then
+    grep -q "no built in cds support" cds.err && exit 77
+    cat cds.err
+    exit 1
+fi
+
+../cdsdump cds.out.* >cdsdump.out
+compare_gold cdsdump.out
+
+# responses to client ports at or above 0x8000
+roundtrip "$srcdir/cds_ports.pcap"
+
+# names after the strings in NAPTR rdata
+roundtrip "$srcdir/cds_naptr.pcap"
+
+# a name in rdata that runs past the end of the rdata
+roundtrip "$srcdir/cds_badname.pcap"
+
+# names that end with the message before their root label, the decoded
+# messages must not gain a root label
+rm -f cds.out.*
+../dnscap -r "$srcdir/cds_cutname.pcap" -F cds -w cds.out
+../cdsdump -j cds.out.* | sed -e 's/.*"length":\([0-9]*\).*/\1/' >cdsdump.cmp
+printf '24\n16\n29\n' | diff cdsdump.cmp -
+
+# names in JSON end with a single dot
+../cdsdump -j cds.out.* | grep '"qname":"example.com.",'
+
+# names in rdata given by the rdata indexes
+roundtrip dns.pcap.dist -o cds_use_rdata_index=yes
+roundtrip dns.pcap.dist -o cds_use_rdata_rindex=yes
+
+# TCP segments without data such as SYN and FIN are not stored
+rm -f cds.out.*
+../dnscap -T -r "$srcdir/cds_tcp.pcap" -F cds -w cds.out
+../cdsdump cds.out.* >cdsdump.out
+test "`grep -c '^	dns ' cdsdump.out`" = 2
@@ -0,0 +1,17 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+rm -f cds2pcap.out.*
+if ! ../dnscap -r dns.pcap.dist -F cds -w cds2pcap.out -o cds_segment_messages=10 2>cds2pcap.err; then
+    grep -q "no built in cds support" cds2pcap.err && exit 77
+    cat cds2pcap.err
+    exit 1
+fi
+
+../cds2pcap -w cds2pcap.pcap cds2pcap.out.*
+../cds2pcap -t 2 -w cds2pcap.t2.pcap cds2pcap.out.*
+cmp cds2pcap.pcap cds2pcap.t2.pcap
+
+../dnscap -g -r cds2pcap.pcap 2>cds2pcap.dns
+compare_gold cds2pcap.dns
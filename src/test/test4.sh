@@ -0,0 +1,22 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+rm -f cdsindex.out.*
+if ! ../dnscap -r dns.pcap.dist -F cds -w cdsindex.out -o cds_index=yes -o cds_segment_messages=5 2>cdsindex.err; then
+    grep -q "no built in cds support" cdsindex.err && exit 77
+    cat cdsindex.err
+    exit 1
+fi
+
+# the index is skipped when reading from the start
+../cdsdump cdsindex.out.* >cdsindex.all
+compare_gold cdsindex.all
+
+# seeking with the index gives the same messages as filtering standard input
+../cdsdump -B "2016-10-20 15:23:10" -E "2016-10-20 15:24:05" cdsindex.out.* >cdsindex.seek
+cat cdsindex.out.* | ../cdsdump -B "2016-10-20 15:23:10" -E "2016-10-20 15:24:05" >cdsindex.scan
+strip_header cdsindex.seek >cdsindex.seek.cmp
+strip_header cdsindex.scan >cdsindex.scan.cmp
+diff cdsindex.seek.cmp cdsindex.scan.cmp
+test "`grep -c '^2016-10-20 15:2' cdsindex.seek.cmp`" -eq 12
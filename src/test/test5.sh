@@ -0,0 +1,23 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+rm -f cdsdict.out.* cdsdict.train.*
+if ! ../dnscap -r dns.pcap.dist -F cds -w cdsdict.train -o cds_use_rdata_rindex=yes 2>cdsdict.err; then
+    grep -q "no built in cds support" cdsdict.err && exit 77
+    cat cdsdict.err
+    exit 1
+fi
+../cdsdict -c 1 -w cdsdict.dict cdsdict.train.*
+../cdsdict -v cdsdict.dict >cdsdict.list
+
+# the same messages come back with the dictionary
+../dnscap -r dns.pcap.dist -F cds -w cdsdict.out -o cds_use_rdata_rindex=yes -o cds_dictionary=cdsdict.dict
+../cdsdump -d cdsdict.dict cdsdict.out.* >cdsdict.all
+compare_gold cdsdict.all
+
+# and can not be read without it
+if ../cdsdump -q cdsdict.out.* 2>cdsdict.err; then
+    exit 1
+fi
+grep -q "dictionary missing" cdsdict.err
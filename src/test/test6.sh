@@ -0,0 +1,16 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+rm -f cdns.out.*
+../dnscap -r dns.pcap.dist -F cdns -w cdns.out
+
+# queries and responses come back from their items in time order
+./cdnsdump cdns.out.* >cdnsdump.out
+compare_gold cdnsdump.out
+
+# and with a block for every few items
+rm -f cdns.out.*
+../dnscap -r dns.pcap.dist -F cdns -w cdns.out -o cdns_block_size=7
+./cdnsdump cdns.out.* >cdnsdump.out
+compare_gold cdnsdump.out
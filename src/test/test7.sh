@@ -0,0 +1,44 @@
+#!/bin/sh -xe
+
+rm -f arrow.out.*
+../dnscap -r dns.pcap.dist -F arrow -w arrow.out -o arrow_batch_size=7
+
+# the schema and the time, ID and QNAME of every message
+./arrowdump -s arrow.out.* >arrow.schema
+cat >arrow.schema.gold <<END
+time timestamp[us, UTC]
+src_addr binary[16]
+src_port uint16
+dst_addr binary[16]
+dst_port uint16
+proto uint8
+id uint16
+flags uint16
+rcode uint16
+qname utf8 dictionary null
+qtype uint16 null
+qclass uint16 null
+size uint32
+edns_udp_size uint16 null
+edns_version uint8 null
+edns_do bool null
+original_ancount uint16 null
+original_nscount uint16 null
+original_arcount uint16 null
+END
+diff arrow.schema arrow.schema.gold
+
+./arrowdump arrow.out.* >arrow.rows
+awk '/^\[/ { t = $2 " " $3 } /^\tdns / { split($2, h, ","); id = h[3]; getline; split($2, q, ","); print t, id, q[1] }' "$srcdir/dns.gold" >arrow.gold
+diff arrow.rows arrow.gold
+
+# and with pyarrow, if it is there
+if python3 -c "import pyarrow" 2>/dev/null; then
+    python3 -c "
+import sys, pyarrow.ipc
+for row in pyarrow.ipc.open_stream(open(sys.argv[1], 'rb')).read_all().to_pylist():
+    t = row['time']
+    print('%s.%06d %d %s' % (t.strftime('%Y-%m-%d %H:%M:%S'), t.microsecond, row['id'], row['qname'].rstrip('.')))
+" arrow.out.* >arrow.pyarrow
+    diff arrow.pyarrow arrow.gold
+fi
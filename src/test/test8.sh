@@ -0,0 +1,37 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+rm -f dnstap.out.*
+../dnscap -r dns.pcap.dist -F dnstap -w dnstap.out
+./dnstapdump dnstap.out.* >dnstapdump.out
+compare_gold dnstapdump.out
+
+# and to a reader on a Unix socket, it says when it is listening
+rm -f dnstap.sock dnstap.sock.err
+./dnstapdump -u dnstap.sock >dnstapdump.out 2>dnstap.sock.err &
+pid=$!
+while [ ! -s dnstap.sock.err ]; do
+    kill -0 $pid
+    sleep 1
+done
+../dnscap -r dns.pcap.dist -F dnstap -o dnstap_socket=dnstap.sock
+wait $pid
+compare_gold dnstapdump.out
+
+# read back as input the messages are the ones captured
+../dnscap -g -o dnstap_input=`ls dnstap.out.*` 2>dnstap.input.out
+compare_gold dnstap.input.out
+
+# and from two writers on a socket at the same time
+rm -f dnstap.input.sock
+../dnscap -g -c 164 -o dnstap_listen=dnstap.input.sock 2>dnstap.input.out &
+pid=$!
+while [ ! -S dnstap.input.sock ]; do
+    kill -0 $pid
+    sleep 1
+done
+../dnscap -r dns.pcap.dist -F dnstap -o dnstap_socket=dnstap.input.sock &
+../dnscap -r dns.pcap.dist -F dnstap -o dnstap_socket=dnstap.input.sock
+wait $pid
+test `grep -c '^\[' dnstap.input.out` -eq 164
@@ -0,0 +1,9 @@
+#!/bin/sh -xe
+
+. "$srcdir/gold.sh"
+
+# pcapng is read back by libpcap, -g prints what it printed from the pcap
+rm -f pcapng.out.*
+../dnscap -r dns.pcap.dist -F pcapng -w pcapng.out
+../dnscap -g -r pcapng.out.* 2>pcapng.g
+compare_gold pcapng.g